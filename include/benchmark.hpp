@@ -0,0 +1,232 @@
+#pragma once
+
+#include <common.hpp>
+#include <camera.hpp>
+#include <file.hpp>
+#include <light.hpp>
+#include <obj.hpp>
+#include <sampler.hpp>
+#include <timer.hpp>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Sweeps the number of lights, measuring the light binning on the CPU and the frame on the GPU.
+// Lights are added at a constant density, growing the volume they occupy, which is what a larger
+// scene would look like. Run with --bench-lights
+struct light_benchmark {
+	static constexpr uint WarmupFrames = 30;
+	static constexpr uint MeasuredFrames = 120;
+
+	// Density of the random lights, per cubic unit
+	static constexpr float LightDensity = 2.f;
+
+	struct result {
+		uint NumLights;
+		double CPUMilliseconds;
+		double GPUMilliseconds;
+	};
+
+	std::vector<uint> LightCounts;
+	std::vector<result> Results;
+	uint Step;
+	uint Frame;
+	bool32 Active;
+
+	light_benchmark() : LightCounts{ 3, 8, 16, 32, 64, 128, 256, 512, 1024, 2048, 4096 }, Step{0}, Frame{0}, Active{false} {}
+
+	void Start() {
+		Active = true;
+		Step = 0;
+		Frame = 0;
+		Results.clear();
+	}
+
+	/** Sets up the lights of the current step, returns false once every step was measured */
+	bool32 BeginFrame(std::vector<light>& Lights, size NumSceneLights) {
+		if (Step >= LightCounts.size()) {
+			Active = false;
+			return false;
+		}
+
+		if (Frame == 0) {
+			const auto NumLights = LightCounts[Step];
+			Lights.resize(glm::min((size) NumLights, NumSceneLights));
+
+			if (NumLights > NumSceneLights) {
+				const auto NumRandom = (uint) (NumLights - NumSceneLights);
+				const auto HalfExtent = .5f * glm::pow(NumRandom / LightDensity, 1.f / 3.f);
+				auto Random = MakeRandomPointLights(NumRandom, vec3{ -HalfExtent }, vec3{ HalfExtent });
+				Lights.insert(Lights.end(), Random.begin(), Random.end());
+			}
+
+			Results.push_back(result{ NumLights, 0, 0 });
+		}
+
+		return true;
+	}
+
+	void EndFrame(double CPUMilliseconds, double GPUMilliseconds) {
+		if (Frame >= WarmupFrames) {
+			auto& Result = Results.back();
+			Result.CPUMilliseconds += CPUMilliseconds / MeasuredFrames;
+			Result.GPUMilliseconds += GPUMilliseconds / MeasuredFrames;
+		}
+
+		if (++Frame == WarmupFrames + MeasuredFrames) {
+			Frame = 0;
+			Step++;
+		}
+	}
+
+	void Report(FILE* Out) const {
+		fprintf(Out, "==== Light benchmark (%u frames per step, %.1f lights per cubic unit) ====\n", MeasuredFrames, LightDensity);
+		fprintf(Out, "%8s %14s %14s\n", "Lights", "Binning (ms)", "GPU (ms)");
+		for (const auto& Result : Results) {
+			fprintf(Out, "%8u %14.3f %14.3f\n", Result.NumLights, Result.CPUMilliseconds, Result.GPUMilliseconds);
+		}
+	}
+};
+
+// Texturing of minified geometry with each sampler preset. A wall of textured unit cubes is moved
+// away from the camera so every pixel covers more and more texels: without mipmaps neighbouring
+// pixels read texels far apart and keep missing the texture cache, with them they read neighbouring
+// texels of a smaller level. Times are also given per million covered pixels, the wall shrinks on
+// screen as it moves away. Run with --bench-samplers
+struct sampler_benchmark {
+	static constexpr uint WarmupFrames = 30;
+	static constexpr uint MeasuredFrames = 120;
+	static constexpr uint GridSize = 24; // Cubes on each side of the wall
+	static constexpr float Spacing = 1.25f;
+
+	struct result {
+		sampler_preset::type Preset;
+		float Distance;
+		float FacePixels;    // Side of a cube's face on screen
+		double CoveredPixels;
+		double GPUMilliseconds;
+	};
+
+	std::vector<float> Distances;
+	std::vector<result> Results;
+	uint Step;
+	uint Frame;
+	bool32 Active;
+
+	sampler_benchmark() : Distances{ 3.f, 6.f, 12.f, 24.f, 48.f }, Step{0}, Frame{0}, Active{false} {}
+
+	void Start() {
+		Active = true;
+		Step = 0;
+		Frame = 0;
+		Results.clear();
+	}
+
+	/** The preset and wall distance of the current step, returns false once every step was measured.
+	    Camera looks down -Z from the origin */
+	bool32 BeginFrame(const camera& Camera, sampler_preset::type& Preset, float& Distance) {
+		if (Step >= Distances.size() * sampler_preset::TOTAL) {
+			Active = false;
+			return false;
+		}
+
+		Preset = (sampler_preset::type) (Step % sampler_preset::TOTAL);
+		Distance = Distances[Step / sampler_preset::TOTAL];
+		if (Frame == 0) {
+			const auto FacePixels = Camera.ScreenSize(bounding_sphere{ vec3{ 0.f, 0.f, -Distance }, .5f });
+			const auto WallPixels = (double) GridSize * GridSize * FacePixels * FacePixels;
+			const auto ScreenPixels = (double) Camera.ViewportDimensions.x * Camera.ViewportDimensions.y;
+			Results.push_back(result{ Preset, Distance, FacePixels, glm::min(WallPixels, ScreenPixels), 0 });
+		}
+		return true;
+	}
+
+	/** Model matrix of the wall's cube i of GridSize * GridSize */
+	mat4 CubeModel(uint i, float Distance) const {
+		const auto Offset = .5f * (GridSize - 1);
+		transform Transform;
+		Transform.Position = vec3{ ((i % GridSize) - Offset) * Spacing, ((i / GridSize) - Offset) * Spacing, -Distance };
+		return Transform.ToMatrix();
+	}
+
+	void EndFrame(double GPUMilliseconds) {
+		if (Frame >= WarmupFrames) { Results.back().GPUMilliseconds += GPUMilliseconds / MeasuredFrames; }
+
+		if (++Frame == WarmupFrames + MeasuredFrames) {
+			Frame = 0;
+			Step++;
+		}
+	}
+
+	void Report(FILE* Out) const {
+		fprintf(Out, "==== Sampler benchmark (%u frames per step, %ux%u cubes) ====\n", MeasuredFrames, GridSize, GridSize);
+		fprintf(Out, "%-12s %9s %10s %10s %14s\n", "Preset", "Distance", "Face (px)", "GPU (ms)", "ms / Mpixel");
+		for (const auto& Result : Results) {
+			fprintf(Out, "%-12s %9.1f %10.1f %10.3f %14.3f\n", SamplerPresetNames[Result.Preset], Result.Distance, Result.FacePixels,
+				Result.GPUMilliseconds, Result.GPUMilliseconds / glm::max(Result.CoveredPixels / 1e6, 1e-6));
+		}
+	}
+};
+
+// Parse throughput of the OBJ loader, single threaded and with every thread, next to how fast the
+// file can just be read. The first read shows the disk (unless the file is cached already), the
+// later ones memory bandwidth, which is the most the parser could reach. Run with --bench-obj <file>
+inline void BenchmarkOBJ(const std::string& FileName, FILE* Out, uint Repeats = 3) {
+	auto Throughput = [](size_t Bytes, double Milliseconds) { return Bytes / (1024. * 1024.) / (glm::max(Milliseconds, 1e-3) / 1000.); };
+
+	// Reads every byte of the mapped file, as the parser would
+	auto Read = [&]() {
+		mapped_file File;
+		cpu_timer Timer;
+		if (!File.Open(FileName)) { return -1.; }
+
+		u64 Sum = 0;
+		const auto NumWords = File.Bytes / SizeOf(u64);
+		for (size_t i = 0; i < NumWords; ++i) {
+			u64 Word;
+			memcpy(&Word, File.Data + i * SizeOf(u64), SizeOf(u64));
+			Sum += Word;
+		}
+		volatile u64 Sink = Sum; // Keeps the loop
+		Unused(Sink);
+		return Timer.Milliseconds();
+	};
+
+	const auto FirstRead = Read();
+	if (FirstRead < 0.) {
+		LogError("[OBJ] Could not open %s\n", FileName.c_str());
+		return;
+	}
+	auto CachedRead = Read();
+	for (uint i = 1; i < Repeats; ++i) { CachedRead = glm::min(CachedRead, Read()); }
+
+	struct run {
+		const char* Name;
+		uint MaxChunks;
+		obj_stats Stats;
+		double Milliseconds;
+	};
+	run Runs[] = { { "1 thread", 1, {}, 0. }, { "All threads", 0, {}, 0. } };
+	for (auto& Run : Runs) {
+		for (uint i = 0; i < Repeats; ++i) {
+			obj_mesh Mesh;
+			obj_stats Stats;
+			cpu_timer Timer;
+			if (!LoadOBJ(FileName, Mesh, &Stats, Run.MaxChunks)) { return; }
+			const auto Milliseconds = Timer.Milliseconds();
+			if (i == 0 || Milliseconds < Run.Milliseconds) { Run.Milliseconds = Milliseconds; Run.Stats = Stats; }
+		}
+	}
+
+	const auto& Stats = Runs[1].Stats;
+	fprintf(Out, "==== OBJ benchmark: %s (%.1f MB, best of %u) ====\n", FileName.c_str(), Stats.Bytes / (1024. * 1024.), Repeats);
+	fprintf(Out, "%u positions, %u texture coordinates, %u normals, %u triangles, %u threads\n",
+		Stats.NumPositions, Stats.NumTexCoords, Stats.NumNormals, Stats.NumTriangles, Jobs.NumThreads());
+	fprintf(Out, "%-14s %10s %10s\n", "", "ms", "MB/s");
+	fprintf(Out, "%-14s %10.1f %10.1f\n", "First read", FirstRead, Throughput(Stats.Bytes, FirstRead));
+	fprintf(Out, "%-14s %10.1f %10.1f\n", "Cached read", CachedRead, Throughput(Stats.Bytes, CachedRead));
+	for (const auto& Run : Runs) {
+		fprintf(Out, "%-14s %10.1f %10.1f   (%u chunks: parse %.1f ms, resolve %.1f ms)\n", Run.Name, Run.Milliseconds, Throughput(Stats.Bytes, Run.Milliseconds),
+			Run.Stats.NumChunks, Run.Stats.ParseMilliseconds, Run.Stats.ResolveMilliseconds);
+	}
+}
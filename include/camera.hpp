@@ -2,6 +2,7 @@
 
 #include <common.hpp>
 #include <transform.hpp>
+#include <limits>
 
 struct camera {
 	transform Transform;
@@ -15,6 +16,9 @@ struct camera {
 	mat4 View() const;
 	mat4 Projection() const;
 	mat4 ViewProjection() const;
+
+	/** Approximate diameter in pixels of a world space sphere, infinite when the camera is inside */
+	float ScreenSize(const bounding_sphere& Sphere) const;
 };
 
 camera::camera(vec2 ViewportDimensions, float32 VerticalFov, float32 NearPlane, float32 FarPlane)
@@ -35,6 +39,14 @@ mat4 camera::View() const {
 	return glm::translate(Rot, -Transform.Position);
 }
 
+float camera::ScreenSize(const bounding_sphere& Sphere) const {
+	const auto Distance = glm::distance(Sphere.Center, Transform.Position);
+	if (Distance <= Sphere.Radius) { return std::numeric_limits<float>::infinity(); }
+
+	const auto PixelsPerUnitAtOne = .5f * ViewportDimensions.y / glm::tan(.5f * VerticalFov);
+	return 2.f * Sphere.Radius * PixelsPerUnitAtOne / Distance;
+}
+
 mat4 camera::Projection() const {
 	const auto AspectRatio = ViewportDimensions.x / ViewportDimensions.y;
 	return glm::perspective(VerticalFov, AspectRatio, NearPlane, FarPlane);
@@ -0,0 +1,260 @@
+#pragma once
+
+#include <common.hpp>
+#include <gl_33.hpp>
+#include <camera.hpp>
+#include <gpu_memory.hpp>
+#include <jobs.hpp>
+#include <light.hpp>
+#include <texture_buffer.hpp>
+#include <timer.hpp>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+// Clustered forward shading: the view frustum is split in a grid of froxels (screen tiles x
+// exponential depth slices) and each froxel gets the list of lights whose influence reaches it.
+// Fragments only evaluate the lights of their cluster, so their cost depends on the local
+// light density instead of the total light count, while MSAA and blending keep working.
+struct light_clusters {
+	static constexpr uint TilesX = 16;
+	static constexpr uint TilesY = 9;
+	static constexpr uint Slices = 24;
+	static constexpr uint TilesPerSlice = TilesX * TilesY;
+	static constexpr uint NumClusters = TilesPerSlice * Slices;
+	StaticAssert(TilesPerSlice <= 256); // Tiles are packed in 8 bits during binning
+
+	// Lights that reach everywhere (directional, no falloff) come first in the light data
+	uint NumGlobalLights;
+	vec3 AmbientLight;
+	std::vector<vec4> LightData;
+
+	// Offset and count into Indices for each cluster
+	std::vector<u32> Ranges;
+	std::vector<u32> Indices;
+	u32 MaxIndices;
+
+	float Near, Far;
+	vec2 ScreenSize;
+
+	// Binning scratch
+	struct light_bounds {
+		vec3 Center; // View space
+		float Radius;
+		u32 Index;
+		uint FirstSlice, LastSlice;
+	};
+	std::vector<light_bounds> Bounds;
+	std::array<std::vector<u32>, Slices> SliceBins;
+	std::array<std::vector<u32>, Slices> SliceIndices;
+
+	texture_buffer LightBuffer;
+	texture_buffer RangeBuffer;
+	texture_buffer IndexBuffer;
+
+	double BuildMilliseconds;
+
+	void Initialize();
+	void Shutdown();
+
+	/** Bins the lights into the clusters of the camera's frustum, in parallel over depth slices */
+	void Build(const camera& Camera, const std::vector<light>& Lights);
+	void Upload();
+
+	/** Binds the buffers to 3 consecutive texture units starting at FirstUnit and sets the uniforms */
+	void Bind(uint Program, uint FirstUnit) const;
+
+	float SliceDepth(uint Slice) const { return Near * glm::pow(Far / Near, (float) Slice / Slices); }
+	uint SliceOf(float Depth) const {
+		auto Slice = glm::log(Depth / Near) / glm::log(Far / Near) * Slices;
+		return (uint) glm::clamp((int) Slice, 0, (int) Slices - 1);
+	}
+
+	void BinSlice(uint Slice, const mat4& Projection);
+};
+
+inline void light_clusters::Initialize() {
+	LightBuffer.Initialize(gl::RGBA32F, "Cluster Light Data");
+	RangeBuffer.Initialize(gl::RG32UI, "Cluster Ranges");
+	IndexBuffer.Initialize(gl::R32UI, "Cluster Light Indices");
+
+	GLint MaxTexels = 0;
+	gl::GetIntegerv(gl::MAX_TEXTURE_BUFFER_SIZE, &MaxTexels);
+	MaxIndices = (u32) MaxTexels;
+
+	NumGlobalLights = 0;
+	AmbientLight = vec3{ 0.f };
+	BuildMilliseconds = 0;
+	Ranges.resize(2 * NumClusters);
+}
+
+inline void light_clusters::Shutdown() {
+	LightBuffer.Shutdown();
+	RangeBuffer.Shutdown();
+	IndexBuffer.Shutdown();
+}
+
+inline void light_clusters::BinSlice(uint Slice, const mat4& Projection) {
+	auto& Bins = SliceBins[Slice];
+	Bins.clear();
+
+	const auto SliceNear = SliceDepth(Slice);
+	const auto SliceFar = SliceDepth(Slice + 1);
+	const auto ScaleX = Projection[0][0];
+	const auto ScaleY = Projection[1][1];
+
+	// Tile range covered by [Min, Max] at depths [DepthNear, DepthFar], exact for a box in front of the camera
+	auto TileRange = [](float Min, float Max, float DepthNear, float DepthFar, float Scale, uint NumTiles, uint& First, uint& Last) {
+		auto NDCMin = Scale * (Min >= 0.f ? Min / DepthFar : Min / DepthNear);
+		auto NDCMax = Scale * (Max >= 0.f ? Max / DepthNear : Max / DepthFar);
+		if (NDCMax < -1.f || NDCMin > 1.f) { return false; }
+
+		First = (uint) glm::clamp((int) glm::floor((NDCMin * .5f + .5f) * NumTiles), 0, (int) NumTiles - 1);
+		Last = (uint) glm::clamp((int) glm::floor((NDCMax * .5f + .5f) * NumTiles), 0, (int) NumTiles - 1);
+		return true;
+	};
+
+	for (const auto& Light : Bounds) {
+		if (Slice < Light.FirstSlice || Slice > Light.LastSlice) { continue; }
+
+		const auto Depth = -Light.Center.z;
+		const auto DepthNear = glm::max(SliceNear, Depth - Light.Radius);
+		const auto DepthFar = glm::min(SliceFar, Depth + Light.Radius);
+
+		uint FirstX, LastX, FirstY, LastY;
+		if (!TileRange(Light.Center.x - Light.Radius, Light.Center.x + Light.Radius, DepthNear, DepthFar, ScaleX, TilesX, FirstX, LastX)) { continue; }
+		if (!TileRange(Light.Center.y - Light.Radius, Light.Center.y + Light.Radius, DepthNear, DepthFar, ScaleY, TilesY, FirstY, LastY)) { continue; }
+
+		for (auto Y = FirstY; Y <= LastY; ++Y) {
+			for (auto X = FirstX; X <= LastX; ++X) {
+				Bins.push_back(((Y * TilesX + X) << 24) | Light.Index);
+			}
+		}
+	}
+
+	// Counting sort by tile, leaving each cluster's lights contiguous
+	std::array<u32, TilesPerSlice> Counts{};
+	for (auto Bin : Bins) { Counts[Bin >> 24]++; }
+
+	u32 Offset = 0;
+	for (uint Tile = 0; Tile < TilesPerSlice; ++Tile) {
+		const auto Cluster = Slice * TilesPerSlice + Tile;
+		Ranges[2 * Cluster + 0] = Offset; // Relative to the slice until merged
+		Ranges[2 * Cluster + 1] = Counts[Tile];
+		Offset += Counts[Tile];
+	}
+
+	auto& Sorted = SliceIndices[Slice];
+	Sorted.resize(Bins.size());
+	std::array<u32, TilesPerSlice> Cursor{};
+	for (auto Bin : Bins) {
+		const auto Tile = Bin >> 24;
+		Sorted[Ranges[2 * (Slice * TilesPerSlice + Tile)] + Cursor[Tile]++] = Bin & 0xFFFFFF;
+	}
+}
+
+inline void light_clusters::Build(const camera& Camera, const std::vector<light>& Lights) {
+	cpu_timer Timer;
+
+	Near = Camera.NearPlane;
+	Far = Camera.FarPlane;
+	ScreenSize = Camera.ViewportDimensions;
+
+	const auto View = Camera.View();
+	const auto Projection = Camera.Projection();
+
+	LightData.clear();
+	Bounds.clear();
+	AmbientLight = vec3{ 0.f };
+
+	// Global lights first, the shader loops over them unconditionally
+	NumGlobalLights = 0;
+	for (const auto& Light : Lights) {
+		if (!Light.Enabled) { continue; }
+		AmbientLight += Light.Ambient * Light.Color;
+
+		const auto Radius = LightInfluenceRadius(Light);
+		if (std::isinf(Radius)) {
+			PackLight(LightData, Light, Radius);
+			NumGlobalLights++;
+		}
+	}
+
+	for (const auto& Light : Lights) {
+		if (!Light.Enabled) { continue; }
+
+		const auto Radius = LightInfluenceRadius(Light);
+		if (Radius <= 0.f || std::isinf(Radius)) { continue; }
+
+		light_bounds Bound;
+		Bound.Center = vec3{ View * Light.Position };
+		Bound.Radius = Radius;
+
+		const auto Depth = -Bound.Center.z;
+		if (Depth + Radius < Near || Depth - Radius > Far) { continue; }
+		Bound.FirstSlice = SliceOf(glm::max(Depth - Radius, Near));
+		Bound.LastSlice = SliceOf(glm::min(Depth + Radius, Far));
+
+		Bound.Index = (u32) (LightData.size() / light_texel::TOTAL);
+		PackLight(LightData, Light, Radius);
+		Bounds.push_back(Bound);
+	}
+
+	Jobs.ParallelFor(Slices, 1, [&](uint Begin, uint End) {
+		for (auto Slice = Begin; Slice < End; ++Slice) { BinSlice(Slice, Projection); }
+	});
+
+	// Merge the slices
+	u32 Total = 0;
+	for (uint Slice = 0; Slice < Slices; ++Slice) {
+		const auto SliceCount = (u32) SliceIndices[Slice].size();
+		if (Total + SliceCount > MaxIndices) {
+			LogError("[Clusters] Light index list exceeds the texture buffer limit (%u), dropping lights\n", MaxIndices);
+			for (uint Cluster = Slice * TilesPerSlice; Cluster < NumClusters; ++Cluster) { Ranges[2 * Cluster + 1] = 0; }
+			break;
+		}
+
+		for (uint Tile = 0; Tile < TilesPerSlice; ++Tile) { Ranges[2 * (Slice * TilesPerSlice + Tile)] += Total; }
+		Total += SliceCount;
+	}
+
+	Indices.resize(Total);
+	for (uint Slice = 0, Offset = 0; Slice < Slices && Offset < Total; ++Slice) {
+		const auto& Sorted = SliceIndices[Slice];
+		memcpy(Indices.data() + Offset, Sorted.data(), Sorted.size() * SizeOf(u32));
+		Offset += (uint) Sorted.size();
+	}
+
+	BuildMilliseconds = Timer.Milliseconds();
+}
+
+inline void light_clusters::Upload() {
+	if (!LightData.empty()) { LightBuffer.Upload(LightData.data(), LightData.size() * SizeOf(vec4)); }
+	RangeBuffer.Upload(Ranges.data(), Ranges.size() * SizeOf(u32));
+	if (!Indices.empty()) { IndexBuffer.Upload(Indices.data(), Indices.size() * SizeOf(u32)); }
+}
+
+inline void light_clusters::Bind(uint Program, uint FirstUnit) const {
+	const texture_buffer* Buffers[] = { &LightBuffer, &RangeBuffer, &IndexBuffer };
+	const char* Samplers[] = { "LightData", "ClusterRanges", "ClusterLightIndices" };
+	for (uint i = 0; i < ArraySize(Buffers); ++i) {
+		gl::ActiveTexture(gl::TEXTURE0 + FirstUnit + i);
+		gl::BindTexture(gl::TEXTURE_BUFFER, Buffers[i]->Texture);
+		gl::Uniform1i(gl::GetUniformLocation(Program, Samplers[i]), FirstUnit + i);
+	}
+	gl::ActiveTexture(gl::TEXTURE0);
+
+	gl::Uniform1i(gl::GetUniformLocation(Program, "NumGlobalLights"), NumGlobalLights);
+	gl::Uniform3f(gl::GetUniformLocation(Program, "AmbientLight"), AmbientLight.r, AmbientLight.g, AmbientLight.b);
+
+	gl::Uniform3i(gl::GetUniformLocation(Program, "Clusters.Tiles"), TilesX, TilesY, Slices);
+	gl::Uniform2f(gl::GetUniformLocation(Program, "Clusters.ScreenSize"), ScreenSize.x, ScreenSize.y);
+	gl::Uniform1f(gl::GetUniformLocation(Program, "Clusters.Near"), Near);
+	gl::Uniform1f(gl::GetUniformLocation(Program, "Clusters.Far"), Far);
+
+	// Slice = log(Depth) * Scale + Bias, the inverse of SliceDepth
+	const auto LogRatio = glm::log(Far / Near);
+	gl::Uniform1f(gl::GetUniformLocation(Program, "Clusters.SliceScale"), Slices / LogRatio);
+	gl::Uniform1f(gl::GetUniformLocation(Program, "Clusters.SliceBias"), -(float) Slices * glm::log(Near) / LogRatio);
+}
@@ -128,4 +128,5 @@ void Log (const t& Value, const t_others& ... Others) {
 #define _CRT_SECURE_NO_WARNINGS
 #endif
 
+struct GLFWwindow; // Opaque, tools build without GLFW
 extern GLFWwindow* Window;
\ No newline at end of file
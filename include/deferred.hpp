@@ -0,0 +1,319 @@
+#pragma once
+
+#include <common.hpp>
+#include <gl_33.hpp>
+#include <camera.hpp>
+#include <framebuffer.hpp>
+#include <light.hpp>
+#include <mesh.hpp>
+#include <shader.hpp>
+
+// Deferred shading: the scene is rasterized once into a G-buffer, then each light is
+// shaded only on the pixels it can reach. Directional lights are full-screen passes,
+// point and spot lights are stencil-tested sphere and cone volumes.
+struct deferred_renderer {
+	gbuffer GBuffer;
+
+	shader_variants GeometryShaders;
+	render_program StencilProg;
+	render_program LightProg;
+	render_program ResolveProg;
+
+	// Unit light volumes
+	static constexpr int SphereRings = 8;
+	static constexpr int SphereSegments = 16;
+	static constexpr int ConeSegments = 16;
+	mesh Sphere;
+	mesh Cone;
+
+	uint FullscreenVAO;
+
+	deferred_renderer() = delete;
+	explicit deferred_renderer(glm::ivec2 Size);
+	~deferred_renderer();
+
+	/** Issues the compiles and links, SetupShaders must follow once the batch finished */
+	void QueueShaders(program_batch& Batch);
+	void SetupShaders();
+
+	/** Binds the G-buffer and clears it, GeometryShaders should be used for the scene draws */
+	void BeginGeometryPass();
+
+	/** Shades the G-buffer with the lights and writes the result (color and depth) to the default framebuffer */
+	void LightingPass(const camera& Camera, const std::vector<light>& Lights);
+
+	void DrawLight(const light& Light, const mat4& ViewProjection, mesh* Volume, const mat4& VolumeModel);
+
+	light_locations LightLocations;
+	GLint MVPLoc, FullscreenLoc, AmbientLightLoc;
+	GLint StencilMVPLoc, StencilFullscreenLoc;
+};
+
+inline deferred_renderer::deferred_renderer(glm::ivec2 Size)
+		: GBuffer{Size}
+		, Sphere{GenerateSphereTriangles(1.f, SphereRings, SphereSegments), gl::TRIANGLES, nullptr, "Light Volume Sphere"}
+		, Cone{GenerateConeTriangles(1.f, 1.f, ConeSegments), gl::TRIANGLES, nullptr, "Light Volume Cone"}
+		, FullscreenVAO{0} {
+
+	GeometryShaders.ShaderPaths[shader_stage::Vertex] = "shader/phong.vert";
+	GeometryShaders.ShaderPaths[shader_stage::Fragment] = "shader/deferred_geometry.frag";
+
+	StencilProg.ShaderPaths[shader_stage::Vertex] = "shader/deferred_light.vert";
+	StencilProg.ShaderPaths[shader_stage::Fragment] = "shader/deferred_stencil.frag";
+
+	LightProg.ShaderPaths[shader_stage::Vertex] = "shader/deferred_light.vert";
+	LightProg.ShaderPaths[shader_stage::Fragment] = "shader/deferred_light.frag";
+
+	ResolveProg.ShaderPaths[shader_stage::Vertex] = "shader/deferred_light.vert";
+	ResolveProg.ShaderPaths[shader_stage::Fragment] = "shader/deferred_resolve.frag";
+
+	// Core profile needs a VAO bound even when no attributes are fetched
+	gl::GenVertexArrays(1, &FullscreenVAO);
+}
+
+inline deferred_renderer::~deferred_renderer() {
+	Sphere.Destroy();
+	Cone.Destroy();
+	if (FullscreenVAO > 0) { gl::DeleteVertexArrays(1, &FullscreenVAO); }
+}
+
+inline void deferred_renderer::QueueShaders(program_batch& Batch) {
+	GeometryShaders.Precompile(Batch);
+	Batch.Add(StencilProg);
+	Batch.Add(LightProg);
+	Batch.Add(ResolveProg);
+}
+
+inline void deferred_renderer::SetupShaders() {
+	// Constant uniforms
+	gl::UseProgram(LightProg.ID);
+	gl::Uniform1i(gl::GetUniformLocation(LightProg.ID, "AlbedoSpecular"), 0);
+	gl::Uniform1i(gl::GetUniformLocation(LightProg.ID, "Normals"), 1);
+	gl::Uniform1i(gl::GetUniformLocation(LightProg.ID, "Depth"), 2);
+	gl::Uniform2f(gl::GetUniformLocation(LightProg.ID, "ScreenSize"), (float) GBuffer.Size.x, (float) GBuffer.Size.y);
+	LightLocations = GetLightLocations(LightProg.ID, "Light");
+	MVPLoc = gl::GetUniformLocation(LightProg.ID, "MVP");
+	FullscreenLoc = gl::GetUniformLocation(LightProg.ID, "Fullscreen");
+	AmbientLightLoc = gl::GetUniformLocation(LightProg.ID, "AmbientLight");
+
+	StencilMVPLoc = gl::GetUniformLocation(StencilProg.ID, "MVP");
+	StencilFullscreenLoc = gl::GetUniformLocation(StencilProg.ID, "Fullscreen");
+
+	gl::UseProgram(ResolveProg.ID);
+	gl::Uniform1i(gl::GetUniformLocation(ResolveProg.ID, "Lighting"), 0);
+	gl::Uniform1i(gl::GetUniformLocation(ResolveProg.ID, "Depth"), 1);
+	gl::Uniform1i(gl::GetUniformLocation(ResolveProg.ID, "Fullscreen"), true);
+	gl::UseProgram(0);
+}
+
+inline void deferred_renderer::BeginGeometryPass() {
+	GBuffer.Bind({gbuffer_target::AlbedoSpecular, gbuffer_target::Normal, gbuffer_target::Lighting});
+	gl::ClearColor(0.f, 0.f, 0.f, 0.f);
+	gl::ClearStencil(0);
+	gl::Clear(gl::COLOR_BUFFER_BIT | gl::DEPTH_BUFFER_BIT | gl::STENCIL_BUFFER_BIT);
+
+	GBuffer.Bind({gbuffer_target::AlbedoSpecular, gbuffer_target::Normal});
+
+	// G-buffer channels are not colors, blending them makes no sense
+	gl::Disable(gl::BLEND);
+}
+
+/** Pixels covered by the box around Bounds once projected by MVP, as x, y, width, height. The whole
+    viewport when part of the box is behind the camera */
+inline glm::ivec4 ProjectedScissor(const mat4& MVP, const bounding_sphere& Bounds, glm::ivec2 Size) {
+	vec2 Min{ 1.f }, Max{ -1.f };
+	for (int i = 0; i < 8; ++i) {
+		const auto Corner = Bounds.Center + Bounds.Radius * vec3{ i & 1 ? 1.f : -1.f, i & 2 ? 1.f : -1.f, i & 4 ? 1.f : -1.f };
+		const auto Clip = MVP * vec4{ Corner, 1.f };
+		if (Clip.w <= 0.f) { return glm::ivec4{ 0, 0, Size.x, Size.y }; }
+
+		const auto Position = vec2{ Clip.x, Clip.y } / Clip.w;
+		Min = i == 0 ? Position : glm::min(Min, Position);
+		Max = i == 0 ? Position : glm::max(Max, Position);
+	}
+
+	const auto Low = glm::ivec2{ glm::floor((glm::clamp(Min, vec2{ -1.f }, vec2{ 1.f }) * .5f + .5f) * vec2{ Size }) };
+	const auto High = glm::ivec2{ glm::ceil((glm::clamp(Max, vec2{ -1.f }, vec2{ 1.f }) * .5f + .5f) * vec2{ Size }) };
+	return glm::ivec4{ Low.x, Low.y, High.x - Low.x, High.y - Low.y };
+}
+
+inline void deferred_renderer::DrawLight(const light& Light, const mat4& ViewProjection, mesh* Volume, const mat4& VolumeModel) {
+	if (Volume == nullptr) {
+		// Full-screen
+		GBuffer.Bind({gbuffer_target::Lighting});
+		gl::Disable(gl::STENCIL_TEST);
+		gl::Disable(gl::DEPTH_TEST);
+		gl::Disable(gl::CULL_FACE);
+
+		gl::UseProgram(LightProg.ID);
+		gl::Uniform1i(FullscreenLoc, true);
+		BindLight(LightLocations, Light);
+
+		gl::BindVertexArray(FullscreenVAO);
+		gl::DrawArrays(gl::TRIANGLES, 0, 3);
+		return;
+	}
+
+	const auto MVP = ViewProjection * VolumeModel;
+
+	// Stencil pass: mark pixels whose geometry lies inside the volume
+	// back faces behind the scene increment, front faces behind the scene decrement.
+	// The light pass cannot reset what it read (see below), the volume's rectangle is cleared first
+	GBuffer.Bind({});
+	const auto Scissor = ProjectedScissor(MVP, Volume->Bounds, GBuffer.Size);
+	gl::Enable(gl::SCISSOR_TEST);
+	gl::Scissor(Scissor.x, Scissor.y, Scissor.z, Scissor.w);
+	gl::StencilMask(0xFF);
+	gl::Clear(gl::STENCIL_BUFFER_BIT);
+	gl::Disable(gl::SCISSOR_TEST);
+
+	gl::Enable(gl::STENCIL_TEST);
+	gl::Enable(gl::DEPTH_TEST);
+	gl::Disable(gl::CULL_FACE);
+	gl::StencilFunc(gl::ALWAYS, 0, 0);
+	gl::StencilOpSeparate(gl::BACK, gl::KEEP, gl::INCR_WRAP, gl::KEEP);
+	gl::StencilOpSeparate(gl::FRONT, gl::KEEP, gl::DECR_WRAP, gl::KEEP);
+
+	gl::UseProgram(StencilProg.ID);
+	gl::Uniform1i(StencilFullscreenLoc, false);
+	gl::UniformMatrix4fv(StencilMVPLoc, 1, false, glm::value_ptr(MVP));
+	gl::BindVertexArray(Volume->PositionVAO); // The volumes only need positions
+	Volume->Draw();
+
+	// Light pass: shade marked pixels. The depth-stencil image is sampled for the positions while it
+	// is attached, so the stencil is left untouched, writing it would be a feedback loop
+	GBuffer.Bind({gbuffer_target::Lighting});
+	gl::Disable(gl::DEPTH_TEST);
+	gl::Enable(gl::CULL_FACE);
+	gl::CullFace(gl::FRONT); // Back faces still cover the volume when the camera is inside of it
+	gl::StencilFunc(gl::NOTEQUAL, 0, 0xFF);
+	gl::StencilOp(gl::KEEP, gl::KEEP, gl::KEEP);
+	gl::StencilMask(0);
+
+	gl::UseProgram(LightProg.ID);
+	gl::Uniform1i(FullscreenLoc, false);
+	gl::UniformMatrix4fv(MVPLoc, 1, false, glm::value_ptr(MVP));
+	BindLight(LightLocations, Light);
+	Volume->Draw();
+}
+
+inline void deferred_renderer::LightingPass(const camera& Camera, const std::vector<light>& Lights) {
+	const auto ViewProjection = Camera.ViewProjection();
+	const auto InverseViewProjection = glm::inverse(ViewProjection);
+
+	gl::DepthMask(false);
+	gl::Enable(gl::BLEND);
+	gl::BlendFunc(gl::ONE, gl::ONE);
+
+	gl::ActiveTexture(gl::TEXTURE0);
+	gl::BindTexture(gl::TEXTURE_2D, GBuffer.Targets[gbuffer_target::AlbedoSpecular]);
+	gl::ActiveTexture(gl::TEXTURE1);
+	gl::BindTexture(gl::TEXTURE_2D, GBuffer.Targets[gbuffer_target::Normal]);
+	gl::ActiveTexture(gl::TEXTURE2);
+	gl::BindTexture(gl::TEXTURE_2D, GBuffer.DepthStencilTexture);
+
+	gl::UseProgram(LightProg.ID);
+	gl::UniformMatrix4fv(gl::GetUniformLocation(LightProg.ID, "InverseViewProjection"), 1, false, glm::value_ptr(InverseViewProjection));
+	gl::Uniform3f(gl::GetUniformLocation(LightProg.ID, "Camera.Position"), Camera.Transform.Position.x, Camera.Transform.Position.y, Camera.Transform.Position.z);
+
+	// Ambient does not attenuate, so it's summed once instead of per light
+	vec3 AmbientLight{ 0.f };
+	for (const auto& Light : Lights) { if (Light.Enabled) { AmbientLight += Light.Ambient * Light.Color; } }
+
+	// Directional lights, the first one also carries the ambient
+	bool32 AppliedAmbient = false;
+	for (const auto& Light : Lights) {
+		if (!Light.Enabled || Light.Position.w != 0.f) { continue; }
+
+		gl::UseProgram(LightProg.ID);
+		gl::Uniform3f(AmbientLightLoc, AmbientLight.r, AmbientLight.g, AmbientLight.b);
+		DrawLight(Light, ViewProjection, nullptr, mat4{});
+
+		AmbientLight = vec3{ 0.f };
+		AppliedAmbient = true;
+	}
+
+	if (!AppliedAmbient) {
+		gl::UseProgram(LightProg.ID);
+		gl::Uniform3f(AmbientLightLoc, AmbientLight.r, AmbientLight.g, AmbientLight.b);
+		DrawLight(light{}, ViewProjection, nullptr, mat4{});
+	}
+	gl::UseProgram(LightProg.ID);
+	gl::Uniform3f(AmbientLightLoc, 0.f, 0.f, 0.f);
+
+	// Point and spot lights
+	for (const auto& Light : Lights) {
+		if (!Light.Enabled || Light.Position.w == 0.f) { continue; }
+
+		const auto Radius = LightInfluenceRadius(Light);
+		if (Radius <= 0.f) { continue; }
+
+		const auto LightPosition = vec3{ Light.Position };
+		const bool32 IsSpot = IsSpotLight(Light);
+
+		// The polyhedra are inscribed in the unit volumes, scale them so they contain the real ones
+		const auto SphereScale = 1.f / (glm::cos(Pi / SphereSegments) * glm::cos(Pi / (2 * SphereRings)));
+		const auto BoundingRadius = Radius * SphereScale;
+
+		// Volumes the camera is in (or too big to be rasterized) are shaded full-screen
+		const auto ToCamera = Camera.Transform.Position - LightPosition;
+		const auto CameraMargin = 2.f * Camera.NearPlane;
+		if (glm::dot(ToCamera, ToCamera) < glm::pow(BoundingRadius + CameraMargin, 2.f)
+			|| BoundingRadius > .5f * Camera.FarPlane) {
+			DrawLight(Light, ViewProjection, nullptr, mat4{});
+			continue;
+		}
+
+		// Cones wider than this are better served by the sphere
+		const auto MinSpotCosine = .5f;
+		if (IsSpot && Light.OuterCone > MinSpotCosine) {
+			// Apex at the light, base at Radius along the direction
+			const auto Direction = glm::normalize(Light.ConeDirection);
+			const auto OuterAngle = glm::acos(glm::min(Light.OuterCone, 1.f));
+			const auto BaseRadius = Radius * glm::tan(OuterAngle) / glm::cos(Pi / ConeSegments);
+
+			transform Transform;
+			Transform.Position = LightPosition + Direction * Radius;
+			Transform.Rotation = glm::rotation(vec3{ 1.f, 0.f, 0.f }, -Direction);
+			Transform.Scale = vec3{ Radius, BaseRadius, BaseRadius };
+			DrawLight(Light, ViewProjection, &Cone, Transform.ToMatrix());
+		} else {
+			transform Transform;
+			Transform.Position = LightPosition;
+			Transform.Scale = vec3{ BoundingRadius };
+			DrawLight(Light, ViewProjection, &Sphere, Transform.ToMatrix());
+		}
+	}
+
+	// Resolve into the default framebuffer, depth included
+	gl::BindFramebuffer(gl::FRAMEBUFFER, 0);
+	gl::Disable(gl::STENCIL_TEST);
+	gl::StencilMask(0xFF);
+	gl::Disable(gl::BLEND);
+	gl::Disable(gl::CULL_FACE);
+	gl::Enable(gl::DEPTH_TEST);
+	gl::DepthMask(true);
+	gl::DepthFunc(gl::ALWAYS);
+
+	gl::ActiveTexture(gl::TEXTURE0);
+	gl::BindTexture(gl::TEXTURE_2D, GBuffer.Targets[gbuffer_target::Lighting]);
+	gl::ActiveTexture(gl::TEXTURE1);
+	gl::BindTexture(gl::TEXTURE_2D, GBuffer.DepthStencilTexture);
+
+	gl::UseProgram(ResolveProg.ID);
+	gl::BindVertexArray(FullscreenVAO);
+	gl::DrawArrays(gl::TRIANGLES, 0, 3);
+
+	// Back to the state forward rendering expects
+	gl::BindTexture(gl::TEXTURE_2D, 0);
+	gl::ActiveTexture(gl::TEXTURE2);
+	gl::BindTexture(gl::TEXTURE_2D, 0);
+	gl::ActiveTexture(gl::TEXTURE0);
+	gl::BindTexture(gl::TEXTURE_2D, 0);
+
+	gl::DepthFunc(gl::LESS);
+	gl::Enable(gl::CULL_FACE);
+	gl::CullFace(gl::BACK);
+	gl::Disable(gl::BLEND);
+	gl::BindVertexArray(0);
+}
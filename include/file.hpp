@@ -4,6 +4,17 @@
 
 #include <fstream>
 #include <sstream>
+#include <string>
+#include <vector>
+#include <cerrno>
+#include <sys/stat.h>
+#if MSVC
+#include <direct.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 inline std::string ReadFile(std::string FileName) {
 
@@ -30,3 +41,98 @@ inline std::string ReadFile(std::string FileName) {
 
 	return Result;
 }
+
+inline bool32 ReadBinaryFile(const std::string& FileName, std::vector<u8>& Result) {
+	std::ifstream File{ FileName, std::ios::binary | std::ios::ate };
+	if (!File.is_open()) { return false; }
+
+	Result.resize((size_t) File.tellg());
+	File.seekg(0);
+	return (bool32) !File.read((char*) Result.data(), Result.size()).fail();
+}
+
+inline bool32 WriteBinaryFile(const std::string& FileName, const void* Data, size_t Bytes) {
+	std::ofstream File{ FileName, std::ios::binary | std::ios::trunc };
+	if (!File.is_open()) { return false; }
+
+	return (bool32) !File.write((const char*) Data, Bytes).fail();
+}
+
+// Read-only view of a whole file. Mapped where available, so the pages are read by whichever
+// thread touches them first and nothing is copied; read into memory otherwise
+struct mapped_file {
+	const u8* Data = nullptr;
+	size_t Bytes = 0;
+#if MSVC
+	std::vector<u8> Buffer;
+#endif
+
+	mapped_file() = default;
+	mapped_file(const mapped_file&) = delete;
+	mapped_file& operator=(const mapped_file&) = delete;
+	~mapped_file() { Close(); }
+
+	bool32 Open(const std::string& FileName);
+	void Close();
+};
+
+inline bool32 mapped_file::Open(const std::string& FileName) {
+	Close();
+#if MSVC
+	if (!ReadBinaryFile(FileName, Buffer)) { return false; }
+	Data = Buffer.data();
+	Bytes = Buffer.size();
+	return true;
+#else
+	auto Handle = open(FileName.c_str(), O_RDONLY | O_CLOEXEC);
+	if (Handle < 0) { return false; }
+	defer{ close(Handle); }; // The mapping outlives the descriptor
+
+	struct stat Stat;
+	if (fstat(Handle, &Stat) != 0) { return false; }
+	if (Stat.st_size == 0) { return true; } // Empty files cannot be mapped, they have nothing to read anyway
+
+	auto Mapping = mmap(nullptr, (size_t) Stat.st_size, PROT_READ, MAP_PRIVATE, Handle, 0);
+	if (Mapping == MAP_FAILED) { return false; }
+	madvise(Mapping, (size_t) Stat.st_size, MADV_SEQUENTIAL);
+
+	Data = (const u8*) Mapping;
+	Bytes = (size_t) Stat.st_size;
+	return true;
+#endif
+}
+
+inline void mapped_file::Close() {
+#if MSVC
+	Buffer.clear();
+	Buffer.shrink_to_fit();
+#else
+	if (Data) { munmap((void*) Data, Bytes); }
+#endif
+	Data = nullptr;
+	Bytes = 0;
+}
+
+/** Creates the directory if missing, parents must exist */
+inline bool32 MakeDirectory(const std::string& Path) {
+#if MSVC
+	auto Result = _mkdir(Path.c_str());
+#else
+	auto Result = mkdir(Path.c_str(), 0755);
+#endif
+	return Result == 0 || errno == EEXIST;
+}
+
+// 64 bit FNV-1a, chain calls through Hash to cover several buffers
+inline u64 HashBytes(const void* Data, size_t Bytes, u64 Hash = 0xcbf29ce484222325ull) {
+	auto Bytes8 = (const u8*) Data;
+	for (size_t i = 0; i < Bytes; ++i) {
+		Hash ^= Bytes8[i];
+		Hash *= 0x100000001b3ull;
+	}
+	return Hash;
+}
+
+inline u64 HashString(const std::string& String, u64 Hash = 0xcbf29ce484222325ull) {
+	return HashBytes(String.data(), String.size(), Hash);
+}
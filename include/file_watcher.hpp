@@ -0,0 +1,119 @@
+#pragma once
+
+#include <common.hpp>
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <sys/stat.h>
+
+#if defined(__linux__)
+#define FILE_WATCHER_INOTIFY true
+#include <sys/inotify.h>
+#include <unistd.h>
+#else
+#define FILE_WATCHER_INOTIFY false
+#endif
+
+// Reports files modified on disk without blocking. With inotify the directories of the files are
+// watched, not the files themselves, because many editors save by writing a new file and renaming
+// it over the old one. Elsewhere the modification times are polled
+struct file_watcher {
+#if FILE_WATCHER_INOTIFY
+	int Handle = -1;
+	std::unordered_map<int, std::string> Directories; // Watch descriptor to directory, with its trailing slash
+#endif
+	std::unordered_map<std::string, time_t> Files; // Last modification time of every watched file
+
+	bool32 Initialize();
+	void Shutdown();
+
+	void Watch(const std::string& Path);
+
+	/** Appends the watched files changed since the last call */
+	void Poll(std::vector<std::string>& Changed);
+
+	static time_t ModificationTime(const std::string& Path) {
+		struct stat Stat;
+		return stat(Path.c_str(), &Stat) == 0 ? Stat.st_mtime : 0;
+	}
+};
+
+inline bool32 file_watcher::Initialize() {
+#if FILE_WATCHER_INOTIFY
+	Handle = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (Handle < 0) {
+		LogError("[File Watcher] inotify unavailable, polling modification times\n");
+	}
+#endif
+	return true;
+}
+
+inline void file_watcher::Shutdown() {
+#if FILE_WATCHER_INOTIFY
+	if (Handle >= 0) { close(Handle); }
+	Handle = -1;
+	Directories.clear();
+#endif
+	Files.clear();
+}
+
+inline void file_watcher::Watch(const std::string& Path) {
+	if (Files.count(Path)) { return; }
+	Files[Path] = ModificationTime(Path);
+
+#if FILE_WATCHER_INOTIFY
+	if (Handle < 0) { return; }
+
+	const auto Directory = Path.substr(0, Path.find_last_of('/') + 1);
+	for (const auto& Entry : Directories) { if (Entry.second == Directory) { return; } }
+
+	auto Descriptor = inotify_add_watch(Handle, Directory.empty() ? "." : Directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+	if (Descriptor < 0) {
+		LogError("[File Watcher] Could not watch %s\n", Directory.c_str());
+		return;
+	}
+	Directories[Descriptor] = Directory;
+#endif
+}
+
+inline void file_watcher::Poll(std::vector<std::string>& Changed) {
+	const auto FirstChanged = Changed.size();
+	auto Report = [&](const std::string& Path) {
+		if (std::find(Changed.begin() + FirstChanged, Changed.end(), Path) == Changed.end()) { Changed.push_back(Path); }
+	};
+
+#if FILE_WATCHER_INOTIFY
+	if (Handle >= 0) {
+		alignas(inotify_event) char Buffer[4096];
+		while (true) {
+			auto Length = read(Handle, Buffer, SizeOf(Buffer));
+			if (Length <= 0) { break; } // EAGAIN, nothing left
+
+			for (char* At = Buffer; At < Buffer + Length; ) {
+				auto Event = (const inotify_event*) At;
+				At += SizeOf(inotify_event) + Event->len;
+
+				auto Directory = Directories.find(Event->wd);
+				if (Directory == Directories.end() || Event->len == 0) { continue; }
+
+				auto Path = Directory->second + Event->name;
+				auto File = Files.find(Path);
+				if (File != Files.end()) {
+					File->second = ModificationTime(Path);
+					Report(Path);
+				}
+			}
+		}
+		return;
+	}
+#endif
+
+	for (auto& File : Files) {
+		auto Time = ModificationTime(File.first);
+		if (Time != File.second) {
+			File.second = Time;
+			Report(File.first);
+		}
+	}
+}
@@ -2,6 +2,9 @@
 
 #include <common.hpp>
 #include <gl_33.hpp>
+#include <gpu_memory.hpp>
+#include <array>
+#include <initializer_list>
 
 // a color, depth and stecil framebuffer
 struct default_framebuffer {
@@ -39,6 +42,7 @@ inline default_framebuffer::default_framebuffer(glm::ivec2 Size)
 	gl::TexParameteri(gl::TEXTURE_2D, gl::TEXTURE_MIN_FILTER, gl::LINEAR);
 	gl::TexParameteri(gl::TEXTURE_2D, gl::TEXTURE_MAG_FILTER, gl::LINEAR);
 	gl::FramebufferTexture2D(gl::FRAMEBUFFER, gl::COLOR_ATTACHMENT0, gl::TEXTURE_2D, ColorTexture, 0);
+	GPUMemory.Track(gpu_resource::Texture, ColorTexture, EstimateTextureBytes(gl::RGB16F, Size.x, Size.y), "Framebuffer Color");
 
     // Bind depth stencil buffer
 	gl::GenRenderbuffers(1, &DepthStencilBuffer);
@@ -46,6 +50,7 @@ inline default_framebuffer::default_framebuffer(glm::ivec2 Size)
 //	defer{ gl::BindRenderbuffer(gl::RENDERBUFFER, 0); };
 	gl::RenderbufferStorage(gl::RENDERBUFFER, gl::DEPTH24_STENCIL8, Size.x, Size.y);
 	gl::FramebufferRenderbuffer(gl::FRAMEBUFFER, gl::DEPTH_STENCIL_ATTACHMENT, gl::RENDERBUFFER, DepthStencilBuffer);
+	GPUMemory.Track(gpu_resource::Renderbuffer, DepthStencilBuffer, EstimateTextureBytes(gl::DEPTH24_STENCIL8, Size.x, Size.y), "Framebuffer Depth Stencil");
 
     // Check framebuffer completeness
 	if (gl::CheckFramebufferStatus(gl::FRAMEBUFFER) != gl::FRAMEBUFFER_COMPLETE) {
@@ -55,7 +60,190 @@ inline default_framebuffer::default_framebuffer(glm::ivec2 Size)
 
 inline default_framebuffer::~default_framebuffer() {
 	if (ID != INVALID_ID) { gl::DeleteFramebuffers(1, &ID); }
-	if (ColorTexture != INVALID_ID) { gl::DeleteTextures(1, &ColorTexture); }
-	if (DepthStencilBuffer != INVALID_ID) { gl::DeleteFramebuffers(1, &DepthStencilBuffer); }
+	if (ColorTexture != INVALID_ID) {
+		GPUMemory.Release(gpu_resource::Texture, ColorTexture);
+		gl::DeleteTextures(1, &ColorTexture);
+	}
+	if (DepthStencilBuffer != INVALID_ID) {
+		GPUMemory.Release(gpu_resource::Renderbuffer, DepthStencilBuffer);
+		gl::DeleteRenderbuffers(1, &DepthStencilBuffer);
+	}
+}
+
+
+// Creates a screen sized texture suited to be a framebuffer attachment
+inline uint MakeAttachmentTexture(glm::ivec2 Size, GLint InternalFormat, GLenum Format, GLenum Type, const char* DebugName) {
+	uint Texture;
+	gl::GenTextures(1, &Texture);
+	gl::BindTexture(gl::TEXTURE_2D, Texture);
+	gl::TexImage2D(gl::TEXTURE_2D, 0, InternalFormat, Size.x, Size.y, 0, Format, Type, nullptr);
+	gl::TexParameteri(gl::TEXTURE_2D, gl::TEXTURE_MIN_FILTER, gl::NEAREST);
+	gl::TexParameteri(gl::TEXTURE_2D, gl::TEXTURE_MAG_FILTER, gl::NEAREST);
+	gl::TexParameteri(gl::TEXTURE_2D, gl::TEXTURE_WRAP_S, gl::CLAMP_TO_EDGE);
+	gl::TexParameteri(gl::TEXTURE_2D, gl::TEXTURE_WRAP_T, gl::CLAMP_TO_EDGE);
+	GPUMemory.Track(gpu_resource::Texture, Texture, EstimateTextureBytes(InternalFormat, Size.x, Size.y), DebugName);
+	return Texture;
+}
+
+namespace gbuffer_target {
+	enum type : uint {
+		AlbedoSpecular = 0, // sRGB albedo, specular power in alpha
+		Normal,
+		Lighting,           // HDR light accumulation
+		TOTAL
+	};
+}
+
+// Multiple render target framebuffer for deferred shading
+struct gbuffer {
+	static constexpr uint INVALID_ID = (uint)-1;
+
+	uint ID;
+	std::array<uint, gbuffer_target::TOTAL> Targets;
+	uint DepthStencilTexture;
+
+	glm::ivec2 Size;
+
+	gbuffer() = delete;
+	explicit gbuffer(glm::ivec2 Size);
+	~gbuffer();
+
+	/** Bind with the given attachments as draw buffers, no target means no color writes */
+	void Bind(std::initializer_list<gbuffer_target::type> DrawTargets);
+};
+
+inline gbuffer::gbuffer(glm::ivec2 Size)
+		: ID{INVALID_ID}
+		, Targets{}
+		, DepthStencilTexture{INVALID_ID}
+		, Size{Size} {
+
+	gl::GenFramebuffers(1, &ID);
+	gl::BindFramebuffer(gl::FRAMEBUFFER, ID);
+	defer{ gl::BindFramebuffer(gl::FRAMEBUFFER, 0); };
+
+	Targets[gbuffer_target::AlbedoSpecular] = MakeAttachmentTexture(Size, gl::SRGB8_ALPHA8, gl::RGBA, gl::UNSIGNED_BYTE, "GBuffer Albedo Specular");
+	Targets[gbuffer_target::Normal] = MakeAttachmentTexture(Size, gl::RGB16F, gl::RGB, gl::FLOAT, "GBuffer Normal");
+	Targets[gbuffer_target::Lighting] = MakeAttachmentTexture(Size, gl::RGBA16F, gl::RGBA, gl::FLOAT, "GBuffer Lighting");
+	for (uint iTarget = 0; iTarget < gbuffer_target::TOTAL; ++iTarget) {
+		gl::FramebufferTexture2D(gl::FRAMEBUFFER, gl::COLOR_ATTACHMENT0 + iTarget, gl::TEXTURE_2D, Targets[iTarget], 0);
+	}
+
+	// Depth is sampled to reconstruct positions, stencil marks light volumes
+	DepthStencilTexture = MakeAttachmentTexture(Size, gl::DEPTH24_STENCIL8, gl::DEPTH_STENCIL, gl::UNSIGNED_INT_24_8, "GBuffer Depth Stencil");
+	gl::FramebufferTexture2D(gl::FRAMEBUFFER, gl::DEPTH_STENCIL_ATTACHMENT, gl::TEXTURE_2D, DepthStencilTexture, 0);
+	gl::BindTexture(gl::TEXTURE_2D, 0);
+
+	if (gl::CheckFramebufferStatus(gl::FRAMEBUFFER) != gl::FRAMEBUFFER_COMPLETE) {
+		Assert(!"GBuffer is not Complete");
+	}
+}
+
+inline gbuffer::~gbuffer() {
+	if (ID != INVALID_ID) { gl::DeleteFramebuffers(1, &ID); }
+	for (auto& Target : Targets) {
+		GPUMemory.Release(gpu_resource::Texture, Target);
+		gl::DeleteTextures(1, &Target);
+	}
+	if (DepthStencilTexture != INVALID_ID) {
+		GPUMemory.Release(gpu_resource::Texture, DepthStencilTexture);
+		gl::DeleteTextures(1, &DepthStencilTexture);
+	}
+}
+
+inline void gbuffer::Bind(std::initializer_list<gbuffer_target::type> DrawTargets) {
+	gl::BindFramebuffer(gl::FRAMEBUFFER, ID);
+
+	std::array<GLenum, gbuffer_target::TOTAL> Buffers;
+	GLsizei NumBuffers = 0;
+	for (auto Target : DrawTargets) { Buffers[NumBuffers++] = gl::COLOR_ATTACHMENT0 + Target; }
+
+	if (NumBuffers > 0) {
+		gl::DrawBuffers(NumBuffers, Buffers.data());
+	} else {
+		gl::DrawBuffer(gl::NONE);
+	}
 }
 
+namespace oit_target {
+	enum type : uint {
+		Accumulation = 0, // Weighted premultiplied color, revealage in alpha
+		Weights,          // Sum of the weights
+		TOTAL
+	};
+}
+
+// Targets of weighted blended order-independent transparency. The depth buffer is a copy of the
+// scene's so transparent surfaces behind opaque ones are rejected
+struct oit_buffer {
+	static constexpr uint INVALID_ID = (uint)-1;
+
+	uint ID;
+	std::array<uint, oit_target::TOTAL> Targets;
+	uint DepthStencilBuffer;
+
+	glm::ivec2 Size;
+
+	oit_buffer() = delete;
+	explicit oit_buffer(glm::ivec2 Size);
+	~oit_buffer();
+
+	/** Copies the depth of the window framebuffer, resolving it when multisampled, and clears the targets */
+	void Begin();
+};
+
+inline oit_buffer::oit_buffer(glm::ivec2 Size)
+		: ID{INVALID_ID}
+		, Targets{}
+		, DepthStencilBuffer{INVALID_ID}
+		, Size{Size} {
+
+	gl::GenFramebuffers(1, &ID);
+	gl::BindFramebuffer(gl::FRAMEBUFFER, ID);
+	defer{ gl::BindFramebuffer(gl::FRAMEBUFFER, 0); };
+
+	Targets[oit_target::Accumulation] = MakeAttachmentTexture(Size, gl::RGBA16F, gl::RGBA, gl::FLOAT, "OIT Accumulation");
+	Targets[oit_target::Weights] = MakeAttachmentTexture(Size, gl::R16F, gl::RED, gl::FLOAT, "OIT Weights");
+	for (uint iTarget = 0; iTarget < oit_target::TOTAL; ++iTarget) {
+		gl::FramebufferTexture2D(gl::FRAMEBUFFER, gl::COLOR_ATTACHMENT0 + iTarget, gl::TEXTURE_2D, Targets[iTarget], 0);
+	}
+	gl::BindTexture(gl::TEXTURE_2D, 0);
+
+	const GLenum Buffers[] = { gl::COLOR_ATTACHMENT0 + oit_target::Accumulation, gl::COLOR_ATTACHMENT0 + oit_target::Weights };
+	gl::DrawBuffers(ArraySize(Buffers), Buffers);
+
+	// Same format as the window's, blits between depth buffers need matching formats
+	gl::GenRenderbuffers(1, &DepthStencilBuffer);
+	gl::BindRenderbuffer(gl::RENDERBUFFER, DepthStencilBuffer);
+	gl::RenderbufferStorage(gl::RENDERBUFFER, gl::DEPTH24_STENCIL8, Size.x, Size.y);
+	gl::FramebufferRenderbuffer(gl::FRAMEBUFFER, gl::DEPTH_STENCIL_ATTACHMENT, gl::RENDERBUFFER, DepthStencilBuffer);
+	GPUMemory.Track(gpu_resource::Renderbuffer, DepthStencilBuffer, EstimateTextureBytes(gl::DEPTH24_STENCIL8, Size.x, Size.y), "OIT Depth Stencil");
+
+	if (gl::CheckFramebufferStatus(gl::FRAMEBUFFER) != gl::FRAMEBUFFER_COMPLETE) {
+		Assert(!"OIT buffer is not Complete");
+	}
+}
+
+inline oit_buffer::~oit_buffer() {
+	if (ID != INVALID_ID) { gl::DeleteFramebuffers(1, &ID); }
+	for (auto& Target : Targets) {
+		GPUMemory.Release(gpu_resource::Texture, Target);
+		gl::DeleteTextures(1, &Target);
+	}
+	if (DepthStencilBuffer != INVALID_ID) {
+		GPUMemory.Release(gpu_resource::Renderbuffer, DepthStencilBuffer);
+		gl::DeleteRenderbuffers(1, &DepthStencilBuffer);
+	}
+}
+
+inline void oit_buffer::Begin() {
+	gl::BindFramebuffer(gl::READ_FRAMEBUFFER, 0);
+	gl::BindFramebuffer(gl::DRAW_FRAMEBUFFER, ID);
+	gl::BlitFramebuffer(0, 0, Size.x, Size.y, 0, 0, Size.x, Size.y, gl::DEPTH_BUFFER_BIT, gl::NEAREST);
+	gl::BindFramebuffer(gl::FRAMEBUFFER, ID);
+
+	const GLfloat Revealed[] = { 0.f, 0.f, 0.f, 1.f }; // Nothing accumulated, everything behind shows
+	const GLfloat Zero[] = { 0.f, 0.f, 0.f, 0.f };
+	gl::ClearBufferfv(gl::COLOR, oit_target::Accumulation, Revealed);
+	gl::ClearBufferfv(gl::COLOR, oit_target::Weights, Zero);
+}
@@ -0,0 +1,829 @@
+#pragma once
+
+#include <common.hpp>
+#include <gl_33.hpp>
+#include <file.hpp>
+#include <gpu_memory.hpp>
+#include <json.hpp>
+#include <material.hpp>
+#include <mesh.hpp>
+#include <texture.hpp>
+#include <transform.hpp>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+// glTF 2.0 models, .gltf with external or embedded (data URI) buffers and .glb. The file is mapped
+// and the JSON parsed in place. Every buffer view a primitive reads becomes one GL buffer uploaded
+// straight from the mapping, and the accessors become VertexAttribPointer calls on it with their
+// own offset and the view's stride, whatever the interleaving. Primitives the attribute formats do
+// not allow that for (quantized positions, sparse accessors, missing normals or texture
+// coordinates) are decoded to mesh_vertex and built like any other mesh. glTF texture coordinates
+// start at the top of the image like the textures are uploaded, they need no flip.
+// Samplers map to the shared sampler objects, their wrap modes as given and their filters capping
+// the frame's filtering preset. Not supported: skins, morph targets, animations, cameras, texture transforms, alpha masking
+// (MASK materials are drawn opaque) and any PBR parameter beyond the base color and roughness.
+// Files requiring an extension other than KHR_mesh_quantization fail to load. Only the default
+// scene is drawn
+
+struct gltf_primitive {
+	mesh Mesh;
+	int Material; // Into gltf_model::Materials, -1 for the default material
+};
+
+struct gltf_node {
+	mat4 Local;
+	mat4 World; // Relative to the model
+	int Mesh;   // Into gltf_model::Meshes, -1 when the node has none
+	int Parent;
+	std::vector<uint> Children;
+};
+
+// A glTF mesh is a range of primitives
+struct gltf_mesh {
+	uint FirstPrimitive;
+	uint NumPrimitives;
+};
+
+struct gltf_model {
+	std::string Path;
+	std::vector<GLuint> ViewBuffers; // GL buffer of each buffer view, 0 for the views no primitive reads directly
+	std::vector<gltf_primitive> Primitives;
+	std::vector<gltf_mesh> Meshes;
+	std::vector<gltf_node> Nodes;
+	std::vector<uint> Roots;      // Nodes of the scene
+	std::vector<uint> SceneNodes; // Every node reachable from Roots, the only ones drawn
+	std::vector<material> Materials;
+	material DefaultMaterial;
+	std::vector<std::unique_ptr<texture>> Images;
+	bounding_sphere Bounds; // Of the whole scene, model space
+	uint NumDirect, NumDecoded; // Primitives drawn from the buffer views as they are, and converted ones
+
+	/** DefaultTexture is used by the materials without a base color texture */
+	bool32 Load(const std::string& FileName, uint DefaultTexture);
+	void Destroy();
+
+	/** Calls Draw(const mesh&, const mat4& Model, const material&) for every primitive of the scene */
+	template <typename draw_function>
+	void ForEachPrimitive(const mat4& Transform, draw_function Draw) const;
+};
+
+namespace gltf_component {
+	enum type : GLenum { // Same values as the GL types
+		Byte = 5120,
+		UnsignedByte = 5121,
+		Short = 5122,
+		UnsignedShort = 5123,
+		UnsignedInt = 5125,
+		Float = 5126,
+	};
+}
+
+inline uint GltfComponentSize(GLenum ComponentType) {
+	switch (ComponentType) {
+	case gltf_component::Byte: case gltf_component::UnsignedByte: return 1;
+	case gltf_component::Short: case gltf_component::UnsignedShort: return 2;
+	case gltf_component::UnsignedInt: case gltf_component::Float: return 4;
+	default: return 0;
+	}
+}
+
+inline uint GltfNumComponents(const std::string& Type) {
+	if (Type == "SCALAR") { return 1; }
+	if (Type == "VEC2") { return 2; }
+	if (Type == "VEC3") { return 3; }
+	if (Type == "VEC4" || Type == "MAT2") { return 4; }
+	if (Type == "MAT3") { return 9; }
+	if (Type == "MAT4") { return 16; }
+	return 0;
+}
+
+inline std::vector<u8> GltfDecodeBase64(const char* Text, size_t Length) {
+	auto Value = [](char C) -> int {
+		if (C >= 'A' && C <= 'Z') { return C - 'A'; }
+		if (C >= 'a' && C <= 'z') { return C - 'a' + 26; }
+		if (C >= '0' && C <= '9') { return C - '0' + 52; }
+		if (C == '+' || C == '-') { return 62; }
+		if (C == '/' || C == '_') { return 63; }
+		return -1;
+	};
+
+	std::vector<u8> Result;
+	Result.reserve(Length / 4 * 3);
+	u32 Bits = 0;
+	int NumBits = 0;
+	for (size_t i = 0; i < Length; ++i) {
+		const auto Sextet = Value(Text[i]);
+		if (Sextet < 0) { continue; } // Padding and line breaks
+		Bits = Bits << 6 | (u32) Sextet;
+		NumBits += 6;
+		if (NumBits >= 8) {
+			NumBits -= 8;
+			Result.push_back((u8) (Bits >> NumBits));
+		}
+	}
+	return Result;
+}
+
+// Relative URIs may be percent encoded
+inline std::string GltfDecodeUri(const std::string& Uri) {
+	auto Hex = [](char C) { return IsDigit(C) ? C - '0' : (C | 32) - 'a' + 10; };
+
+	std::string Result;
+	for (size_t i = 0; i < Uri.size(); ++i) {
+		if (Uri[i] == '%' && i + 2 < Uri.size()) {
+			Result += (char) (Hex(Uri[i + 1]) * 16 + Hex(Uri[i + 2]));
+			i += 2;
+		} else {
+			Result += Uri[i];
+		}
+	}
+	return Result;
+}
+
+// Everything the loader needs while the files are mapped
+struct gltf_loader {
+	struct view {
+		int Buffer;
+		size_t Offset, Length;
+		uint Stride; // 0 when tightly packed
+	};
+
+	struct accessor {
+		int View; // -1 for all zeros (before sparse values)
+		size_t Offset;
+		GLenum ComponentType;
+		uint NumComponents;
+		uint Count;
+		bool32 Normalized;
+		const json_value* Sparse;
+		bool32 HasBounds;
+		vec3 Min, Max;
+	};
+
+	gltf_model& Model;
+	std::string Directory;
+	json_document Json;
+	std::vector<std::unique_ptr<mapped_file>> Files;
+	std::vector<std::vector<u8>> Decoded; // Data URIs
+	std::vector<const u8*> Buffers;
+	std::vector<size_t> BufferBytes;
+	std::vector<view> Views;
+	std::vector<accessor> Accessors;
+
+	explicit gltf_loader(gltf_model& Model) : Model(Model) {}
+
+	bool32 Fail(const char* Message) {
+		LogError("[glTF] %s: %s\n", Model.Path.c_str(), Message);
+		return false;
+	}
+
+	const json_value* Array(const json_value& Object, const char* Key) const {
+		const auto Member = Json.Find(Object, Key);
+		return Member && Member->IsArray() ? Member : nullptr;
+	}
+
+	int Index(const json_value& Object, const char* Key) const { return (int) Json.Number(Object, Key, -1.); }
+
+	bool32 LoadBuffers(const u8* BinaryChunk, size_t BinaryBytes);
+	bool32 ParseViews();
+	bool32 ParseAccessors();
+	const u8* Element(const accessor& Accessor, uint Index) const;
+	std::vector<float> ReadFloats(const accessor& Accessor) const;
+	std::vector<uint> ReadIndices(const accessor& Accessor) const;
+	GLuint ViewBuffer(int ViewIndex);
+	bool32 LoadImages();
+	material_sampler Sampler(const json_value& Texture) const;
+	void LoadMaterials();
+	bool32 LoadMeshes();
+	bool32 BuildPrimitive(const json_value& Primitive, const char* DebugName);
+	void LoadNodes();
+};
+
+inline bool32 gltf_loader::LoadBuffers(const u8* BinaryChunk, size_t BinaryBytes) {
+	const auto BufferArray = Array(Json.Root(), "buffers");
+	const auto NumBuffers = BufferArray ? BufferArray->Length : 0u;
+	for (uint i = 0; i < NumBuffers; ++i) {
+		const auto& Buffer = Json(*BufferArray, i);
+		const auto Bytes = (size_t) Json.Number(Buffer, "byteLength");
+		const auto UriValue = Json.Find(Buffer, "uri");
+
+		if (!UriValue) {
+			// The .glb binary chunk, zero copy
+			if (i != 0 || !BinaryChunk) { return Fail("Buffer without uri outside of a .glb"); }
+			Buffers.push_back(BinaryChunk);
+			BufferBytes.push_back(BinaryBytes);
+		} else if (UriValue->Length > 5 && memcmp(UriValue->String, "data:", 5) == 0) {
+			const auto Comma = (const char*) memchr(UriValue->String, ',', UriValue->Length);
+			if (!Comma) { return Fail("Invalid data uri"); }
+			Decoded.push_back(GltfDecodeBase64(Comma + 1, UriValue->String + UriValue->Length - Comma - 1));
+			Buffers.push_back(Decoded.back().data());
+			BufferBytes.push_back(Decoded.back().size());
+		} else {
+			const auto FileName = Directory + GltfDecodeUri(JsonUnescape(UriValue->String, UriValue->Length));
+			std::unique_ptr<mapped_file> File{ new mapped_file{} };
+			if (!File->Open(FileName)) {
+				LogError("[glTF] Could not open %s\n", FileName.c_str());
+				return false;
+			}
+			Buffers.push_back(File->Data);
+			BufferBytes.push_back(File->Bytes);
+			Files.push_back(std::move(File));
+		}
+
+		if (BufferBytes.back() < Bytes) { return Fail("Buffer smaller than its byteLength"); }
+	}
+	return true;
+}
+
+inline bool32 gltf_loader::ParseViews() {
+	const auto ViewArray = Array(Json.Root(), "bufferViews");
+	const auto NumViews = ViewArray ? ViewArray->Length : 0u;
+	for (uint i = 0; i < NumViews; ++i) {
+		const auto& Value = Json(*ViewArray, i);
+		view View;
+		View.Buffer = Index(Value, "buffer");
+		View.Offset = (size_t) Json.Number(Value, "byteOffset");
+		View.Length = (size_t) Json.Number(Value, "byteLength");
+		View.Stride = (uint) Json.Number(Value, "byteStride");
+		if (View.Buffer < 0 || View.Buffer >= (int) Buffers.size()) { return Fail("Buffer view of a missing buffer"); }
+		if (View.Offset > BufferBytes[View.Buffer] || View.Length > BufferBytes[View.Buffer] - View.Offset) { return Fail("Buffer view out of its buffer"); }
+		Views.push_back(View);
+	}
+	Model.ViewBuffers.assign(Views.size(), 0);
+	return true;
+}
+
+inline bool32 gltf_loader::ParseAccessors() {
+	const auto AccessorArray = Array(Json.Root(), "accessors");
+	const auto NumAccessors = AccessorArray ? AccessorArray->Length : 0u;
+	for (uint i = 0; i < NumAccessors; ++i) {
+		const auto& Value = Json(*AccessorArray, i);
+		accessor Accessor;
+		Accessor.View = Index(Value, "bufferView");
+		Accessor.Offset = (size_t) Json.Number(Value, "byteOffset");
+		Accessor.ComponentType = (GLenum) Json.Number(Value, "componentType");
+		Accessor.NumComponents = GltfNumComponents(Json.String(Value, "type"));
+		Accessor.Count = (uint) Json.Number(Value, "count");
+		Accessor.Normalized = Json.Bool(Value, "normalized");
+		Accessor.Sparse = Json.Find(Value, "sparse");
+
+		const auto ComponentSize = GltfComponentSize(Accessor.ComponentType);
+		if (ComponentSize == 0 || Accessor.NumComponents == 0) { return Fail("Unknown accessor type"); }
+		if (Accessor.View >= (int) Views.size()) { return Fail("Accessor of a missing buffer view"); }
+
+		// The last element must end inside the view
+		if (Accessor.View >= 0 && Accessor.Count > 0) {
+			const auto& View = Views[Accessor.View];
+			const auto ElementBytes = ComponentSize * Accessor.NumComponents;
+			const auto Stride = View.Stride ? View.Stride : ElementBytes;
+			if (Accessor.Offset + (size_t) Stride * (Accessor.Count - 1) + ElementBytes > View.Length) { return Fail("Accessor out of its buffer view"); }
+		}
+
+		const auto Min = Array(Value, "min");
+		const auto Max = Array(Value, "max");
+		Accessor.HasBounds = Min && Max && Min->Length >= 3 && Max->Length >= 3;
+		if (Accessor.HasBounds) {
+			for (int k = 0; k < 3; ++k) {
+				Accessor.Min[k] = (float) Json(*Min, k).Number;
+				Accessor.Max[k] = (float) Json(*Max, k).Number;
+			}
+		}
+		Accessors.push_back(Accessor);
+	}
+	return true;
+}
+
+inline const u8* gltf_loader::Element(const accessor& Accessor, uint Index) const {
+	const auto& View = Views[Accessor.View];
+	const auto Stride = View.Stride ? View.Stride : GltfComponentSize(Accessor.ComponentType) * Accessor.NumComponents;
+	return Buffers[View.Buffer] + View.Offset + Accessor.Offset + (size_t) Stride * Index;
+}
+
+// Any accessor as floats, normalized integers mapped to [0, 1] or [-1, 1], sparse values applied
+inline std::vector<float> gltf_loader::ReadFloats(const accessor& Accessor) const {
+	const auto N = Accessor.NumComponents;
+	std::vector<float> Result((size_t) Accessor.Count * N, 0.f);
+
+	auto Convert = [&](const u8* Data, GLenum Type, float* Out) {
+		for (uint k = 0; k < N; ++k) {
+			float Value = 0.f;
+			switch (Type) {
+			case gltf_component::Byte: { i8 V; memcpy(&V, Data + k, 1); Value = Accessor.Normalized ? glm::max(V / 127.f, -1.f) : V; } break;
+			case gltf_component::UnsignedByte: { u8 V = Data[k]; Value = Accessor.Normalized ? V / 255.f : V; } break;
+			case gltf_component::Short: { i16 V; memcpy(&V, Data + 2 * k, 2); Value = Accessor.Normalized ? glm::max(V / 32767.f, -1.f) : V; } break;
+			case gltf_component::UnsignedShort: { u16 V; memcpy(&V, Data + 2 * k, 2); Value = Accessor.Normalized ? V / 65535.f : V; } break;
+			case gltf_component::UnsignedInt: { u32 V; memcpy(&V, Data + 4 * k, 4); Value = (float) V; } break;
+			case gltf_component::Float: memcpy(&Value, Data + 4 * k, 4); break;
+			}
+			Out[k] = Value;
+		}
+	};
+
+	if (Accessor.View >= 0) {
+		for (uint i = 0; i < Accessor.Count; ++i) { Convert(Element(Accessor, i), Accessor.ComponentType, &Result[(size_t) i * N]); }
+	}
+
+	if (Accessor.Sparse) {
+		const auto& Sparse = *Accessor.Sparse;
+		const auto Count = (uint) Json.Number(Sparse, "count");
+		const auto Indices = Json.Find(Sparse, "indices");
+		const auto Values = Json.Find(Sparse, "values");
+		if (!Indices || !Values) { return Result; }
+
+		accessor IndexAccessor = {};
+		IndexAccessor.View = Index(*Indices, "bufferView");
+		IndexAccessor.Offset = (size_t) Json.Number(*Indices, "byteOffset");
+		IndexAccessor.ComponentType = (GLenum) Json.Number(*Indices, "componentType");
+		IndexAccessor.NumComponents = 1;
+		IndexAccessor.Count = Count;
+
+		accessor ValueAccessor = Accessor;
+		ValueAccessor.View = Index(*Values, "bufferView");
+		ValueAccessor.Offset = (size_t) Json.Number(*Values, "byteOffset");
+		ValueAccessor.Count = Count;
+
+		const auto IndexSize = GltfComponentSize(IndexAccessor.ComponentType);
+		const auto ValueSize = GltfComponentSize(Accessor.ComponentType) * N;
+		auto InView = [&](const accessor& Part, size_t ElementBytes) {
+			return Part.View >= 0 && Part.View < (int) Views.size() && Part.Offset + ElementBytes * Count <= Views[Part.View].Length;
+		};
+		if (IndexSize == 0 || !InView(IndexAccessor, IndexSize) || !InView(ValueAccessor, ValueSize)) {
+			LogError("[glTF] %s: Invalid sparse accessor, ignored\n", Model.Path.c_str());
+			return Result;
+		}
+
+		const auto Targets = ReadIndices(IndexAccessor);
+		for (uint i = 0; i < Count; ++i) {
+			if (Targets[i] >= Accessor.Count) { continue; }
+			const auto At = Buffers[Views[ValueAccessor.View].Buffer] + Views[ValueAccessor.View].Offset + ValueAccessor.Offset + (size_t) ValueSize * i;
+			Convert(At, Accessor.ComponentType, &Result[(size_t) Targets[i] * N]);
+		}
+	}
+	return Result;
+}
+
+inline std::vector<uint> gltf_loader::ReadIndices(const accessor& Accessor) const {
+	std::vector<uint> Result(Accessor.Count, 0);
+	if (Accessor.View < 0) { return Result; }
+
+	for (uint i = 0; i < Accessor.Count; ++i) {
+		const auto Data = Element(Accessor, i);
+		switch (Accessor.ComponentType) {
+		case gltf_component::UnsignedByte: Result[i] = Data[0]; break;
+		case gltf_component::UnsignedShort: { u16 V; memcpy(&V, Data, 2); Result[i] = V; } break;
+		case gltf_component::UnsignedInt: memcpy(&Result[i], Data, 4); break;
+		}
+	}
+	return Result;
+}
+
+// Uploaded the first time a primitive reads the view, straight from the file
+inline GLuint gltf_loader::ViewBuffer(int ViewIndex) {
+	auto& Buffer = Model.ViewBuffers[ViewIndex];
+	if (Buffer == 0) {
+		const auto& View = Views[ViewIndex];
+		gl::GenBuffers(1, &Buffer);
+		gl::BindBuffer(gl::ARRAY_BUFFER, Buffer);
+		gl::BufferData(gl::ARRAY_BUFFER, View.Length, Buffers[View.Buffer] + View.Offset, gl::STATIC_DRAW);
+		gl::BindBuffer(gl::ARRAY_BUFFER, 0);
+		GPUMemory.Track(gpu_resource::Buffer, Buffer, View.Length, Model.Path + " View " + std::to_string(ViewIndex));
+	}
+	return Buffer;
+}
+
+inline bool32 gltf_loader::LoadImages() {
+	const auto ImageArray = Array(Json.Root(), "images");
+	const auto NumImages = ImageArray ? ImageArray->Length : 0u;
+	for (uint i = 0; i < NumImages; ++i) {
+		const auto& Image = Json(*ImageArray, i);
+		const auto Uri = Json.String(Image, "uri");
+		const auto ViewIndex = Index(Image, "bufferView");
+
+		std::unique_ptr<texture> Texture;
+		bool32 Loaded = false;
+		if (ViewIndex >= 0 && ViewIndex < (int) Views.size()) {
+			const auto& View = Views[ViewIndex];
+			Texture.reset(new texture{ Model.Path + " Image " + std::to_string(i) });
+			Loaded = Texture->LoadFromMemory(Buffers[View.Buffer] + View.Offset, View.Length);
+		} else if (Uri.compare(0, 5, "data:") == 0) {
+			const auto Comma = Uri.find(',');
+			const auto Data = Comma == std::string::npos ? std::vector<u8>{} : GltfDecodeBase64(Uri.data() + Comma + 1, Uri.size() - Comma - 1);
+			Texture.reset(new texture{ Model.Path + " Image " + std::to_string(i) });
+			Loaded = Texture->LoadFromMemory(Data.data(), Data.size());
+		} else if (!Uri.empty()) {
+			Texture.reset(new texture{ Directory + GltfDecodeUri(Uri) });
+			Loaded = Texture->Load();
+		}
+
+		if (!Loaded) {
+			LogError("[glTF] %s: Image %u could not be loaded, its materials are untextured\n", Model.Path.c_str(), i);
+			Texture.reset();
+		}
+		Model.Images.push_back(std::move(Texture));
+	}
+	return true;
+}
+
+// The texture's sampler, repeating with mipmaps when it has none. Mipmapped minification filters
+// all take the frame's preset, NEAREST and LINEAR cap it
+inline material_sampler gltf_loader::Sampler(const json_value& Texture) const {
+	material_sampler Result{ sampler_wrap::Repeat, sampler_wrap::Repeat, sampler_filter::Default };
+	const auto SamplerArray = Array(Json.Root(), "samplers");
+	const auto SamplerIndex = Index(Texture, "sampler");
+	if (!SamplerArray || SamplerIndex < 0 || SamplerIndex >= (int) SamplerArray->Length) { return Result; }
+
+	auto Wrap = [](int Mode) {
+		switch (Mode) {
+		case gl::CLAMP_TO_EDGE: return sampler_wrap::ClampToEdge;
+		case gl::MIRRORED_REPEAT: return sampler_wrap::MirroredRepeat;
+		default: return sampler_wrap::Repeat;
+		}
+	};
+	const auto& Value = Json(*SamplerArray, SamplerIndex);
+	Result.WrapS = Wrap(Index(Value, "wrapS"));
+	Result.WrapT = Wrap(Index(Value, "wrapT"));
+
+	const auto MagFilter = Index(Value, "magFilter");
+	const auto MinFilter = Index(Value, "minFilter");
+	if (MagFilter == gl::NEAREST) {
+		Result.Filter = sampler_filter::Nearest;
+	} else if (MinFilter == gl::NEAREST || MinFilter == gl::LINEAR) {
+		Result.Filter = sampler_filter::Linear;
+	}
+	return Result;
+}
+
+// Base color and alpha blending map over, roughness becomes a Blinn-Phong exponent
+inline void gltf_loader::LoadMaterials() {
+	const auto TextureArray = Array(Json.Root(), "textures");
+	const auto MaterialArray = Array(Json.Root(), "materials");
+	const auto NumMaterials = MaterialArray ? MaterialArray->Length : 0u;
+	for (uint i = 0; i < NumMaterials; ++i) {
+		const auto& Value = Json(*MaterialArray, i);
+		auto Material = Model.DefaultMaterial;
+
+		float Roughness = 1.f;
+		if (const auto Pbr = Json.Find(Value, "pbrMetallicRoughness")) {
+			const auto Factor = Array(*Pbr, "baseColorFactor");
+			if (Factor && Factor->Length == 4) {
+				for (int k = 0; k < 4; ++k) { Material.Color[k] = (float) Json(*Factor, k).Number; }
+			}
+			Roughness = (float) Json.Number(*Pbr, "roughnessFactor", 1.);
+
+			const auto BaseColor = Json.Find(*Pbr, "baseColorTexture");
+			const auto TextureIndex = BaseColor ? Index(*BaseColor, "index") : -1;
+			if (TextureArray && TextureIndex >= 0 && TextureIndex < (int) TextureArray->Length) {
+				const auto& Texture = Json(*TextureArray, TextureIndex);
+				const auto Source = Index(Texture, "source");
+				if (Source >= 0 && Source < (int) Model.Images.size() && Model.Images[Source]) {
+					Material.Texture = Model.Images[Source]->ID;
+					Material.Sampler = Sampler(Texture);
+				}
+			}
+		}
+
+		const auto Alpha = glm::clamp(Roughness * Roughness, 1e-3f, 1.f);
+		Material.SpecularPower = glm::clamp(2.f / (Alpha * Alpha) - 2.f, 1.f, 1024.f);
+		Material.Transparent = Json.String(Value, "alphaMode") == "BLEND";
+		Model.Materials.push_back(Material);
+	}
+}
+
+inline bool32 gltf_loader::BuildPrimitive(const json_value& Primitive, const char* DebugName) {
+	const auto Attributes = Json.Find(Primitive, "attributes");
+	if (!Attributes) { return Fail("Primitive without attributes"); }
+
+	auto Attribute = [&](const char* Name) -> const accessor* {
+		const auto Index = this->Index(*Attributes, Name);
+		return Index >= 0 && Index < (int) Accessors.size() ? &Accessors[Index] : nullptr;
+	};
+	const auto Position = Attribute("POSITION");
+	const auto Normal = Attribute("NORMAL");
+	const auto TexCoords = Attribute("TEXCOORD_0");
+	if (!Position || Position->NumComponents != 3) { return Fail("Primitive without positions"); }
+
+	const auto IndicesIndex = Index(Primitive, "indices");
+	const accessor* Indices = IndicesIndex >= 0 && IndicesIndex < (int) Accessors.size() ? &Accessors[IndicesIndex] : nullptr;
+
+	static const GLenum Modes[] = { gl::POINTS, gl::LINES, gl::LINE_LOOP, gl::LINE_STRIP, gl::TRIANGLES, gl::TRIANGLE_STRIP, gl::TRIANGLE_FAN };
+	const auto ModeIndex = Index(Primitive, "mode");
+	const GLenum Mode = ModeIndex >= 0 && ModeIndex < (int) ArraySize(Modes) ? Modes[ModeIndex] : (GLenum) gl::TRIANGLES;
+	const auto NumVerts = Position->Count;
+
+	auto Direct = [&](const accessor* Accessor, bool32 AllowNormalized) {
+		if (!Accessor || Accessor->View < 0 || Accessor->Sparse || Accessor->Count != NumVerts) { return false; }
+		if (Accessor->ComponentType == gltf_component::Float) { return true; }
+		return AllowNormalized && Accessor->Normalized
+			&& (Accessor->ComponentType == gltf_component::UnsignedByte || Accessor->ComponentType == gltf_component::UnsignedShort);
+	};
+	const auto DirectIndices = !Indices || (Indices->View >= 0 && !Indices->Sparse && Indices->NumComponents == 1
+		&& Indices->ComponentType != gltf_component::Float && (Indices->ComponentType & 1) // Unsigned types are odd
+		&& Indices->Offset % GltfComponentSize(Indices->ComponentType) == 0);
+
+	const auto Material = Index(Primitive, "material");
+	const auto MaterialIndex = Material >= 0 && Material < (int) Model.Materials.size() ? Material : -1;
+
+	if (Direct(Position, false) && Direct(Normal, false) && TexCoords && TexCoords->NumComponents == 2 && Direct(TexCoords, true) && DirectIndices) {
+		// Attribute pointers into the views, no copies
+		auto Pointer = [&](GLuint Location, const accessor& Accessor) {
+			gl::BindBuffer(gl::ARRAY_BUFFER, ViewBuffer(Accessor.View));
+			gl::EnableVertexAttribArray(Location);
+			gl::VertexAttribPointer(Location, Accessor.NumComponents, Accessor.ComponentType, Accessor.Normalized, Views[Accessor.View].Stride, (void*) Accessor.Offset);
+		};
+
+		GLuint IBO = Indices ? ViewBuffer(Indices->View) : 0;
+		GLuint VAO, PositionVAO;
+		gl::GenVertexArrays(1, &VAO);
+		gl::BindVertexArray(VAO);
+		Pointer(mesh_vertex_layout::Position, *Position);
+		Pointer(mesh_vertex_layout::Normal, *Normal);
+		Pointer(mesh_vertex_layout::TexCoords, *TexCoords);
+		if (IBO) { gl::BindBuffer(gl::ELEMENT_ARRAY_BUFFER, IBO); }
+
+		gl::GenVertexArrays(1, &PositionVAO);
+		gl::BindVertexArray(PositionVAO);
+		Pointer(mesh_vertex_layout::Position, *Position);
+		if (IBO) { gl::BindBuffer(gl::ELEMENT_ARRAY_BUFFER, IBO); }
+		gl::BindVertexArray(0);
+		gl::BindBuffer(gl::ARRAY_BUFFER, 0);
+
+		mesh Mesh{ VAO, ViewBuffer(Position->View), IBO, Mode, NumVerts, Indices ? Indices->Count : 0u };
+		Mesh.PositionVAO = PositionVAO;
+		Mesh.SharedBuffers = true;
+		if (Indices) {
+			// The accessor's place in the shared index buffer, as the one level of detail
+			Mesh.IndexType = Indices->ComponentType;
+			const auto First = (uint) (Indices->Offset / GltfComponentSize(Indices->ComponentType));
+			Mesh.Lods.push_back(mesh_lod{ First, Indices->Count, std::numeric_limits<float>::infinity() });
+		}
+		if (Position->HasBounds) {
+			Mesh.Bounds = bounding_sphere{ .5f * (Position->Min + Position->Max), .5f * glm::distance(Position->Min, Position->Max) };
+		}
+
+		Model.Primitives.push_back(gltf_primitive{ Mesh, MaterialIndex });
+		Model.NumDirect++;
+		return true;
+	}
+
+	// Decoded to mesh_vertex
+	std::vector<mesh_vertex> Vertices(NumVerts);
+	const auto Positions = ReadFloats(*Position);
+	for (uint i = 0; i < NumVerts; ++i) { Vertices[i].Position = vec3{ Positions[3 * i], Positions[3 * i + 1], Positions[3 * i + 2] }; }
+
+	if (TexCoords && TexCoords->NumComponents == 2 && TexCoords->Count == NumVerts) {
+		const auto Values = ReadFloats(*TexCoords);
+		for (uint i = 0; i < NumVerts; ++i) { Vertices[i].TexCoords = vec2{ Values[2 * i], Values[2 * i + 1] }; }
+	}
+
+	std::vector<uint> IndexValues;
+	if (Indices) {
+		IndexValues = ReadIndices(*Indices);
+		for (auto& Index : IndexValues) {
+			if (Index >= NumVerts) { return Fail("Index out of range"); }
+		}
+	}
+
+	if (Normal && Normal->NumComponents == 3 && Normal->Count == NumVerts) {
+		const auto Values = ReadFloats(*Normal);
+		for (uint i = 0; i < NumVerts; ++i) { Vertices[i].Normal = vec3{ Values[3 * i], Values[3 * i + 1], Values[3 * i + 2] }; }
+	} else if (Mode == gl::TRIANGLES) {
+		// Smooth normals, glTF asks for flat ones but shared vertices cannot have them
+		std::vector<vec3> Accumulated(NumVerts, vec3{ 0.f });
+		const auto NumCorners = Indices ? (uint) IndexValues.size() : NumVerts;
+		auto Corner = [&](uint i) { return Indices ? IndexValues[i] : i; };
+		for (uint i = 0; i + 2 < NumCorners; i += 3) {
+			const auto A = Corner(i), B = Corner(i + 1), C = Corner(i + 2);
+			const auto FaceNormal = glm::cross(Vertices[B].Position - Vertices[A].Position, Vertices[C].Position - Vertices[A].Position);
+			Accumulated[A] += FaceNormal;
+			Accumulated[B] += FaceNormal;
+			Accumulated[C] += FaceNormal;
+		}
+		for (uint i = 0; i < NumVerts; ++i) {
+			const auto Length = glm::length(Accumulated[i]);
+			Vertices[i].Normal = Length > 0.f ? Accumulated[i] / Length : vec3{ 0.f, 1.f, 0.f };
+		}
+	}
+
+	Model.Primitives.push_back(gltf_primitive{ mesh{ std::move(Vertices), Mode, Indices ? &IndexValues : nullptr, DebugName }, MaterialIndex });
+	Model.NumDecoded++;
+	return true;
+}
+
+inline bool32 gltf_loader::LoadMeshes() {
+	const auto MeshArray = Array(Json.Root(), "meshes");
+	const auto NumMeshes = MeshArray ? MeshArray->Length : 0u;
+	for (uint i = 0; i < NumMeshes; ++i) {
+		const auto& Value = Json(*MeshArray, i);
+		const auto Name = Model.Path + " " + Json.String(Value, "name", ("Mesh " + std::to_string(i)).c_str());
+
+		gltf_mesh Mesh{ (uint) Model.Primitives.size(), 0 };
+		if (const auto PrimitiveArray = Array(Value, "primitives")) {
+			for (uint p = 0; p < PrimitiveArray->Length; ++p) {
+				if (!BuildPrimitive(Json(*PrimitiveArray, p), Name.c_str())) { return false; }
+				Mesh.NumPrimitives++;
+			}
+		}
+		Model.Meshes.push_back(Mesh);
+	}
+	return true;
+}
+
+inline void gltf_loader::LoadNodes() {
+	const auto NodeArray = Array(Json.Root(), "nodes");
+	const auto NumNodes = NodeArray ? NodeArray->Length : 0u;
+	Model.Nodes.resize(NumNodes);
+
+	for (uint i = 0; i < NumNodes; ++i) {
+		const auto& Value = Json(*NodeArray, i);
+		auto& Node = Model.Nodes[i];
+		Node.Mesh = Index(Value, "mesh");
+		if (Node.Mesh >= (int) Model.Meshes.size()) { Node.Mesh = -1; }
+		Node.Parent = -1;
+
+		auto Vector = [&](const char* Key, vec4 Default, uint Size) {
+			const auto Member = Array(Value, Key);
+			if (Member && Member->Length == Size) {
+				for (uint k = 0; k < Size; ++k) { Default[k] = (float) Json(*Member, k).Number; }
+			}
+			return Default;
+		};
+
+		const auto Matrix = Array(Value, "matrix");
+		if (Matrix && Matrix->Length == 16) {
+			float Elements[16];
+			for (uint k = 0; k < 16; ++k) { Elements[k] = (float) Json(*Matrix, k).Number; }
+			Node.Local = glm::make_mat4(Elements); // Both column major
+		} else {
+			const auto Translation = vec3{ Vector("translation", vec4{ 0.f }, 3) };
+			const auto Rotation = Vector("rotation", vec4{ 0.f, 0.f, 0.f, 1.f }, 4); // x, y, z, w
+			const auto Scale = vec3{ Vector("scale", vec4{ 1.f }, 3) };
+			Node.Local = glm::translate(mat4{}, Translation) * glm::toMat4(quat{ Rotation.w, Rotation.x, Rotation.y, Rotation.z }) * glm::scale(mat4{}, Scale);
+		}
+
+		if (const auto Children = Array(Value, "children")) {
+			for (uint c = 0; c < Children->Length; ++c) {
+				const auto Child = (uint) Json(*Children, c).Number;
+				if (Child < NumNodes && Child != i) { Node.Children.push_back(Child); }
+			}
+		}
+	}
+
+	for (uint i = 0; i < NumNodes; ++i) {
+		for (auto Child : Model.Nodes[i].Children) { Model.Nodes[Child].Parent = (int) i; }
+	}
+
+	// The default scene, or every node without a parent when there is none
+	const auto SceneArray = Array(Json.Root(), "scenes");
+	const auto SceneIndex = glm::max(Index(Json.Root(), "scene"), 0);
+	const auto SceneNodes = SceneArray && SceneIndex < (int) SceneArray->Length ? Array(Json(*SceneArray, SceneIndex), "nodes") : nullptr;
+	if (SceneNodes) {
+		for (uint n = 0; n < SceneNodes->Length; ++n) {
+			const auto Node = (uint) Json(*SceneNodes, n).Number;
+			if (Node < NumNodes) { Model.Roots.push_back(Node); }
+		}
+	} else {
+		for (uint i = 0; i < NumNodes; ++i) { if (Model.Nodes[i].Parent < 0) { Model.Roots.push_back(i); } }
+	}
+
+	// World transforms top down. Nodes of other scenes and orphans are never reached, a node is only
+	// visited once so cycles and shared children in broken files cannot loop
+	struct pending { uint Node; mat4 Parent; };
+	std::vector<pending> Stack;
+	std::vector<bool> Visited(NumNodes, false);
+	for (auto Root : Model.Roots) { Stack.push_back(pending{ Root, mat4{} }); }
+	while (!Stack.empty()) {
+		const auto Entry = Stack.back();
+		Stack.pop_back();
+		if (Visited[Entry.Node]) { continue; }
+		Visited[Entry.Node] = true;
+
+		auto& Node = Model.Nodes[Entry.Node];
+		Node.World = Entry.Parent * Node.Local;
+		Model.SceneNodes.push_back(Entry.Node);
+		for (auto Child : Node.Children) { Stack.push_back(pending{ Child, Node.World }); }
+	}
+}
+
+inline bool32 gltf_model::Load(const std::string& FileName, uint DefaultTexture) {
+	Path = FileName;
+	NumDirect = NumDecoded = 0;
+	DefaultMaterial = material{ vec4{ 1.f }, 32.f, DefaultTexture, false };
+
+	gltf_loader Loader{ *this };
+	const auto Slash = FileName.find_last_of("/\\");
+	Loader.Directory = Slash == std::string::npos ? "" : FileName.substr(0, Slash + 1);
+
+	mapped_file File;
+	if (!File.Open(FileName)) { return Loader.Fail("Could not open the file"); }
+
+	// .glb: 12 byte header, then chunks of length, type and data. JSON first, then the optional binary one
+	const char* JsonText = (const char*) File.Data;
+	size_t JsonBytes = File.Bytes;
+	const u8* BinaryChunk = nullptr;
+	size_t BinaryBytes = 0;
+	if (File.Bytes >= 12 && memcmp(File.Data, "glTF", 4) == 0) {
+		u32 Header[3];
+		memcpy(Header, File.Data, SizeOf(Header));
+		if (Header[1] != 2) { return Loader.Fail("Only glTF 2.0 binaries are supported"); }
+
+		const auto End = glm::min((size_t) Header[2], File.Bytes);
+		bool32 HasJson = false;
+		for (size_t At = 12; At + 8 <= End; ) {
+			u32 Chunk[2];
+			memcpy(Chunk, File.Data + At, SizeOf(Chunk));
+			At += 8;
+			if (Chunk[0] > End - At) { return Loader.Fail("Truncated chunk"); }
+
+			if (Chunk[1] == 0x4E4F534A && !HasJson) { // "JSON"
+				JsonText = (const char*) File.Data + At;
+				JsonBytes = Chunk[0];
+				HasJson = true;
+			} else if (Chunk[1] == 0x004E4942 && !BinaryChunk) { // "BIN\0"
+				BinaryChunk = File.Data + At;
+				BinaryBytes = Chunk[0];
+			}
+			At += (Chunk[0] + 3) & ~3u;
+		}
+		if (!HasJson) { return Loader.Fail("No JSON chunk"); }
+	}
+
+	if (!Loader.Json.Parse(JsonText, JsonBytes)) {
+		LogError("[glTF] %s: %s at byte %u\n", FileName.c_str(), Loader.Json.Error, (uint) (Loader.Json.ErrorAt - JsonText));
+		return false;
+	}
+	if (const auto Asset = Loader.Json.Find(Loader.Json.Root(), "asset")) {
+		if (Loader.Json.String(*Asset, "version").compare(0, 2, "2.") != 0) { return Loader.Fail("Only glTF 2.0 is supported"); }
+	}
+	// Extensions the file cannot be read without (Draco, meshopt, Basis textures...). Quantized
+	// attributes are decoded like any other
+	if (const auto Required = Loader.Array(Loader.Json.Root(), "extensionsRequired")) {
+		for (uint i = 0; i < Required->Length; ++i) {
+			const auto& Value = Loader.Json(*Required, i);
+			const auto Name = Value.IsString() ? JsonUnescape(Value.String, Value.Length) : std::string{};
+			if (Name != "KHR_mesh_quantization") {
+				LogError("[glTF] %s: Required extension %s is not supported\n", FileName.c_str(), Name.c_str());
+				return false;
+			}
+		}
+	}
+
+	if (!Loader.LoadBuffers(BinaryChunk, BinaryBytes) || !Loader.ParseViews() || !Loader.ParseAccessors() || !Loader.LoadImages()) {
+		Destroy();
+		return false;
+	}
+	Loader.LoadMaterials();
+	if (!Loader.LoadMeshes()) {
+		Destroy();
+		return false;
+	}
+	Loader.LoadNodes();
+
+	// Scene bounds, a box around the primitives' spheres
+	vec3 Min{ std::numeric_limits<float>::max() }, Max{ -std::numeric_limits<float>::max() };
+	ForEachPrimitive(mat4{}, [&](const mesh& Mesh, const mat4& Transform, const material&) {
+		if (std::isinf(Mesh.Bounds.Radius)) { return; } // Direct primitive without min and max
+		const auto Sphere = TransformSphere(Transform, Mesh.Bounds);
+		Min = glm::min(Min, Sphere.Center - Sphere.Radius);
+		Max = glm::max(Max, Sphere.Center + Sphere.Radius);
+	});
+	Bounds = Min.x <= Max.x ? bounding_sphere{ .5f * (Min + Max), .5f * glm::distance(Min, Max) } : bounding_sphere{ vec3{ 0.f }, 0.f };
+
+	printf("[glTF] %s: %u meshes, %u primitives (%u from the buffer views, %u decoded), %u nodes, %u materials, %u images\n",
+		FileName.c_str(), (uint) Meshes.size(), (uint) Primitives.size(), NumDirect, NumDecoded, (uint) Nodes.size(), (uint) Materials.size(), (uint) Images.size());
+	return true;
+}
+
+inline void gltf_model::Destroy() {
+	for (auto& Primitive : Primitives) { Primitive.Mesh.Destroy(); }
+	Primitives.clear();
+	for (auto& Buffer : ViewBuffers) {
+		if (Buffer == 0) { continue; }
+		GPUMemory.Release(gpu_resource::Buffer, Buffer);
+		gl::DeleteBuffers(1, &Buffer);
+	}
+	ViewBuffers.clear();
+	Images.clear();
+	Meshes.clear();
+	Nodes.clear();
+	Roots.clear();
+	SceneNodes.clear();
+	Materials.clear();
+}
+
+template <typename draw_function>
+void gltf_model::ForEachPrimitive(const mat4& Transform, draw_function Draw) const {
+	for (auto Index : SceneNodes) {
+		const auto& Node = Nodes[Index];
+		if (Node.Mesh < 0) { continue; }
+		const auto Model = Transform * Node.World;
+		const auto& Mesh = Meshes[Node.Mesh];
+		for (uint i = 0; i < Mesh.NumPrimitives; ++i) {
+			const auto& Primitive = Primitives[Mesh.FirstPrimitive + i];
+			Draw(Primitive.Mesh, Model, Primitive.Material >= 0 ? Materials[Primitive.Material] : DefaultMaterial);
+		}
+	}
+}
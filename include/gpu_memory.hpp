@@ -0,0 +1,194 @@
+#pragma once
+
+#include <common.hpp>
+#include <gl_33.hpp>
+#include <array>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace gpu_resource {
+	enum type : uint {
+		Texture = 0,
+		Cubemap,
+		Buffer,
+		Renderbuffer,
+		Framebuffer, // Window system surfaces, not FBO handles
+		TOTAL
+	};
+}
+static const char* GPUResourceNames[] = { "Texture", "Cubemap", "Buffer", "Renderbuffer", "Framebuffer" };
+StaticAssert(ArraySize(GPUResourceNames) == gpu_resource::TOTAL);
+
+struct gpu_allocation {
+	gpu_resource::type Category;
+	uint ID;
+	u64 Bytes;
+	std::string Name;
+};
+
+// Book-keeping of every GL allocation we make, so we can budget VRAM and catch leaks.
+// Sizes are estimates, drivers are free to pad or compress however they like
+struct gpu_memory_registry {
+	std::vector<gpu_allocation> Allocations;
+	std::array<u64, gpu_resource::TOTAL> CategoryBytes;
+	u64 PeakBytes;
+
+	gpu_memory_registry() : Allocations{}, CategoryBytes{}, PeakBytes{0} {}
+
+	void Track(gpu_resource::type Category, uint ID, u64 Bytes, std::string Name);
+	void Release(gpu_resource::type Category, uint ID);
+
+	u64 TotalBytes() const;
+	u64 BytesOf(gpu_resource::type Category) const { return CategoryBytes[Category]; }
+	const gpu_allocation* Find(gpu_resource::type Category, uint ID) const;
+
+	void DumpReport(FILE* Out) const;
+	bool32 ReportLeaks(FILE* Out) const;
+};
+
+static gpu_memory_registry GPUMemory;
+
+inline void gpu_memory_registry::Track(gpu_resource::type Category, uint ID, u64 Bytes, std::string Name) {
+	Assert(Category < gpu_resource::TOTAL);
+	if (Find(Category, ID)) {
+		// Storage was respecified, e.g. TexImage2D over a live texture
+		Release(Category, ID);
+	}
+
+	Allocations.push_back(gpu_allocation{ Category, ID, Bytes, Name });
+	CategoryBytes[Category] += Bytes;
+	PeakBytes = glm::max(PeakBytes, TotalBytes());
+}
+
+inline void gpu_memory_registry::Release(gpu_resource::type Category, uint ID) {
+	for (size i = 0; i < Allocations.size(); ++i) {
+		auto& Allocation = Allocations[i];
+		if (Allocation.Category == Category && Allocation.ID == ID) {
+			CategoryBytes[Category] -= Allocation.Bytes;
+			Allocation = Allocations.back();
+			Allocations.pop_back();
+			return;
+		}
+	}
+
+	LogError("[GPU Memory] Releasing untracked %s %u\n", GPUResourceNames[Category], ID);
+}
+
+inline u64 gpu_memory_registry::TotalBytes() const {
+	u64 Total = 0;
+	for (auto Bytes : CategoryBytes) { Total += Bytes; }
+	return Total;
+}
+
+inline const gpu_allocation* gpu_memory_registry::Find(gpu_resource::type Category, uint ID) const {
+	for (const auto& Allocation : Allocations) {
+		if (Allocation.Category == Category && Allocation.ID == ID) { return &Allocation; }
+	}
+	return nullptr;
+}
+
+inline void gpu_memory_registry::DumpReport(FILE* Out) const {
+	const auto MB = [](u64 Bytes) { return (double) Bytes / (1024. * 1024.); };
+
+	fprintf(Out, "==== GPU Memory: %.2f MB in %u allocations (peak %.2f MB) ====\n",
+		MB(TotalBytes()), (uint) Allocations.size(), MB(PeakBytes));
+
+	for (uint iCategory = 0; iCategory < gpu_resource::TOTAL; ++iCategory) {
+		// Group allocations sharing a debug name
+		struct group { uint Count; u64 Bytes; };
+		std::map<std::string, group> Groups;
+		for (const auto& Allocation : Allocations) {
+			if (Allocation.Category != iCategory) { continue; }
+			auto& Group = Groups[Allocation.Name];
+			Group.Count++;
+			Group.Bytes += Allocation.Bytes;
+		}
+
+		if (Groups.empty()) { continue; }
+
+		fprintf(Out, "%-12s %10.2f MB\n", GPUResourceNames[iCategory], MB(CategoryBytes[iCategory]));
+		for (const auto& Group : Groups) {
+			fprintf(Out, "    %-40s x%-4u %10.2f KB\n", Group.first.c_str(), Group.second.Count, (double) Group.second.Bytes / 1024.);
+		}
+	}
+}
+
+inline bool32 gpu_memory_registry::ReportLeaks(FILE* Out) const {
+	for (const auto& Allocation : Allocations) {
+		fprintf(Out, "[GPU Memory] Leaked %s %u \"%s\" (%llu bytes)\n", GPUResourceNames[Allocation.Category],
+			Allocation.ID, Allocation.Name.c_str(), (unsigned long long) Allocation.Bytes);
+	}
+	return Allocations.empty();
+}
+
+////////////////////
+// Size estimation
+////////////////////
+
+inline uint NumMipLevels(int Width, int Height) {
+	uint Levels = 1;
+	while (Width > 1 || Height > 1) {
+		Width = glm::max(Width / 2, 1);
+		Height = glm::max(Height / 2, 1);
+		++Levels;
+	}
+	return Levels;
+}
+
+// Bytes of a 4x4 block for block compressed formats, 0 otherwise
+inline uint BlockBytes(GLenum InternalFormat) {
+	switch (InternalFormat) {
+	case gl::COMPRESSED_RGB_S3TC_DXT1_EXT:
+	case gl::COMPRESSED_RGBA_S3TC_DXT1_EXT:
+	case gl::COMPRESSED_SRGB_S3TC_DXT1_EXT:
+	case gl::COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT:
+	case gl::COMPRESSED_RED_RGTC1:
+	case gl::COMPRESSED_SIGNED_RED_RGTC1:
+		return 8;
+	case gl::COMPRESSED_RGBA_S3TC_DXT3_EXT:
+	case gl::COMPRESSED_RGBA_S3TC_DXT5_EXT:
+	case gl::COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT:
+	case gl::COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT:
+	case gl::COMPRESSED_RG_RGTC2:
+	case gl::COMPRESSED_SIGNED_RG_RGTC2:
+		return 16;
+	default: return 0;
+	}
+}
+
+inline uint BytesPerPixel(GLenum InternalFormat) {
+	switch (InternalFormat) {
+	case gl::R8: return 1;
+	case gl::R16UI: return 2;
+	// Three component formats are padded to four by virtually every driver
+	case gl::RGB: case gl::RGB8: case gl::SRGB: case gl::SRGB8: return 4;
+	case gl::RGBA: case gl::RGBA8: case gl::SRGB_ALPHA: case gl::SRGB8_ALPHA8: return 4;
+	case gl::RG16F: case gl::R32UI: case gl::R11F_G11F_B10F: return 4;
+	case gl::DEPTH_COMPONENT24: case gl::DEPTH24_STENCIL8: return 4;
+	case gl::RGB16F: case gl::RGBA16F: case gl::RG32UI: return 8;
+	case gl::RGBA32F: return 16;
+	default:
+		LogError("[GPU Memory] Unknown internal format 0x%X, assuming 4 bytes per pixel\n", InternalFormat);
+		return 4;
+	}
+}
+
+// Estimated size of a texture, NumLevels = 0 means the full mip chain
+inline u64 EstimateTextureBytes(GLenum InternalFormat, int Width, int Height, int Layers = 1, uint NumLevels = 1, uint Samples = 1) {
+	if (NumLevels == 0) { NumLevels = NumMipLevels(Width, Height); }
+
+	u64 Bytes = 0;
+	const auto Block = BlockBytes(InternalFormat);
+	for (uint iLevel = 0; iLevel < NumLevels; ++iLevel) {
+		if (Block) {
+			Bytes += (u64) ((Width + 3) / 4) * ((Height + 3) / 4) * Block;
+		} else {
+			Bytes += (u64) Width * Height * BytesPerPixel(InternalFormat);
+		}
+		Width = glm::max(Width / 2, 1);
+		Height = glm::max(Height / 2, 1);
+	}
+
+	return Bytes * glm::max(Samples, 1u) * Layers;
+}
@@ -24,6 +24,10 @@ struct mouse_state {
 	std::array<bool8, 8> Pressed;
 };
 
+struct keyboard_state {
+	std::array<bool8, GLFW_KEY_LAST + 1> Pressed;
+};
+
 template <typename state>
 struct captured_state {
 		state Now;
@@ -39,6 +43,7 @@ struct input {
 	
 
 	captured_state<mouse_state> Mouse;
+	captured_state<keyboard_state> Keyboard;
 
 	bool8 IsDown(mouse_button Button) const;
 	bool8 IsUp(mouse_button Button) const;
@@ -48,6 +53,7 @@ struct input {
 
 	bool8 IsDown(int Key) const;
 	bool8 IsUp(int Key) const;
+	bool8 JustDown(int Key) const;
 
 	void StartFrame();
 	void EndFrame();
@@ -72,6 +78,7 @@ inline void input::StartFrame() {
 
 inline void input::EndFrame() {
 	Mouse.Prev = Mouse.Now;
+	Keyboard.Prev = Keyboard.Now;
 }
 
 inline bool8 input::IsDown(mouse_button Button) const {
@@ -106,6 +113,10 @@ inline bool8 input::IsUp(int Key) const {
 	return glfwGetKey(Window, Key) == GLFW_RELEASE;
 }
 
+inline bool8 input::JustDown(int Key) const {
+	return Keyboard.Now.Pressed[Key] && !Keyboard.Prev.Pressed[Key];
+}
+
 
 void MouseButtonCallback(GLFWwindow* /*Window*/, int Button, int Action, int /*Mods*/) {
 	Input.Mouse.Now.Pressed[Button] = (Action == GLFW_PRESS);
@@ -114,4 +125,10 @@ void MouseButtonCallback(GLFWwindow* /*Window*/, int Button, int Action, int /*M
 void CursorPosCallback(GLFWwindow* /*Window*/, double X, double Y) {
 	Input.Mouse.Now.Pos.x = (float) X;
 	Input.Mouse.Now.Pos.y = (float) Y;
+}
+
+void KeyCallback(GLFWwindow* /*Window*/, int Key, int /*Scancode*/, int Action, int /*Mods*/) {
+	if (Key < 0 || Key > GLFW_KEY_LAST) { return; } // GLFW_KEY_UNKNOWN
+	if (Action == GLFW_PRESS) { Input.Keyboard.Now.Pressed[Key] = true; }
+	else if (Action == GLFW_RELEASE) { Input.Keyboard.Now.Pressed[Key] = false; }
 }
\ No newline at end of file
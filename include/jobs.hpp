@@ -0,0 +1,138 @@
+#pragma once
+
+#include <common.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Tracks completion of a group of jobs
+struct job_counter {
+	std::atomic<int> Pending{0};
+
+	bool32 IsDone() const { return Pending.load() == 0; }
+};
+
+struct job {
+	std::function<void()> Func;
+	job_counter* Counter;
+};
+
+// Fixed pool of worker threads fed by a single queue
+struct job_system {
+	std::vector<std::thread> Workers;
+	std::deque<job> Queue;
+	std::mutex Mutex;
+	std::condition_variable WorkAvailable;
+	std::condition_variable WorkDone;
+	bool32 Quit = false;
+
+	/** NumWorkers = 0 means one less than the hardware threads, the main thread also works while it waits */
+	bool Initialize(uint NumWorkers = 0);
+	bool Shutdown();
+
+	void Submit(std::function<void()> Func, job_counter* Counter = nullptr);
+
+	/** Blocks until every job of the counter has finished, running them on the calling thread meanwhile */
+	void Wait(job_counter& Counter);
+
+	/** Calls Func(Begin, End) over [0, Count) split in batches of at most BatchSize, blocks until done */
+	template <typename func>
+	void ParallelFor(uint Count, uint BatchSize, const func& Func);
+
+	uint NumThreads() const { return (uint) Workers.size() + 1; }
+
+	void WorkerLoop();
+	bool32 RunOne(std::unique_lock<std::mutex>& Lock, job_counter* OnlyCounter);
+};
+
+static job_system Jobs;
+
+inline bool job_system::Initialize(uint NumWorkers) {
+	if (NumWorkers == 0) {
+		NumWorkers = glm::max(std::thread::hardware_concurrency(), 2u) - 1;
+	}
+
+	Quit = false;
+	for (uint i = 0; i < NumWorkers; ++i) {
+		Workers.emplace_back([this]() { WorkerLoop(); });
+	}
+	return true;
+}
+
+inline bool job_system::Shutdown() {
+	{
+		std::lock_guard<std::mutex> Lock{ Mutex };
+		Quit = true;
+	}
+	WorkAvailable.notify_all();
+
+	for (auto& Worker : Workers) { Worker.join(); }
+	Workers.clear();
+	return true;
+}
+
+inline void job_system::Submit(std::function<void()> Func, job_counter* Counter) {
+	if (Counter) { Counter->Pending++; }
+
+	{
+		std::lock_guard<std::mutex> Lock{ Mutex };
+		Queue.push_back(job{ std::move(Func), Counter });
+	}
+	WorkAvailable.notify_one();
+}
+
+// Runs a queued job, optionally only one belonging to the given counter. Expects the lock held
+inline bool32 job_system::RunOne(std::unique_lock<std::mutex>& Lock, job_counter* OnlyCounter) {
+	auto It = Queue.begin();
+	if (OnlyCounter) {
+		while (It != Queue.end() && It->Counter != OnlyCounter) { ++It; }
+	}
+	if (It == Queue.end()) { return false; }
+
+	auto Job = std::move(*It);
+	Queue.erase(It);
+
+	Lock.unlock();
+	Job.Func();
+	Lock.lock();
+
+	if (Job.Counter) { Job.Counter->Pending--; }
+	WorkDone.notify_all();
+	return true;
+}
+
+inline void job_system::WorkerLoop() {
+	std::unique_lock<std::mutex> Lock{ Mutex };
+	while (true) {
+		WorkAvailable.wait(Lock, [this]() { return Quit || !Queue.empty(); });
+		if (Quit) { return; }
+
+		RunOne(Lock, nullptr);
+	}
+}
+
+inline void job_system::Wait(job_counter& Counter) {
+	std::unique_lock<std::mutex> Lock{ Mutex };
+	while (!Counter.IsDone()) {
+		// Help with our own jobs instead of picking up unrelated long ones
+		if (!RunOne(Lock, &Counter)) {
+			WorkDone.wait(Lock, [&]() { return Counter.IsDone(); });
+		}
+	}
+}
+
+template <typename func>
+inline void job_system::ParallelFor(uint Count, uint BatchSize, const func& Func) {
+	BatchSize = glm::max(BatchSize, 1u);
+
+	job_counter Counter;
+	for (uint Begin = 0; Begin < Count; Begin += BatchSize) {
+		const auto End = glm::min(Begin + BatchSize, Count);
+		Submit([&Func, Begin, End]() { Func(Begin, End); }, &Counter);
+	}
+	Wait(Counter);
+}
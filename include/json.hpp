@@ -0,0 +1,267 @@
+#pragma once
+
+#include <common.hpp>
+#include <parse.hpp>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Read-only JSON parser that keeps pointers into the text instead of copying strings, the text
+// must outlive the document. The children of each array and object are stored next to each other
+// so arrays are indexed in constant time, objects are searched linearly (they are small)
+
+namespace json_type {
+	enum type : u8 {
+		Null = 0,
+		False,
+		True,
+		Number,
+		String,
+		Array,
+		Object,
+	};
+}
+
+struct json_value {
+	json_type::type Type;
+	const char* Key;    // Member name when inside an object, escapes left as written
+	u32 KeyLength;
+	const char* String; // Escapes left as written, see JsonUnescape
+	u32 Length;         // Characters of a string, children of an array or object
+	u32 First;          // Index of the first child in json_document::Values
+	double Number;
+
+	bool32 IsNumber() const { return Type == json_type::Number; }
+	bool32 IsString() const { return Type == json_type::String; }
+	bool32 IsArray() const { return Type == json_type::Array; }
+	bool32 IsObject() const { return Type == json_type::Object; }
+};
+
+struct json_document {
+	static constexpr uint MaxDepth = 128;
+
+	std::vector<json_value> Values;
+	std::vector<json_value> Pending; // Children of the containers being parsed
+	const char* Error;
+	const char* ErrorAt;
+
+	/** The root is Values.back() */
+	bool32 Parse(const char* Text, size_t Length);
+	const json_value& Root() const { return Values.back(); }
+
+	const json_value& operator()(const json_value& Array, uint Index) const { return Values[Array.First + Index]; }
+
+	/** nullptr when Object is not an object or has no such member */
+	const json_value* Find(const json_value& Object, const char* Key) const;
+
+	// Members of an object with defaults for the missing or mistyped ones
+	double Number(const json_value& Object, const char* Key, double Default = 0.) const;
+	bool32 Bool(const json_value& Object, const char* Key, bool32 Default = false) const;
+	std::string String(const json_value& Object, const char* Key, const char* Default = "") const;
+
+	const char* ParseValue(const char* At, const char* End, uint Depth);
+	const char* Fail(const char* Message, const char* At) { Error = Message; ErrorAt = At; return nullptr; }
+};
+
+/** Resolves the escapes of a string or key, \u included (as UTF-8) */
+inline std::string JsonUnescape(const char* String, size_t Length) {
+	std::string Result;
+	Result.reserve(Length);
+
+	auto Hex = [](const char* At) {
+		u32 Value = 0;
+		for (int i = 0; i < 4; ++i) {
+			const auto C = At[i];
+			Value = Value * 16 + (u32) (IsDigit(C) ? C - '0' : (C | 32) - 'a' + 10);
+		}
+		return Value;
+	};
+
+	for (size_t i = 0; i < Length; ++i) {
+		if (String[i] != '\\' || i + 1 == Length) { Result += String[i]; continue; }
+
+		switch (String[++i]) {
+		case 'b': Result += '\b'; break;
+		case 'f': Result += '\f'; break;
+		case 'n': Result += '\n'; break;
+		case 'r': Result += '\r'; break;
+		case 't': Result += '\t'; break;
+		case 'u': {
+			if (i + 4 >= Length) { break; }
+			auto CodePoint = Hex(String + i + 1);
+			i += 4;
+			if (CodePoint >= 0xD800 && CodePoint < 0xDC00 && i + 6 < Length && String[i + 1] == '\\' && String[i + 2] == 'u') {
+				CodePoint = 0x10000 + ((CodePoint - 0xD800) << 10) + (Hex(String + i + 3) - 0xDC00);
+				i += 6;
+			}
+
+			if (CodePoint < 0x80) {
+				Result += (char) CodePoint;
+			} else if (CodePoint < 0x800) {
+				Result += (char) (0xC0 | CodePoint >> 6);
+				Result += (char) (0x80 | (CodePoint & 0x3F));
+			} else if (CodePoint < 0x10000) {
+				Result += (char) (0xE0 | CodePoint >> 12);
+				Result += (char) (0x80 | (CodePoint >> 6 & 0x3F));
+				Result += (char) (0x80 | (CodePoint & 0x3F));
+			} else {
+				Result += (char) (0xF0 | CodePoint >> 18);
+				Result += (char) (0x80 | (CodePoint >> 12 & 0x3F));
+				Result += (char) (0x80 | (CodePoint >> 6 & 0x3F));
+				Result += (char) (0x80 | (CodePoint & 0x3F));
+			}
+		} break;
+		default: Result += String[i]; break; // \" \\ \/
+		}
+	}
+	return Result;
+}
+
+inline const char* JsonSkipSpaces(const char* At, const char* End) {
+	while (At < End && (*At == ' ' || *At == '\t' || *At == '\n' || *At == '\r')) { ++At; }
+	return At;
+}
+
+// At points past the opening quote, returns past the closing one
+inline const char* JsonScanString(const char* At, const char* End) {
+	while (At < End && *At != '"') {
+		if (*At == '\\') { ++At; }
+		++At;
+	}
+	return At < End ? At + 1 : nullptr;
+}
+
+inline const char* json_document::ParseValue(const char* At, const char* End, uint Depth) {
+	At = JsonSkipSpaces(At, End);
+	if (At == End) { return Fail("Unexpected end", At); }
+	if (Depth > MaxDepth) { return Fail("Nested too deep", At); }
+
+	json_value Value = {};
+	auto Literal = [&](const char* Word, json_type::type Type) -> const char* {
+		const auto Length = strlen(Word);
+		if ((size_t) (End - At) < Length || memcmp(At, Word, Length) != 0) { return Fail("Invalid literal", At); }
+		Value.Type = Type;
+		Pending.push_back(Value);
+		return At + Length;
+	};
+
+	switch (*At) {
+	case 'n': return Literal("null", json_type::Null);
+	case 't': return Literal("true", json_type::True);
+	case 'f': return Literal("false", json_type::False);
+
+	case '"': {
+		const auto Close = JsonScanString(At + 1, End);
+		if (!Close) { return Fail("Unterminated string", At); }
+		Value.Type = json_type::String;
+		Value.String = At + 1;
+		Value.Length = (u32) (Close - At - 2);
+		Pending.push_back(Value);
+		return Close;
+	}
+
+	case '[':
+	case '{': {
+		const auto IsObject = *At == '{';
+		const auto Close = IsObject ? '}' : ']';
+		const auto FirstPending = Pending.size();
+
+		At = JsonSkipSpaces(At + 1, End);
+		if (At < End && *At == Close) {
+			++At;
+		} else {
+			while (true) {
+				const char* Key = nullptr;
+				const char* KeyEnd = nullptr;
+				if (IsObject) {
+					At = JsonSkipSpaces(At, End);
+					if (At == End || *At != '"') { return Fail("Expected a member name", At); }
+					Key = At + 1;
+					At = JsonScanString(Key, End);
+					if (!At) { return Fail("Unterminated string", Key); }
+					KeyEnd = At - 1;
+
+					At = JsonSkipSpaces(At, End);
+					if (At == End || *At != ':') { return Fail("Expected ':'", At); }
+					++At;
+				}
+
+				At = ParseValue(At, End, Depth + 1);
+				if (!At) { return nullptr; }
+				if (IsObject) {
+					Pending.back().Key = Key;
+					Pending.back().KeyLength = (u32) (KeyEnd - Key);
+				}
+
+				At = JsonSkipSpaces(At, End);
+				if (At < End && *At == ',') { ++At; continue; }
+				if (At < End && *At == Close) { ++At; break; }
+				return Fail(IsObject ? "Expected ',' or '}'" : "Expected ',' or ']'", At);
+			}
+		}
+
+		// The children move next to each other, their own children are already in place
+		Value.Type = IsObject ? json_type::Object : json_type::Array;
+		Value.First = (u32) Values.size();
+		Value.Length = (u32) (Pending.size() - FirstPending);
+		Values.insert(Values.end(), Pending.begin() + FirstPending, Pending.end());
+		Pending.resize(FirstPending);
+		Pending.push_back(Value);
+		return At;
+	}
+
+	default: {
+		const auto Next = ParseDouble(At, End, Value.Number);
+		if (Next == At || *At == '+') { return Fail("Unexpected character", At); }
+		Value.Type = json_type::Number;
+		Pending.push_back(Value);
+		return Next;
+	}
+	}
+}
+
+inline bool32 json_document::Parse(const char* Text, size_t Length) {
+	Values.clear();
+	Pending.clear();
+	Error = nullptr;
+	ErrorAt = nullptr;
+
+	const auto End = Text + Length;
+	auto At = ParseValue(Text, End, 0);
+	if (At && JsonSkipSpaces(At, End) != End) { Fail("Unexpected data after the root", At); }
+	if (Error) {
+		Values.clear();
+		return false;
+	}
+
+	Values.push_back(Pending.back());
+	Pending.clear();
+	return true;
+}
+
+inline const json_value* json_document::Find(const json_value& Object, const char* Key) const {
+	if (Object.Type != json_type::Object) { return nullptr; }
+
+	const auto KeyLength = strlen(Key);
+	for (u32 i = 0; i < Object.Length; ++i) {
+		const auto& Member = Values[Object.First + i];
+		if (Member.KeyLength == KeyLength && memcmp(Member.Key, Key, KeyLength) == 0) { return &Member; }
+	}
+	return nullptr;
+}
+
+inline double json_document::Number(const json_value& Object, const char* Key, double Default) const {
+	const auto Member = Find(Object, Key);
+	return Member && Member->IsNumber() ? Member->Number : Default;
+}
+
+inline bool32 json_document::Bool(const json_value& Object, const char* Key, bool32 Default) const {
+	const auto Member = Find(Object, Key);
+	if (!Member || (Member->Type != json_type::True && Member->Type != json_type::False)) { return Default; }
+	return Member->Type == json_type::True;
+}
+
+inline std::string json_document::String(const json_value& Object, const char* Key, const char* Default) const {
+	const auto Member = Find(Object, Key);
+	return Member && Member->IsString() ? JsonUnescape(Member->String, Member->Length) : std::string{ Default };
+}
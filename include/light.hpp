@@ -1,6 +1,12 @@
 #pragma once
 #include <gl_33.hpp>
 #include <common.hpp>
+#include <shader.hpp>
+#include <transform.hpp>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <vector>
 
 struct light {
 	vec4 Position;
@@ -11,29 +17,159 @@ struct light {
 	float QuadraticFalloff;
 	float InnerCone;
 	float OuterCone;
+	bool32 Enabled = true; // Disabled lights are skipped by every lighting path
 };
 
-void BindLight(uint Program, const char* Variable, const light& Light) {
+// Contributions below this fraction of full intensity are not visible after quantization
+constexpr float LightCutoff = 1.f / 256.f;
+
+// Distance at which a positional light's attenuated contribution falls under the cutoff.
+// Directional lights and lights without falloff reach everywhere
+inline float LightInfluenceRadius(const light& Light, float Cutoff = LightCutoff) {
+	const auto Infinity = std::numeric_limits<float>::infinity();
+	if (Light.Position.w == 0.f) { return Infinity; }
+
+	auto MaxComponent = [](vec3 V) { return glm::max(V.x, glm::max(V.y, V.z)); };
+	auto Peak = glm::max(MaxComponent(Light.Color), MaxComponent(Light.SpecularColor));
+
+	// Peak / (1 + L*d + Q*d^2) = Cutoff  =>  Q*d^2 + L*d + (1 - Peak/Cutoff) = 0
+	auto C = 1.f - Peak / Cutoff;
+	if (C >= 0.f) { return 0.f; }
+
+	const auto L = Light.LinearFalloff;
+	const auto Q = Light.QuadraticFalloff;
+	if (Q > 0.f) { return (-L + glm::sqrt(L*L - 4.f*Q*C)) / (2.f*Q); }
+	if (L > 0.f) { return -C / L; }
+	return Infinity;
+}
+
+inline bool32 IsSpotLight(const light& Light) {
+	return Light.Position.w != 0.f && glm::dot(Light.ConeDirection, Light.ConeDirection) > 0.f;
+}
+
+// Shader features needed to evaluate the light, see shader_feature
+inline uint LightShaderFeatures(const light& Light) {
+	if (Light.Position.w == 0.f) { return 0; }
+	return shader_feature::PointLights | (IsSpotLight(Light) ? (uint) shader_feature::SpotLights : 0u);
+}
+
+// Region a light can affect: a sphere of its influence radius, narrowed to a cone for spotlights
+// since nothing outside OuterCone gets lit
+struct light_volume {
+	vec3 Position;
+	float Radius;
+	vec3 Direction;
+	float CosCutoff, SinCutoff;
+	bool32 IsSpot;
+};
+
+inline light_volume MakeLightVolume(const light& Light) {
+	light_volume Volume;
+	Volume.Position = vec3{ Light.Position };
+	Volume.Radius = LightInfluenceRadius(Light);
+	Volume.IsSpot = IsSpotLight(Light) && Light.OuterCone > 0.f;
+	Volume.Direction = Volume.IsSpot ? glm::normalize(Light.ConeDirection) : vec3{ 0.f };
+	Volume.CosCutoff = glm::clamp(Light.OuterCone, 0.f, 1.f);
+	Volume.SinCutoff = glm::sqrt(1.f - Volume.CosCutoff * Volume.CosCutoff);
+	return Volume;
+}
+
+inline bool32 LightVolumeIntersects(const light_volume& Volume, const bounding_sphere& Sphere) {
+	if (std::isinf(Volume.Radius)) { return true; }
+	if (Volume.Radius <= 0.f) { return false; }
+
+	const auto ToSphere = Sphere.Center - Volume.Position;
+	const auto DistanceSqr = glm::dot(ToSphere, ToSphere);
+	if (DistanceSqr > glm::pow(Volume.Radius + Sphere.Radius, 2.f)) { return false; }
+	if (!Volume.IsSpot) { return true; }
+
+	// Sphere against cone: distance from the center to the cone's side, along the axis to its apex
+	const auto AlongAxis = glm::dot(ToSphere, Volume.Direction);
+	const auto FromAxis = glm::sqrt(glm::max(DistanceSqr - AlongAxis * AlongAxis, 0.f));
+	const auto ToSide = Volume.CosCutoff * FromAxis - Volume.SinCutoff * AlongAxis;
+	return ToSide <= Sphere.Radius && AlongAxis >= -Sphere.Radius;
+}
+
+// Texels of a light in the light data buffer, must match FetchLight in the shaders
+namespace light_texel {
+	enum type : uint {
+		Position = 0,
+		ColorAmbient,
+		SpecularLinearFalloff,
+		ConeQuadraticFalloff,
+		ConesRadius,
+		TOTAL
+	};
+}
+
+inline void PackLight(std::vector<vec4>& Texels, const light& Light, float Radius) {
+	Texels.push_back(Light.Position);
+	Texels.push_back(vec4{ Light.Color, Light.Ambient });
+	Texels.push_back(vec4{ Light.SpecularColor, Light.LinearFalloff });
+	Texels.push_back(vec4{ Light.ConeDirection, Light.QuadraticFalloff });
+	Texels.push_back(vec4{ Light.InnerCone, Light.OuterCone, Radius, 0.f });
+}
+
+// Small colorful point lights scattered inside a box, useful to stress the lighting paths
+inline std::vector<light> MakeRandomPointLights(uint Count, vec3 Min, vec3 Max, uint32 Seed = 1337) {
+	std::mt19937 Random{ Seed };
+	std::uniform_real_distribution<float> Unit{ 0.f, 1.f };
+
+	std::vector<light> Result(Count);
+	for (auto& Light : Result) {
+		Light = light{};
+		Light.Position = vec4{ glm::mix(Min.x, Max.x, Unit(Random)), glm::mix(Min.y, Max.y, Unit(Random)), glm::mix(Min.z, Max.z, Unit(Random)), 1.f };
+		Light.Color = vec3{ Unit(Random), Unit(Random), Unit(Random) };
+		Light.SpecularColor = Light.Color;
+		Light.LinearFalloff = 1.f;
+		Light.QuadraticFalloff = 30.f;
+	}
+
+	return Result;
+}
+
+// Locations of a light struct uniform, querying them is much slower than setting them
+struct light_locations {
+	GLint Position;
+	GLint Color;
+	GLint Ambient;
+	GLint SpecularColor;
+	GLint ConeDirection;
+	GLint LinearFalloff;
+	GLint QuadraticFalloff;
+	GLint InnerCone;
+	GLint OuterCone;
+};
+
+inline light_locations GetLightLocations(uint Program, const char* Variable) {
 	char Buffer[64];
 	auto MakeName = [&](auto Member) { sprintf(Buffer, "%s.%s", Variable, Member); return Buffer; };
 
-	auto PositionLoc = gl::GetUniformLocation(Program, MakeName("Position"));
-	auto ColorLoc = gl::GetUniformLocation(Program, MakeName("Color"));
-	auto AmbientLoc = gl::GetUniformLocation(Program, MakeName("Ambient"));
-	auto SpecularColorLoc = gl::GetUniformLocation(Program, MakeName("SpecularColor"));
-	auto ConeDirectionLoc = gl::GetUniformLocation(Program, MakeName("ConeDirection"));
-	auto LinearFalloffLoc = gl::GetUniformLocation(Program, MakeName("LinearFalloff"));
-	auto QuadraticFalloffLoc = gl::GetUniformLocation(Program, MakeName("QuadraticFalloff"));
-	auto InnerConeLoc = gl::GetUniformLocation(Program, MakeName("InnerCone"));
-	auto OuterConeLoc = gl::GetUniformLocation(Program, MakeName("OuterCone"));
-
-	gl::Uniform4f(PositionLoc, Light.Position.x, Light.Position.y, Light.Position.z, Light.Position.w);
-	gl::Uniform3f(ColorLoc, Light.Color.r, Light.Color.g, Light.Color.b);
-	gl::Uniform1f(AmbientLoc, Light.Ambient);
-	gl::Uniform3f(SpecularColorLoc, Light.SpecularColor.r, Light.SpecularColor.g, Light.SpecularColor.b);
-	gl::Uniform3f(ConeDirectionLoc, Light.ConeDirection.x, Light.ConeDirection.y, Light.ConeDirection.z);
-	gl::Uniform1f(LinearFalloffLoc, Light.LinearFalloff);
-	gl::Uniform1f(QuadraticFalloffLoc, Light.QuadraticFalloff);
-	gl::Uniform1f(InnerConeLoc, Light.InnerCone);
-	gl::Uniform1f(OuterConeLoc, Light.OuterCone);
-}
\ No newline at end of file
+	light_locations Locations;
+	Locations.Position = gl::GetUniformLocation(Program, MakeName("Position"));
+	Locations.Color = gl::GetUniformLocation(Program, MakeName("Color"));
+	Locations.Ambient = gl::GetUniformLocation(Program, MakeName("Ambient"));
+	Locations.SpecularColor = gl::GetUniformLocation(Program, MakeName("SpecularColor"));
+	Locations.ConeDirection = gl::GetUniformLocation(Program, MakeName("ConeDirection"));
+	Locations.LinearFalloff = gl::GetUniformLocation(Program, MakeName("LinearFalloff"));
+	Locations.QuadraticFalloff = gl::GetUniformLocation(Program, MakeName("QuadraticFalloff"));
+	Locations.InnerCone = gl::GetUniformLocation(Program, MakeName("InnerCone"));
+	Locations.OuterCone = gl::GetUniformLocation(Program, MakeName("OuterCone"));
+	return Locations;
+}
+
+inline void BindLight(const light_locations& Locations, const light& Light) {
+	gl::Uniform4f(Locations.Position, Light.Position.x, Light.Position.y, Light.Position.z, Light.Position.w);
+	gl::Uniform3f(Locations.Color, Light.Color.r, Light.Color.g, Light.Color.b);
+	gl::Uniform1f(Locations.Ambient, Light.Ambient);
+	gl::Uniform3f(Locations.SpecularColor, Light.SpecularColor.r, Light.SpecularColor.g, Light.SpecularColor.b);
+	gl::Uniform3f(Locations.ConeDirection, Light.ConeDirection.x, Light.ConeDirection.y, Light.ConeDirection.z);
+	gl::Uniform1f(Locations.LinearFalloff, Light.LinearFalloff);
+	gl::Uniform1f(Locations.QuadraticFalloff, Light.QuadraticFalloff);
+	gl::Uniform1f(Locations.InnerCone, Light.InnerCone);
+	gl::Uniform1f(Locations.OuterCone, Light.OuterCone);
+}
+
+void BindLight(uint Program, const char* Variable, const light& Light) {
+	BindLight(GetLightLocations(Program, Variable), Light);
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <common.hpp>
+#include <gl_33.hpp>
+#include <light.hpp>
+#include <texture_buffer.hpp>
+#include <transform.hpp>
+#include <array>
+#include <vector>
+
+// Injected as MAX_OBJECT_LIGHTS in the per-vertex lighting shaders
+constexpr uint MaxObjectLights = 8;
+
+// Indices into the light data of the lights reaching one object
+struct object_lights {
+	std::array<GLint, MaxObjectLights> Indices;
+	GLint Count;
+	uint Features; // Shader features the lights need
+};
+
+// Per-object light lists for the forward per-vertex models (Gouraud, flat). Enabled lights are
+// uploaded once per frame, then every draw only gets the indices of the lights whose range (and
+// spot cone) reaches the object's bounding sphere. When more lights than fit reach an object the
+// brightest ones at its surface are kept
+struct light_lists {
+	struct culled_light {
+		light_volume Volume;
+		float Peak;
+		float LinearFalloff;
+		float QuadraticFalloff;
+		uint Features;
+	};
+
+	std::vector<culled_light> Candidates; // Parallel to the lights in LightData
+	std::vector<vec4> LightData;
+	vec3 AmbientLight;
+
+	texture_buffer LightBuffer;
+
+	void Initialize();
+	void Shutdown();
+
+	/** Gathers the enabled lights and uploads them */
+	void Build(const std::vector<light>& Lights);
+
+	/** Lights affecting a world space bounding sphere */
+	object_lights Cull(const bounding_sphere& Sphere) const;
+
+	/** Binds the light data to the texture unit and sets the per-frame uniforms */
+	void Bind(uint Program, uint Unit) const;
+};
+
+inline void light_lists::Initialize() {
+	LightBuffer.Initialize(gl::RGBA32F, "Object Light Data");
+	AmbientLight = vec3{ 0.f };
+}
+
+inline void light_lists::Shutdown() {
+	LightBuffer.Shutdown();
+}
+
+inline void light_lists::Build(const std::vector<light>& Lights) {
+	Candidates.clear();
+	LightData.clear();
+	AmbientLight = vec3{ 0.f };
+
+	auto MaxComponent = [](vec3 V) { return glm::max(V.x, glm::max(V.y, V.z)); };
+
+	for (const auto& Light : Lights) {
+		if (!Light.Enabled) { continue; }
+		AmbientLight += Light.Ambient * Light.Color;
+
+		culled_light Candidate;
+		Candidate.Volume = MakeLightVolume(Light);
+		if (Candidate.Volume.Radius <= 0.f) { continue; }
+
+		Candidate.Peak = glm::max(MaxComponent(Light.Color), MaxComponent(Light.SpecularColor));
+		Candidate.LinearFalloff = Light.LinearFalloff;
+		Candidate.QuadraticFalloff = Light.QuadraticFalloff;
+		Candidate.Features = LightShaderFeatures(Light);
+		Candidates.push_back(Candidate);
+
+		PackLight(LightData, Light, Candidate.Volume.Radius);
+	}
+
+	if (!LightData.empty()) { LightBuffer.Upload(LightData.data(), LightData.size() * SizeOf(vec4)); }
+}
+
+inline object_lights light_lists::Cull(const bounding_sphere& Sphere) const {
+	object_lights Result;
+	Result.Count = 0;
+	Result.Features = 0;
+
+	// Kept sorted by decreasing brightness so overflowing lists drop the dimmest
+	std::array<float, MaxObjectLights> Scores;
+
+	for (uint i = 0; i < Candidates.size(); ++i) {
+		const auto& Candidate = Candidates[i];
+		if (!LightVolumeIntersects(Candidate.Volume, Sphere)) { continue; }
+
+		auto Score = std::numeric_limits<float>::infinity();
+		if (!std::isinf(Candidate.Volume.Radius)) {
+			const auto Distance = glm::max(glm::distance(Sphere.Center, Candidate.Volume.Position) - Sphere.Radius, 0.f);
+			Score = Candidate.Peak / (1.f + Candidate.LinearFalloff * Distance + Candidate.QuadraticFalloff * Distance * Distance);
+		}
+
+		if (Result.Count == (GLint) MaxObjectLights && Score <= Scores[MaxObjectLights - 1]) { continue; }
+
+		auto Slot = glm::min(Result.Count, (GLint) MaxObjectLights - 1);
+		for (; Slot > 0 && Scores[Slot - 1] < Score; --Slot) {
+			Scores[Slot] = Scores[Slot - 1];
+			Result.Indices[Slot] = Result.Indices[Slot - 1];
+		}
+		Scores[Slot] = Score;
+		Result.Indices[Slot] = (GLint) i;
+		Result.Count = glm::min(Result.Count + 1, (GLint) MaxObjectLights);
+	}
+
+	for (GLint i = 0; i < Result.Count; ++i) { Result.Features |= Candidates[Result.Indices[i]].Features; }
+
+	return Result;
+}
+
+inline void light_lists::Bind(uint Program, uint Unit) const {
+	gl::ActiveTexture(gl::TEXTURE0 + Unit);
+	gl::BindTexture(gl::TEXTURE_BUFFER, LightBuffer.Texture);
+	gl::ActiveTexture(gl::TEXTURE0);
+	gl::Uniform1i(gl::GetUniformLocation(Program, "LightData"), Unit);
+
+	gl::Uniform3f(gl::GetUniformLocation(Program, "AmbientLight"), AmbientLight.r, AmbientLight.g, AmbientLight.b);
+}
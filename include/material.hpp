@@ -0,0 +1,44 @@
+#pragma once
+
+#include <common.hpp>
+
+// A layer of one of the texture arrays, see texture_array.hpp. Array is 0 for none
+struct texture_layer {
+	uint Array;
+	uint Layer;
+};
+
+namespace sampler_wrap {
+	enum type : u8 {
+		ClampToEdge = 0,
+		Repeat,
+		MirroredRepeat,
+		TOTAL
+	};
+}
+
+namespace sampler_filter {
+	enum type : u8 {
+		Default = 0, // The frame's filtering preset, see samplers
+		Nearest,     // Point sampling, whatever the preset
+		Linear,      // At most bilinear, for textures meant to be sampled without mips
+		TOTAL
+	};
+}
+
+// How a material's texture is sampled, resolved to one of the shared sampler objects (see sampler.hpp)
+struct material_sampler {
+	sampler_wrap::type WrapS;
+	sampler_wrap::type WrapT;
+	sampler_filter::type Filter;
+};
+
+// Surface parameters of a draw, mirrors the material struct in shader/material.glsl
+struct material {
+	vec4 Color;
+	float SpecularPower;
+	uint Texture;
+	bool32 Transparent; // Drawn after the opaque geometry with blending, see render_queue
+	texture_layer Layer = {}; // Sampled instead of Texture when set, so draws share the array binding
+	material_sampler Sampler = {}; // Not in the shader, picks the sampler object the texture is bound with
+};
@@ -3,71 +3,347 @@
 #include <common.hpp>
 #include <vertex.hpp>
 #include <gl_33.hpp>
+#include <gpu_memory.hpp>
+#include <mesh_processing.hpp>
+#include <cstring>
+#include <initializer_list>
+#include <limits>
 #include <vector>
 #include <transform.hpp>
 
+// Sphere around the center of the bounding box, not minimal but cheap and good enough for culling
+inline bounding_sphere ComputeBoundingSphere(const std::vector<mesh_vertex>& Vertices) {
+	if (Vertices.empty()) { return bounding_sphere{ vec3{ 0.f }, 0.f }; }
+
+	auto Min = Vertices[0].Position;
+	auto Max = Vertices[0].Position;
+	for (const auto& Vertex : Vertices) {
+		Min = glm::min(Min, Vertex.Position);
+		Max = glm::max(Max, Vertex.Position);
+	}
+
+	bounding_sphere Result{ .5f * (Min + Max), 0.f };
+	for (const auto& Vertex : Vertices) {
+		Result.Radius = glm::max(Result.Radius, glm::distance(Result.Center, Vertex.Position));
+	}
+	return Result;
+}
+
+// A level of detail, a range of the mesh's vertices (or indices when indexed)
+struct mesh_lod {
+	uint First;
+	uint Count;
+	float MaxScreenSize; // Largest projected diameter in pixels the level looks right at
+};
+
+// Fraction below a level's MaxScreenSize an object must shrink to before switching to it, so
+// objects around a threshold do not pop back and forth
+constexpr float LodHysteresis = .15f;
+
+// Vertices of every level of detail of a mesh, finest first
+struct lod_vertices {
+	std::vector<mesh_vertex> Vertices;
+	std::vector<mesh_lod> Lods;
+};
+
+// Levels of a surface of revolution, generated by Generate(NumSteps). Each level is used while
+// its steps stay around PixelsPerStep apart on screen
+template <typename generator>
+inline lod_vertices GenerateRevolvedLods(std::initializer_list<int> StepCounts, generator Generate, float PixelsPerStep = 12.f) {
+	lod_vertices Result;
+	for (auto NumSteps : StepCounts) {
+		const auto Level = Generate(NumSteps);
+		const auto MaxScreenSize = Result.Lods.empty() ? std::numeric_limits<float>::infinity() : NumSteps * PixelsPerStep / Pi;
+		Result.Lods.push_back(mesh_lod{ (uint) Result.Vertices.size(), (uint) Level.size(), MaxScreenSize });
+		Result.Vertices.insert(Result.Vertices.end(), Level.begin(), Level.end());
+	}
+	return Result;
+}
+
+// Welds a triangle soup into an indexed mesh, then reorders the triangles of each level of detail
+// for the post-transform cache and the vertices for fetching. Soup vertex i becomes index i, so
+// the level ranges carry over to the indices as they are
+inline void IndexTriangles(lod_vertices& Levels, std::vector<uint>& Indices, const char* DebugName) {
+	std::vector<mesh_vertex> Vertices;
+	WeldVertices(Levels.Vertices, Vertices, Indices);
+	const auto BeforeACMR = ComputeACMR(Indices.data(), Indices.size());
+
+	if (Levels.Lods.empty()) {
+		OptimizeVertexCache(Indices.data(), Indices.size(), Vertices.size());
+	} else {
+		for (const auto& Level : Levels.Lods) { OptimizeVertexCache(Indices.data() + Level.First, Level.Count, Vertices.size()); }
+	}
+	const auto AfterACMR = ComputeACMR(Indices.data(), Indices.size());
+
+	OptimizeVertexFetch(Vertices, Indices);
+
+	printf("[Mesh] %s: %u soup vertices welded to %u, ACMR %.2f indexed, %.2f optimized\n",
+		DebugName, (uint) Levels.Vertices.size(), (uint) Vertices.size(), BeforeACMR, AfterACMR);
+	Levels.Vertices.swap(Vertices);
+}
+
+inline size_t IndexTypeSize(GLenum IndexType) {
+	switch (IndexType) {
+	case gl::UNSIGNED_BYTE: return SizeOf(u8);
+	case gl::UNSIGNED_SHORT: return SizeOf(u16);
+	default: return SizeOf(u32);
+	}
+}
+
+// Everything about a mesh but its data, as laid out for the GPU
+struct mesh_layout {
+	vertex_format::type Format;
+	GLenum GeometryMode;
+	GLenum IndexType; // UNSIGNED_SHORT when every vertex can be addressed with 16 bits
+	uint NumVerts;
+	uint NumIndices;
+	bounding_sphere Bounds;
+	mat4 PositionTransform;
+	std::vector<mesh_lod> Lods;
+};
+
+// The buffers' contents, wherever they live
+struct mesh_streams {
+	const void* Positions;
+	size_t PositionBytes;
+	const void* Attributes; // Normals and texture coordinates
+	size_t AttributeBytes;
+	const void* Indices;
+	size_t IndexBytes;
+};
+
+// A mesh ready to upload or save, see BuildMeshData
+struct mesh_data {
+	mesh_layout Layout;
+	std::vector<u8> Positions, Attributes, Indices;
+
+	mesh_streams Streams() const {
+		return mesh_streams{ Positions.data(), Positions.size(), Attributes.data(), Attributes.size(), Indices.data(), Indices.size() };
+	}
+};
+
+template <typename t>
+inline void AppendBytes(std::vector<u8>& Bytes, const std::vector<t>& Values) {
+	const auto First = Bytes.size();
+	Bytes.resize(First + Values.size() * SizeOf(t));
+	if (!Values.empty()) { memcpy(Bytes.data() + First, Values.data(), Values.size() * SizeOf(t)); }
+}
+
+/** Converts vertices to the buffers' layout. Triangle soups (no Indices) are indexed and
+    optimized, see IndexTriangles */
+inline mesh_data BuildMeshData(lod_vertices Levels, GLenum GeometryMode, std::vector<uint>* Indices, const char* DebugName, vertex_format::type Format) {
+	std::vector<uint> GeneratedIndices;
+	if ((Indices == nullptr || Indices->empty()) && GeometryMode == gl::TRIANGLES && !Levels.Vertices.empty()) {
+		IndexTriangles(Levels, GeneratedIndices, DebugName);
+		Indices = &GeneratedIndices;
+	}
+	const auto& Vertices = Levels.Vertices;
+
+	mesh_data Result;
+	auto& Layout = Result.Layout;
+	Layout.Format = Format;
+	Layout.GeometryMode = GeometryMode;
+	Layout.NumVerts = (uint) Vertices.size();
+	Layout.Bounds = ComputeBoundingSphere(Vertices);
+	Layout.PositionTransform = mat4{};
+	Layout.Lods = std::move(Levels.Lods);
+
+	// Positions apart from the rest so position-only passes fetch nothing else
+	if (Format == vertex_format::Packed && !Vertices.empty()) {
+		auto Min = Vertices[0].Position;
+		auto Max = Vertices[0].Position;
+		for (const auto& Vertex : Vertices) {
+			Min = glm::min(Min, Vertex.Position);
+			Max = glm::max(Max, Vertex.Position);
+		}
+		const auto Extent = Max - Min;
+		Layout.PositionTransform = glm::scale(glm::translate(mat4{}, Min), Extent);
+
+		std::vector<packed_position> Positions(Vertices.size());
+		std::vector<packed_attributes> Attributes(Vertices.size());
+		for (size_t i = 0; i < Vertices.size(); ++i) { PackVertex(Vertices[i], Min, Extent, Positions[i], Attributes[i]); }
+		AppendBytes(Result.Positions, Positions);
+		AppendBytes(Result.Attributes, Attributes);
+	} else {
+		Layout.Format = vertex_format::Float;
+
+		std::vector<vec3> Positions(Vertices.size());
+		std::vector<mesh_attributes> Attributes(Vertices.size());
+		for (size_t i = 0; i < Vertices.size(); ++i) {
+			Positions[i] = Vertices[i].Position;
+			Attributes[i] = mesh_attributes{ Vertices[i].Normal, Vertices[i].TexCoords };
+		}
+		AppendBytes(Result.Positions, Positions);
+		AppendBytes(Result.Attributes, Attributes);
+	}
+
+	// Halved when the vertices fit 16 bit indices
+	Layout.NumIndices = 0;
+	Layout.IndexType = gl::UNSIGNED_INT;
+	if (Indices != nullptr && !Indices->empty()) {
+		Layout.NumIndices = (uint) Indices->size();
+		if (Layout.NumVerts <= 0x10000) {
+			Layout.IndexType = gl::UNSIGNED_SHORT;
+			AppendBytes(Result.Indices, std::vector<u16>{ Indices->begin(), Indices->end() });
+		} else {
+			AppendBytes(Result.Indices, *Indices);
+		}
+	}
+
+	return Result;
+}
+
 struct mesh {
 	GLuint VAO, VBO, IBO;
+	GLuint AttributeVBO; // Normals and texture coordinates, VBO only has the positions
+	GLuint PositionVAO;  // Positions alone, for depth-only passes and the like
+	bool32 SharedBuffers; // The buffers belong to someone else (a glTF model's buffer views), Destroy leaves them
 	GLenum GeometryMode;
+	GLenum IndexType; // UNSIGNED_SHORT when every vertex can be addressed with 16 bits
 	uint NumVerts;
 	uint NumIndices;
+	bounding_sphere Bounds; // Model space
+	std::vector<mesh_lod> Lods; // Finest first, empty when there is a single level
+
+	// Packed positions are relative to the bounding box, this maps them back to model space. Only
+	// the positions need it, normals still use the model's normal matrix
+	vertex_format::type Format;
+	mat4 PositionTransform;
 
+	/** The bounds are unknown here, they default to everything so nothing culls the mesh */
 	mesh(GLuint VAO, GLuint VBO, GLuint IBO, GLenum GeometryMode, uint NumVerts, uint NumIndices)
 		: VAO{VAO},
 		  VBO{VBO},
 		  IBO{IBO},
+		  AttributeVBO{0},
+		  PositionVAO{VAO},
+		  SharedBuffers{false},
 		  GeometryMode{GeometryMode},
+		  IndexType{gl::UNSIGNED_INT},
 		  NumVerts{NumVerts},
-		  NumIndices{NumIndices} {}
+		  NumIndices{NumIndices},
+		  Bounds{vec3{0.f}, std::numeric_limits<float>::infinity()},
+		  Format{vertex_format::Float},
+		  PositionTransform{} {}
+
+	/** Triangle soups (no Indices) are indexed and optimized, see IndexTriangles */
+	mesh(std::vector<mesh_vertex> Vertices, GLenum GeometryMode, std::vector<uint>* Indices = nullptr, const char* DebugName = "Mesh", vertex_format::type Format = vertex_format::Float)
+		: mesh{ lod_vertices{ std::move(Vertices), {} }, GeometryMode, Indices, DebugName, Format } {}
+
+	mesh(lod_vertices Levels, GLenum GeometryMode, const char* DebugName = "Mesh", vertex_format::type Format = vertex_format::Float)
+		: mesh{ std::move(Levels), GeometryMode, nullptr, DebugName, Format } {}
+
+	mesh(lod_vertices Levels, GLenum GeometryMode, std::vector<uint>* Indices, const char* DebugName, vertex_format::type Format)
+		: mesh{ BuildMeshData(std::move(Levels), GeometryMode, Indices, DebugName, Format), DebugName } {}
+
+	mesh(const mesh_data& Data, const char* DebugName)
+		: mesh{ Data.Layout, Data.Streams(), DebugName } {}
+
+	/** Uploads the streams as they are, they can point anywhere (a mapped file for instance) */
+	mesh(const mesh_layout& Layout, const mesh_streams& Streams, const char* DebugName)
+			: SharedBuffers{ false },
+			  GeometryMode{ Layout.GeometryMode },
+			  IndexType{ Layout.IndexType },
+			  NumVerts{ Layout.NumVerts },
+			  NumIndices{ Layout.NumIndices },
+			  Bounds{ Layout.Bounds },
+			  Lods{ Layout.Lods },
+			  Format{ Layout.Format },
+			  PositionTransform{ Layout.PositionTransform } {
+		gl::GenBuffers(1, &VBO);
+		gl::BindBuffer(gl::ARRAY_BUFFER, VBO);
+		gl::BufferData(gl::ARRAY_BUFFER, Streams.PositionBytes, Streams.Positions, gl::STATIC_DRAW);
+		GPUMemory.Track(gpu_resource::Buffer, VBO, Streams.PositionBytes, std::string{DebugName} + " Positions");
+
+		gl::GenBuffers(1, &AttributeVBO);
+		gl::BindBuffer(gl::ARRAY_BUFFER, AttributeVBO);
+		gl::BufferData(gl::ARRAY_BUFFER, Streams.AttributeBytes, Streams.Attributes, gl::STATIC_DRAW);
+		GPUMemory.Track(gpu_resource::Buffer, AttributeVBO, Streams.AttributeBytes, std::string{DebugName} + " Attributes");
 
-	mesh(std::vector<mesh_vertex> Vertices, GLenum GeometryMode, std::vector<uint>* Indices = nullptr) : GeometryMode{ GeometryMode } {
+		// The element array binding is VAO state, the IBO is bound to both VAOs
 		gl::GenVertexArrays(1, &VAO);
 		gl::BindVertexArray(VAO);
-		defer{ gl::BindVertexArray(0); };
-
-		// Vertex Buffer
-		NumVerts = (uint) Vertices.size();
-		gl::GenBuffers(1, &VBO);
-		gl::BindBuffer(gl::ARRAY_BUFFER, VBO);
-		gl::BufferData(gl::ARRAY_BUFFER, Vertices.size() * sizeof(mesh_vertex), Vertices.data(), gl::STATIC_DRAW);
 
-		// Index Buffer
-		NumIndices = 0;
-		if (Indices != nullptr && Indices->size() > 0) {
-			NumIndices = (uint) Indices->size();
+		IBO = 0;
+		if (NumIndices > 0) {
 			gl::GenBuffers(1, &IBO);
 			gl::BindBuffer(gl::ELEMENT_ARRAY_BUFFER, IBO);
-			gl::BufferData(gl::ELEMENT_ARRAY_BUFFER, Indices->size() * sizeof(GLuint), Indices->data(), gl::STATIC_DRAW);
+			gl::BufferData(gl::ELEMENT_ARRAY_BUFFER, Streams.IndexBytes, Streams.Indices, gl::STATIC_DRAW);
+			GPUMemory.Track(gpu_resource::Buffer, IBO, Streams.IndexBytes, std::string{DebugName} + " IBO");
+		}
+
+		// Normalized and half float attributes reach the shaders as floats, they need no changes
+		auto BindPositions = [&] {
+			gl::BindBuffer(gl::ARRAY_BUFFER, VBO);
+			gl::EnableVertexAttribArray(mesh_vertex_layout::Position);
+			if (Format == vertex_format::Packed) {
+				gl::VertexAttribPointer(mesh_vertex_layout::Position, 3, gl::UNSIGNED_SHORT, true, SizeOf(packed_position), (void*)OffsetOf(packed_position, Position));
+			} else {
+				gl::VertexAttribPointer(mesh_vertex_layout::Position, 3, gl::FLOAT, false, SizeOf(vec3), nullptr);
+			}
+			if (IBO != 0) { gl::BindBuffer(gl::ELEMENT_ARRAY_BUFFER, IBO); }
+		};
+
+		BindPositions();
+
+		gl::BindBuffer(gl::ARRAY_BUFFER, AttributeVBO);
+		gl::EnableVertexAttribArray(mesh_vertex_layout::Normal);
+		gl::EnableVertexAttribArray(mesh_vertex_layout::TexCoords);
+		if (Format == vertex_format::Packed) {
+			gl::VertexAttribPointer(mesh_vertex_layout::Normal, 4, gl::INT_2_10_10_10_REV, true, SizeOf(packed_attributes), (void*)OffsetOf(packed_attributes, Normal));
+			gl::VertexAttribPointer(mesh_vertex_layout::TexCoords, 2, gl::HALF_FLOAT, false, SizeOf(packed_attributes), (void*)OffsetOf(packed_attributes, TexCoords));
 		} else {
-			IBO = 0;
+			gl::VertexAttribPointer(mesh_vertex_layout::Normal, 3, gl::FLOAT, false, SizeOf(mesh_attributes), (void*)OffsetOf(mesh_attributes, Normal));
+			gl::VertexAttribPointer(mesh_vertex_layout::TexCoords, 2, gl::FLOAT, false, SizeOf(mesh_attributes), (void*)OffsetOf(mesh_attributes, TexCoords));
 		}
 
-		gl::EnableVertexAttribArray(mesh_vertex_layout::Position);
-		gl::VertexAttribPointer(mesh_vertex_layout::Position, 3, gl::FLOAT, false, SizeOf(Vertices[0]), (void*)OffsetOf(mesh_vertex, Position));
+		gl::GenVertexArrays(1, &PositionVAO);
+		gl::BindVertexArray(PositionVAO);
+		BindPositions();
 
-		gl::EnableVertexAttribArray(mesh_vertex_layout::Normal);
-		gl::VertexAttribPointer(mesh_vertex_layout::Normal, 3, gl::FLOAT, false, SizeOf(Vertices[0]), (void*)OffsetOf(mesh_vertex, Normal));
+		gl::BindVertexArray(0);
+		gl::BindBuffer(gl::ARRAY_BUFFER, 0);
+	}
 
-		gl::EnableVertexAttribArray(mesh_vertex_layout::TexCoords);
-		gl::VertexAttribPointer(mesh_vertex_layout::TexCoords, 2, gl::FLOAT, false, SizeOf(Vertices[0]), (void*)OffsetOf(mesh_vertex, TexCoords));
+	/** Level for an object covering ScreenSize pixels that used CurrentLod last frame */
+	uint SelectLod(float ScreenSize, uint CurrentLod) const {
+		uint Lod = 0;
+		for (uint i = 1; i < Lods.size(); ++i) {
+			const auto Threshold = Lods[i].MaxScreenSize * (i > CurrentLod ? 1.f - LodHysteresis : 1.f);
+			if (ScreenSize <= Threshold) { Lod = i; }
+		}
+		return Lod;
 	}
 
-	/** This function expects the VAO to be bound already */
-	void Draw(GLenum OverrideMode = 0) {
+	/** This function expects the VAO (or PositionVAO) to be bound already */
+	void Draw(GLenum OverrideMode = 0, uint Lod = 0) const {
 		GLenum Mode = OverrideMode != 0 ? OverrideMode : GeometryMode;
+		uint First = 0;
+		uint Count = IBO != 0 ? NumIndices : NumVerts;
+		if (!Lods.empty()) {
+			const auto& Level = Lods[glm::min(Lod, (uint) Lods.size() - 1)];
+			First = Level.First;
+			Count = Level.Count;
+		}
+
 		if(IBO != 0) {
-			gl::DrawElements(Mode, NumVerts, gl::UNSIGNED_INT, nullptr);
+			gl::DrawElements(Mode, Count, IndexType, (void*) (First * IndexTypeSize(IndexType)));
 		} else {
-			gl::DrawArrays(Mode, 0, NumVerts);
+			gl::DrawArrays(Mode, First, Count);
 		}
 	}
 
 	void Destroy() {
+		if (PositionVAO > 0 && PositionVAO != VAO) { gl::DeleteVertexArrays(1, &PositionVAO); }
+		PositionVAO = 0;
 		if (VAO > 0) { gl::DeleteVertexArrays(1, &VAO); VAO = 0; }
-		if (VBO > 0) { gl::DeleteBuffers(1, &VBO); VBO = 0; }
-		if (IBO > 0) { gl::DeleteBuffers(1, &IBO); IBO = 0; }
+		if (SharedBuffers) { VBO = AttributeVBO = IBO = 0; }
+		if (AttributeVBO > 0) { GPUMemory.Release(gpu_resource::Buffer, AttributeVBO); gl::DeleteBuffers(1, &AttributeVBO); AttributeVBO = 0; }
+		if (VBO > 0) { GPUMemory.Release(gpu_resource::Buffer, VBO); gl::DeleteBuffers(1, &VBO); VBO = 0; }
+		if (IBO > 0) { GPUMemory.Release(gpu_resource::Buffer, IBO); gl::DeleteBuffers(1, &IBO); IBO = 0; }
 		NumVerts = 0; 
 		NumIndices = 0;
+		Lods.clear();
 		GeometryMode = 0;
 	}
 };
@@ -256,4 +532,34 @@ inline std::vector<mesh_vertex> GenerateCubeTriangles(transform PositionTransfor
 	}
 
 	return Result;
-}
\ No newline at end of file
+}
+
+inline std::vector<mesh_vertex> GenerateSphereTriangles(float Radius, int NumRings, int NumSegments) {
+	const uint VertsPerQuad = 6;
+	std::vector<mesh_vertex> Result{ (size_t) NumRings * NumSegments * VertsPerQuad };
+
+	auto SphereVert = [&](mesh_vertex& Vert, int iRing, int iSegment) {
+		const float Phi = Pi * iRing / NumRings;
+		const float Theta = 2.f * Pi * iSegment / NumSegments;
+		Vert.Normal = vec3{ sin(Phi) * cos(Theta), cos(Phi), sin(Phi) * sin(Theta) };
+		Vert.Position = Radius * Vert.Normal;
+		Vert.TexCoords = vec2{ (float) iSegment / NumSegments, (float) iRing / NumRings };
+	};
+
+	for (auto iRing = 0; iRing < NumRings; ++iRing) {
+		for (auto iSegment = 0; iSegment < NumSegments; ++iSegment) {
+			const auto iVert = (iRing * NumSegments + iSegment) * VertsPerQuad;
+			auto i = 0;
+
+			SphereVert(Result[iVert + (i++)], iRing, iSegment);
+			SphereVert(Result[iVert + (i++)], iRing, iSegment + 1);
+			SphereVert(Result[iVert + (i++)], iRing + 1, iSegment);
+
+			SphereVert(Result[iVert + (i++)], iRing, iSegment + 1);
+			SphereVert(Result[iVert + (i++)], iRing + 1, iSegment + 1);
+			SphereVert(Result[iVert + (i++)], iRing + 1, iSegment);
+		}
+	}
+
+	return Result;
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <common.hpp>
+#include <file.hpp>
+#include <mesh.hpp>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Binary meshes, the buffers exactly as the GPU takes them so loading is mapping the file and
+// handing pointers into it to BufferData. Layout, little endian:
+//   mesh_file_header
+//   mesh_lod[NumLods]
+//   positions, attributes, indices: each at a multiple of MeshFileAlignment
+// Files are written by the MeshConverter tool, see tools/mesh_converter.cpp
+
+constexpr u32 MeshFileMagic = 'M' | 'E' << 8 | 'S' << 16 | 'H' << 24;
+constexpr u32 MeshFileVersion = 1; // Bump on any change to the layout, older files are rejected
+constexpr size_t MeshFileAlignment = 64;
+
+struct mesh_file_blob {
+	u64 Offset; // From the start of the file
+	u64 Bytes;
+};
+
+struct mesh_file_header {
+	u32 Magic;
+	u32 Version;
+	u32 Format;       // vertex_format::type
+	u32 GeometryMode; // GL primitive
+	u32 IndexType;    // GL type, meaningless without indices
+	u32 NumVerts;
+	u32 NumIndices;
+	u32 NumLods;
+	float Bounds[4];  // Center and radius
+	float PositionTransform[16];
+	mesh_file_blob Lods, Positions, Attributes, Indices;
+};
+StaticAssert(sizeof(mesh_file_header) == 112 + 4 * sizeof(mesh_file_blob));
+StaticAssert(sizeof(mesh_lod) == 12);
+
+inline bool32 SaveMeshFile(const std::string& FileName, const mesh_data& Data) {
+	const auto& Layout = Data.Layout;
+
+	std::vector<u8> Bytes(SizeOf(mesh_file_header));
+	auto Append = [&](const void* Blob, size_t BlobBytes, size_t Alignment) {
+		Bytes.resize((Bytes.size() + Alignment - 1) / Alignment * Alignment, 0);
+		const mesh_file_blob Result{ Bytes.size(), BlobBytes };
+		Bytes.insert(Bytes.end(), (const u8*) Blob, (const u8*) Blob + BlobBytes);
+		return Result;
+	};
+
+	mesh_file_header Header = {};
+	Header.Magic = MeshFileMagic;
+	Header.Version = MeshFileVersion;
+	Header.Format = Layout.Format;
+	Header.GeometryMode = Layout.GeometryMode;
+	Header.IndexType = Layout.IndexType;
+	Header.NumVerts = Layout.NumVerts;
+	Header.NumIndices = Layout.NumIndices;
+	Header.NumLods = (u32) Layout.Lods.size();
+	memcpy(Header.Bounds, &Layout.Bounds.Center, SizeOf(vec3));
+	Header.Bounds[3] = Layout.Bounds.Radius;
+	memcpy(Header.PositionTransform, glm::value_ptr(Layout.PositionTransform), SizeOf(Header.PositionTransform));
+	Header.Lods = Append(Layout.Lods.data(), Layout.Lods.size() * SizeOf(mesh_lod), AlignOf(mesh_lod));
+	Header.Positions = Append(Data.Positions.data(), Data.Positions.size(), MeshFileAlignment);
+	Header.Attributes = Append(Data.Attributes.data(), Data.Attributes.size(), MeshFileAlignment);
+	Header.Indices = Append(Data.Indices.data(), Data.Indices.size(), MeshFileAlignment);
+	memcpy(Bytes.data(), &Header, SizeOf(Header));
+
+	if (!WriteBinaryFile(FileName, Bytes.data(), Bytes.size())) {
+		LogError("[Mesh] Could not write %s\n", FileName.c_str());
+		return false;
+	}
+	return true;
+}
+
+/** Maps the file and uploads straight from the mapping, Result is left untouched on failure */
+inline bool32 LoadMeshFile(const std::string& FileName, mesh& Result) {
+	mapped_file File;
+	if (!File.Open(FileName)) {
+		LogError("[Mesh] Could not open %s\n", FileName.c_str());
+		return false;
+	}
+
+	auto Fail = [&](const char* Reason) {
+		LogError("[Mesh] %s: %s\n", FileName.c_str(), Reason);
+		return false;
+	};
+
+	if (File.Bytes < SizeOf(mesh_file_header)) { return Fail("Truncated header"); }
+	mesh_file_header Header;
+	memcpy(&Header, File.Data, SizeOf(Header));
+	if (Header.Magic != MeshFileMagic) { return Fail("Not a mesh file"); }
+	if (Header.Version != MeshFileVersion) { return Fail("Unsupported version, convert it again"); }
+	if (Header.Format >= vertex_format::TOTAL) { return Fail("Unknown vertex format"); }
+	if (Header.NumIndices > 0 && Header.IndexType != gl::UNSIGNED_SHORT && Header.IndexType != gl::UNSIGNED_INT) { return Fail("Unknown index type"); }
+	switch (Header.GeometryMode) {
+	case gl::POINTS: case gl::LINES: case gl::LINE_LOOP: case gl::LINE_STRIP:
+	case gl::TRIANGLES: case gl::TRIANGLE_STRIP: case gl::TRIANGLE_FAN:
+		break;
+	default: return Fail("Unknown geometry mode");
+	}
+
+	auto InFile = [&](const mesh_file_blob& Blob) { return Blob.Offset <= File.Bytes && Blob.Bytes <= File.Bytes - Blob.Offset; };
+	if (!InFile(Header.Lods) || !InFile(Header.Positions) || !InFile(Header.Attributes) || !InFile(Header.Indices)) {
+		return Fail("Truncated data");
+	}
+
+	const auto Packed = Header.Format == vertex_format::Packed;
+	if (Header.Lods.Bytes != Header.NumLods * SizeOf(mesh_lod)
+		|| Header.Positions.Bytes != Header.NumVerts * (Packed ? SizeOf(packed_position) : SizeOf(vec3))
+		|| Header.Attributes.Bytes != Header.NumVerts * (Packed ? SizeOf(packed_attributes) : SizeOf(mesh_attributes))
+		|| Header.Indices.Bytes != Header.NumIndices * IndexTypeSize(Header.IndexType)) {
+		return Fail("Sizes do not match the header");
+	}
+
+	mesh_layout Layout;
+	Layout.Format = (vertex_format::type) Header.Format;
+	Layout.GeometryMode = Header.GeometryMode;
+	Layout.IndexType = Header.IndexType;
+	Layout.NumVerts = Header.NumVerts;
+	Layout.NumIndices = Header.NumIndices;
+	Layout.Bounds = bounding_sphere{ vec3{ Header.Bounds[0], Header.Bounds[1], Header.Bounds[2] }, Header.Bounds[3] };
+	Layout.PositionTransform = glm::make_mat4(Header.PositionTransform);
+	Layout.Lods.resize(Header.NumLods);
+	if (Header.NumLods > 0) { memcpy(Layout.Lods.data(), File.Data + Header.Lods.Offset, Header.Lods.Bytes); }
+
+	// Draws take the levels' ranges as they are
+	const u64 NumElements = Header.NumIndices > 0 ? Header.NumIndices : Header.NumVerts;
+	for (const auto& Lod : Layout.Lods) {
+		if ((u64) Lod.First + Lod.Count > NumElements) { return Fail("Level of detail out of range"); }
+	}
+
+	mesh_streams Streams;
+	Streams.Positions = File.Data + Header.Positions.Offset;
+	Streams.PositionBytes = Header.Positions.Bytes;
+	Streams.Attributes = File.Data + Header.Attributes.Offset;
+	Streams.AttributeBytes = Header.Attributes.Bytes;
+	Streams.Indices = File.Data + Header.Indices.Offset;
+	Streams.IndexBytes = Header.Indices.Bytes;
+
+	Result = mesh{ Layout, Streams, FileName.c_str() };
+	return true;
+}
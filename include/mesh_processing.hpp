@@ -0,0 +1,193 @@
+#pragma once
+
+#include <common.hpp>
+#include <file.hpp>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+// Offline style processing of triangle lists: welding soups into indexed meshes, reordering
+// triangles for the post-transform vertex cache and vertices for fetch locality. Vertices are
+// compared bit for bit, so any vertex type without padding works
+
+// Average cache miss ratio: vertices transformed per triangle with a FIFO post-transform cache
+// of CacheSize entries. 3 for a soup, around 0.5-0.7 for a well ordered regular mesh
+inline float ComputeACMR(const u32* Indices, size NumIndices, uint CacheSize = 16) {
+	const auto NumTriangles = NumIndices / 3;
+	if (NumTriangles == 0) { return 0.f; }
+
+	std::vector<u32> Cache;
+	Cache.reserve(CacheSize);
+	uint Oldest = 0;
+	uint Misses = 0;
+	for (size i = 0; i < NumIndices; ++i) {
+		if (std::find(Cache.begin(), Cache.end(), Indices[i]) != Cache.end()) { continue; }
+
+		Misses++;
+		if (Cache.size() < CacheSize) {
+			Cache.push_back(Indices[i]);
+		} else {
+			Cache[Oldest] = Indices[i];
+			Oldest = (Oldest + 1) % CacheSize;
+		}
+	}
+	return (float) Misses / (float) NumTriangles;
+}
+
+// Merges identical vertices, Indices[i] is the welded vertex of Soup[i]
+template <typename vertex>
+inline void WeldVertices(const std::vector<vertex>& Soup, std::vector<vertex>& Vertices, std::vector<u32>& Indices) {
+	struct vertex_hash {
+		size_t operator()(const vertex& Vertex) const { return (size_t) HashBytes(&Vertex, SizeOf(vertex)); }
+	};
+	struct vertex_equal {
+		bool operator()(const vertex& A, const vertex& B) const { return memcmp(&A, &B, SizeOf(vertex)) == 0; }
+	};
+
+	std::unordered_map<vertex, u32, vertex_hash, vertex_equal> Unique;
+	Unique.reserve(Soup.size());
+
+	Vertices.clear();
+	Indices.resize(Soup.size());
+	for (size i = 0; i < Soup.size(); ++i) {
+		auto Inserted = Unique.insert({ Soup[i], (u32) Vertices.size() });
+		if (Inserted.second) { Vertices.push_back(Soup[i]); }
+		Indices[i] = Inserted.first->second;
+	}
+}
+
+// Reorders the triangles of a range of indices for the post-transform cache, following Tom
+// Forsyth's "Linear-Speed Vertex Cache Optimisation": vertices score higher the more recently
+// they were used and the fewer triangles they have left, the best triangle among those touching
+// the cache is emitted next. Index values are left untouched
+inline void OptimizeVertexCache(u32* Indices, size NumIndices, size NumVertices) {
+	constexpr uint CacheSize = 32;
+	constexpr float DecayPower = 1.5f;
+	constexpr float LastTriangleScore = .75f;
+	constexpr float ValenceBoostScale = 2.f;
+	constexpr float ValenceBoostPower = .5f;
+	constexpr u32 None = ~0u;
+
+	const auto NumTriangles = (u32) (NumIndices / 3);
+	if (NumTriangles == 0) { return; }
+
+	// Triangles of each vertex, the first Remaining[v] of them are not emitted yet
+	std::vector<u32> Remaining(NumVertices, 0);
+	for (size i = 0; i < NumIndices; ++i) { Remaining[Indices[i]]++; }
+
+	std::vector<u32> FirstTriangle(NumVertices + 1, 0);
+	for (size v = 0; v < NumVertices; ++v) { FirstTriangle[v + 1] = FirstTriangle[v] + Remaining[v]; }
+
+	std::vector<u32> Adjacency(NumIndices);
+	{
+		std::vector<u32> Filled(NumVertices, 0);
+		for (u32 Triangle = 0; Triangle < NumTriangles; ++Triangle) {
+			for (uint k = 0; k < 3; ++k) {
+				const auto Vertex = Indices[3 * Triangle + k];
+				Adjacency[FirstTriangle[Vertex] + Filled[Vertex]++] = Triangle;
+			}
+		}
+	}
+
+	std::vector<int> CachePosition(NumVertices, -1);
+	auto VertexScore = [&](u32 Vertex) {
+		if (Remaining[Vertex] == 0) { return -1.f; }
+
+		auto Score = 0.f;
+		const auto Position = CachePosition[Vertex];
+		if (Position >= 0) {
+			if (Position < 3) {
+				Score = LastTriangleScore; // Fixed, whichever order the last triangle's vertices were used in
+			} else {
+				Score = std::pow(1.f - (float) (Position - 3) / (CacheSize - 3), DecayPower);
+			}
+		}
+		return Score + ValenceBoostScale * std::pow((float) Remaining[Vertex], -ValenceBoostPower);
+	};
+
+	std::vector<float> VertexScores(NumVertices);
+	for (size v = 0; v < NumVertices; ++v) { VertexScores[v] = VertexScore((u32) v); }
+
+	std::vector<float> TriangleScores(NumTriangles);
+	std::vector<u8> Emitted(NumTriangles, false);
+	u32 Best = None;
+	for (u32 Triangle = 0; Triangle < NumTriangles; ++Triangle) {
+		const auto* T = Indices + 3 * Triangle;
+		TriangleScores[Triangle] = VertexScores[T[0]] + VertexScores[T[1]] + VertexScores[T[2]];
+		if (Best == None || TriangleScores[Triangle] > TriangleScores[Best]) { Best = Triangle; }
+	}
+
+	std::vector<u32> Output(NumIndices);
+	std::vector<u32> Cache, NewCache;
+	Cache.reserve(CacheSize + 3);
+	NewCache.reserve(CacheSize + 3);
+	u32 Cursor = 0; // Dead ends restart from the first triangle not emitted yet
+
+	for (u32 Out = 0; Out < NumTriangles; ++Out) {
+		if (Best == None) {
+			while (Emitted[Cursor]) { Cursor++; }
+			Best = Cursor;
+		}
+
+		const u32 Triangle[3] = { Indices[3 * Best], Indices[3 * Best + 1], Indices[3 * Best + 2] };
+		Output[3 * Out + 0] = Triangle[0];
+		Output[3 * Out + 1] = Triangle[1];
+		Output[3 * Out + 2] = Triangle[2];
+		Emitted[Best] = true;
+
+		// Move the triangle past the remaining ones of its vertices
+		for (auto Vertex : Triangle) {
+			auto* Begin = Adjacency.data() + FirstTriangle[Vertex];
+			auto* Last = Begin + Remaining[Vertex] - 1;
+			auto* At = std::find(Begin, Last + 1, Best);
+			std::swap(*At, *Last);
+			Remaining[Vertex]--;
+		}
+
+		// The triangle's vertices move to the front of the cache, the oldest entries fall out
+		NewCache.assign(Triangle, Triangle + 3);
+		for (auto Vertex : Cache) {
+			if (Vertex != Triangle[0] && Vertex != Triangle[1] && Vertex != Triangle[2]) { NewCache.push_back(Vertex); }
+		}
+		for (uint i = 0; i < NewCache.size(); ++i) { CachePosition[NewCache[i]] = i < CacheSize ? (int) i : -1; }
+		for (auto Vertex : NewCache) { VertexScores[Vertex] = VertexScore(Vertex); }
+
+		// Only triangles touching the cache changed score, the best of them is next
+		Best = None;
+		for (auto Vertex : NewCache) {
+			for (u32 i = 0; i < Remaining[Vertex]; ++i) {
+				const auto Candidate = Adjacency[FirstTriangle[Vertex] + i];
+				const auto* T = Indices + 3 * Candidate;
+				TriangleScores[Candidate] = VertexScores[T[0]] + VertexScores[T[1]] + VertexScores[T[2]];
+				if (Best == None || TriangleScores[Candidate] > TriangleScores[Best]) { Best = Candidate; }
+			}
+		}
+
+		if (NewCache.size() > CacheSize) { NewCache.resize(CacheSize); }
+		std::swap(Cache, NewCache);
+	}
+
+	std::copy(Output.begin(), Output.end(), Indices);
+}
+
+// Renumbers the vertices in the order the indices first use them so fetching them walks the
+// vertex buffer forward, unreferenced vertices are dropped
+template <typename vertex>
+inline void OptimizeVertexFetch(std::vector<vertex>& Vertices, std::vector<u32>& Indices) {
+	constexpr u32 Unused = ~0u;
+	std::vector<u32> Remap(Vertices.size(), Unused);
+
+	std::vector<vertex> Reordered;
+	Reordered.reserve(Vertices.size());
+	for (auto& Index : Indices) {
+		if (Remap[Index] == Unused) {
+			Remap[Index] = (u32) Reordered.size();
+			Reordered.push_back(Vertices[Index]);
+		}
+		Index = Remap[Index];
+	}
+	Vertices.swap(Reordered);
+}
@@ -0,0 +1,252 @@
+#pragma once
+
+#include <common.hpp>
+#include <gl_33.hpp>
+#include <gpu_memory.hpp>
+#include <jobs.hpp>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MIPMAP_SSE2 true
+#include <emmintrin.h>
+#else
+#define MIPMAP_SSE2 false
+#endif
+
+// Mip chains built on the CPU, so every driver samples the same levels instead of whatever its
+// GenerateMipmap does. Color is filtered in linear light: sRGB values are converted to linear floats,
+// each level is filtered from the previous one in float (never from a rounded 8-bit level) and
+// converted back. Alpha is always linear. Levels are filtered separably, rows then columns, in bands
+// of rows split over the job system. Each band filters the rows it needs into a scratch of its own,
+// and the first level reads the 8-bit image directly, so only the float copy of level 1 (a quarter of
+// the image) is ever held whole
+
+namespace mip_filter {
+	enum type : uint {
+		Box = 0, // 2x2 average, what GenerateMipmap usually does
+		Kaiser,  // Kaiser windowed sinc over 8 texels, sharper and without the box's aliasing
+		TOTAL
+	};
+}
+static const char* MipFilterNames[] = { "box", "kaiser" };
+StaticAssert(ArraySize(MipFilterNames) == mip_filter::TOTAL);
+
+struct mip_level {
+	size_t Offset; // Into mip_chain::Data
+	size_t Bytes;
+	int Width, Height;
+};
+
+// Every level of an image as the GPU takes it, block compressed (see texture_compression.hpp) or 8-bit
+struct mip_chain {
+	GLenum InternalFormat;
+	std::vector<mip_level> Levels; // Largest first
+	std::vector<u8> Data;
+};
+
+/** Storage for NumLevels levels of a TEXTURE_2D, or of every face of a TEXTURE_CUBE_MAP. Immutable
+    with ARB_texture_storage, otherwise Format describes the (absent) pixels as in TexImage2D.
+    No buffer may be bound to PIXEL_UNPACK_BUFFER, it would be read from */
+inline void AllocateTextureStorage(GLenum Target, uint NumLevels, GLint InternalFormat, GLenum Format, int Width, int Height) {
+	if (gl::exts::var_ARB_texture_storage) {
+		gl::TexStorage2D(Target, NumLevels, InternalFormat, Width, Height);
+		return;
+	}
+
+	const auto NumFaces = Target == gl::TEXTURE_CUBE_MAP ? 6u : 1u;
+	for (uint Level = 0; Level < NumLevels; ++Level) {
+		for (uint Face = 0; Face < NumFaces; ++Face) {
+			const auto FaceTarget = NumFaces > 1 ? (GLenum) (gl::TEXTURE_CUBE_MAP_POSITIVE_X + Face) : Target;
+			gl::TexImage2D(FaceTarget, Level, InternalFormat, glm::max(Width >> Level, 1), glm::max(Height >> Level, 1), 0, Format, gl::UNSIGNED_BYTE, nullptr);
+		}
+	}
+	gl::TexParameteri(Target, gl::TEXTURE_MAX_LEVEL, (GLint) NumLevels - 1);
+}
+
+/** Bytes of one level of a mip_chain in InternalFormat */
+inline size_t MipLevelBytes(GLenum InternalFormat, int Width, int Height) {
+	if (const auto Block = BlockBytes(InternalFormat)) { return (size_t) ((Width + 3) / 4) * ((Height + 3) / 4) * Block; }
+	const auto Channels = InternalFormat == gl::RGB8 || InternalFormat == gl::SRGB8 ? 3u : 4u;
+	return (size_t) Width * Height * Channels;
+}
+
+// 8-bit values to linear floats and back, the reverse through a 16-bit quantization of [0, 1]
+struct mip_tables {
+	static constexpr int Steps = 65535;
+
+	float ToLinear[256];
+	u8 FromLinear[Steps + 1];
+
+	explicit mip_tables(bool32 SRGB) {
+		auto Decode = [&](float V) { return !SRGB ? V : V <= .04045f ? V / 12.92f : std::pow((V + .055f) / 1.055f, 2.4f); };
+		auto Encode = [&](float V) { return !SRGB ? V : V <= .0031308f ? V * 12.92f : 1.055f * std::pow(V, 1.f / 2.4f) - .055f; };
+		for (int i = 0; i < 256; ++i) { ToLinear[i] = Decode(i / 255.f); }
+		for (int i = 0; i <= Steps; ++i) { FromLinear[i] = (u8) (Encode((float) i / Steps) * 255.f + .5f); }
+	}
+};
+
+inline const mip_tables& MipTables(bool32 SRGB) {
+	static const mip_tables Linear{ false };
+	static const mip_tables Gamma{ true };
+	return SRGB ? Gamma : Linear;
+}
+
+// Weights of the source texels 2x + First ... 2x + First + NumTaps - 1 for destination texel x
+struct mip_kernel {
+	int First;
+	int NumTaps;
+	float Weights[8];
+};
+
+inline mip_kernel MipKernel(mip_filter::type Filter) {
+	if (Filter == mip_filter::Box) { return mip_kernel{ 0, 2, { .5f, .5f } }; }
+
+	// Sinc with the cutoff at the destination's Nyquist frequency, windowed over 4 source texels
+	// on each side of the destination texel's center (at 2x + 0.5)
+	const float Alpha = 4.f, Radius = 4.f;
+	auto BesselI0 = [](float X) {
+		float Sum = 1.f, Term = 1.f;
+		for (int k = 1; k < 16; ++k) {
+			Term *= (X / (2.f * k)) * (X / (2.f * k));
+			Sum += Term;
+		}
+		return Sum;
+	};
+
+	mip_kernel Kernel{ -3, 8, {} };
+	float Total = 0.f;
+	for (int i = 0; i < Kernel.NumTaps; ++i) {
+		const auto Distance = (Kernel.First + i) - .5f;
+		const auto X = .5f * Distance * Pi;
+		const auto Sinc = std::sin(X) / X;
+		const auto T = Distance / Radius;
+		Kernel.Weights[i] = Sinc * BesselI0(Alpha * std::sqrt(1.f - T * T)) / BesselI0(Alpha);
+		Total += Kernel.Weights[i];
+	}
+	for (auto& Weight : Kernel.Weights) { Weight /= Total; }
+	return Kernel;
+}
+
+/** Halves an image to linear RGBA floats, edges clamped. Row(y, Buffer) returns source row y as Width
+    linear RGBA floats, pointing into the image or converted into Buffer (room for Width texels) */
+template <typename row_func>
+inline void DownsampleLinear(int Width, int Height, const mip_kernel& Kernel, const row_func& Row, std::vector<float>& Result) {
+	const auto NewWidth = glm::max(Width / 2, 1);
+	const auto NewHeight = glm::max(Height / 2, 1);
+	Result.resize((size_t) NewWidth * NewHeight * 4);
+
+	// Each destination texel is a weighted sum of whole source texels, 4 floats at a time
+	auto Accumulate = [&](float* Out, const float* const* Texels) {
+#if MIPMAP_SSE2
+		auto Sum = _mm_setzero_ps();
+		for (int i = 0; i < Kernel.NumTaps; ++i) { Sum = _mm_add_ps(Sum, _mm_mul_ps(_mm_set1_ps(Kernel.Weights[i]), _mm_loadu_ps(Texels[i]))); }
+		// Negative lobes can undershoot, there is no negative light
+		_mm_storeu_ps(Out, _mm_max_ps(Sum, _mm_setzero_ps()));
+#else
+		for (int k = 0; k < 4; ++k) {
+			float Sum = 0.f;
+			for (int i = 0; i < Kernel.NumTaps; ++i) { Sum += Kernel.Weights[i] * Texels[i][k]; }
+			Out[k] = glm::max(Sum, 0.f);
+		}
+#endif
+	};
+
+	Jobs.ParallelFor((uint) NewHeight, 32, [&](uint Begin, uint End) {
+		// The rows pass over every source row the band's columns pass reads, clamped at the edges
+		const auto FirstRow = 2 * (int) Begin + Kernel.First;
+		const auto NumRows = 2 * (int) (End - Begin - 1) + Kernel.NumTaps;
+		std::vector<float> Scratch((size_t) NumRows * NewWidth * 4);
+		std::vector<float> Buffer((size_t) Width * 4);
+
+		const float* Texels[8];
+		for (int r = 0; r < NumRows; ++r) {
+			const float* Source = Row(glm::clamp(FirstRow + r, 0, Height - 1), Buffer.data());
+			for (int x = 0; x < NewWidth; ++x) {
+				for (int i = 0; i < Kernel.NumTaps; ++i) { Texels[i] = Source + 4 * glm::clamp(2 * x + Kernel.First + i, 0, Width - 1); }
+				Accumulate(&Scratch[((size_t) r * NewWidth + x) * 4], Texels);
+			}
+		}
+
+		const float* Rows[8];
+		for (auto y = (int) Begin; y < (int) End; ++y) {
+			for (int i = 0; i < Kernel.NumTaps; ++i) { Rows[i] = &Scratch[(size_t) (2 * y + Kernel.First + i - FirstRow) * NewWidth * 4]; }
+			for (int x = 0; x < NewWidth; ++x) {
+				for (int i = 0; i < Kernel.NumTaps; ++i) { Texels[i] = Rows[i] + 4 * x; }
+				Accumulate(&Result[((size_t) y * NewWidth + x) * 4], Texels);
+			}
+		}
+	});
+}
+
+/** Linear floats of a level back to 8-bit, NumChannels of 3 drops the alpha */
+inline void EncodeMipLevel(const float* Linear, int Width, int Height, int NumChannels, const mip_tables& Tables, u8* Out) {
+	Jobs.ParallelFor((uint) Height, 32, [&](uint Begin, uint End) {
+		for (auto y = Begin; y < End; ++y) {
+			for (int x = 0; x < Width; ++x) {
+				const auto Texel = (size_t) y * Width + x;
+				const auto In = Linear + 4 * Texel;
+				const auto Pixel = Out + NumChannels * Texel;
+#if MIPMAP_SSE2
+				// Color to table steps, alpha straight to 8 bits
+				const auto Scale = _mm_setr_ps((float) mip_tables::Steps, (float) mip_tables::Steps, (float) mip_tables::Steps, 255.f);
+				const auto Clamped = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(In), _mm_setzero_ps()), _mm_set1_ps(1.f));
+				alignas(16) i32 Steps[4];
+				_mm_store_si128((__m128i*) Steps, _mm_cvtps_epi32(_mm_mul_ps(Clamped, Scale)));
+				for (int k = 0; k < 3; ++k) { Pixel[k] = Tables.FromLinear[Steps[k]]; }
+				if (NumChannels == 4) { Pixel[3] = (u8) Steps[3]; }
+#else
+				for (int k = 0; k < 3; ++k) { Pixel[k] = Tables.FromLinear[(int) (glm::clamp(In[k], 0.f, 1.f) * mip_tables::Steps + .5f)]; }
+				if (NumChannels == 4) { Pixel[3] = (u8) (glm::clamp(In[3], 0.f, 1.f) * 255.f + .5f); }
+#endif
+			}
+		}
+	});
+}
+
+/** Every level down to 1x1 of an 8-bit image with 3 or 4 channels, level 0 is a copy of Pixels */
+inline void BuildMipChain(const u8* Pixels, int Width, int Height, int NumChannels, bool32 SRGB, mip_filter::type Filter, mip_chain& Result) {
+	Assert(NumChannels == 3 || NumChannels == 4);
+	if (NumChannels == 4) {
+		Result.InternalFormat = SRGB ? gl::SRGB8_ALPHA8 : gl::RGBA8;
+	} else {
+		Result.InternalFormat = SRGB ? gl::SRGB8 : gl::RGB8;
+	}
+
+	Result.Levels.clear();
+	size_t Bytes = 0;
+	for (int LevelWidth = Width, LevelHeight = Height; ; LevelWidth = glm::max(LevelWidth / 2, 1), LevelHeight = glm::max(LevelHeight / 2, 1)) {
+		const auto LevelBytes = MipLevelBytes(Result.InternalFormat, LevelWidth, LevelHeight);
+		Result.Levels.push_back(mip_level{ Bytes, LevelBytes, LevelWidth, LevelHeight });
+		Bytes += LevelBytes;
+		if (LevelWidth == 1 && LevelHeight == 1) { break; }
+	}
+	Result.Data.resize(Bytes);
+	memcpy(Result.Data.data(), Pixels, Result.Levels[0].Bytes);
+
+	const auto& Tables = MipTables(SRGB);
+	const auto Kernel = MipKernel(Filter);
+	std::vector<float> Level, Next;
+	for (size_t i = 1; i < Result.Levels.size(); ++i) {
+		const auto& Previous = Result.Levels[i - 1];
+		const auto& Info = Result.Levels[i];
+		if (i == 1) {
+			// Straight from the 8-bit pixels, a row at a time
+			DownsampleLinear(Width, Height, Kernel, [&](int y, float* Buffer) {
+				const auto Row = Pixels + (size_t) y * Width * NumChannels;
+				for (int x = 0; x < Width; ++x) {
+					for (int k = 0; k < 3; ++k) { Buffer[4 * x + k] = Tables.ToLinear[Row[NumChannels * x + k]]; }
+					Buffer[4 * x + 3] = NumChannels == 4 ? Row[4 * x + 3] / 255.f : 1.f;
+				}
+				return (const float*) Buffer;
+			}, Next);
+		} else {
+			const auto Source = Level.data();
+			const auto SourceWidth = Previous.Width;
+			DownsampleLinear(Previous.Width, Previous.Height, Kernel, [=](int y, float*) { return Source + (size_t) y * SourceWidth * 4; }, Next);
+		}
+		Level.swap(Next);
+		EncodeMipLevel(Level.data(), Info.Width, Info.Height, NumChannels, Tables, Result.Data.data() + Info.Offset);
+	}
+}
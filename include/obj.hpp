@@ -0,0 +1,374 @@
+#pragma once
+
+#include <common.hpp>
+#include <file.hpp>
+#include <jobs.hpp>
+#include <parse.hpp>
+#include <timer.hpp>
+#include <vertex.hpp>
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Wavefront OBJ loading. The file is mapped and cut at line boundaries into chunks parsed in
+// parallel, each chunk keeps its own attributes and faces. Faces may refer to attributes of any
+// chunk (negative indices to the ones before them), so once every chunk is parsed the attributes
+// are concatenated and the chunks resolve their corners into vertices, again in parallel, welding
+// the corners repeated within the chunk. Only the few vertices shared across chunk boundaries end
+// up duplicated. Polygons are triangulated as fans, materials, groups and smoothing are ignored
+
+struct obj_mesh {
+	std::vector<mesh_vertex> Vertices;
+	std::vector<uint> Indices; // Triangle list
+};
+
+struct obj_stats {
+	size_t Bytes;
+	uint NumChunks;
+	uint NumPositions, NumTexCoords, NumNormals;
+	uint NumTriangles;
+	uint NumBadIndices; // Out of range, left as missing attributes
+	double MapMilliseconds;
+	double ParseMilliseconds;
+	double ResolveMilliseconds; // Merging the chunks into the final vertices and indices
+};
+
+// Corner of a face as written, 0 based. Relative has a bit per attribute counted from the end of
+// the chunk's own attributes at that line, since the earlier chunks' counts are not known yet
+struct obj_corner {
+	static constexpr i32 Missing = INT_MIN;
+
+	i32 Position, TexCoords, Normal;
+	u32 Relative;
+
+	bool operator==(const obj_corner& Other) const {
+		return Position == Other.Position && TexCoords == Other.TexCoords && Normal == Other.Normal;
+	}
+};
+
+struct obj_chunk {
+	const char* Begin;
+	const char* End;
+
+	std::vector<vec3> Positions;
+	std::vector<vec2> TexCoords;
+	std::vector<vec3> Normals;
+	std::vector<obj_corner> Corners; // 3 per triangle
+
+	// Filled by the resolve pass, indices are local to the chunk until merged
+	std::vector<obj_corner> Unique; // Resolved corner of each vertex
+	std::vector<mesh_vertex> Vertices;
+	std::vector<uint> Indices;
+	uint NumBadIndices = 0;
+
+	// Where the chunk's data goes in the merged arrays
+	uint FirstPosition = 0, FirstTexCoords = 0, FirstNormal = 0;
+	uint FirstVertex = 0, FirstIndex = 0;
+};
+
+inline bool32 ObjIsSpace(char C) { return C == ' ' || C == '\t' || C == '\r'; }
+
+inline const char* ObjSkipSpaces(const char* At, const char* End) {
+	while (At < End && ObjIsSpace(*At)) { ++At; }
+	return At;
+}
+
+// Returns At when there is no number
+inline const char* ObjParseInt(const char* At, const char* End, i32& Result) {
+	const auto Start = At;
+	bool32 Negative = false;
+	if (At < End && (*At == '-' || *At == '+')) { Negative = *At++ == '-'; }
+	if (At == End || !IsDigit(*At)) { return Start; }
+
+	i64 Value = 0;
+	for (; At < End && IsDigit(*At); ++At) { Value = glm::min(Value * 10 + (*At - '0'), (i64) INT_MAX); }
+	Result = (i32) (Negative ? -Value : Value);
+	return At;
+}
+
+// Stores an index as written in the file: 1 based from the start, or negative from the end
+inline void ObjStoreIndex(i32 Index, i32 LocalCount, uint Bit, i32& Stored, u32& Relative) {
+	if (Index > 0) {
+		Stored = Index - 1;
+	} else if (Index < 0) {
+		Stored = LocalCount + Index;
+		Relative |= Bit;
+	} else {
+		Stored = obj_corner::Missing;
+	}
+}
+
+inline void ObjParseChunk(obj_chunk& Chunk) {
+	std::vector<obj_corner> Polygon;
+
+	for (auto At = Chunk.Begin; At < Chunk.End; ) {
+		auto LineEnd = (const char*) memchr(At, '\n', Chunk.End - At);
+		if (!LineEnd) { LineEnd = Chunk.End; }
+		defer{ At = LineEnd + 1; };
+
+		At = ObjSkipSpaces(At, LineEnd);
+		if (LineEnd - At < 2 || (At[0] != 'v' && At[0] != 'f')) { continue; }
+
+		if (At[0] == 'v') {
+			if (ObjIsSpace(At[1])) {
+				vec3 Position{ 0.f };
+				for (int i = 0; i < 3; ++i) { At = ParseFloat(ObjSkipSpaces(At + (i == 0), LineEnd), LineEnd, Position[i]); }
+				Chunk.Positions.push_back(Position); // Extra w or vertex colors are ignored
+			} else if (At[1] == 't') {
+				vec2 TexCoords{ 0.f };
+				At += 2;
+				for (int i = 0; i < 2; ++i) { At = ParseFloat(ObjSkipSpaces(At, LineEnd), LineEnd, TexCoords[i]); }
+				Chunk.TexCoords.push_back(TexCoords);
+			} else if (At[1] == 'n') {
+				vec3 Normal{ 0.f };
+				At += 2;
+				for (int i = 0; i < 3; ++i) { At = ParseFloat(ObjSkipSpaces(At, LineEnd), LineEnd, Normal[i]); }
+				Chunk.Normals.push_back(Normal);
+			}
+			continue;
+		}
+
+		if (!ObjIsSpace(At[1])) { continue; }
+		At++;
+
+		// v, v/vt, v//vn or v/vt/vn
+		Polygon.clear();
+		while (true) {
+			At = ObjSkipSpaces(At, LineEnd);
+			i32 Position = 0, TexCoords = 0, Normal = 0;
+			auto Next = ObjParseInt(At, LineEnd, Position);
+			if (Next == At) { break; }
+			At = Next;
+			if (At < LineEnd && *At == '/') {
+				At = ObjParseInt(At + 1, LineEnd, TexCoords);
+				if (At < LineEnd && *At == '/') { At = ObjParseInt(At + 1, LineEnd, Normal); }
+			}
+			while (At < LineEnd && !ObjIsSpace(*At)) { ++At; } // Anything unexpected up to the next corner
+
+			obj_corner Corner;
+			Corner.Relative = 0;
+			ObjStoreIndex(Position, (i32) Chunk.Positions.size(), 1, Corner.Position, Corner.Relative);
+			ObjStoreIndex(TexCoords, (i32) Chunk.TexCoords.size(), 2, Corner.TexCoords, Corner.Relative);
+			ObjStoreIndex(Normal, (i32) Chunk.Normals.size(), 4, Corner.Normal, Corner.Relative);
+			Polygon.push_back(Corner);
+		}
+
+		for (size_t i = 2; i < Polygon.size(); ++i) {
+			Chunk.Corners.push_back(Polygon[0]);
+			Chunk.Corners.push_back(Polygon[i - 1]);
+			Chunk.Corners.push_back(Polygon[i]);
+		}
+	}
+}
+
+// Turns the chunk's corners into welded vertices, using the merged attributes
+inline void ObjResolveChunk(obj_chunk& Chunk, const std::vector<vec3>& Positions, const std::vector<vec2>& TexCoords, const std::vector<vec3>& Normals) {
+	auto Resolve = [&](i32& Index, u32 Relative, uint Bit, uint First, size_t Count) {
+		if (Index == obj_corner::Missing) { return; }
+
+		const auto Absolute = (i64) Index + ((Relative & Bit) ? First : 0);
+		if (Absolute < 0 || Absolute >= (i64) Count) {
+			Chunk.NumBadIndices++;
+			Index = obj_corner::Missing;
+		} else {
+			Index = (i32) Absolute;
+		}
+	};
+
+	// Open addressing kept at most half full. Sized for about one vertex per position of the
+	// chunk, the usual case, and grown when there are more
+	auto HashCorner = [](const obj_corner& Corner) {
+		const auto Hash = (u64) (u32) Corner.Position * 0x9E3779B97F4A7C15ull
+			^ (u64) (u32) Corner.TexCoords * 0xC2B2AE3D27D4EB4Full
+			^ (u64) (u32) Corner.Normal * 0x165667B19E3779F9ull;
+		return (size_t) (Hash >> 29);
+	};
+	constexpr uint Empty = ~0u;
+	std::vector<uint> Slots;
+	size_t Mask = 0;
+	auto Rehash = [&](size_t NumSlots) {
+		Slots.assign(NumSlots, Empty);
+		Mask = NumSlots - 1;
+		for (uint v = 0; v < (uint) Chunk.Unique.size(); ++v) {
+			auto Slot = HashCorner(Chunk.Unique[v]) & Mask;
+			while (Slots[Slot] != Empty) { Slot = (Slot + 1) & Mask; }
+			Slots[Slot] = v;
+		}
+	};
+
+	Chunk.Unique.clear();
+	Chunk.Vertices.clear();
+	Chunk.Indices.resize(Chunk.Corners.size());
+
+	size_t NumSlots = 16;
+	while (NumSlots < 2 * glm::min(Chunk.Positions.size(), Chunk.Corners.size())) { NumSlots *= 2; }
+	Rehash(NumSlots);
+
+	for (size_t i = 0; i < Chunk.Corners.size(); ++i) {
+		auto Corner = Chunk.Corners[i];
+		Resolve(Corner.Position, Corner.Relative, 1, Chunk.FirstPosition, Positions.size());
+		Resolve(Corner.TexCoords, Corner.Relative, 2, Chunk.FirstTexCoords, TexCoords.size());
+		Resolve(Corner.Normal, Corner.Relative, 4, Chunk.FirstNormal, Normals.size());
+
+		auto Slot = HashCorner(Corner) & Mask;
+		while (Slots[Slot] != Empty && !(Chunk.Unique[Slots[Slot]] == Corner)) { Slot = (Slot + 1) & Mask; }
+
+		if (Slots[Slot] == Empty) {
+			Slots[Slot] = (uint) Chunk.Vertices.size();
+			Chunk.Unique.push_back(Corner);
+
+			mesh_vertex Vertex;
+			if (Corner.Position != obj_corner::Missing) { Vertex.Position = Positions[Corner.Position]; }
+			if (Corner.TexCoords != obj_corner::Missing) { Vertex.TexCoords = TexCoords[Corner.TexCoords]; }
+			if (Corner.Normal != obj_corner::Missing) { Vertex.Normal = Normals[Corner.Normal]; }
+			Chunk.Vertices.push_back(Vertex);
+			Chunk.Indices[i] = Slots[Slot];
+			if (2 * Chunk.Unique.size() > Slots.size()) { Rehash(2 * Slots.size()); }
+		} else {
+			Chunk.Indices[i] = Slots[Slot];
+		}
+	}
+}
+
+// Smooth normals for the vertices without one, the area weighted face normals around each position
+inline void ObjGenerateNormals(std::vector<obj_chunk>& Chunks, size_t NumPositions) {
+	std::vector<vec3> Accumulated(NumPositions, vec3{ 0.f });
+	for (const auto& Chunk : Chunks) {
+		for (size_t i = 0; i + 2 < Chunk.Indices.size(); i += 3) {
+			const auto& A = Chunk.Vertices[Chunk.Indices[i]].Position;
+			const auto& B = Chunk.Vertices[Chunk.Indices[i + 1]].Position;
+			const auto& C = Chunk.Vertices[Chunk.Indices[i + 2]].Position;
+			const auto FaceNormal = glm::cross(B - A, C - A); // Length is twice the area
+			for (int k = 0; k < 3; ++k) {
+				const auto Position = Chunk.Unique[Chunk.Indices[i + k]].Position;
+				if (Position != obj_corner::Missing) { Accumulated[Position] += FaceNormal; }
+			}
+		}
+	}
+
+	for (auto& Chunk : Chunks) {
+		for (size_t v = 0; v < Chunk.Vertices.size(); ++v) {
+			const auto& Corner = Chunk.Unique[v];
+			if (Corner.Normal != obj_corner::Missing || Corner.Position == obj_corner::Missing) { continue; }
+
+			const auto& Normal = Accumulated[Corner.Position];
+			const auto Length = glm::length(Normal);
+			Chunk.Vertices[v].Normal = Length > 0.f ? Normal / Length : vec3{ 0.f, 1.f, 0.f };
+		}
+	}
+}
+
+/** Parses OBJ text already in memory. MaxChunks limits the parallelism, 0 picks it from the size
+    and the number of threads, 1 parses everything on the calling thread */
+inline void ParseOBJ(const char* Data, size_t Bytes, obj_mesh& Result, obj_stats* Stats = nullptr, uint MaxChunks = 0) {
+	constexpr size_t MinChunkBytes = 1 << 20;
+
+	cpu_timer Timer;
+	if (MaxChunks == 0) { MaxChunks = 8 * Jobs.NumThreads(); } // Several per thread, lines are not evenly costly
+	const auto NumChunks = (uint) std::max<size_t>(1, std::min<size_t>(MaxChunks, Bytes / MinChunkBytes));
+
+	// Chunks start after a line break
+	std::vector<obj_chunk> Chunks(NumChunks);
+	const auto End = Data + Bytes;
+	auto Begin = Data;
+	for (uint i = 0; i < NumChunks; ++i) {
+		auto ChunkEnd = i + 1 == NumChunks ? End : Data + Bytes / NumChunks * (i + 1);
+		if (ChunkEnd < Begin) { ChunkEnd = Begin; }
+		if (ChunkEnd < End) {
+			auto LineBreak = (const char*) memchr(ChunkEnd, '\n', End - ChunkEnd);
+			ChunkEnd = LineBreak ? LineBreak + 1 : End;
+		}
+		Chunks[i].Begin = Begin;
+		Chunks[i].End = ChunkEnd;
+		Begin = ChunkEnd;
+	}
+
+	auto ForEachChunk = [&](const std::function<void(obj_chunk&)>& Func) {
+		if (NumChunks == 1) { Func(Chunks[0]); return; }
+		Jobs.ParallelFor(NumChunks, 1, [&](uint First, uint Last) {
+			for (auto i = First; i < Last; ++i) { Func(Chunks[i]); }
+		});
+	};
+
+	ForEachChunk([](obj_chunk& Chunk) { ObjParseChunk(Chunk); });
+	const auto ParseMilliseconds = Timer.Milliseconds();
+	Timer.Reset();
+
+	// Everything's place in the merged arrays
+	uint NumPositions = 0, NumTexCoords = 0, NumNormals = 0;
+	for (auto& Chunk : Chunks) {
+		Chunk.FirstPosition = NumPositions;
+		Chunk.FirstTexCoords = NumTexCoords;
+		Chunk.FirstNormal = NumNormals;
+		NumPositions += (uint) Chunk.Positions.size();
+		NumTexCoords += (uint) Chunk.TexCoords.size();
+		NumNormals += (uint) Chunk.Normals.size();
+	}
+
+	std::vector<vec3> Positions(NumPositions);
+	std::vector<vec2> TexCoords(NumTexCoords);
+	std::vector<vec3> Normals(NumNormals);
+	ForEachChunk([&](obj_chunk& Chunk) {
+		std::copy(Chunk.Positions.begin(), Chunk.Positions.end(), Positions.begin() + Chunk.FirstPosition);
+		std::copy(Chunk.TexCoords.begin(), Chunk.TexCoords.end(), TexCoords.begin() + Chunk.FirstTexCoords);
+		std::copy(Chunk.Normals.begin(), Chunk.Normals.end(), Normals.begin() + Chunk.FirstNormal);
+	});
+
+	ForEachChunk([&](obj_chunk& Chunk) { ObjResolveChunk(Chunk, Positions, TexCoords, Normals); });
+
+	bool32 MissingNormals = false;
+	uint NumVertices = 0, NumIndices = 0, NumBadIndices = 0;
+	for (auto& Chunk : Chunks) {
+		Chunk.FirstVertex = NumVertices;
+		Chunk.FirstIndex = NumIndices;
+		NumVertices += (uint) Chunk.Vertices.size();
+		NumIndices += (uint) Chunk.Indices.size();
+		NumBadIndices += Chunk.NumBadIndices;
+		for (const auto& Corner : Chunk.Unique) { MissingNormals |= Corner.Normal == obj_corner::Missing; }
+	}
+	if (MissingNormals) { ObjGenerateNormals(Chunks, NumPositions); }
+
+	Result.Vertices.resize(NumVertices);
+	Result.Indices.resize(NumIndices);
+	ForEachChunk([&](obj_chunk& Chunk) {
+		std::copy(Chunk.Vertices.begin(), Chunk.Vertices.end(), Result.Vertices.begin() + Chunk.FirstVertex);
+		auto Out = Result.Indices.begin() + Chunk.FirstIndex;
+		for (auto Index : Chunk.Indices) { *Out++ = Index + Chunk.FirstVertex; }
+	});
+
+	if (NumBadIndices > 0) { LogError("[OBJ] %u indices out of range\n", NumBadIndices); }
+
+	if (Stats) {
+		Stats->Bytes = Bytes;
+		Stats->NumChunks = NumChunks;
+		Stats->NumPositions = NumPositions;
+		Stats->NumTexCoords = NumTexCoords;
+		Stats->NumNormals = NumNormals;
+		Stats->NumTriangles = NumIndices / 3;
+		Stats->NumBadIndices = NumBadIndices;
+		Stats->ParseMilliseconds = ParseMilliseconds;
+		Stats->ResolveMilliseconds = Timer.Milliseconds();
+	}
+}
+
+inline bool32 LoadOBJ(const std::string& FileName, obj_mesh& Result, obj_stats* Stats = nullptr, uint MaxChunks = 0) {
+	cpu_timer Timer;
+	mapped_file File;
+	if (!File.Open(FileName)) {
+		LogError("[OBJ] Could not open %s\n", FileName.c_str());
+		return false;
+	}
+	const auto MapMilliseconds = Timer.Milliseconds();
+
+	ParseOBJ((const char*) File.Data, File.Bytes, Result, Stats, MaxChunks);
+	if (Stats) { Stats->MapMilliseconds = MapMilliseconds; }
+
+	if (Result.Indices.empty()) {
+		LogError("[OBJ] No faces in %s\n", FileName.c_str());
+		return false;
+	}
+	return true;
+}
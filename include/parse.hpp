@@ -0,0 +1,63 @@
+#pragma once
+
+#include <common.hpp>
+#include <cmath>
+
+// Number parsing for the text formats (OBJ, JSON), over ranges that need not be null terminated
+
+inline bool32 IsDigit(char C) { return (unsigned) (C - '0') < 10u; }
+
+// Decimal and scientific notation without locales or strtod. Up to 19 significant digits are
+// accumulated exactly, then scaled by an exact power of ten, which is correctly rounded whenever
+// the mantissa fits a double (every float an exporter writes). Returns At when there is no number,
+// a lone '.' included
+inline const char* ParseDouble(const char* At, const char* End, double& Result) {
+	static const double Powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+	const auto Start = At;
+	bool32 Negative = false;
+	if (At < End && (*At == '-' || *At == '+')) { Negative = *At++ == '-'; }
+
+	u64 Mantissa = 0;
+	int Exponent = 0, Digits = 0;
+	const auto FirstDigit = At;
+	for (; At < End && IsDigit(*At); ++At) {
+		if (Digits < 19) { Mantissa = Mantissa * 10 + (u64) (*At - '0'); Digits += Mantissa > 0; }
+		else { Exponent++; }
+	}
+	if (At < End && *At == '.') {
+		for (++At; At < End && IsDigit(*At); ++At) {
+			if (Digits < 19) { Mantissa = Mantissa * 10 + (u64) (*At - '0'); Digits += Mantissa > 0; Exponent--; }
+		}
+	}
+	if (At == FirstDigit || (At == FirstDigit + 1 && *FirstDigit == '.')) { return Start; }
+
+	if (At < End && (*At == 'e' || *At == 'E')) {
+		auto ExponentAt = At + 1;
+		bool32 NegativeExponent = false;
+		if (ExponentAt < End && (*ExponentAt == '-' || *ExponentAt == '+')) { NegativeExponent = *ExponentAt++ == '-'; }
+		if (ExponentAt < End && IsDigit(*ExponentAt)) {
+			int Value = 0;
+			for (; ExponentAt < End && IsDigit(*ExponentAt); ++ExponentAt) { Value = glm::min(Value * 10 + (*ExponentAt - '0'), 10000); }
+			Exponent += NegativeExponent ? -Value : Value;
+			At = ExponentAt;
+		}
+	}
+
+	auto Value = (double) Mantissa;
+	if (Exponent < 0) {
+		Value = Exponent >= -22 ? Value / Powers[-Exponent] : Value * std::pow(10., Exponent);
+	} else if (Exponent > 0) {
+		Value = Exponent <= 22 ? Value * Powers[Exponent] : Value * std::pow(10., Exponent);
+	}
+	Result = Negative ? -Value : Value;
+	return At;
+}
+
+inline const char* ParseFloat(const char* At, const char* End, float& Result) {
+	double Value;
+	const auto Next = ParseDouble(At, End, Value);
+	if (Next != At) { Result = (float) Value; }
+	return Next;
+}
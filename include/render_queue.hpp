@@ -0,0 +1,302 @@
+#pragma once
+
+#include <common.hpp>
+#include <gl_33.hpp>
+#include <camera.hpp>
+#include <framebuffer.hpp>
+#include <material.hpp>
+#include <mesh.hpp>
+#include <shader.hpp>
+#include <algorithm>
+#include <array>
+#include <utility>
+#include <vector>
+
+// Everything needed to draw one object in any pass
+struct draw_item {
+	const mesh* Mesh;
+	mat4 Model;
+	material Material;
+	uint Lod = 0; // See mesh::SelectLod
+};
+
+namespace depth_prepass {
+	enum type : uint {
+		Off = 0,
+		On,
+		Auto, // On while the measured overdraw is high
+		TOTAL
+	};
+}
+
+namespace transparency {
+	enum type : uint {
+		Sorted = 0,      // Back to front by distance to the camera, exact for non-intersecting objects
+		WeightedBlended, // Order-independent approximation, no sorting and a single pass whatever the count
+		TOTAL
+	};
+}
+
+// Collects the frame's draws so they can be replayed in several passes. With the depth pre-pass
+// the opaque draws first lay down depth with a position only program, then the lit pass runs with
+// EQUAL and no depth writes, so every pixel is shaded exactly once whatever the depth complexity.
+// The pre-pass costs a second geometry pass, in Auto it is only used while it pays off.
+// Opaque draws run with blending disabled, transparent ones are drawn afterwards with blending.
+// They are sorted by texture and mesh first, so consecutive draws keep their bindings (draws in
+// the same texture array only differ in their layer, see texture_array.hpp)
+struct render_queue {
+	static constexpr uint QueryLatency = 4;
+	static constexpr uint ProbeInterval = 120;   // Frames between measurements while Auto keeps the pre-pass off
+	static constexpr float EnableOverdraw = 1.5f;  // Hysteresis so the choice does not flicker
+	static constexpr float DisableOverdraw = 1.2f;
+
+	std::vector<draw_item> Opaque;
+	std::vector<draw_item> Transparent;
+
+	depth_prepass::type PrepassMode;
+	bool32 AutoPrepass;       // Auto's current choice
+	bool32 PrepassThisFrame;
+	uint FramesSinceProbe;
+
+	// Samples passing LESS per sample passing EQUAL: how many times each visible sample would be
+	// shaded without the pre-pass. Only measurable in frames with the pre-pass
+	float Overdraw;
+
+	render_program DepthProg;
+	GLint DepthMVPLoc;
+
+	struct overdraw_query {
+		uint Prepass, Shading; // SAMPLES_PASSED of each pass
+		bool32 Issued;
+	};
+	std::array<overdraw_query, QueryLatency> Queries;
+	uint CurrentQuery;
+
+	transparency::type TransparencyMode;
+	std::vector<std::pair<float, uint>> SortKeys; // Distance to the camera and index of the transparent items
+	oit_buffer OITBuffer;
+	render_program CompositeProg;
+	uint FullscreenVAO;
+
+	render_queue() = delete;
+	explicit render_queue(glm::ivec2 ScreenSize);
+	~render_queue();
+
+	void Initialize();
+	void Shutdown();
+
+	void QueueShaders(program_batch& Batch);
+	void SetupShaders();
+
+	void Clear() { Opaque.clear(); Transparent.clear(); }
+	void Add(const draw_item& Item) { (Item.Material.Transparent ? Transparent : Opaque).push_back(Item); }
+
+	/** Draws the opaque items, Draw(Item, PassFeatures) sets up the lit program with the pass'
+	    shader features added and issues the item's draw. AllowPrepass is false for paths that
+	    already shade once per pixel */
+	template <typename draw_function>
+	void DrawOpaque(const mat4& ViewProjection, bool32 AllowPrepass, draw_function Draw);
+
+	/** Draws the transparent items over the finished opaque scene, Draw as in DrawOpaque */
+	template <typename draw_function>
+	void DrawTransparent(const camera& Camera, draw_function Draw);
+
+	void SortOpaque();
+	void DepthPrepass(const mat4& ViewProjection);
+	void ReadQueries(bool32 Wait);
+	void Measured(GLuint PrepassSamples, GLuint ShadingSamples);
+};
+
+inline render_queue::render_queue(glm::ivec2 ScreenSize)
+	: PrepassMode{depth_prepass::Auto}, AutoPrepass{false}, PrepassThisFrame{false}, FramesSinceProbe{0}
+	, Overdraw{0.f}, DepthMVPLoc{-1}, Queries{}, CurrentQuery{0}
+	, TransparencyMode{transparency::WeightedBlended}, OITBuffer{ScreenSize}, FullscreenVAO{0} {
+	DepthProg.ShaderPaths[shader_stage::Vertex] = "shader/depth.vert";
+	DepthProg.ShaderPaths[shader_stage::Fragment] = "shader/depth.frag";
+
+	CompositeProg.ShaderPaths[shader_stage::Vertex] = "shader/deferred_light.vert";
+	CompositeProg.ShaderPaths[shader_stage::Fragment] = "shader/oit_composite.frag";
+
+	// The fullscreen triangle is generated from gl_VertexID, the VAO is there because core profile needs one
+	gl::GenVertexArrays(1, &FullscreenVAO);
+}
+
+inline render_queue::~render_queue() {
+	if (FullscreenVAO > 0) { gl::DeleteVertexArrays(1, &FullscreenVAO); }
+}
+
+inline void render_queue::QueueShaders(program_batch& Batch) {
+	Batch.Add(DepthProg);
+	Batch.Add(CompositeProg);
+}
+
+inline void render_queue::SetupShaders() {
+	DepthMVPLoc = gl::GetUniformLocation(DepthProg.ID, "MVP");
+
+	gl::UseProgram(CompositeProg.ID);
+	gl::Uniform1i(gl::GetUniformLocation(CompositeProg.ID, "Accumulation"), 0);
+	gl::Uniform1i(gl::GetUniformLocation(CompositeProg.ID, "Weights"), 1);
+	gl::Uniform1i(gl::GetUniformLocation(CompositeProg.ID, "Fullscreen"), true);
+	gl::UseProgram(0);
+}
+
+inline void render_queue::Initialize() {
+	for (auto& Query : Queries) {
+		gl::GenQueries(1, &Query.Prepass);
+		gl::GenQueries(1, &Query.Shading);
+		Query.Issued = false;
+	}
+}
+
+inline void render_queue::Shutdown() {
+	for (auto& Query : Queries) {
+		gl::DeleteQueries(1, &Query.Prepass);
+		gl::DeleteQueries(1, &Query.Shading);
+	}
+}
+
+inline void render_queue::Measured(GLuint PrepassSamples, GLuint ShadingSamples) {
+	if (ShadingSamples == 0) { return; } // Nothing visible, nothing to learn
+	Overdraw = (float) PrepassSamples / (float) ShadingSamples;
+
+	const auto WasOn = AutoPrepass;
+	AutoPrepass = Overdraw >= (AutoPrepass ? DisableOverdraw : EnableOverdraw);
+	if (PrepassMode == depth_prepass::Auto && AutoPrepass != WasOn) {
+		printf("[Render] Depth pre-pass %s, overdraw %.2f\n", AutoPrepass ? "on" : "off", Overdraw);
+	}
+}
+
+inline void render_queue::ReadQueries(bool32 Wait) {
+	for (auto& Query : Queries) {
+		if (!Query.Issued) { continue; }
+
+		// The shading query ends last, once it is available both are
+		GLuint Available = Wait;
+		if (!Wait) { gl::GetQueryObjectuiv(Query.Shading, gl::QUERY_RESULT_AVAILABLE, &Available); }
+		if (!Available) { continue; }
+
+		GLuint PrepassSamples = 0, ShadingSamples = 0;
+		gl::GetQueryObjectuiv(Query.Prepass, gl::QUERY_RESULT, &PrepassSamples);
+		gl::GetQueryObjectuiv(Query.Shading, gl::QUERY_RESULT, &ShadingSamples);
+		Query.Issued = false;
+		Measured(PrepassSamples, ShadingSamples);
+	}
+}
+
+inline void render_queue::SortOpaque() {
+	std::stable_sort(Opaque.begin(), Opaque.end(), [](const draw_item& A, const draw_item& B) {
+		if (A.Material.Layer.Array != B.Material.Layer.Array) { return A.Material.Layer.Array < B.Material.Layer.Array; }
+		if (A.Material.Texture != B.Material.Texture) { return A.Material.Texture < B.Material.Texture; }
+		return A.Mesh < B.Mesh;
+	});
+}
+
+inline void render_queue::DepthPrepass(const mat4& ViewProjection) {
+	gl::ColorMask(false, false, false, false);
+	gl::DepthMask(true);
+	gl::DepthFunc(gl::LESS);
+	gl::UseProgram(DepthProg.ID);
+
+	for (const auto& Item : Opaque) {
+		// Multiplied in the same order as the lit pass, the EQUAL depth test needs the very same positions
+		const auto Model = Item.Model * Item.Mesh->PositionTransform;
+		const auto MVP = ViewProjection * Model;
+		gl::UniformMatrix4fv(DepthMVPLoc, 1, false, glm::value_ptr(MVP));
+		gl::BindVertexArray(Item.Mesh->PositionVAO);
+		Item.Mesh->Draw(0, Item.Lod);
+	}
+
+	gl::ColorMask(true, true, true, true);
+}
+
+template <typename draw_function>
+void render_queue::DrawOpaque(const mat4& ViewProjection, bool32 AllowPrepass, draw_function Draw) {
+	ReadQueries(false);
+	SortOpaque();
+
+	PrepassThisFrame = false;
+	if (AllowPrepass && !Opaque.empty()) {
+		switch (PrepassMode) {
+		case depth_prepass::Off: break;
+		case depth_prepass::On: PrepassThisFrame = true; break;
+		case depth_prepass::Auto:
+			// While off, a pre-pass now and then measures whether it would help
+			PrepassThisFrame = AutoPrepass || ++FramesSinceProbe >= ProbeInterval;
+			if (PrepassThisFrame) { FramesSinceProbe = 0; }
+			break;
+		default: Assert(!"Invalid depth pre-pass mode");
+		}
+	}
+
+	auto& Query = Queries[CurrentQuery];
+	if (PrepassThisFrame) {
+		if (Query.Issued) { ReadQueries(true); } // Only if the GPU is more than QueryLatency frames behind
+		CurrentQuery = (CurrentQuery + 1) % QueryLatency;
+
+		gl::BeginQuery(gl::SAMPLES_PASSED, Query.Prepass);
+		DepthPrepass(ViewProjection);
+		gl::EndQuery(gl::SAMPLES_PASSED);
+
+		gl::DepthFunc(gl::EQUAL);
+		gl::DepthMask(false);
+		gl::BeginQuery(gl::SAMPLES_PASSED, Query.Shading);
+	}
+
+	for (const auto& Item : Opaque) { Draw(Item, 0u); }
+
+	if (PrepassThisFrame) {
+		gl::EndQuery(gl::SAMPLES_PASSED);
+		Query.Issued = true;
+
+		gl::DepthFunc(gl::LESS);
+		gl::DepthMask(true);
+	}
+}
+
+template <typename draw_function>
+void render_queue::DrawTransparent(const camera& Camera, draw_function Draw) {
+	if (Transparent.empty()) { return; }
+
+	// Transparent surfaces are tested against the scene but do not hide each other
+	gl::DepthMask(false);
+	gl::Enable(gl::BLEND);
+
+	if (TransparencyMode == transparency::Sorted) {
+		SortKeys.clear();
+		for (uint i = 0; i < Transparent.size(); ++i) {
+			const auto& Item = Transparent[i];
+			const auto Center = TransformSphere(Item.Model, Item.Mesh->Bounds).Center;
+			SortKeys.push_back({ glm::distance(Center, Camera.Transform.Position), i });
+		}
+		std::sort(SortKeys.begin(), SortKeys.end(), [](const std::pair<float, uint>& A, const std::pair<float, uint>& B) { return A.first > B.first; });
+
+		gl::BlendFunc(gl::SRC_ALPHA, gl::ONE_MINUS_SRC_ALPHA);
+		for (const auto& Key : SortKeys) { Draw(Transparent[Key.second], 0u); }
+	} else {
+		OITBuffer.Begin();
+		gl::BlendFuncSeparate(gl::ONE, gl::ONE, gl::ZERO, gl::ONE_MINUS_SRC_ALPHA);
+		for (const auto& Item : Transparent) { Draw(Item, (uint) shader_feature::WeightedOIT); }
+
+		// Composite over the opaque scene
+		gl::BindFramebuffer(gl::FRAMEBUFFER, 0);
+		gl::Disable(gl::DEPTH_TEST);
+		gl::BlendFunc(gl::ONE_MINUS_SRC_ALPHA, gl::SRC_ALPHA);
+
+		gl::ActiveTexture(gl::TEXTURE0);
+		gl::BindTexture(gl::TEXTURE_2D, OITBuffer.Targets[oit_target::Accumulation]);
+		gl::ActiveTexture(gl::TEXTURE1);
+		gl::BindTexture(gl::TEXTURE_2D, OITBuffer.Targets[oit_target::Weights]);
+
+		gl::UseProgram(CompositeProg.ID);
+		gl::BindVertexArray(FullscreenVAO);
+		gl::DrawArrays(gl::TRIANGLES, 0, 3);
+
+		gl::BindTexture(gl::TEXTURE_2D, 0);
+		gl::ActiveTexture(gl::TEXTURE0);
+		gl::BindTexture(gl::TEXTURE_2D, 0);
+		gl::Enable(gl::DEPTH_TEST);
+	}
+
+	gl::Disable(gl::BLEND);
+	gl::DepthMask(true);
+}
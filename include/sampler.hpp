@@ -0,0 +1,78 @@
+#pragma once
+
+#include <common.hpp>
+#include <gl_33.hpp>
+#include <material.hpp>
+
+// Filtering presets as sampler objects, shared by every texture sampled with them. A sampler bound
+// to a unit overrides the filtering and wrapping of whatever texture is bound there, so textures
+// only keep their own storage state (levels, MAX_LEVEL). There is one sampler per preset and pair
+// of wrap modes, materials pick theirs with material_sampler
+
+namespace sampler_preset {
+	enum type : uint {
+		Nearest = 0, // Point sampling of the top level, no mipmaps
+		Bilinear,    // Top level only, what textures ended up with when their mip filter was overwritten
+		Trilinear,
+		Anisotropic, // Trilinear plus EXT_texture_filter_anisotropic, Trilinear without the extension
+		TOTAL
+	};
+}
+static const char* SamplerPresetNames[] = { "Nearest", "Bilinear", "Trilinear", "Anisotropic" };
+StaticAssert(ArraySize(SamplerPresetNames) == sampler_preset::TOTAL);
+
+struct samplers {
+	static constexpr uint Count = sampler_wrap::TOTAL * sampler_wrap::TOTAL * sampler_preset::TOTAL;
+
+	GLuint IDs[Count];   // By wrap S, wrap T then preset
+	float MaxAnisotropy; // 1 without the extension
+
+	samplers() : IDs{}, MaxAnisotropy{1.f} {}
+
+	/** Anisotropy is clamped to what the driver supports */
+	void Initialize(float Anisotropy = 8.f);
+	void Shutdown();
+
+	/** The sampler of the frame's Preset as the material asks for it, clamped to the edges by default */
+	GLuint ID(sampler_preset::type Preset, material_sampler Sampler = {}) const;
+	void Bind(uint Unit, sampler_preset::type Preset, material_sampler Sampler = {}) const { gl::BindSampler(Unit, ID(Preset, Sampler)); }
+};
+
+inline void samplers::Initialize(float Anisotropy) {
+	if (gl::exts::var_EXT_texture_filter_anisotropic) {
+		gl::GetFloatv(gl::MAX_TEXTURE_MAX_ANISOTROPY_EXT, &MaxAnisotropy);
+		MaxAnisotropy = glm::clamp(Anisotropy, 1.f, MaxAnisotropy);
+	}
+
+	const GLint WrapModes[] = { gl::CLAMP_TO_EDGE, gl::REPEAT, gl::MIRRORED_REPEAT };
+	StaticAssert(ArraySize(WrapModes) == sampler_wrap::TOTAL);
+
+	gl::GenSamplers(Count, IDs);
+	for (uint i = 0; i < Count; ++i) {
+		const auto Sampler = IDs[i];
+		const auto Preset = i % sampler_preset::TOTAL;
+		const auto WrapT = i / sampler_preset::TOTAL % sampler_wrap::TOTAL;
+		const auto WrapS = i / sampler_preset::TOTAL / sampler_wrap::TOTAL;
+		const auto Mipmapped = Preset >= sampler_preset::Trilinear;
+		gl::SamplerParameteri(Sampler, gl::TEXTURE_MIN_FILTER, Preset == sampler_preset::Nearest ? gl::NEAREST : Mipmapped ? gl::LINEAR_MIPMAP_LINEAR : gl::LINEAR);
+		gl::SamplerParameteri(Sampler, gl::TEXTURE_MAG_FILTER, Preset == sampler_preset::Nearest ? gl::NEAREST : gl::LINEAR);
+		gl::SamplerParameteri(Sampler, gl::TEXTURE_WRAP_S, WrapModes[WrapS]);
+		gl::SamplerParameteri(Sampler, gl::TEXTURE_WRAP_T, WrapModes[WrapT]);
+		if (Preset == sampler_preset::Anisotropic && MaxAnisotropy > 1.f) {
+			gl::SamplerParameterf(Sampler, gl::TEXTURE_MAX_ANISOTROPY_EXT, MaxAnisotropy);
+		}
+	}
+}
+
+inline void samplers::Shutdown() {
+	gl::DeleteSamplers(Count, IDs);
+}
+
+inline GLuint samplers::ID(sampler_preset::type Preset, material_sampler Sampler) const {
+	if (Sampler.Filter == sampler_filter::Nearest) {
+		Preset = sampler_preset::Nearest;
+	} else if (Sampler.Filter == sampler_filter::Linear && Preset > sampler_preset::Bilinear) {
+		Preset = sampler_preset::Bilinear;
+	}
+	return IDs[(Sampler.WrapS * sampler_wrap::TOTAL + Sampler.WrapT) * sampler_preset::TOTAL + Preset];
+}
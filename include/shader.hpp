@@ -1,7 +1,18 @@
 #pragma once
 
 #include <common.hpp>
+#include <file.hpp>
+#include <algorithm>
 #include <array>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 #include <gl_33.hpp>
 
 namespace shader_stage {
@@ -14,6 +25,222 @@ namespace shader_stage {
 }
 static const uint InternalShaderTypes[] = {gl::VERTEX_SHADER, gl::GEOMETRY_SHADER, gl::FRAGMENT_SHADER};
 
+// Optional code paths of the shaders, every one is defined to 0 or 1 in the GLSL source.
+// Turning one off compiles its branches out
+namespace shader_feature {
+    enum type : uint {
+        Texture = 1 << 0,
+        PointLights = 1 << 1, // Without them only directional lights are evaluated
+        SpotLights = 1 << 2,
+        WeightedOIT = 1 << 3, // Writes to the weighted blended transparency targets instead of the screen
+        TextureArray = 1 << 4, // Samples a texture array layer instead of the texture, never with Texture
+        COUNT = 5,
+        All = (1 << COUNT) - 1
+    };
+}
+static const char* ShaderFeatureDefines[] = {"HAS_TEXTURE", "HAS_POINT_LIGHTS", "HAS_SPOT_LIGHTS", "HAS_WEIGHTED_OIT", "HAS_TEXTURE_ARRAY"};
+StaticAssert(ArraySize(ShaderFeatureDefines) == shader_feature::COUNT);
+
+inline std::string ShaderDefine(const char* Name, int Value) {
+    return std::string{"#define "} + Name + " " + std::to_string(Value) + "\n";
+}
+
+// Resolves #include "file" (relative to the including file, each file at most once) and adds
+// #line directives so compile errors point at the right file, Files[N] is source string N.
+// Defines are inserted right after the #version line of the root file
+inline bool32 PreprocessShader(const std::string& Path, const std::string& Defines, std::string& Out, std::vector<std::string>& Files) {
+    if (!std::ifstream{Path}.is_open()) {
+        LogError("[Shader] Could not open %s\n", Path.c_str());
+        return false;
+    }
+
+    const auto FileIndex = (uint) Files.size();
+    Files.push_back(Path);
+
+    const auto Directory = Path.substr(0, Path.find_last_of("/\\") + 1);
+    const auto Source = ReadFile(Path);
+
+    uint LineNumber = 0;
+    size Start = 0;
+    while (Start < Source.size()) {
+        auto End = Source.find('\n', Start);
+        if (End == std::string::npos) { End = Source.size(); }
+        const auto Line = Source.substr(Start, End - Start);
+        Start = End + 1;
+        LineNumber++;
+
+        const auto FirstChar = Line.find_first_not_of(" \t");
+        if (FirstChar != std::string::npos && Line.compare(FirstChar, 8, "#include") == 0) {
+            const auto Open = Line.find('"', FirstChar);
+            const auto Close = Open != std::string::npos ? Line.find('"', Open + 1) : std::string::npos;
+            if (Close == std::string::npos) {
+                LogError("[Shader] %s:%u: malformed #include\n", Path.c_str(), LineNumber);
+                return false;
+            }
+
+            const auto IncludePath = Directory + Line.substr(Open + 1, Close - Open - 1);
+            bool32 AlreadyIncluded = false;
+            for (const auto& File : Files) { AlreadyIncluded |= (File == IncludePath); }
+
+            if (!AlreadyIncluded) {
+                Out += "#line 1 " + std::to_string(Files.size()) + "\n";
+                if (!PreprocessShader(IncludePath, "", Out, Files)) { return false; }
+            }
+            Out += "#line " + std::to_string(LineNumber + 1) + " " + std::to_string(FileIndex) + "\n";
+            continue;
+        }
+
+        Out += Line;
+        Out += '\n';
+
+        if (FirstChar != std::string::npos && Line.compare(FirstChar, 8, "#version") == 0 && !Defines.empty()) {
+            Out += Defines;
+            Out += "#line " + std::to_string(LineNumber + 1) + " " + std::to_string(FileIndex) + "\n";
+        }
+    }
+
+    return true;
+}
+
+// Defines of the features, all of them so the sources can test them with #if
+inline std::string ShaderFeatureDefinesOf(uint Features) {
+    std::string Result;
+    for (uint i = 0; i < shader_feature::COUNT; ++i) {
+        Result += ShaderDefine(ShaderFeatureDefines[i], (Features >> i) & 1);
+    }
+    return Result;
+}
+
+// Linked program binaries stored on disk, so later runs skip compiling and linking. Entries are
+// keyed by the preprocessed sources and the driver, binaries the driver rejects (it was updated,
+// the GPU changed) are deleted and the program is compiled from source again
+struct program_binary_cache {
+    static constexpr u32 Magic = 0x4E494250; // "PBIN"
+    static constexpr u32 Version = 1;
+
+    struct header {
+        u32 Magic;
+        u32 Version;
+        u64 Key;
+        u32 Format;
+        u32 Length;
+    };
+
+    bool32 Enabled = false;
+    std::string Directory;
+    u64 DriverHash = 0;
+
+    // Programs loaded from binaries, compiled from source and binaries rejected by the driver
+    uint Hits = 0;
+    uint Compiled = 0;
+    uint Rejected = 0;
+
+    /** Expects a current context, disables itself without driver support */
+    void Initialize(const std::string& CacheDirectory);
+
+    u64 Key(const std::array<std::string, shader_stage::TOTAL>& Sources) const;
+    std::string PathOf(u64 Key) const;
+
+    /** Hands the binary to the driver, false if missing or invalid. Whether the driver accepted it
+        is only queried once the program is finished, see render_program::FinishLoad */
+    bool32 Load(uint Program, u64 Key);
+    void Store(uint Program, u64 Key);
+    /** Deletes a binary the driver did not link */
+    void Reject(u64 Key);
+};
+
+static program_binary_cache ProgramCache;
+
+inline void program_binary_cache::Initialize(const std::string& CacheDirectory) {
+    GLint NumFormats = 0;
+    if (gl::exts::var_ARB_get_program_binary) {
+        gl::GetIntegerv(gl::NUM_PROGRAM_BINARY_FORMATS, &NumFormats);
+    }
+    if (NumFormats <= 0) {
+        LogError("[Shader] Program binaries not supported, the cache is disabled\n");
+        Enabled = false;
+        return;
+    }
+
+    Directory = CacheDirectory;
+    if (!MakeDirectory(Directory)) {
+        LogError("[Shader] Could not create the program cache directory %s\n", Directory.c_str());
+        Enabled = false;
+        return;
+    }
+
+    // Binaries are only valid for the driver that produced them
+    DriverHash = 0xcbf29ce484222325ull;
+    const GLenum DriverStrings[] = {gl::VENDOR, gl::RENDERER, gl::VERSION, gl::SHADING_LANGUAGE_VERSION};
+    for (auto Name : DriverStrings) {
+        auto String = (const char*) gl::GetString(Name);
+        if (String) { DriverHash = HashBytes(String, strlen(String), DriverHash); }
+    }
+
+    Enabled = true;
+}
+
+inline u64 program_binary_cache::Key(const std::array<std::string, shader_stage::TOTAL>& Sources) const {
+    auto Hash = HashBytes(&Version, SizeOf(Version), DriverHash);
+    for (uint iStage = 0; iStage < shader_stage::TOTAL; ++iStage) {
+        Hash = HashBytes(&iStage, SizeOf(iStage), Hash);
+        Hash = HashString(Sources[iStage], Hash);
+    }
+    return Hash;
+}
+
+inline std::string program_binary_cache::PathOf(u64 Key) const {
+    char Name[32];
+    sprintf(Name, "/%016llx.bin", (unsigned long long) Key);
+    return Directory + Name;
+}
+
+inline bool32 program_binary_cache::Load(uint Program, u64 Key) {
+    if (!Enabled) { return false; }
+
+    std::vector<u8> File;
+    if (!ReadBinaryFile(PathOf(Key), File)) { return false; }
+
+    header Header;
+    bool32 Valid = File.size() >= SizeOf(Header);
+    if (Valid) {
+        memcpy(&Header, File.data(), SizeOf(Header));
+        Valid = Header.Magic == Magic && Header.Version == Version && Header.Key == Key
+            && File.size() == SizeOf(Header) + Header.Length;
+    }
+
+    if (!Valid) {
+        Reject(Key);
+        return false;
+    }
+
+    // No status query here, it would wait for the driver to load every binary one by one
+    gl::ProgramBinary(Program, Header.Format, File.data() + SizeOf(Header), (GLsizei) Header.Length);
+    return true;
+}
+
+inline void program_binary_cache::Reject(u64 Key) {
+    Rejected++;
+    std::remove(PathOf(Key).c_str());
+}
+
+inline void program_binary_cache::Store(uint Program, u64 Key) {
+    if (!Enabled) { return; }
+
+    GLint Length = 0;
+    gl::GetProgramiv(Program, gl::PROGRAM_BINARY_LENGTH, &Length);
+    if (Length <= 0) { return; }
+
+    std::vector<u8> File(SizeOf(header) + Length);
+    header Header{Magic, Version, Key, 0, (u32) Length};
+    gl::GetProgramBinary(Program, Length, nullptr, (GLenum*) &Header.Format, File.data() + SizeOf(Header));
+    memcpy(File.data(), &Header, SizeOf(Header));
+
+    if (!WriteBinaryFile(PathOf(Key), File.data(), File.size())) {
+        LogError("[Shader] Could not write %s\n", PathOf(Key).c_str());
+    }
+}
+
 struct render_program {
     // Invalid value for program and shader handles
     static const uint INVALID_ID = 0xFFFFFFFF;
@@ -22,18 +249,54 @@ struct render_program {
     std::array<uint, shader_stage::TOTAL> Shaders;
     std::array<std::string, shader_stage::TOTAL> ShaderPaths;
 
+    uint Features;
+    std::string Defines; // Added to every stage, after the features
+
+    // Every file the stages were built from, includes too
+    std::vector<std::string> SourceFiles;
+
+    // State between BeginLoad and FinishLoad
+    std::array<std::vector<std::string>, shader_stage::TOTAL> StageFiles;
+    u64 CacheKey;
+    bool32 Cacheable;
+    bool32 LoadedFromCache;
+
     render_program();
 
     ~render_program();
 
+    /** Compiles and links synchronously */
     bool32 LoadShaders();
 
+    /** Issues the compiles and the link without waiting for them, see program_batch. Tries the
+        binary cache first unless UseCache is false */
+    void BeginLoad(bool32 UseCache = true);
+
+    /** True once the driver is done, never blocks. Always true without KHR_parallel_shader_compile */
+    bool32 IsLoadComplete() const;
+
+    /** Waits for the compile and link, reports errors */
+    bool32 FinishLoad();
+
     void KillShaders();
 
     void ReloadShaders();
+
+    /** Exchanges the GL objects with another build of the same program */
+    void Swap(render_program& Other);
 };
 
-inline render_program::render_program() : ID{INVALID_ID}, Shaders{}, ShaderPaths{} {
+// Lets the driver compile and link on its own threads, without this the work happens when the
+// status is queried. Needs a current context
+inline void EnableParallelShaderCompile() {
+    if (gl::exts::var_KHR_parallel_shader_compile) {
+        gl::MaxShaderCompilerThreadsKHR(0xFFFFFFFF); // As many as the driver likes
+    }
+}
+
+inline render_program::render_program()
+    : ID{INVALID_ID}, Shaders{}, ShaderPaths{}, Features{shader_feature::All}
+    , CacheKey{0}, Cacheable{false}, LoadedFromCache{false} {
     for (uint i = 0; i < shader_stage::TOTAL; ++i) {
         Shaders[i] = INVALID_ID;
         ShaderPaths[i] = "";
@@ -46,49 +309,144 @@ inline render_program::~render_program() {
 }
 
 inline bool32 render_program::LoadShaders() {
-    char Log[100];
+    BeginLoad();
+    return FinishLoad();
+}
 
+inline void render_program::BeginLoad(bool32 UseCache) {
     if (ID == INVALID_ID) { ID = gl::CreateProgram(); }
+    SourceFiles.clear();
+    const auto AllDefines = ShaderFeatureDefinesOf(Features) + Defines;
+
+    // Every stage is preprocessed first, the final sources key the binary cache
+    std::array<std::string, shader_stage::TOTAL> Sources;
+    Cacheable = true;
+    for (uint iStage = 0; iStage < shader_stage::TOTAL; ++iStage) {
+        StageFiles[iStage].clear();
+        if (ShaderPaths[iStage].empty()) { continue; }
+        if (!PreprocessShader(ShaderPaths[iStage], AllDefines, Sources[iStage], StageFiles[iStage])) {
+            Sources[iStage].clear();
+            Cacheable = false;
+            continue;
+        }
+        SourceFiles.insert(SourceFiles.end(), StageFiles[iStage].begin(), StageFiles[iStage].end());
+    }
+
+    CacheKey = ProgramCache.Key(Sources);
+    LoadedFromCache = UseCache && Cacheable && ProgramCache.Load(ID, CacheKey);
+    if (LoadedFromCache) { return; }
 
+    // No status queries in between, they would wait for each compile
     for (uint iStage = 0; iStage < shader_stage::TOTAL; ++iStage) {
-        const auto &Path = ShaderPaths[iStage];
+        const auto &Source = Sources[iStage];
         auto &Shader = Shaders[iStage];
 
-        if (!Path.empty()) {
+        if (!Source.empty()) {
             Shader = gl::CreateShader(InternalShaderTypes[iStage]);
 
-            auto Source = ReadFile(Path);
             auto SourceVar = Source.c_str();
             auto LengthVar = (int) Source.length();
             gl::ShaderSource(Shader, 1, &SourceVar, &LengthVar);
 
             gl::CompileShader(Shader);
-
-            GLint Success;
-            gl::GetShaderiv(Shader, gl::COMPILE_STATUS, &Success);
-
-            if (Success) {
-                gl::AttachShader(ID, Shader);
-            } else {
-                gl::GetShaderInfoLog(Shader, (GLsizei) SizeOf(Log)-1, nullptr, Log);
-                fprintf(stderr, "Error compiling shader %s: %s\n", Path.c_str(), Log);
-                continue;
-            }
+            gl::AttachShader(ID, Shader);
         }
     }
 
+    if (ProgramCache.Enabled) { gl::ProgramParameteri(ID, gl::PROGRAM_BINARY_RETRIEVABLE_HINT, true); }
     gl::LinkProgram(ID);
+    ProgramCache.Compiled++;
+}
+
+inline bool32 render_program::IsLoadComplete() const {
+    if (!gl::exts::var_KHR_parallel_shader_compile) { return true; }
 
+    GLint Complete = true;
+    gl::GetProgramiv(ID, gl::COMPLETION_STATUS_KHR, &Complete);
+    return (bool32) Complete;
+}
+
+inline bool32 render_program::FinishLoad() {
     GLint Success;
     gl::GetProgramiv(ID, gl::LINK_STATUS, &Success);
-    if (!Success) {
-        gl::GetProgramInfoLog(ID, (GLsizei) SizeOf(Log) - 1, nullptr, Log);
-        fprintf(stderr, "Error linking shader: %s\n", Log);
+
+    if (LoadedFromCache) {
+        if (Success) {
+            ProgramCache.Hits++;
+            return true;
+        }
+        // The driver changed since the binary was stored, build it from source after all
+        ProgramCache.Reject(CacheKey);
+        BeginLoad(false);
+        return FinishLoad();
     }
 
-    return (bool32) Success;
+    char Log[1024];
+
+    if (Success) {
+        if (Cacheable) { ProgramCache.Store(ID, CacheKey); }
+        return true;
+    }
+
+    // Find out which stage failed
+    for (uint iStage = 0; iStage < shader_stage::TOTAL; ++iStage) {
+        if (Shaders[iStage] == INVALID_ID) { continue; }
+
+        GLint Compiled;
+        gl::GetShaderiv(Shaders[iStage], gl::COMPILE_STATUS, &Compiled);
+        if (!Compiled) {
+            gl::GetShaderInfoLog(Shaders[iStage], (GLsizei) SizeOf(Log)-1, nullptr, Log);
+            fprintf(stderr, "Error compiling shader %s: %s\n", ShaderPaths[iStage].c_str(), Log);
+            for (uint iFile = 1; iFile < StageFiles[iStage].size(); ++iFile) {
+                fprintf(stderr, "    Source %u: %s\n", iFile, StageFiles[iStage][iFile].c_str());
+            }
+        }
+    }
+
+    gl::GetProgramInfoLog(ID, (GLsizei) SizeOf(Log) - 1, nullptr, Log);
+    fprintf(stderr, "Error linking shader: %s\n", Log);
+    return false;
 }
 
+// Programs loaded together: every compile and link is issued before any status is queried, so
+// the driver works on them in the background (on several threads with KHR_parallel_shader_compile)
+// while the application keeps loading other things
+struct program_batch {
+    std::vector<render_program*> Programs;
+
+    void Add(render_program& Program) {
+        Program.BeginLoad();
+        Programs.push_back(&Program);
+    }
+
+    /** Never blocks */
+    bool32 IsDone() const {
+        for (auto Program : Programs) { if (!Program->IsLoadComplete()) { return false; } }
+        return true;
+    }
+
+    bool32 Contains(const render_program& Program) const {
+        return std::find(Programs.begin(), Programs.end(), &Program) != Programs.end();
+    }
+
+    /** Waits for every program, true if all of them linked */
+    bool32 Finish() {
+        bool32 Success = true;
+        for (auto Program : Programs) { Success = Program->FinishLoad() && Success; }
+        Programs.clear();
+        return Success;
+    }
+
+    /** Finishes the programs the driver is done with and leaves the others, never blocks */
+    void FinishCompleted() {
+        for (auto It = Programs.begin(); It != Programs.end(); ) {
+            if (!(*It)->IsLoadComplete()) { ++It; continue; }
+            (*It)->FinishLoad();
+            It = Programs.erase(It);
+        }
+    }
+};
+
 inline void render_program::KillShaders() {
     for(auto& Shader : Shaders) {
         if(Shader != INVALID_ID) {
@@ -103,3 +461,102 @@ inline void render_program::ReloadShaders() {
     KillShaders();
     LoadShaders();
 }
+
+inline void render_program::Swap(render_program& Other) {
+    std::swap(ID, Other.ID);
+    std::swap(Shaders, Other.Shaders);
+    std::swap(SourceFiles, Other.SourceFiles);
+    std::swap(StageFiles, Other.StageFiles);
+    std::swap(CacheKey, Other.CacheKey);
+    std::swap(Cacheable, Other.Cacheable);
+    std::swap(LoadedFromCache, Other.LoadedFromCache);
+}
+
+// Programs built from the same sources with different features, usually all queued up front by
+// Precompile. A variant first asked for later (new features after a reload) is queued on the
+// variants' own batch and Get returns null until it has linked, so the frame never waits on the
+// compiler. Features the sources never test are masked out of the key, so variants that would
+// compile to the same code share a program
+struct shader_variants {
+    std::array<std::string, shader_stage::TOTAL> ShaderPaths;
+    std::string Defines;
+
+    // Features tested by any stage, scanned on first use
+    uint UsedFeatures;
+    bool32 Scanned;
+
+    std::unordered_map<uint, std::unique_ptr<render_program>> Programs;
+    program_batch Building; // Variants queued by Get
+
+    shader_variants() : ShaderPaths{}, UsedFeatures{0}, Scanned{false} {}
+
+    /** The variant with these features, null while it is still being built */
+    render_program* Get(uint Features);
+
+    /** Queues every variant not built yet, instead of building them on first use */
+    void Precompile(program_batch& Batch);
+
+    void ScanFeatures();
+};
+
+inline void shader_variants::ScanFeatures() {
+    auto IsIdentifierChar = [](char C) { return isalnum((unsigned char) C) || C == '_'; };
+
+    UsedFeatures = 0;
+    for (const auto& Path : ShaderPaths) {
+        if (Path.empty()) { continue; }
+
+        std::string Source;
+        std::vector<std::string> Files;
+        if (!PreprocessShader(Path, "", Source, Files)) { continue; }
+
+        for (uint i = 0; i < shader_feature::COUNT; ++i) {
+            const std::string Name = ShaderFeatureDefines[i];
+            for (auto At = Source.find(Name); At != std::string::npos; At = Source.find(Name, At + 1)) {
+                const auto End = At + Name.size();
+                if ((At == 0 || !IsIdentifierChar(Source[At - 1])) && (End == Source.size() || !IsIdentifierChar(Source[End]))) {
+                    UsedFeatures |= 1u << i;
+                    break;
+                }
+            }
+        }
+    }
+    Scanned = true;
+}
+
+inline render_program* shader_variants::Get(uint Features) {
+    if (!Scanned) { ScanFeatures(); }
+
+    if (!Building.Programs.empty()) { Building.FinishCompleted(); }
+
+    const auto Key = Features & UsedFeatures;
+    auto& Program = Programs[Key];
+    if (!Program) {
+        Program.reset(new render_program{});
+        Program->ShaderPaths = ShaderPaths;
+        Program->Features = Key;
+        Program->Defines = Defines;
+        Building.Add(*Program);
+    }
+    return Building.Contains(*Program) ? nullptr : Program.get();
+}
+
+inline void shader_variants::Precompile(program_batch& Batch) {
+    if (!Scanned) { ScanFeatures(); }
+
+    for (uint Features = 0; Features <= shader_feature::All; ++Features) {
+        // A draw samples one or the other
+        const uint BothTextures = shader_feature::Texture | shader_feature::TextureArray;
+        if ((Features & BothTextures) == BothTextures) { continue; }
+
+        auto& Program = Programs[Features & UsedFeatures];
+        if (Program) { continue; }
+
+        Program.reset(new render_program{});
+        Program->ShaderPaths = ShaderPaths;
+        Program->Features = Features & UsedFeatures;
+        Program->Defines = Defines;
+        Batch.Add(*Program);
+    }
+}
+
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <common.hpp>
+#include <file_watcher.hpp>
+#include <shader.hpp>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Rebuilds the programs whose sources (includes too) change on disk. The new program is built
+// next to the old one, which stays in use until the new one links; if it fails the last working
+// program is kept. Builds are finished at least a frame after being issued, so with
+// KHR_parallel_shader_compile the frame never waits on the compiler
+struct shader_hot_reload {
+	struct watched {
+		render_program* Program;    // Either a single program
+		shader_variants* Variants;  // or every variant built from the same sources
+		std::function<void()> OnReload;
+	};
+
+	struct rebuild {
+		render_program* Target;
+		std::unique_ptr<render_program> Build;
+		const watched* Owner;
+		uint FramesWaited;
+	};
+
+	file_watcher Watcher;
+	std::vector<std::unique_ptr<watched>> Watched;
+	std::vector<rebuild> Rebuilds;
+	std::vector<std::string> Changed;
+
+	bool32 Initialize() { return Watcher.Initialize(); }
+	void Shutdown();
+
+	/** OnReload runs after any of the programs was replaced, to set constant uniforms again */
+	void Add(render_program& Program, std::function<void()> OnReload = nullptr);
+	void Add(shader_variants& Variants, std::function<void()> OnReload = nullptr);
+
+	/** Polls the watcher, issues the rebuilds and swaps in the ones that linked, call once per frame */
+	void Update();
+
+	/** Rebuilds everything, as if every source changed */
+	void ReloadAll();
+
+	void Rebuild(render_program& Program, const watched& Owner);
+	void WatchSources(const std::vector<std::string>& Files);
+	static bool32 DependsOn(const render_program& Program, const std::vector<std::string>& Files);
+};
+
+inline void shader_hot_reload::Shutdown() {
+	Rebuilds.clear();
+	Watched.clear();
+	Watcher.Shutdown();
+}
+
+inline void shader_hot_reload::WatchSources(const std::vector<std::string>& Files) {
+	for (const auto& File : Files) { Watcher.Watch(File); }
+}
+
+inline bool32 shader_hot_reload::DependsOn(const render_program& Program, const std::vector<std::string>& Files) {
+	for (const auto& File : Files) {
+		if (std::find(Program.SourceFiles.begin(), Program.SourceFiles.end(), File) != Program.SourceFiles.end()) { return true; }
+	}
+	return false;
+}
+
+inline void shader_hot_reload::Add(render_program& Program, std::function<void()> OnReload) {
+	Watched.emplace_back(new watched{ &Program, nullptr, std::move(OnReload) });
+	WatchSources(Program.SourceFiles);
+}
+
+inline void shader_hot_reload::Add(shader_variants& Variants, std::function<void()> OnReload) {
+	Watched.emplace_back(new watched{ nullptr, &Variants, std::move(OnReload) });
+
+	// Variants may not be built yet, find the includes by preprocessing
+	for (const auto& Path : Variants.ShaderPaths) {
+		if (Path.empty()) { continue; }
+
+		std::string Source;
+		std::vector<std::string> Files;
+		PreprocessShader(Path, "", Source, Files);
+		WatchSources(Files);
+	}
+}
+
+inline void shader_hot_reload::Rebuild(render_program& Program, const watched& Owner) {
+	// A newer build replaces one still in flight
+	Rebuilds.erase(std::remove_if(Rebuilds.begin(), Rebuilds.end(), [&](const rebuild& Entry) { return Entry.Target == &Program; }), Rebuilds.end());
+
+	std::unique_ptr<render_program> Build{ new render_program{} };
+	Build->ShaderPaths = Program.ShaderPaths;
+	Build->Features = Program.Features;
+	Build->Defines = Program.Defines;
+	Build->BeginLoad();
+
+	Rebuilds.push_back(rebuild{ &Program, std::move(Build), &Owner, 0 });
+}
+
+inline void shader_hot_reload::Update() {
+	Changed.clear();
+	Watcher.Poll(Changed);
+
+	if (!Changed.empty()) {
+		for (const auto& File : Changed) { printf("[Shader] %s changed\n", File.c_str()); }
+
+		for (const auto& Entry : Watched) {
+			if (Entry->Program && DependsOn(*Entry->Program, Changed)) {
+				Rebuild(*Entry->Program, *Entry);
+			}
+
+			if (Entry->Variants) {
+				// Sources may test other features now, new combinations are built on first use
+				Entry->Variants->ScanFeatures();
+				for (auto& Variant : Entry->Variants->Programs) {
+					if (DependsOn(*Variant.second, Changed)) { Rebuild(*Variant.second, *Entry); }
+				}
+			}
+		}
+	}
+
+	for (auto It = Rebuilds.begin(); It != Rebuilds.end(); ) {
+		auto& Entry = *It;
+		if (Entry.FramesWaited++ == 0 || !Entry.Build->IsLoadComplete()) { ++It; continue; }
+
+		if (Entry.Build->FinishLoad()) {
+			Entry.Target->Swap(*Entry.Build); // The old program is deleted along with the build
+			WatchSources(Entry.Target->SourceFiles);
+			if (Entry.Owner->OnReload) { Entry.Owner->OnReload(); }
+		} else {
+			LogError("[Shader] Keeping the last working version of %s\n", Entry.Target->ShaderPaths[shader_stage::Fragment].c_str());
+		}
+
+		It = Rebuilds.erase(It);
+	}
+}
+
+inline void shader_hot_reload::ReloadAll() {
+	for (const auto& Entry : Watched) {
+		if (Entry->Program) { Rebuild(*Entry->Program, *Entry); }
+		if (Entry->Variants) {
+			Entry->Variants->ScanFeatures();
+			for (auto& Variant : Entry->Variants->Programs) { Rebuild(*Variant.second, *Entry); }
+		}
+	}
+}
@@ -2,8 +2,13 @@
 
 #include <common.hpp>
 #include <gl_33.hpp>
+#include <file.hpp>
+#include <gpu_memory.hpp>
+#include <mipmap.hpp>
+#include <texture_container.hpp>
 
 #define STB_IMAGE_IMPLEMENTATION
+#define STBI_THREAD_LOCAL thread_local // Workers decode concurrently, each reads its own stbi_failure_reason
 #include <stb_image.h>
 
 struct image {
@@ -20,10 +25,29 @@ image LoadImageFromFile(const char* Filename) {
 	return Image;
 }
 
+/** Channels to decode an image with, textures take 3 or 4: gray is expanded to RGB, gray and alpha to RGBA */
+inline int TextureChannels(int FileChannels) {
+	return FileChannels == 1 || FileChannels == 3 ? 3 : 4;
+}
+
 void FreeImage(image Image) {
 	if (Image.Data) stbi_image_free(Image.Data);
 }
 
+/** GL formats of 8-bit images, false for channel counts not yet supported */
+inline bool32 TextureFormats(int NumChannels, bool32 SRGB, GLint& InternalFormat, GLenum& Format) {
+	switch (NumChannels) {
+	case 3:
+		InternalFormat = SRGB ? gl::SRGB8 : gl::RGB8;
+		Format = gl::RGB;
+		return true;
+	case 4:
+		InternalFormat = SRGB ? gl::SRGB8_ALPHA8 : gl::RGBA8;
+		Format = gl::RGBA;
+		return true;
+	default: return false;
+	}
+}
 
 struct texture {
 	static constexpr uint INVALID_ID = (uint) -1;
@@ -42,63 +66,106 @@ struct texture {
 		, SRGB{ SRGB } {}
 
 	~texture() {
-		gl::DeleteTextures(1, &ID); ID = -1;
+		if (ID != INVALID_ID) {
+			GPUMemory.Release(gpu_resource::Texture, ID);
+			gl::DeleteTextures(1, &ID);
+			ID = INVALID_ID;
+		}
 	}
 
+	/** The texture, or Placeholder while it is still loading (see texture_streamer) or failed to */
+	uint IDOr(uint Placeholder) const { return ID != INVALID_ID ? ID : Placeholder; }
+
 	bool Load() {
 		if (Path.empty()) { return false; }
+		if (IsTextureContainer(Path)) { return LoadContainer(); }
+
+		// Decoded like an embedded image, so gray ones are expanded the same way
+		std::vector<u8> File;
+		if (!ReadBinaryFile(Path, File)) {
+			LogError("[Texture] Could not read %s\n", Path.c_str());
+			return false;
+		}
+		return LoadFromMemory(File.data(), File.size());
+	}
+
+	/** Decodes an image file held in memory (embedded in a model for instance), Path only names it */
+	bool LoadFromMemory(const void* Data, size_t Bytes) {
+		if (IsTextureContainerData(Data, Bytes)) { return UploadContainer(Data, Bytes); }
 
-		// Load Image
-		auto Image = LoadImageFromFile(Path.c_str());
+		int Channels = 4;
+		if (stbi_info_from_memory((const stbi_uc*) Data, (int) Bytes, nullptr, nullptr, &Channels)) { Channels = TextureChannels(Channels); }
+
+		image Image;
+		Image.Data = stbi_load_from_memory((const stbi_uc*) Data, (int) Bytes, &Image.Width, &Image.Height, &Image.NumChannels, Channels);
+		if (!Image.Data) {
+			LogError("[Texture] Could not decode %s: %s\n", Path.c_str(), stbi_failure_reason());
+			return false;
+		}
 		defer{ FreeImage(Image); };
+		Image.NumChannels = Channels; // stbi reports the file's
+		return Upload(Image);
+	}
+
+	/** A KTX or DDS file, mapped and uploaded straight from the mapping with the levels it holds: nothing is decoded or copied */
+	bool LoadContainer() {
+		mapped_file File;
+		if (!File.Open(Path)) {
+			LogError("[Texture] Could not open %s\n", Path.c_str());
+			return false;
+		}
+		return UploadContainer(File.Data, File.Bytes);
+	}
 
+	/** A KTX or DDS file held in memory, see texture_container.hpp */
+	bool UploadContainer(const void* Data, size_t Bytes) {
+		texture_container Container;
+		if (!ParseTextureContainer((const u8*) Data, Bytes, SRGB, Container, Path.c_str())) { return false; }
+		if (Container.NumFaces != 1) {
+			LogError("[Texture] %s is a cubemap, see texture_streamer::Load(cubemap&, ...)\n", Path.c_str());
+			return false;
+		}
+
+		Width = Container.Width;
+		Height = Container.Height;
+		NumChannels = ContainerNumChannels(Container);
+
+		gl::GenTextures(1, &ID);
+		gl::BindTexture(gl::TEXTURE_2D, ID);
+		UploadTextureContainer(gl::TEXTURE_2D, Container);
+		GPUMemory.Track(gpu_resource::Texture, ID, EstimateTextureBytes(Container.InternalFormat, Width, Height, 1, Container.NumLevels), Path);
+
+		return true;
+	}
+
+	/** Uploads the image with its mip chain, built on the CPU in linear space (see mipmap.hpp) */
+	bool Upload(const image& Image, mip_filter::type Filter = mip_filter::Kaiser) {
 		Width = Image.Width;
 		Height = Image.Height;
 		NumChannels = Image.NumChannels;
 
+		GLint InternalFormat = 0;
+		GLenum Format = 0;
+		const auto Supported = TextureFormats(NumChannels, SRGB, InternalFormat, Format);
+		Assert(Supported && "Image with number of channels not yet supported");
+
+		mip_chain Chain;
+		BuildMipChain(Image.Data, Width, Height, NumChannels, SRGB, Filter, Chain);
+
 		// Generate Texture
 		gl::GenTextures(1, &ID);
 		gl::BindTexture(gl::TEXTURE_2D, ID);
 		//		defer{ gl::BindTexture(gl::TEXTURE_2D, 0); }; // Unbinding is unnecessary if we guarantee no code uses leaking textures
+		// Filtering and wrapping come from the sampler it is drawn with, see sampler.hpp
 
-		gl::TexParameteri(gl::TEXTURE_2D, gl::TEXTURE_MIN_FILTER, gl::LINEAR_MIPMAP_LINEAR);
-		gl::TexParameteri(gl::TEXTURE_2D, gl::TEXTURE_MIN_FILTER, gl::LINEAR);
-
-		gl::TexParameteri(gl::TEXTURE_2D, gl::TEXTURE_WRAP_S, gl::CLAMP_TO_EDGE);
-		gl::TexParameteri(gl::TEXTURE_2D, gl::TEXTURE_WRAP_T, gl::CLAMP_TO_EDGE);
-
-		GLint InternalFormat = 0;
-		GLenum Format = 0;
-		if(SRGB) {
-			switch(NumChannels) {
-			case 3: 
-				InternalFormat = gl::SRGB8;
-				Format = gl::RGB;
-				break;
-			case 4:
-				InternalFormat = gl::SRGB8_ALPHA8;
-				Format = gl::RGBA;
-				break;
-			default: Assert(!"Image with number of channels not yet supported");
-			}
-		} else {
-			switch (NumChannels) {
-			case 3:
-				InternalFormat = gl::RGB;
-				Format = gl::RGB;
-				break;
-			case 4:
-				InternalFormat = gl::RGBA;
-				Format = gl::RGBA;
-				break;
-			default: Assert(!"Image with number of channels not yet supported");
-			}
+		AllocateTextureStorage(gl::TEXTURE_2D, (uint) Chain.Levels.size(), InternalFormat, Format, Width, Height);
+		gl::PixelStorei(gl::UNPACK_ALIGNMENT, 1); // Rows of RGB levels are not padded
+		for (uint Level = 0; Level < Chain.Levels.size(); ++Level) {
+			const auto& Info = Chain.Levels[Level];
+			gl::TexSubImage2D(gl::TEXTURE_2D, Level, 0, 0, Info.Width, Info.Height, Format, gl::UNSIGNED_BYTE, Chain.Data.data() + Info.Offset);
 		}
-
-		// As we wont do lighting in this asignment RGBA is acceptable, 
-		// but on further assignments we'll have to linearize sRGBA textures
-		gl::TexImage2D(gl::TEXTURE_2D, 0, InternalFormat, Width, Height, 0, Format, gl::UNSIGNED_BYTE, Image.Data);
-		gl::GenerateMipmap(gl::TEXTURE_2D);		
+		gl::PixelStorei(gl::UNPACK_ALIGNMENT, 4);
+		GPUMemory.Track(gpu_resource::Texture, ID, EstimateTextureBytes(InternalFormat, Width, Height, 1, 0), Path);
 
 		return true;
 	}
@@ -110,11 +177,10 @@ uint MakeBlankTexture() {
 	gl::BindTexture(gl::TEXTURE_2D, ID);
 	uint8 White[4] = { 255, 255, 255, 255 };
 	gl::TexImage2D(gl::TEXTURE_2D, 0, gl::RGBA, 1, 1, 0, gl::RGBA, gl::UNSIGNED_BYTE, White);
+	GPUMemory.Track(gpu_resource::Texture, ID, EstimateTextureBytes(gl::RGBA, 1, 1), "Blank");
 
-	gl::TexParameteri(gl::TEXTURE_2D, gl::TEXTURE_MIN_FILTER, gl::LINEAR_MIPMAP_LINEAR);
-	gl::TexParameteri(gl::TEXTURE_2D, gl::TEXTURE_MIN_FILTER, gl::LINEAR);
-	gl::TexParameteri(gl::TEXTURE_2D, gl::TEXTURE_WRAP_S, gl::CLAMP_TO_EDGE);
-	gl::TexParameteri(gl::TEXTURE_2D, gl::TEXTURE_WRAP_T, gl::CLAMP_TO_EDGE);
+	// A single level, complete under the mipmapped samplers too
+	gl::TexParameteri(gl::TEXTURE_2D, gl::TEXTURE_MAX_LEVEL, 0);
 
 	return ID;
 }
\ No newline at end of file
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <common.hpp>
+#include <gl_33.hpp>
+#include <gpu_memory.hpp>
+#include <material.hpp>
+#include <vector>
+
+// Textures of the same size and format packed as the layers of GL_TEXTURE_2D_ARRAYs. Materials then
+// name an (array, layer) pair, see texture_layer, and draws using different textures keep the same
+// binding and only change the layer uniform. A shape (size, format, levels) starts with a single
+// layer, so a texture whose shape is unique costs what a texture of its own would. A full array grows
+// to twice its layers, up to LayersPerArray, after which another array is started. GL 3.3 cannot copy
+// between textures (nor render into compressed ones), so layers are filled in place by the streamer,
+// see texture_streamer::Load(texture_layer&, ...), and growing replaces the array with a larger one:
+// the old array is retired, its layers streamed again into the new one by their owner (see
+// texture_registry::Update) and it is deleted once the last of them is freed
+
+struct texture_array {
+	GLuint ID;
+	int Width, Height;
+	GLint InternalFormat;
+	uint NumLevels;
+	uint NumLayers;
+	uint NumUsed;
+	std::vector<uint> FreeLayers; // Given back below NumUsed
+	bool32 Retired;               // Replaced by a larger array, no more layers are allocated from it
+};
+
+struct texture_arrays {
+	uint LayersPerArray = 16;
+	GLint MaxLayers = 0; // MAX_ARRAY_TEXTURE_LAYERS, queried with the first array
+
+	std::vector<texture_array> Arrays;
+	uint NumRetired = 0;
+
+	/** A free layer of an array with this shape, growing the array or creating another when they are
+	    all full. Format only describes the (absent) pixels of the allocation, as in TexImage3D */
+	texture_layer Allocate(int Width, int Height, GLint InternalFormat, GLenum Format, uint NumLevels);
+	/** Deletes a retired array with its last layer */
+	void Free(texture_layer Layer);
+
+	texture_array* Find(GLuint ID);
+	bool32 IsRetired(GLuint ID);
+	void Clear();
+};
+
+inline texture_layer texture_arrays::Allocate(int Width, int Height, GLint InternalFormat, GLenum Format, uint NumLevels) {
+	if (!MaxLayers) { gl::GetIntegerv(gl::MAX_ARRAY_TEXTURE_LAYERS, &MaxLayers); }
+	const auto MaxPerArray = glm::max(glm::min(LayersPerArray, (uint) MaxLayers), 1u);
+
+	// The shape's largest array that can still grow, there is at most one
+	texture_array* Growing = nullptr;
+	bool32 Exists = false;
+	for (auto& Array : Arrays) {
+		if (Array.Retired || Array.Width != Width || Array.Height != Height || Array.InternalFormat != InternalFormat || Array.NumLevels != NumLevels) { continue; }
+
+		if (!Array.FreeLayers.empty()) {
+			const auto Layer = Array.FreeLayers.back();
+			Array.FreeLayers.pop_back();
+			return texture_layer{ Array.ID, Layer };
+		}
+		if (Array.NumUsed < Array.NumLayers) { return texture_layer{ Array.ID, Array.NumUsed++ }; }
+		if (Array.NumLayers < MaxPerArray) { Growing = &Array; }
+		Exists = true;
+	}
+
+	texture_array Array{};
+	Array.Width = Width;
+	Array.Height = Height;
+	Array.InternalFormat = InternalFormat;
+	Array.NumLevels = NumLevels;
+	Array.NumLayers = Growing ? glm::min(Growing->NumLayers * 2, MaxPerArray) : Exists ? MaxPerArray : 1;
+	Array.NumUsed = 1;
+	if (Growing) {
+		// Its layers move over as their owners stream them again
+		Growing->Retired = true;
+		NumRetired++;
+	}
+
+	// Storage of every level and layer, immutable where supported. With no buffer bound since a bound one would be read from
+	gl::BindBuffer(gl::PIXEL_UNPACK_BUFFER, 0);
+	gl::GenTextures(1, &Array.ID);
+	gl::BindTexture(gl::TEXTURE_2D_ARRAY, Array.ID);
+	if (gl::exts::var_ARB_texture_storage) {
+		gl::TexStorage3D(gl::TEXTURE_2D_ARRAY, NumLevels, InternalFormat, Width, Height, Array.NumLayers);
+	} else {
+		for (uint Level = 0; Level < NumLevels; ++Level) {
+			gl::TexImage3D(gl::TEXTURE_2D_ARRAY, Level, InternalFormat, glm::max(Width >> Level, 1), glm::max(Height >> Level, 1), Array.NumLayers, 0, Format, gl::UNSIGNED_BYTE, nullptr);
+		}
+		gl::TexParameteri(gl::TEXTURE_2D_ARRAY, gl::TEXTURE_MAX_LEVEL, (GLint) NumLevels - 1);
+	}
+	// Filtering comes from the sampler it is drawn with, see sampler.hpp
+	gl::BindTexture(gl::TEXTURE_2D_ARRAY, 0);
+
+	GPUMemory.Track(gpu_resource::Texture, Array.ID, EstimateTextureBytes(InternalFormat, Width, Height, Array.NumLayers, NumLevels), "Texture Array");
+	Arrays.push_back(std::move(Array));
+	return texture_layer{ Arrays.back().ID, 0 };
+}
+
+inline void texture_arrays::Free(texture_layer Layer) {
+	auto Array = Find(Layer.Array);
+	Assert(Array && Layer.Layer < Array->NumUsed);
+	Array->FreeLayers.push_back(Layer.Layer);
+	if (!Array->Retired || Array->FreeLayers.size() < Array->NumUsed) { return; }
+
+	GPUMemory.Release(gpu_resource::Texture, Array->ID);
+	gl::DeleteTextures(1, &Array->ID);
+	Arrays.erase(Arrays.begin() + (Array - Arrays.data()));
+	NumRetired--;
+}
+
+inline texture_array* texture_arrays::Find(GLuint ID) {
+	for (auto& Array : Arrays) {
+		if (Array.ID == ID) { return &Array; }
+	}
+	return nullptr;
+}
+
+inline bool32 texture_arrays::IsRetired(GLuint ID) {
+	const auto Array = Find(ID);
+	return Array && Array->Retired;
+}
+
+inline void texture_arrays::Clear() {
+	for (auto& Array : Arrays) {
+		GPUMemory.Release(gpu_resource::Texture, Array.ID);
+		gl::DeleteTextures(1, &Array.ID);
+	}
+	Arrays.clear();
+	NumRetired = 0;
+}
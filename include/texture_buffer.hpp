@@ -0,0 +1,56 @@
+#pragma once
+
+#include <common.hpp>
+#include <gl_33.hpp>
+#include <gpu_memory.hpp>
+
+// Buffer object sampled as a texture (samplerBuffer in GLSL), grows as needed
+struct texture_buffer {
+	uint Buffer;
+	uint Texture;
+	GLenum InternalFormat;
+	u64 Capacity;
+	const char* DebugName;
+
+	void Initialize(GLenum InternalFormat, const char* DebugName);
+	void Shutdown();
+
+	void Upload(const void* Data, u64 Bytes);
+};
+
+inline void texture_buffer::Initialize(GLenum Format, const char* Name) {
+	InternalFormat = Format;
+	DebugName = Name;
+	Capacity = 0;
+
+	gl::GenBuffers(1, &Buffer);
+	gl::GenTextures(1, &Texture);
+
+	// Texture buffers can't be empty
+	const u64 Zeros[2] = { 0, 0 };
+	Upload(Zeros, SizeOf(Zeros));
+
+	gl::BindTexture(gl::TEXTURE_BUFFER, Texture);
+	gl::TexBuffer(gl::TEXTURE_BUFFER, InternalFormat, Buffer);
+	gl::BindTexture(gl::TEXTURE_BUFFER, 0);
+}
+
+inline void texture_buffer::Shutdown() {
+	GPUMemory.Release(gpu_resource::Buffer, Buffer);
+	gl::DeleteTextures(1, &Texture);
+	gl::DeleteBuffers(1, &Buffer);
+}
+
+inline void texture_buffer::Upload(const void* Data, u64 Bytes) {
+	gl::BindBuffer(gl::TEXTURE_BUFFER, Buffer);
+	defer{ gl::BindBuffer(gl::TEXTURE_BUFFER, 0); };
+
+	if (Bytes > Capacity) {
+		Capacity = glm::max(Bytes, 2 * Capacity);
+		GPUMemory.Track(gpu_resource::Buffer, Buffer, Capacity, DebugName);
+	}
+
+	// Orphan last frame's storage so we don't wait on draws still reading it
+	gl::BufferData(gl::TEXTURE_BUFFER, Capacity, nullptr, gl::STREAM_DRAW);
+	gl::BufferSubData(gl::TEXTURE_BUFFER, 0, Bytes, Data);
+}
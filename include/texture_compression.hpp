@@ -0,0 +1,327 @@
+#pragma once
+
+#include <common.hpp>
+#include <gl_33.hpp>
+#include <file.hpp>
+#include <jobs.hpp>
+#include <mipmap.hpp>
+#include <atomic>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TEXTURE_COMPRESSION_SSE2 true
+#include <emmintrin.h>
+#else
+#define TEXTURE_COMPRESSION_SSE2 false
+#endif
+
+// BC1 (DXT1) and BC3 (DXT5) encoding of 8-bit images, fast rather than optimal: the endpoints are
+// the inset bounding box of the block's colors and every pixel takes the palette entry nearest to
+// its projection on the line between them. Good enough for color maps, the point is 4-8x less
+// memory and upload bandwidth. Results are kept on disk by texture_cache since the source files
+// rarely change, along with the uncompressed mip chains of mipmap.hpp
+
+inline u16 PackRGB565(int R, int G, int B) {
+	return (u16) (((R * 31 + 127) / 255) << 11 | ((G * 63 + 127) / 255) << 5 | (B * 31 + 127) / 255);
+}
+
+inline void UnpackRGB565(u16 Color, int* RGB) {
+	const int R = Color >> 11 & 31, G = Color >> 5 & 63, B = Color & 31;
+	RGB[0] = R << 3 | R >> 2;
+	RGB[1] = G << 2 | G >> 4;
+	RGB[2] = B << 3 | B >> 2;
+}
+
+/** The 8 byte BC1 color block of 16 RGBA pixels (alpha ignored), always in four color mode */
+inline void EncodeBC1Block(const u8* Pixels, u8* Out) {
+	int Min[3], Max[3];
+#if TEXTURE_COMPRESSION_SSE2
+	{
+		__m128i Lo = _mm_loadu_si128((const __m128i*) Pixels);
+		__m128i Hi = Lo;
+		for (int i = 1; i < 4; ++i) {
+			const auto Row = _mm_loadu_si128((const __m128i*) (Pixels + 16 * i));
+			Lo = _mm_min_epu8(Lo, Row);
+			Hi = _mm_max_epu8(Hi, Row);
+		}
+		// Down to one pixel
+		Lo = _mm_min_epu8(Lo, _mm_shuffle_epi32(Lo, _MM_SHUFFLE(1, 0, 3, 2)));
+		Lo = _mm_min_epu8(Lo, _mm_shuffle_epi32(Lo, _MM_SHUFFLE(2, 3, 0, 1)));
+		Hi = _mm_max_epu8(Hi, _mm_shuffle_epi32(Hi, _MM_SHUFFLE(1, 0, 3, 2)));
+		Hi = _mm_max_epu8(Hi, _mm_shuffle_epi32(Hi, _MM_SHUFFLE(2, 3, 0, 1)));
+		const auto Low = (u32) _mm_cvtsi128_si32(Lo);
+		const auto High = (u32) _mm_cvtsi128_si32(Hi);
+		for (int k = 0; k < 3; ++k) {
+			Min[k] = Low >> 8 * k & 255;
+			Max[k] = High >> 8 * k & 255;
+		}
+	}
+#else
+	for (int k = 0; k < 3; ++k) {
+		Min[k] = 255;
+		Max[k] = 0;
+		for (int i = 0; i < 16; ++i) {
+			Min[k] = glm::min(Min[k], (int) Pixels[4 * i + k]);
+			Max[k] = glm::max(Max[k], (int) Pixels[4 * i + k]);
+		}
+	}
+#endif
+
+	// Inset by 1/16th of the range, the extremes are rarely worth the error they add elsewhere
+	for (int k = 0; k < 3; ++k) {
+		const auto Inset = (Max[k] - Min[k]) >> 4;
+		Min[k] += Inset;
+		Max[k] -= Inset;
+	}
+
+	// Max is at least Min in every channel, so the first endpoint is never below the second
+	const auto Color0 = PackRGB565(Max[0], Max[1], Max[2]);
+	const auto Color1 = PackRGB565(Min[0], Min[1], Min[2]);
+	memcpy(Out, &Color0, 2);
+	memcpy(Out + 2, &Color1, 2);
+	if (Color0 == Color1) {
+		memset(Out + 4, 0, 4);
+		return;
+	}
+
+	int End0[3], End1[3];
+	UnpackRGB565(Color0, End0);
+	UnpackRGB565(Color1, End1);
+	const int Dir[3] = { End0[0] - End1[0], End0[1] - End1[1], End0[2] - End1[2] };
+	const auto Start = End1[0] * Dir[0] + End1[1] * Dir[1] + End1[2] * Dir[2];
+	const auto Range = End0[0] * Dir[0] + End0[1] * Dir[1] + End0[2] * Dir[2] - Start;
+
+	// Palette entries sit at 0, 1/3, 2/3 and 1 of the range, compare six times the projection with
+	// the midpoints at 1/6, 3/6 and 5/6 to stay in integers. Steps count from the second endpoint
+	int Steps[16];
+#if TEXTURE_COMPRESSION_SSE2
+	{
+		const auto Zero = _mm_setzero_si128();
+		const auto Direction = _mm_setr_epi16((i16) Dir[0], (i16) Dir[1], (i16) Dir[2], 0, (i16) Dir[0], (i16) Dir[1], (i16) Dir[2], 0);
+		const auto Threshold1 = _mm_set1_epi32(Range);
+		const auto Threshold3 = _mm_set1_epi32(3 * Range);
+		const auto Threshold5 = _mm_set1_epi32(5 * Range);
+		const auto Origin = _mm_set1_epi32(Start);
+
+		// Dot products of two pixels, each lands in lanes 0 and 1 or 2 and 3
+		auto Dot2 = [&](__m128i Pair) {
+			const auto Products = _mm_madd_epi16(Pair, Direction);
+			return _mm_add_epi32(Products, _mm_shuffle_epi32(Products, _MM_SHUFFLE(2, 3, 0, 1)));
+		};
+
+		for (int i = 0; i < 4; ++i) {
+			const auto Row = _mm_loadu_si128((const __m128i*) (Pixels + 16 * i));
+			const auto Low = _mm_shuffle_epi32(Dot2(_mm_unpacklo_epi8(Row, Zero)), _MM_SHUFFLE(3, 1, 2, 0));
+			const auto High = _mm_shuffle_epi32(Dot2(_mm_unpackhi_epi8(Row, Zero)), _MM_SHUFFLE(3, 1, 2, 0));
+			auto Projection = _mm_sub_epi32(_mm_unpacklo_epi64(Low, High), Origin);
+			Projection = _mm_add_epi32(_mm_slli_epi32(Projection, 2), _mm_slli_epi32(Projection, 1)); // Times 6
+
+			// Comparisons are all ones when true, subtracting them counts
+			auto Count = _mm_sub_epi32(Zero, _mm_cmpgt_epi32(Projection, Threshold1));
+			Count = _mm_sub_epi32(Count, _mm_cmpgt_epi32(Projection, Threshold3));
+			Count = _mm_sub_epi32(Count, _mm_cmpgt_epi32(Projection, Threshold5));
+			_mm_storeu_si128((__m128i*) (Steps + 4 * i), Count);
+		}
+	}
+#else
+	for (int i = 0; i < 16; ++i) {
+		const auto Projection = 6 * (Pixels[4 * i] * Dir[0] + Pixels[4 * i + 1] * Dir[1] + Pixels[4 * i + 2] * Dir[2] - Start);
+		Steps[i] = (Projection > Range) + (Projection > 3 * Range) + (Projection > 5 * Range);
+	}
+#endif
+
+	// Steps 0, 1, 2 and 3 are the indices 1, 3, 2 and 0
+	u32 Indices = 0;
+	for (int i = 0; i < 16; ++i) {
+		const u32 Step = (u32) Steps[i];
+		const u32 Index = ((Step ^ Step >> 1) & 1) << 1 | (~Step >> 1 & 1);
+		Indices |= Index << 2 * i;
+	}
+	memcpy(Out + 4, &Indices, 4);
+}
+
+/** The 8 byte BC3 alpha block of 16 RGBA pixels, in eight value mode */
+inline void EncodeBC3AlphaBlock(const u8* Pixels, u8* Out) {
+	int Alpha0 = 0, Alpha1 = 255;
+	for (int i = 0; i < 16; ++i) {
+		Alpha0 = glm::max(Alpha0, (int) Pixels[4 * i + 3]);
+		Alpha1 = glm::min(Alpha1, (int) Pixels[4 * i + 3]);
+	}
+	Out[0] = (u8) Alpha0;
+	Out[1] = (u8) Alpha1;
+
+	// Values 0 to 7 from the second endpoint to the first are the indices 1, 7, 6, 5, 4, 3, 2 and 0
+	u64 Indices = 0;
+	const auto Range = Alpha0 - Alpha1;
+	if (Range > 0) {
+		for (int i = 0; i < 16; ++i) {
+			const auto Value = ((Pixels[4 * i + 3] - Alpha1) * 7 + Range / 2) / Range;
+			const u64 Index = Value == 7 ? 0 : Value == 0 ? 1 : 8 - Value;
+			Indices |= Index << 3 * i;
+		}
+	}
+	memcpy(Out + 2, &Indices, 6); // Little endian
+}
+
+/** Blocks are read with the edges clamped, so any size works */
+inline void CompressLevel(const u8* Rgba, int Width, int Height, bool32 Alpha, u8* Out) {
+	const auto BlocksX = (Width + 3) / 4;
+	const auto BlocksY = (Height + 3) / 4;
+	const auto BlockBytes = Alpha ? 16u : 8u;
+
+	Jobs.ParallelFor((uint) BlocksY, 8, [&](uint Begin, uint End) {
+		u8 Block[64];
+		for (auto y = (int) Begin; y < (int) End; ++y) {
+			for (int x = 0; x < BlocksX; ++x) {
+				for (int Row = 0; Row < 4; ++Row) {
+					const auto SourceY = glm::min(4 * y + Row, Height - 1);
+					for (int Column = 0; Column < 4; ++Column) {
+						const auto SourceX = glm::min(4 * x + Column, Width - 1);
+						memcpy(Block + 16 * Row + 4 * Column, Rgba + 4 * ((size_t) SourceY * Width + SourceX), 4);
+					}
+				}
+
+				auto Destination = Out + ((size_t) y * BlocksX + x) * BlockBytes;
+				if (Alpha) {
+					EncodeBC3AlphaBlock(Block, Destination);
+					Destination += 8;
+				}
+				EncodeBC1Block(Block, Destination);
+			}
+		}
+	});
+}
+
+/** BC3 when some pixel is not opaque, BC1 otherwise. With Mips the whole chain down to 1x1, see BuildMipChain */
+inline void CompressImage(const u8* Rgba, int Width, int Height, bool32 SRGB, bool32 Mips, mip_filter::type Filter, mip_chain& Result) {
+	bool32 Alpha = false;
+	for (size_t i = 0; i < (size_t) Width * Height && !Alpha; ++i) { Alpha = Rgba[4 * i + 3] != 255; }
+
+	if (Alpha) {
+		Result.InternalFormat = SRGB ? gl::COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT : gl::COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	} else {
+		Result.InternalFormat = SRGB ? gl::COMPRESSED_SRGB_S3TC_DXT1_EXT : gl::COMPRESSED_RGB_S3TC_DXT1_EXT;
+	}
+
+	// The levels are filtered in full first, then compressed one by one
+	mip_chain Pixels;
+	if (Mips) { BuildMipChain(Rgba, Width, Height, 4, SRGB, Filter, Pixels); }
+
+	Result.Levels.clear();
+	size_t Bytes = 0;
+	for (int LevelWidth = Width, LevelHeight = Height; ; LevelWidth = glm::max(LevelWidth / 2, 1), LevelHeight = glm::max(LevelHeight / 2, 1)) {
+		const auto LevelBytes = MipLevelBytes(Result.InternalFormat, LevelWidth, LevelHeight);
+		Result.Levels.push_back(mip_level{ Bytes, LevelBytes, LevelWidth, LevelHeight });
+		Bytes += LevelBytes;
+		if (!Mips || (LevelWidth == 1 && LevelHeight == 1)) { break; }
+	}
+	Result.Data.resize(Bytes);
+
+	for (size_t i = 0; i < Result.Levels.size(); ++i) {
+		const auto& Info = Result.Levels[i];
+		const auto Source = Mips ? Pixels.Data.data() + Pixels.Levels[i].Offset : Rgba;
+		CompressLevel(Source, Info.Width, Info.Height, Alpha, Result.Data.data() + Info.Offset);
+	}
+}
+
+// Compressed images and mip chains on disk, keyed by a hash of the source file's bytes and the
+// settings so an edited file is simply a miss
+struct texture_cache {
+	static constexpr u32 Magic = 'T' | 'X' << 8 | 'B' << 16 | 'C' << 24;
+	static constexpr u32 Version = 2; // Bump on any change to the encoder, the mip filters or the layout
+
+	struct header {
+		u32 Magic;
+		u32 Version;
+		u64 Key;
+		u32 InternalFormat;
+		u32 NumLevels;
+		i32 Width, Height;
+	};
+
+	bool32 Enabled = false;
+	std::string Directory;
+
+	// Written by the decoding workers
+	std::atomic<uint> Hits{ 0 };
+	std::atomic<uint> Misses{ 0 };
+
+	void Initialize(const std::string& CacheDirectory);
+
+	u64 Key(const void* FileData, size_t Bytes, bool32 SRGB, bool32 Mips, bool32 Compressed, mip_filter::type Filter) const;
+	std::string PathOf(u64 Key) const;
+
+	/** False if missing or invalid */
+	bool32 Load(u64 Key, mip_chain& Result);
+	void Store(u64 Key, const mip_chain& Image);
+};
+
+static texture_cache TextureCache;
+
+inline void texture_cache::Initialize(const std::string& CacheDirectory) {
+	Directory = CacheDirectory;
+	Enabled = MakeDirectory(Directory);
+	if (!Enabled) { LogError("[Texture] Could not create the texture cache directory %s\n", Directory.c_str()); }
+}
+
+inline u64 texture_cache::Key(const void* FileData, size_t Bytes, bool32 SRGB, bool32 Mips, bool32 Compressed, mip_filter::type Filter) const {
+	const u32 Settings[] = { Version, (u32) SRGB, (u32) Mips, (u32) Compressed, (u32) Filter };
+	return HashBytes(FileData, Bytes, HashBytes(Settings, SizeOf(Settings)));
+}
+
+inline std::string texture_cache::PathOf(u64 Key) const {
+	char Name[32];
+	sprintf(Name, "/%016llx.bc", (unsigned long long) Key);
+	return Directory + Name;
+}
+
+inline bool32 texture_cache::Load(u64 Key, mip_chain& Result) {
+	if (!Enabled) { return false; }
+
+	std::vector<u8> File;
+	if (!ReadBinaryFile(PathOf(Key), File) || File.size() < SizeOf(header)) {
+		Misses++;
+		return false;
+	}
+
+	header Header;
+	memcpy(&Header, File.data(), SizeOf(Header));
+	bool32 Valid = Header.Magic == Magic && Header.Version == Version && Header.Key == Key
+		&& Header.Width > 0 && Header.Height > 0 && Header.NumLevels > 0 && Header.NumLevels <= 32;
+
+	Result.InternalFormat = Header.InternalFormat;
+	Result.Levels.clear();
+	size_t Bytes = 0;
+	for (uint i = 0; Valid && i < Header.NumLevels; ++i) {
+		const auto Width = glm::max(Header.Width >> i, 1);
+		const auto Height = glm::max(Header.Height >> i, 1);
+		const auto LevelBytes = MipLevelBytes(Header.InternalFormat, Width, Height);
+		Result.Levels.push_back(mip_level{ Bytes, LevelBytes, Width, Height });
+		Bytes += LevelBytes;
+	}
+
+	if (!Valid || File.size() != SizeOf(Header) + Bytes) {
+		Misses++;
+		std::remove(PathOf(Key).c_str());
+		return false;
+	}
+
+	Result.Data.assign(File.begin() + SizeOf(Header), File.end());
+	Hits++;
+	return true;
+}
+
+inline void texture_cache::Store(u64 Key, const mip_chain& Image) {
+	if (!Enabled || Image.Levels.empty()) { return; }
+
+	header Header{ Magic, Version, Key, Image.InternalFormat, (u32) Image.Levels.size(), Image.Levels[0].Width, Image.Levels[0].Height };
+	std::vector<u8> File(SizeOf(Header) + Image.Data.size());
+	memcpy(File.data(), &Header, SizeOf(Header));
+	memcpy(File.data() + SizeOf(Header), Image.Data.data(), Image.Data.size());
+
+	if (!WriteBinaryFile(PathOf(Key), File.data(), File.size())) {
+		LogError("[Texture] Could not write %s\n", PathOf(Key).c_str());
+	}
+}
@@ -0,0 +1,366 @@
+#pragma once
+
+#include <common.hpp>
+#include <gl_33.hpp>
+#include <gpu_memory.hpp>
+#include <mipmap.hpp>
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// KTX (1 and 2) and DDS files, which hold every level (and cubemap face) already in a GL format, so
+// loading one is only pointing the GL at its bytes. Parsing never copies, the images point into the
+// file's memory, a mapped_file typically. Supported are 8-bit RGB(A) and BGR(A), half float RGBA and
+// the BC1-BC5 block formats. KTX2 supercompression, arrays and 3D textures are not. As for decoded
+// images, whether color is sRGB is the texture's setting, the sRGB variant of the file's format is
+// picked (or dropped) accordingly
+
+struct container_image {
+	const u8* Data; // Into the file
+	size_t Bytes;
+	int Width, Height;
+};
+
+struct texture_container {
+	GLint InternalFormat;
+	GLenum Format, Type; // Of the pixels, unused when compressed
+	int Width, Height;
+	uint NumLevels;
+	uint NumFaces;       // 6 for a cubemap, in the order of the GL's face targets
+	uint RowAlignment;   // UNPACK_ALIGNMENT of the rows, KTX1 pads them to 4 bytes
+	std::vector<container_image> Images; // Level by level, every face of a level in a row
+
+	bool32 IsCompressed() const { return BlockBytes(InternalFormat) > 0; }
+	const container_image& Image(uint Level, uint Face) const { return Images[Level * NumFaces + Face]; }
+};
+
+/** By extension: .ktx, .ktx2 or .dds */
+inline bool32 IsTextureContainer(const std::string& Path) {
+	auto Dot = Path.find_last_of('.');
+	if (Dot == std::string::npos) { return false; }
+	auto Extension = Path.substr(Dot + 1);
+	for (auto& c : Extension) { c = (char) tolower(c); }
+	return Extension == "ktx" || Extension == "ktx2" || Extension == "dds";
+}
+
+/** By the first bytes, for files without a name (embedded in a model for instance) */
+inline bool32 IsTextureContainerData(const void* Data, size_t Bytes) {
+	static const u8 KTXIdentifier[] = { 0xAB, 'K', 'T', 'X', ' ' };
+	return (Bytes >= SizeOf(KTXIdentifier) && memcmp(Data, KTXIdentifier, SizeOf(KTXIdentifier)) == 0)
+		|| (Bytes >= 4 && memcmp(Data, "DDS ", 4) == 0);
+}
+
+/** The sRGB or the linear variant of InternalFormat, unchanged for formats without one */
+inline GLenum ContainerSRGB(GLenum InternalFormat, bool32 SRGB) {
+	static const GLenum Pairs[][2] = {
+		{ gl::RGBA8, gl::SRGB8_ALPHA8 },
+		{ gl::RGB8, gl::SRGB8 },
+		{ gl::COMPRESSED_RGB_S3TC_DXT1_EXT, gl::COMPRESSED_SRGB_S3TC_DXT1_EXT },
+		{ gl::COMPRESSED_RGBA_S3TC_DXT1_EXT, gl::COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT },
+		{ gl::COMPRESSED_RGBA_S3TC_DXT3_EXT, gl::COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT },
+		{ gl::COMPRESSED_RGBA_S3TC_DXT5_EXT, gl::COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT },
+	};
+	for (const auto& Pair : Pairs) {
+		if (InternalFormat == Pair[0] || InternalFormat == Pair[1]) { return Pair[SRGB ? 1 : 0]; }
+	}
+	return InternalFormat;
+}
+
+inline bool32 ContainerFormatSupported(GLenum InternalFormat) {
+	switch (ContainerSRGB(InternalFormat, false)) {
+	case gl::RGBA8: case gl::RGB8: case gl::RGBA16F:
+	case gl::COMPRESSED_RED_RGTC1: case gl::COMPRESSED_SIGNED_RED_RGTC1:
+	case gl::COMPRESSED_RG_RGTC2: case gl::COMPRESSED_SIGNED_RG_RGTC2:
+		return true;
+	case gl::COMPRESSED_RGB_S3TC_DXT1_EXT: case gl::COMPRESSED_RGBA_S3TC_DXT1_EXT:
+	case gl::COMPRESSED_RGBA_S3TC_DXT3_EXT: case gl::COMPRESSED_RGBA_S3TC_DXT5_EXT:
+		return gl::exts::var_EXT_texture_compression_s3tc && gl::exts::var_EXT_texture_sRGB;
+	default:
+		return false;
+	}
+}
+
+/** Bytes of one image of the container's format, rows padded to RowAlignment */
+inline size_t ContainerImageBytes(const texture_container& Container, int Width, int Height) {
+	if (const auto Block = BlockBytes(Container.InternalFormat)) { return (size_t) ((Width + 3) / 4) * ((Height + 3) / 4) * Block; }
+
+	const auto Channels = Container.Format == gl::RGBA || Container.Format == gl::BGRA ? 4u : 3u;
+	const auto ChannelBytes = Container.Type == gl::HALF_FLOAT ? 2u : 1u;
+	const auto RowBytes = (Width * Channels * ChannelBytes + Container.RowAlignment - 1) / Container.RowAlignment * Container.RowAlignment;
+	return (size_t) RowBytes * Height;
+}
+
+inline u32 ContainerU32(const u8* Data) {
+	u32 Result;
+	memcpy(&Result, Data, SizeOf(Result));
+	return Result;
+}
+
+inline u64 ContainerU64(const u8* Data) {
+	u64 Result;
+	memcpy(&Result, Data, SizeOf(Result));
+	return Result;
+}
+
+/** Adds the image of Level at Offset, false when it does not have the expected size or lies outside the file */
+inline bool32 AddContainerImage(texture_container& Container, const u8* File, size_t FileBytes, size_t Offset, size_t Bytes, uint Level) {
+	const auto Width = glm::max(Container.Width >> Level, 1);
+	const auto Height = glm::max(Container.Height >> Level, 1);
+	if (Bytes != ContainerImageBytes(Container, Width, Height) || Offset > FileBytes || Bytes > FileBytes - Offset) { return false; }
+
+	Container.Images.push_back(container_image{ File + Offset, Bytes, Width, Height });
+	return true;
+}
+
+/** The fields every format has, checked before the images are */
+inline bool32 ContainerHeaderValid(const texture_container& Container) {
+	if (!ContainerFormatSupported((GLenum) Container.InternalFormat)) { return false; }
+	if (!Container.IsCompressed()) {
+		const auto ValidFormat = Container.Format == gl::RGB || Container.Format == gl::BGR || Container.Format == gl::RGBA || Container.Format == gl::BGRA;
+		const auto Half = Container.InternalFormat == gl::RGBA16F;
+		if (!ValidFormat || Container.Type != (Half ? gl::HALF_FLOAT : gl::UNSIGNED_BYTE)) { return false; }
+	}
+	return Container.Width > 0 && Container.Height > 0 && (Container.NumFaces == 1 || Container.NumFaces == 6)
+		&& Container.NumLevels > 0 && Container.NumLevels <= NumMipLevels(Container.Width, Container.Height);
+}
+
+inline bool32 ParseKTX(const u8* Data, size_t Bytes, texture_container& Result) {
+	const size_t HeaderBytes = 64;
+	if (Bytes < HeaderBytes || ContainerU32(Data + 12) != 0x04030201) { return false; } // Big endian files are not supported
+
+	Result.Type = ContainerU32(Data + 16);
+	Result.Format = ContainerU32(Data + 24);
+	Result.InternalFormat = (GLint) ContainerU32(Data + 28);
+	Result.Width = (int) ContainerU32(Data + 36);
+	Result.Height = (int) ContainerU32(Data + 40);
+	Result.NumFaces = ContainerU32(Data + 52);
+	Result.NumLevels = glm::max(ContainerU32(Data + 56), 1u); // 0 asks for generated mipmaps, only the top level is there
+	Result.RowAlignment = 4;
+	const auto Depth = ContainerU32(Data + 44);
+	const auto ArrayElements = ContainerU32(Data + 48);
+	const auto KeyValueBytes = ContainerU32(Data + 60);
+
+	// Unsized formats are what older exporters write
+	switch (Result.InternalFormat) {
+	case gl::RGBA: Result.InternalFormat = gl::RGBA8; break;
+	case gl::RGB: Result.InternalFormat = gl::RGB8; break;
+	case gl::SRGB_ALPHA: Result.InternalFormat = gl::SRGB8_ALPHA8; break;
+	case gl::SRGB: Result.InternalFormat = gl::SRGB8; break;
+	}
+	if (Depth != 0 || ArrayElements != 0 || !ContainerHeaderValid(Result)) { return false; }
+
+	// Each level is its size then its faces, every face and level padded to 4 bytes
+	auto Offset = HeaderBytes + KeyValueBytes;
+	for (uint Level = 0; Level < Result.NumLevels; ++Level) {
+		if (Offset + 4 > Bytes) { return false; }
+		const auto ImageBytes = (size_t) ContainerU32(Data + Offset);
+		Offset += 4;
+		for (uint Face = 0; Face < Result.NumFaces; ++Face) {
+			if (!AddContainerImage(Result, Data, Bytes, Offset, ImageBytes, Level)) { return false; }
+			Offset += (ImageBytes + 3) & ~(size_t) 3;
+		}
+	}
+	return true;
+}
+
+inline bool32 ParseKTX2(const u8* Data, size_t Bytes, texture_container& Result) {
+	const size_t HeaderBytes = 80;
+	if (Bytes < HeaderBytes) { return false; }
+
+	const auto VkFormat = ContainerU32(Data + 12);
+	Result.Width = (int) ContainerU32(Data + 20);
+	Result.Height = (int) ContainerU32(Data + 24);
+	Result.NumFaces = ContainerU32(Data + 36);
+	Result.NumLevels = glm::max(ContainerU32(Data + 40), 1u);
+	Result.RowAlignment = 1;
+	const auto Depth = ContainerU32(Data + 28);
+	const auto Layers = ContainerU32(Data + 32);
+	const auto Supercompression = ContainerU32(Data + 44);
+
+	// VkFormat values, the block formats' sRGB variants follow their UNORM ones
+	Result.Type = gl::UNSIGNED_BYTE;
+	switch (VkFormat) {
+	case 23: case 29: Result.InternalFormat = gl::RGB8; Result.Format = gl::RGB; break;
+	case 37: case 43: Result.InternalFormat = gl::RGBA8; Result.Format = gl::RGBA; break;
+	case 44: case 50: Result.InternalFormat = gl::RGBA8; Result.Format = gl::BGRA; break;
+	case 97: Result.InternalFormat = gl::RGBA16F; Result.Format = gl::RGBA; Result.Type = gl::HALF_FLOAT; break;
+	case 131: case 132: Result.InternalFormat = gl::COMPRESSED_RGB_S3TC_DXT1_EXT; break;
+	case 133: case 134: Result.InternalFormat = gl::COMPRESSED_RGBA_S3TC_DXT1_EXT; break;
+	case 135: case 136: Result.InternalFormat = gl::COMPRESSED_RGBA_S3TC_DXT3_EXT; break;
+	case 137: case 138: Result.InternalFormat = gl::COMPRESSED_RGBA_S3TC_DXT5_EXT; break;
+	case 139: Result.InternalFormat = gl::COMPRESSED_RED_RGTC1; break;
+	case 140: Result.InternalFormat = gl::COMPRESSED_SIGNED_RED_RGTC1; break;
+	case 141: Result.InternalFormat = gl::COMPRESSED_RG_RGTC2; break;
+	case 142: Result.InternalFormat = gl::COMPRESSED_SIGNED_RG_RGTC2; break;
+	default: return false;
+	}
+	if (Depth != 0 || Layers != 0 || Supercompression != 0 || !ContainerHeaderValid(Result)) { return false; }
+	if (HeaderBytes + 24 * (size_t) Result.NumLevels > Bytes) { return false; }
+
+	// The level index gives each level's faces, one after the other
+	for (uint Level = 0; Level < Result.NumLevels; ++Level) {
+		const auto Entry = Data + HeaderBytes + 24 * Level;
+		const auto Offset = (size_t) ContainerU64(Entry);
+		const auto LevelBytes = (size_t) ContainerU64(Entry + 8);
+		const auto FaceBytes = LevelBytes / Result.NumFaces;
+		if (Offset > Bytes || LevelBytes > Bytes) { return false; }
+		for (uint Face = 0; Face < Result.NumFaces; ++Face) {
+			if (!AddContainerImage(Result, Data, Bytes, Offset + Face * FaceBytes, FaceBytes, Level)) { return false; }
+		}
+	}
+	return true;
+}
+
+inline bool32 ParseDDS(const u8* Data, size_t Bytes, texture_container& Result) {
+	const size_t HeaderBytes = 128, DX10HeaderBytes = 20;
+	if (Bytes < HeaderBytes || ContainerU32(Data + 4) != 124) { return false; }
+
+	auto FourCC = [](const char* Code) { return (u32) Code[0] | (u32) Code[1] << 8 | (u32) Code[2] << 16 | (u32) Code[3] << 24; };
+	const u32 MipMapCountFlag = 0x20000, AlphaPixelsFlag = 0x1, FourCCFlag = 0x4, RGBFlag = 0x40;
+	const u32 CubemapFlag = 0x200, AllFacesFlags = 0xFC00;
+
+	const auto Flags = ContainerU32(Data + 8);
+	Result.Height = (int) ContainerU32(Data + 12);
+	Result.Width = (int) ContainerU32(Data + 16);
+	Result.NumLevels = Flags & MipMapCountFlag ? glm::max(ContainerU32(Data + 28), 1u) : 1u;
+	Result.RowAlignment = 1;
+	const auto PixelFlags = ContainerU32(Data + 80);
+	const auto Code = ContainerU32(Data + 84);
+	const auto BitCount = ContainerU32(Data + 88);
+	const auto RedMask = ContainerU32(Data + 92);
+	const auto Caps2 = ContainerU32(Data + 112);
+	Result.NumFaces = Caps2 & CubemapFlag ? 6 : 1;
+	if (Result.NumFaces == 6 && (Caps2 & AllFacesFlags) != AllFacesFlags) { return false; } // Partial cubemaps
+
+	auto Offset = HeaderBytes;
+	Result.Type = gl::UNSIGNED_BYTE;
+	if ((PixelFlags & FourCCFlag) && Code == FourCC("DX10")) {
+		if (Bytes < HeaderBytes + DX10HeaderBytes) { return false; }
+		Offset += DX10HeaderBytes;
+		const auto DXGIFormat = ContainerU32(Data + 128);
+		const auto MiscFlags = ContainerU32(Data + 136);
+		const auto ArraySize = ContainerU32(Data + 140);
+		if (ArraySize != 1) { return false; }
+		Result.NumFaces = MiscFlags & 0x4 ? 6 : 1;
+
+		switch (DXGIFormat) {
+		case 10: Result.InternalFormat = gl::RGBA16F; Result.Format = gl::RGBA; Result.Type = gl::HALF_FLOAT; break;
+		case 28: case 29: Result.InternalFormat = gl::RGBA8; Result.Format = gl::RGBA; break;
+		case 87: case 91: Result.InternalFormat = gl::RGBA8; Result.Format = gl::BGRA; break;
+		case 71: case 72: Result.InternalFormat = gl::COMPRESSED_RGBA_S3TC_DXT1_EXT; break;
+		case 74: case 75: Result.InternalFormat = gl::COMPRESSED_RGBA_S3TC_DXT3_EXT; break;
+		case 77: case 78: Result.InternalFormat = gl::COMPRESSED_RGBA_S3TC_DXT5_EXT; break;
+		case 80: Result.InternalFormat = gl::COMPRESSED_RED_RGTC1; break;
+		case 81: Result.InternalFormat = gl::COMPRESSED_SIGNED_RED_RGTC1; break;
+		case 83: Result.InternalFormat = gl::COMPRESSED_RG_RGTC2; break;
+		case 84: Result.InternalFormat = gl::COMPRESSED_SIGNED_RG_RGTC2; break;
+		default: return false;
+		}
+	} else if (PixelFlags & FourCCFlag) {
+		if (Code == FourCC("DXT1")) {
+			Result.InternalFormat = PixelFlags & AlphaPixelsFlag ? gl::COMPRESSED_RGBA_S3TC_DXT1_EXT : gl::COMPRESSED_RGB_S3TC_DXT1_EXT;
+		} else if (Code == FourCC("DXT3")) {
+			Result.InternalFormat = gl::COMPRESSED_RGBA_S3TC_DXT3_EXT;
+		} else if (Code == FourCC("DXT5")) {
+			Result.InternalFormat = gl::COMPRESSED_RGBA_S3TC_DXT5_EXT;
+		} else if (Code == FourCC("ATI1") || Code == FourCC("BC4U")) {
+			Result.InternalFormat = gl::COMPRESSED_RED_RGTC1;
+		} else if (Code == FourCC("ATI2") || Code == FourCC("BC5U")) {
+			Result.InternalFormat = gl::COMPRESSED_RG_RGTC2;
+		} else if (Code == 113) { // D3DFMT_A16B16G16R16F
+			Result.InternalFormat = gl::RGBA16F;
+			Result.Format = gl::RGBA;
+			Result.Type = gl::HALF_FLOAT;
+		} else {
+			return false;
+		}
+	} else if ((PixelFlags & RGBFlag) && (BitCount == 32 || BitCount == 24)) {
+		// Red in the low byte is RGB(A) in memory, in the third byte BGR(A)
+		const auto Alpha = BitCount == 32;
+		Result.InternalFormat = Alpha ? gl::RGBA8 : gl::RGB8;
+		if (RedMask == 0xFF) {
+			Result.Format = Alpha ? gl::RGBA : gl::RGB;
+		} else if (RedMask == 0xFF0000) {
+			Result.Format = Alpha ? gl::BGRA : gl::BGR;
+		} else {
+			return false;
+		}
+	} else {
+		return false;
+	}
+	if (!ContainerHeaderValid(Result)) { return false; }
+
+	// Face by face, each with all its levels, reordered level by level once read
+	for (uint Face = 0; Face < Result.NumFaces; ++Face) {
+		for (uint Level = 0; Level < Result.NumLevels; ++Level) {
+			const auto ImageBytes = ContainerImageBytes(Result, glm::max(Result.Width >> Level, 1), glm::max(Result.Height >> Level, 1));
+			if (!AddContainerImage(Result, Data, Bytes, Offset, ImageBytes, Level)) { return false; }
+			Offset += ImageBytes;
+		}
+	}
+	std::vector<container_image> Images(Result.Images.size());
+	for (uint Face = 0; Face < Result.NumFaces; ++Face) {
+		for (uint Level = 0; Level < Result.NumLevels; ++Level) { Images[Level * Result.NumFaces + Face] = Result.Images[Face * Result.NumLevels + Level]; }
+	}
+	Result.Images.swap(Images);
+	return true;
+}
+
+/** Parses a KTX, KTX2 or DDS file held in memory, which has to outlive Result. Name only names it in errors */
+inline bool32 ParseTextureContainer(const u8* Data, size_t Bytes, bool32 SRGB, texture_container& Result, const char* Name) {
+	static const u8 KTXIdentifier[] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+	static const u8 KTX2Identifier[] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+	Result = texture_container{};
+	bool32 Valid;
+	if (Bytes >= SizeOf(KTXIdentifier) && memcmp(Data, KTXIdentifier, SizeOf(KTXIdentifier)) == 0) {
+		Valid = ParseKTX(Data, Bytes, Result);
+	} else if (Bytes >= SizeOf(KTX2Identifier) && memcmp(Data, KTX2Identifier, SizeOf(KTX2Identifier)) == 0) {
+		Valid = ParseKTX2(Data, Bytes, Result);
+	} else if (Bytes >= 4 && memcmp(Data, "DDS ", 4) == 0) {
+		Valid = ParseDDS(Data, Bytes, Result);
+	} else {
+		LogError("[Texture] %s is not a KTX or DDS file\n", Name);
+		return false;
+	}
+
+	if (!Valid) {
+		LogError("[Texture] %s: Unsupported or truncated container (format 0x%X)\n", Name, Result.InternalFormat);
+		return false;
+	}
+	Result.InternalFormat = (GLint) ContainerSRGB((GLenum) Result.InternalFormat, SRGB);
+	return true;
+}
+
+/** Channels the format stores, as texture::NumChannels reports them */
+inline int ContainerNumChannels(const texture_container& Container) {
+	switch (ContainerSRGB((GLenum) Container.InternalFormat, false)) {
+	case gl::COMPRESSED_RED_RGTC1: case gl::COMPRESSED_SIGNED_RED_RGTC1: return 1;
+	case gl::COMPRESSED_RG_RGTC2: case gl::COMPRESSED_SIGNED_RG_RGTC2: return 2;
+	case gl::COMPRESSED_RGB_S3TC_DXT1_EXT: case gl::RGB8: return 3;
+	default: return 4;
+	}
+}
+
+/** Allocates the storage of the bound TEXTURE_2D or TEXTURE_CUBE_MAP and uploads every image straight from the container */
+inline void UploadTextureContainer(GLenum Target, const texture_container& Container) {
+	const auto Format = Container.IsCompressed() ? (GLenum) gl::RGBA : Container.Format;
+	gl::BindBuffer(gl::PIXEL_UNPACK_BUFFER, 0);
+	AllocateTextureStorage(Target, Container.NumLevels, Container.InternalFormat, Format, Container.Width, Container.Height);
+
+	gl::PixelStorei(gl::UNPACK_ALIGNMENT, (GLint) Container.RowAlignment);
+	for (uint Level = 0; Level < Container.NumLevels; ++Level) {
+		for (uint Face = 0; Face < Container.NumFaces; ++Face) {
+			const auto& Image = Container.Image(Level, Face);
+			const auto FaceTarget = Container.NumFaces > 1 ? (GLenum) (gl::TEXTURE_CUBE_MAP_POSITIVE_X + Face) : Target;
+			if (Container.IsCompressed()) {
+				gl::CompressedTexSubImage2D(FaceTarget, Level, 0, 0, Image.Width, Image.Height, Container.InternalFormat, (GLsizei) Image.Bytes, Image.Data);
+			} else {
+				gl::TexSubImage2D(FaceTarget, Level, 0, 0, Image.Width, Image.Height, Container.Format, Container.Type, Image.Data);
+			}
+		}
+	}
+	gl::PixelStorei(gl::UNPACK_ALIGNMENT, 4);
+}
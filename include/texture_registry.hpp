@@ -0,0 +1,162 @@
+#pragma once
+
+#include <common.hpp>
+#include <texture.hpp>
+#include <texture_array.hpp>
+#include <texture_streamer.hpp>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Shared textures, each file (and sRGB setting) is loaded once however many materials use it.
+// Acquire hands out a handle and counts the reference, Release gives it back. A texture nobody
+// holds stays resident for UnloadAfterFrames more frames, so dropping and taking it again right
+// away costs nothing, then it is unloaded. Loads go through the streamer when there is one, and
+// with Arrays set they are streamed into texture array layers instead of textures of their own.
+// The layers of an array that grew are streamed again into its replacement, the old layer is drawn
+// until the new one is complete
+
+struct texture_registry {
+	static constexpr uint INVALID_HANDLE = (uint) -1;
+
+	struct entry {
+		std::unique_ptr<texture> Texture; // Both null while the slot is free
+		std::unique_ptr<texture_layer> Layer;
+		std::unique_ptr<texture_layer> Moving; // Layer streamed again out of a retired array
+		u32 Key;
+		uint RefCount;
+		u64 LastUsedFrame;
+	};
+
+	texture_streamer* Streamer = nullptr;
+	texture_arrays* Arrays = nullptr; // Needs Streamer
+	uint UnloadAfterFrames = 600;
+	u64 Frame = 0;
+
+	std::unordered_map<std::string, u32> PathIDs; // Interned paths
+	std::vector<std::string> Paths;               // By ID
+	std::unordered_map<u32, uint> Handles;        // Key to entry, for the loaded ones
+	std::vector<entry> Entries;
+	std::vector<uint> FreeEntries;
+
+	// Acquires served by an already loaded texture, and files actually loaded
+	uint Hits = 0;
+	uint Loads = 0;
+
+	/** Takes a reference, loading the file the first time */
+	uint Acquire(const std::string& Path, bool32 SRGB = true);
+	void Release(uint Handle);
+
+	/** The texture's GL name, or Placeholder until it has loaded. Counts as a use for this frame */
+	uint ID(uint Handle, uint Placeholder);
+	/** The texture's array layer, { 0, 0 } until it has loaded or when it is not in an array */
+	texture_layer Layer(uint Handle);
+
+	/** Once per frame, unloads the textures nobody has held for UnloadAfterFrames */
+	void Update();
+	void Clear();
+};
+
+inline uint texture_registry::Acquire(const std::string& Path, bool32 SRGB) {
+	const auto Interned = PathIDs.emplace(Path, (u32) PathIDs.size());
+	if (Interned.second) { Paths.push_back(Path); }
+	const auto PathID = Interned.first->second;
+	const auto Key = PathID << 1 | (SRGB ? 1u : 0u);
+
+	const auto Found = Handles.find(Key);
+	if (Found != Handles.end()) {
+		auto& Entry = Entries[Found->second];
+		Entry.RefCount++;
+		Entry.LastUsedFrame = Frame;
+		Hits++;
+		return Found->second;
+	}
+
+	uint Handle;
+	if (!FreeEntries.empty()) {
+		Handle = FreeEntries.back();
+		FreeEntries.pop_back();
+	} else {
+		Handle = (uint) Entries.size();
+		Entries.emplace_back();
+	}
+
+	auto& Entry = Entries[Handle];
+	Entry.Key = Key;
+	Entry.RefCount = 1;
+	Entry.LastUsedFrame = Frame;
+	Handles[Key] = Handle;
+	Loads++;
+
+	if (Arrays) {
+		Assert(Streamer);
+		Entry.Layer.reset(new texture_layer{});
+		Streamer->Load(*Entry.Layer, Path, SRGB, *Arrays);
+		return Handle;
+	}
+
+	Entry.Texture.reset(new texture{ Path, SRGB });
+	if (Streamer) {
+		Streamer->Load(*Entry.Texture);
+	} else if (!Entry.Texture->Load()) {
+		LogError("[Texture] Could not load %s\n", Path.c_str());
+	}
+	return Handle;
+}
+
+inline void texture_registry::Release(uint Handle) {
+	if (Handle == INVALID_HANDLE) { return; }
+	auto& Entry = Entries[Handle];
+	Assert(Entry.RefCount > 0);
+	Entry.RefCount--;
+	Entry.LastUsedFrame = Frame;
+}
+
+inline uint texture_registry::ID(uint Handle, uint Placeholder) {
+	if (Handle == INVALID_HANDLE) { return Placeholder; }
+	auto& Entry = Entries[Handle];
+	Entry.LastUsedFrame = Frame;
+	return Entry.Texture ? Entry.Texture->IDOr(Placeholder) : Placeholder;
+}
+
+inline texture_layer texture_registry::Layer(uint Handle) {
+	if (Handle == INVALID_HANDLE) { return texture_layer{}; }
+	auto& Entry = Entries[Handle];
+	Entry.LastUsedFrame = Frame;
+	return Entry.Layer ? *Entry.Layer : texture_layer{};
+}
+
+inline void texture_registry::Update() {
+	Frame++;
+	for (uint i = 0; i < Entries.size(); ++i) {
+		auto& Entry = Entries[i];
+		// Out of a retired array, once. A move that fails leaves the old layer in use
+		if (Entry.Layer && !Entry.Moving && Arrays->NumRetired && Arrays->IsRetired(Entry.Layer->Array)) {
+			Entry.Moving.reset(new texture_layer{});
+			Streamer->Load(*Entry.Moving, Paths[Entry.Key >> 1], Entry.Key & 1, *Arrays);
+		}
+		if (Entry.Moving && Entry.Moving->Array) {
+			Arrays->Free(*Entry.Layer);
+			*Entry.Layer = *Entry.Moving;
+			Entry.Moving.reset();
+		}
+
+		if ((!Entry.Texture && !Entry.Layer) || Entry.RefCount > 0 || Frame - Entry.LastUsedFrame <= UnloadAfterFrames) { continue; }
+		if (Streamer && (Entry.Texture ? Streamer->IsLoading(*Entry.Texture) : Streamer->IsLoading(*Entry.Layer))) { continue; } // The streamer still writes to it
+		if (Entry.Moving && Streamer->IsLoading(*Entry.Moving)) { continue; }
+
+		if (Entry.Layer && Entry.Layer->Array) { Arrays->Free(*Entry.Layer); }
+		Entry.Texture.reset();
+		Entry.Layer.reset();
+		Entry.Moving.reset();
+		Handles.erase(Entry.Key);
+		FreeEntries.push_back(i);
+	}
+}
+
+inline void texture_registry::Clear() {
+	Entries.clear();
+	FreeEntries.clear();
+	Handles.clear();
+}
@@ -0,0 +1,541 @@
+#pragma once
+
+#include <common.hpp>
+#include <gl_33.hpp>
+#include <cubemap.hpp>
+#include <gpu_memory.hpp>
+#include <jobs.hpp>
+#include <texture.hpp>
+#include <texture_array.hpp>
+#include <texture_compression.hpp>
+#include <texture_container.hpp>
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Loads textures without blocking the main thread. Workers decode the files and build their mip
+// chains (see mipmap.hpp), compressed to BC1/BC3 when enabled (see texture_compression.hpp). The six
+// faces of a cubemap are decoded in parallel. KTX/DDS files are mapped and taken as they are, levels,
+// pixel types and all, their rows read straight from the mapping, and a single one can hold all the
+// faces of a cubemap. Then every frame the main thread copies up to
+// BytesPerFrame of rows into one of a ring of pixel buffer objects and uploads them from there, so
+// a large image is spread over several frames and the copy never waits for the GPU. A texture's ID
+// stays INVALID_ID (a cubemap's 0) until it is complete, draw a placeholder meanwhile, see
+// texture::IDOr. Textures that fail to load keep their invalid ID. Array layers (see texture_array.hpp)
+// are filled the same way and stay { 0, 0 } until complete.
+// The textures, cubemaps and layers handed over must outlive the streamer
+
+struct texture_streamer {
+	// Staging buffers in flight, a buffer is only rewritten once the GPU has read it
+	static constexpr uint NumStagingBuffers = 3;
+
+	struct pending_texture;
+
+	// Rows of one level as they are uploaded, of 4x4 blocks when compressed
+	struct level_rows {
+		const u8* Data;
+		int Width, Height;
+		size_t RowBytes;
+		uint NumRows;
+		uint RowHeight; // In pixels
+	};
+
+	struct pending_image {
+		pending_texture* Owner;
+		std::string Path;
+		GLenum Target;        // TEXTURE_2D, TEXTURE_2D_ARRAY or a cubemap face
+		mip_chain Chain;      // Every level, built by the worker. Unused for a container, see Face
+		uint Face;            // Of the owner's container
+		GLint InternalFormat; // Set by the worker with the pixels
+		GLenum Format, Type;  // Of the rows, unused when compressed
+		uint RowAlignment;    // UNPACK_ALIGNMENT of the rows
+		bool32 Loaded;        // Set by the worker, false when loading failed
+		bool32 Uploaded;
+		uint Level;           // Level and row being uploaded
+		uint NextRow;
+
+		bool32 IsCompressed() const { return BlockBytes(InternalFormat) > 0; }
+		uint NumLevels() const { return Owner->File ? Owner->Container.NumLevels : (uint) Chain.Levels.size(); }
+		int NumChannels() const;
+		level_rows Rows(uint Level) const;
+	};
+
+	struct pending_texture {
+		texture* Texture; // One of the three
+		cubemap* Cubemap;
+		texture_layer* Layer;
+		texture_arrays* Arrays; // Where Layer is allocated
+		texture_layer Slot;     // Allocated with the first rows
+		bool32 SRGB;
+		GLuint ID;              // Created with the first rows, Slot's array for a layer
+		uint NumImages;
+		uint NumDone;
+		u64 Bytes;
+		bool32 Failed;
+		std::unique_ptr<mapped_file> File; // A KTX/DDS file, mapped until the texture is complete
+		texture_container Container;       // Pointing into File
+		pending_image Images[6];
+	};
+
+	struct staging_buffer {
+		GLuint PBO;
+		GLsync Fence; // Signaled once the uploads reading the buffer are done
+	};
+
+	size_t BytesPerFrame;
+	bool32 Compress; // To BC1/BC3 on the workers, through TextureCache
+	mip_filter::type MipFilter = mip_filter::Kaiser;
+	staging_buffer Staging[NumStagingBuffers];
+	uint NextStaging;
+
+	std::vector<std::unique_ptr<pending_texture>> Pending;
+	std::deque<pending_image*> Uploads; // Loaded, the front one is being uploaded
+	std::vector<pending_image*> Decoded; // Finished by the workers since the last Update, guarded by Mutex
+	std::mutex Mutex;
+	job_counter Decoding;
+
+	/** Compress is ignored without S3TC support */
+	void Initialize(size_t BytesPerFrame = 4 << 20, bool32 Compress = true);
+	void Shutdown();
+
+	/** Streams Texture.Path in */
+	void Load(texture& Texture);
+	/** Six files, Path + face name + "." + Extension, the faces in the order of cubemap::face */
+	void Load(cubemap& Cubemap, const char* Path, const char* Extension, bool32 SRGB = true);
+	/** All six faces from a single KTX or DDS file, see texture_container.hpp */
+	void Load(cubemap& Cubemap, const std::string& Filename, bool32 SRGB = true);
+	/** Streams Path into a layer of one of Arrays, Layer is set once it is complete */
+	void Load(texture_layer& Layer, const std::string& Path, bool32 SRGB, texture_arrays& Arrays);
+
+	/** Once per frame on the GL thread, uploads what the workers loaded meanwhile */
+	void Update();
+	bool32 IsIdle() const { return Pending.empty(); }
+	bool32 IsLoading(const texture& Texture) const;
+	bool32 IsLoading(const texture_layer& Layer) const;
+
+	void Decode(pending_image& Image);
+	void DecodeContainer(pending_texture& Texture, const std::string& Filename);
+	void Complete(pending_texture& Texture);
+};
+
+inline int texture_streamer::pending_image::NumChannels() const {
+	if (Owner->File) { return ContainerNumChannels(Owner->Container); }
+	const auto Block = BlockBytes(InternalFormat);
+	if (Block) { return Block == 16 ? 4 : 3; }
+	return InternalFormat == gl::RGB8 || InternalFormat == gl::SRGB8 ? 3 : 4;
+}
+
+inline texture_streamer::level_rows texture_streamer::pending_image::Rows(uint Level) const {
+	const u8* Data;
+	size_t Bytes;
+	int Width, Height;
+	if (Owner->File) {
+		const auto& Image = Owner->Container.Image(Level, Face);
+		Data = Image.Data;
+		Bytes = Image.Bytes;
+		Width = Image.Width;
+		Height = Image.Height;
+	} else {
+		const auto& Info = Chain.Levels[Level];
+		Data = Chain.Data.data() + Info.Offset;
+		Bytes = Info.Bytes;
+		Width = Info.Width;
+		Height = Info.Height;
+	}
+	if (IsCompressed()) {
+		const auto BlocksY = (uint) (Height + 3) / 4;
+		return level_rows{ Data, Width, Height, Bytes / BlocksY, BlocksY, 4 };
+	}
+	return level_rows{ Data, Width, Height, Bytes / Height, (uint) Height, 1 };
+}
+
+inline void texture_streamer::Initialize(size_t BytesPerFrame, bool32 Compress) {
+	this->BytesPerFrame = BytesPerFrame;
+	this->Compress = Compress && gl::exts::var_EXT_texture_compression_s3tc && gl::exts::var_EXT_texture_sRGB;
+	if (Compress && !this->Compress) { LogError("[Texture] S3TC not supported, textures are not compressed\n"); }
+
+	NextStaging = 0;
+	for (auto& Buffer : Staging) {
+		gl::GenBuffers(1, &Buffer.PBO);
+		gl::BindBuffer(gl::PIXEL_UNPACK_BUFFER, Buffer.PBO);
+		gl::BufferData(gl::PIXEL_UNPACK_BUFFER, BytesPerFrame, nullptr, gl::STREAM_DRAW);
+		GPUMemory.Track(gpu_resource::Buffer, Buffer.PBO, BytesPerFrame, "Texture Staging");
+		Buffer.Fence = nullptr;
+	}
+	gl::BindBuffer(gl::PIXEL_UNPACK_BUFFER, 0);
+}
+
+inline void texture_streamer::Shutdown() {
+	Jobs.Wait(Decoding);
+
+	for (auto& Texture : Pending) {
+		if (Texture->Layer) {
+			if (Texture->Slot.Array) { Texture->Arrays->Free(Texture->Slot); }
+		} else if (Texture->ID) {
+			gl::DeleteTextures(1, &Texture->ID);
+		}
+	}
+	Pending.clear();
+	Uploads.clear();
+	Decoded.clear();
+
+	for (auto& Buffer : Staging) {
+		if (Buffer.Fence) { gl::DeleteSync(Buffer.Fence); }
+		GPUMemory.Release(gpu_resource::Buffer, Buffer.PBO);
+		gl::DeleteBuffers(1, &Buffer.PBO);
+		Buffer = staging_buffer{};
+	}
+}
+
+inline void texture_streamer::Decode(pending_image& Image) {
+	Image.Loaded = false;
+	Image.Uploaded = false;
+	Image.Level = 0;
+	Image.NextRow = 0;
+
+	const auto SRGB = Image.Owner->SRGB;
+	const auto Filter = MipFilter;
+	Jobs.Submit([this, &Image, SRGB, Filter]() {
+		// The file's bytes are the cache key, decoding, filtering and compressing only happen on a miss
+		std::vector<u8> File;
+		if (!ReadBinaryFile(Image.Path, File)) {
+			LogError("[Texture] Could not read %s\n", Image.Path.c_str());
+		} else {
+			const auto Key = TextureCache.Key(File.data(), File.size(), SRGB, true, Compress, Filter);
+			Image.Loaded = TextureCache.Load(Key, Image.Chain);
+			if (!Image.Loaded) {
+				// Gray images are expanded to RGB(A), chains are built from 3 or 4 channels
+				int Channels = 4;
+				if (!Compress && stbi_info_from_memory(File.data(), (int) File.size(), nullptr, nullptr, &Channels)) {
+					Channels = TextureChannels(Channels);
+				}
+				image Pixels;
+				Pixels.Data = stbi_load_from_memory(File.data(), (int) File.size(), &Pixels.Width, &Pixels.Height, &Pixels.NumChannels, Channels);
+				if (Pixels.Data) {
+					if (Compress) {
+						CompressImage(Pixels.Data, Pixels.Width, Pixels.Height, SRGB, true, Filter, Image.Chain);
+					} else {
+						BuildMipChain(Pixels.Data, Pixels.Width, Pixels.Height, Channels, SRGB, Filter, Image.Chain);
+					}
+					FreeImage(Pixels);
+					TextureCache.Store(Key, Image.Chain);
+					Image.Loaded = true;
+				} else {
+					LogError("[Texture] Could not decode %s: %s\n", Image.Path.c_str(), stbi_failure_reason());
+				}
+			}
+		}
+		if (Image.Loaded) {
+			// Chains are of 3 or 4 channels, rows tightly packed
+			Image.InternalFormat = (GLint) Image.Chain.InternalFormat;
+			Image.Format = Image.NumChannels() == 3 ? gl::RGB : gl::RGBA;
+			Image.Type = gl::UNSIGNED_BYTE;
+			Image.RowAlignment = 1;
+		}
+
+		std::lock_guard<std::mutex> Lock{ Mutex };
+		Decoded.push_back(&Image);
+	}, &Decoding);
+}
+
+// One mapping for every image of the texture (six for a cubemap), the levels uploaded from it as the
+// file holds them, without decoding or copying
+inline void texture_streamer::DecodeContainer(pending_texture& Texture, const std::string& Filename) {
+	for (uint i = 0; i < Texture.NumImages; ++i) {
+		auto& Image = Texture.Images[i];
+		Image.Owner = &Texture;
+		Image.Path = Filename;
+		Image.Loaded = false;
+		Image.Uploaded = false;
+		Image.Level = 0;
+		Image.NextRow = 0;
+	}
+
+	auto Owner = &Texture;
+	Jobs.Submit([this, Owner]() {
+		const auto& Path = Owner->Images[0].Path;
+		std::unique_ptr<mapped_file> File{ new mapped_file{} };
+		auto& Container = Owner->Container;
+		if (!File->Open(Path)) {
+			LogError("[Texture] Could not open %s\n", Path.c_str());
+		} else if (ParseTextureContainer(File->Data, File->Bytes, Owner->SRGB, Container, Path.c_str())) {
+			if (Container.NumFaces != Owner->NumImages) {
+				LogError("[Texture] %s has %u faces, expected %u\n", Path.c_str(), Container.NumFaces, Owner->NumImages);
+			} else {
+				Owner->File = std::move(File);
+				for (uint i = 0; i < Owner->NumImages; ++i) {
+					auto& Image = Owner->Images[i];
+					Image.Face = i;
+					Image.InternalFormat = Container.InternalFormat;
+					Image.Format = Container.IsCompressed() ? (GLenum) gl::RGBA : Container.Format;
+					Image.Type = Container.Type;
+					Image.RowAlignment = Container.RowAlignment;
+					Image.Loaded = true;
+				}
+			}
+		}
+
+		std::lock_guard<std::mutex> Lock{ Mutex };
+		for (uint i = 0; i < Owner->NumImages; ++i) { Decoded.push_back(&Owner->Images[i]); }
+	}, &Decoding);
+}
+
+inline void texture_streamer::Load(texture& Texture) {
+	std::unique_ptr<pending_texture> Request{ new pending_texture{} };
+	Request->Texture = &Texture;
+	Request->SRGB = Texture.SRGB;
+	Request->NumImages = 1;
+
+	auto& Image = Request->Images[0];
+	Image.Owner = Request.get();
+	Image.Path = Texture.Path;
+	Image.Target = gl::TEXTURE_2D;
+	if (IsTextureContainer(Image.Path)) {
+		DecodeContainer(*Request, Image.Path);
+	} else {
+		Decode(Image);
+	}
+	Pending.push_back(std::move(Request));
+}
+
+inline void texture_streamer::Load(cubemap& Cubemap, const char* Path, const char* Extension, bool32 SRGB) {
+	// Same order as cubemap::face, the faces' targets
+	const char* FaceNames[] = {
+		"right", "left",
+		"up", "down",
+		"back", "front"
+	};
+
+	std::unique_ptr<pending_texture> Request{ new pending_texture{} };
+	Request->Cubemap = &Cubemap;
+	Request->SRGB = SRGB;
+	Request->NumImages = ArraySize(FaceNames);
+	for (uint i = 0; i < Request->NumImages; ++i) {
+		char Filename[FilenameMax];
+		sprintf(Filename, "%s%s.%s", Path, FaceNames[i], Extension);
+
+		auto& Image = Request->Images[i];
+		Image.Owner = Request.get();
+		Image.Path = Filename;
+		Image.Target = (GLenum) (gl::TEXTURE_CUBE_MAP_POSITIVE_X + i);
+		Decode(Image);
+	}
+	Pending.push_back(std::move(Request));
+}
+
+inline void texture_streamer::Load(cubemap& Cubemap, const std::string& Filename, bool32 SRGB) {
+	std::unique_ptr<pending_texture> Request{ new pending_texture{} };
+	Request->Cubemap = &Cubemap;
+	Request->SRGB = SRGB;
+	Request->NumImages = 6;
+	for (uint i = 0; i < Request->NumImages; ++i) { Request->Images[i].Target = (GLenum) (gl::TEXTURE_CUBE_MAP_POSITIVE_X + i); }
+	DecodeContainer(*Request, Filename);
+	Pending.push_back(std::move(Request));
+}
+
+inline void texture_streamer::Load(texture_layer& Layer, const std::string& Path, bool32 SRGB, texture_arrays& Arrays) {
+	std::unique_ptr<pending_texture> Request{ new pending_texture{} };
+	Request->Layer = &Layer;
+	Request->Arrays = &Arrays;
+	Request->SRGB = SRGB;
+	Request->NumImages = 1;
+
+	auto& Image = Request->Images[0];
+	Image.Owner = Request.get();
+	Image.Path = Path;
+	Image.Target = gl::TEXTURE_2D_ARRAY;
+	if (IsTextureContainer(Path)) {
+		DecodeContainer(*Request, Path);
+	} else {
+		Decode(Image);
+	}
+	Pending.push_back(std::move(Request));
+}
+
+inline void texture_streamer::Update() {
+	{
+		std::lock_guard<std::mutex> Lock{ Mutex };
+		Uploads.insert(Uploads.end(), Decoded.begin(), Decoded.end());
+		Decoded.clear();
+	}
+
+	// Failed images only need their texture to learn about it
+	while (!Uploads.empty() && !Uploads.front()->Loaded) {
+		auto& Owner = *Uploads.front()->Owner;
+		Uploads.pop_front();
+		Owner.Failed = true;
+		if (++Owner.NumDone == Owner.NumImages) { Complete(Owner); }
+	}
+	if (Uploads.empty()) { return; }
+
+	auto& Buffer = Staging[NextStaging];
+	if (Buffer.Fence) {
+		// Still being read by an earlier frame's uploads, try again next frame
+		if (gl::ClientWaitSync(Buffer.Fence, gl::SYNC_FLUSH_COMMANDS_BIT, 0) == gl::TIMEOUT_EXPIRED) { return; }
+		gl::DeleteSync(Buffer.Fence);
+		Buffer.Fence = nullptr;
+	}
+
+	// Whole rows of the images at the front, as many as fit in the budget
+	struct band {
+		pending_image* Image;
+		uint Level;
+		uint FirstRow, NumRows;
+		size_t Offset;     // In the staging buffer
+		bool32 FromMemory; // Straight from the loaded image instead
+	};
+	std::vector<band> Bands;
+
+	gl::BindBuffer(gl::PIXEL_UNPACK_BUFFER, Buffer.PBO);
+	// The fence above guarantees the GPU is done with the buffer, no need for the driver to check
+	auto Mapped = (u8*) gl::MapBufferRange(gl::PIXEL_UNPACK_BUFFER, 0, BytesPerFrame, gl::MAP_WRITE_BIT | gl::MAP_UNSYNCHRONIZED_BIT);
+	size_t Used = 0;
+	for (auto It = Uploads.begin(); Mapped && It != Uploads.end(); ++It) {
+		auto& Image = **It;
+		if (!Image.Loaded) { break; } // Failed, handled next frame
+
+		while (Image.Level < Image.NumLevels()) {
+			Used = glm::min((Used + 7) & ~(size_t) 7, BytesPerFrame); // Offsets of half float rows have to be aligned too
+			const auto Rows = Image.Rows(Image.Level);
+			const auto NumRows = (uint) glm::min((BytesPerFrame - Used) / Rows.RowBytes, (size_t) (Rows.NumRows - Image.NextRow));
+			if (NumRows == 0) { break; }
+
+			memcpy(Mapped + Used, Rows.Data + Rows.RowBytes * Image.NextRow, Rows.RowBytes * NumRows);
+			Bands.push_back(band{ &Image, Image.Level, Image.NextRow, NumRows, Used, false });
+			Used += Rows.RowBytes * NumRows;
+			Image.NextRow += NumRows;
+			if (Image.NextRow == Rows.NumRows) {
+				Image.Level++;
+				Image.NextRow = 0;
+			}
+		}
+		if (Image.Level < Image.NumLevels()) { break; } // Budget spent
+	}
+	if (Mapped) { gl::UnmapBuffer(gl::PIXEL_UNPACK_BUFFER); }
+
+	// A row larger than the whole budget goes straight from memory with the rest of its level
+	if (Bands.empty() && Uploads.front()->Loaded) {
+		auto& Image = *Uploads.front();
+		Bands.push_back(band{ &Image, Image.Level, Image.NextRow, Image.Rows(Image.Level).NumRows - Image.NextRow, 0, true });
+		Image.Level++;
+		Image.NextRow = 0;
+	}
+
+	for (const auto& Band : Bands) {
+		auto& Image = *Band.Image;
+		auto& Owner = *Image.Owner;
+		const auto Target = Owner.Cubemap ? (GLenum) gl::TEXTURE_CUBE_MAP : Image.Target;
+		const auto Rows = Image.Rows(Band.Level);
+
+		const auto InternalFormat = Image.InternalFormat;
+		const auto Format = Image.Format;
+
+		if (Owner.Layer && !Owner.Slot.Array) {
+			// A layer of an array with every level
+			Owner.Slot = Owner.Arrays->Allocate(Rows.Width, Rows.Height, InternalFormat, Format, Image.NumLevels());
+			Owner.ID = Owner.Slot.Array;
+		} else if (!Owner.ID) {
+			// Storage of every level (and face) at once, immutable where supported. The first image
+			// decides the size and format, a cubemap's faces have to agree on them anyway
+			gl::BindBuffer(gl::PIXEL_UNPACK_BUFFER, 0);
+			gl::GenTextures(1, &Owner.ID);
+			gl::BindTexture(Target, Owner.ID);
+			AllocateTextureStorage(Target, Image.NumLevels(), InternalFormat, Format, Rows.Width, Rows.Height);
+			Owner.Bytes = EstimateTextureBytes(InternalFormat, Rows.Width, Rows.Height, Owner.NumImages, Image.NumLevels());
+		}
+		gl::BindTexture(Target, Owner.ID);
+
+		gl::BindBuffer(gl::PIXEL_UNPACK_BUFFER, Band.FromMemory ? 0 : Buffer.PBO);
+		gl::PixelStorei(gl::UNPACK_ALIGNMENT, (GLint) Image.RowAlignment);
+		const auto Pixels = Band.FromMemory ? (const void*) (Rows.Data + Rows.RowBytes * Band.FirstRow) : (const void*) Band.Offset;
+		const auto Y = (int) (Band.FirstRow * Rows.RowHeight);
+		const auto Height = glm::min((int) (Band.NumRows * Rows.RowHeight), Rows.Height - Y);
+		if (Owner.Layer) {
+			if (Image.IsCompressed()) {
+				gl::CompressedTexSubImage3D(Target, Band.Level, 0, Y, Owner.Slot.Layer, Rows.Width, Height, 1, InternalFormat, (GLsizei) (Rows.RowBytes * Band.NumRows), Pixels);
+			} else {
+				gl::TexSubImage3D(Target, Band.Level, 0, Y, Owner.Slot.Layer, Rows.Width, Height, 1, Format, Image.Type, Pixels);
+			}
+		} else if (Image.IsCompressed()) {
+			gl::CompressedTexSubImage2D(Image.Target, Band.Level, 0, Y, Rows.Width, Height, InternalFormat, (GLsizei) (Rows.RowBytes * Band.NumRows), Pixels);
+		} else {
+			gl::TexSubImage2D(Image.Target, Band.Level, 0, Y, Rows.Width, Height, Format, Image.Type, Pixels);
+		}
+		gl::BindTexture(Target, 0);
+	}
+	gl::PixelStorei(gl::UNPACK_ALIGNMENT, 4);
+	gl::BindBuffer(gl::PIXEL_UNPACK_BUFFER, 0);
+
+	if (Mapped) {
+		Buffer.Fence = gl::FenceSync(gl::SYNC_GPU_COMMANDS_COMPLETE, 0);
+		NextStaging = (NextStaging + 1) % NumStagingBuffers;
+	}
+
+	// Completing a texture frees its images, so only once nothing refers to them anymore
+	std::vector<pending_texture*> Completed;
+	for (const auto& Band : Bands) {
+		auto& Image = *Band.Image;
+		if (Image.Uploaded || Image.Level < Image.NumLevels()) { continue; }
+
+		Image.Uploaded = true;
+		Uploads.erase(std::find(Uploads.begin(), Uploads.end(), &Image));
+		std::vector<u8>{}.swap(Image.Chain.Data);
+		if (++Image.Owner->NumDone == Image.Owner->NumImages) { Completed.push_back(Image.Owner); }
+	}
+	for (auto Texture : Completed) { Complete(*Texture); }
+}
+
+inline bool32 texture_streamer::IsLoading(const texture& Texture) const {
+	for (const auto& Request : Pending) {
+		if (Request->Texture == &Texture) { return true; }
+	}
+	return false;
+}
+
+inline bool32 texture_streamer::IsLoading(const texture_layer& Layer) const {
+	for (const auto& Request : Pending) {
+		if (Request->Layer == &Layer) { return true; }
+	}
+	return false;
+}
+
+// Every image is uploaded, hand the texture over
+inline void texture_streamer::Complete(pending_texture& Texture) {
+	const auto& Image = Texture.Images[0];
+	if (Texture.Failed) {
+		if (Texture.Layer) {
+			if (Texture.Slot.Array) { Texture.Arrays->Free(Texture.Slot); }
+		} else if (Texture.ID) {
+			gl::DeleteTextures(1, &Texture.ID);
+		}
+	} else if (Texture.Layer) {
+		*Texture.Layer = Texture.Slot;
+	} else if (Texture.Texture) {
+		// Every level was uploaded, filtering comes from the sampler it is drawn with, see sampler.hpp
+		auto& Result = *Texture.Texture;
+		const auto Rows = Image.Rows(0);
+		Result.ID = Texture.ID;
+		Result.Width = Rows.Width;
+		Result.Height = Rows.Height;
+		Result.NumChannels = Image.NumChannels();
+		GPUMemory.Track(gpu_resource::Texture, Result.ID, Texture.Bytes, Result.Path);
+	} else {
+		gl::BindTexture(gl::TEXTURE_CUBE_MAP, Texture.ID);
+		SetCubemapFiltering();
+		gl::BindTexture(gl::TEXTURE_CUBE_MAP, 0);
+
+		Texture.Cubemap->ID = Texture.ID;
+		GPUMemory.Track(gpu_resource::Cubemap, Texture.ID, Texture.Bytes, Image.Path);
+	}
+
+	for (auto It = Pending.begin(); It != Pending.end(); ++It) {
+		if (It->get() == &Texture) {
+			Pending.erase(It);
+			break;
+		}
+	}
+}
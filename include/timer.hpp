@@ -0,0 +1,66 @@
+#pragma once
+
+#include <common.hpp>
+#include <gl_33.hpp>
+#include <array>
+#include <chrono>
+
+// Wall clock stopwatch
+struct cpu_timer {
+	std::chrono::high_resolution_clock::time_point Start;
+
+	cpu_timer() : Start{ std::chrono::high_resolution_clock::now() } {}
+
+	void Reset() { Start = std::chrono::high_resolution_clock::now(); }
+
+	double Milliseconds() const {
+		return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - Start).count();
+	}
+};
+
+// GPU time of a section of commands. Results are read a few frames late so the CPU never waits for them
+struct gpu_timer {
+	static constexpr uint Latency = 4;
+
+	std::array<uint, Latency> Queries;
+	std::array<bool32, Latency> Issued;
+	uint Current;
+	double LastMilliseconds;
+
+	gpu_timer() : Queries{}, Issued{}, Current{0}, LastMilliseconds{0} {}
+
+	void Initialize() { gl::GenQueries(Latency, Queries.data()); }
+	void Shutdown() { gl::DeleteQueries(Latency, Queries.data()); }
+
+	void Begin() {
+		gl::BeginQuery(gl::TIME_ELAPSED, Queries[Current]);
+	}
+
+	void End() {
+		gl::EndQuery(gl::TIME_ELAPSED);
+		Issued[Current] = true;
+		Current = (Current + 1) % Latency;
+
+		// The oldest query is the next one to be reused
+		if (Issued[Current]) {
+			GLuint64 Nanoseconds = 0;
+			gl::GetQueryObjectui64v(Queries[Current], gl::QUERY_RESULT, &Nanoseconds);
+			LastMilliseconds = (double) Nanoseconds / 1e6;
+			Issued[Current] = false;
+		}
+	}
+
+	/** Blocks until every issued query is available, returns the latest */
+	double Flush() {
+		for (uint i = 1; i <= Latency; ++i) {
+			auto Index = (Current + i) % Latency;
+			if (!Issued[Index]) { continue; }
+
+			GLuint64 Nanoseconds = 0;
+			gl::GetQueryObjectui64v(Queries[Index], gl::QUERY_RESULT, &Nanoseconds);
+			LastMilliseconds = (double) Nanoseconds / 1e6;
+			Issued[Index] = false;
+		}
+		return LastMilliseconds;
+	}
+};
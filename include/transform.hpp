@@ -17,3 +17,15 @@ struct transform {
 		return  scale(translate(mat4{}, this->Position) * Rot, this->Scale);
 	}
 };
+
+
+struct bounding_sphere {
+	vec3 Center;
+	float Radius;
+};
+
+// Conservative under non-uniform scale, the radius grows by the largest axis scale
+inline bounding_sphere TransformSphere(const mat4& Model, const bounding_sphere& Sphere) {
+	const auto MaxScale = glm::max(glm::length(vec3{ Model[0] }), glm::max(glm::length(vec3{ Model[1] }), glm::length(vec3{ Model[2] })));
+	return bounding_sphere{ vec3{ Model * vec4{ Sphere.Center, 1.f } }, Sphere.Radius * MaxScale };
+}
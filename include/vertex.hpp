@@ -2,6 +2,7 @@
 
 #include <common.hpp>
 #include <gl_33.hpp>
+#include <cstring>
 
 namespace mesh_vertex_layout {
 	enum type : GLuint {
@@ -22,3 +23,77 @@ struct mesh_vertex {
 			Normal{Normal},
 			TexCoords{TexCoords} {}
 };
+
+namespace vertex_format {
+	enum type : uint {
+		Float = 0, // 32 bytes: float positions, mesh_attributes
+		Packed,    // 16 bytes: packed_position, packed_attributes
+		TOTAL
+	};
+}
+
+// Meshes keep positions in a stream of their own, the other attributes follow interleaved in a
+// second one
+struct mesh_attributes {
+	vec3 Normal;
+	vec2 TexCoords;
+};
+
+// Half the bandwidth of mesh_vertex. Positions are 16 bit normalized inside the mesh's bounding
+// box, the mesh's PositionTransform maps them back so the shaders read them unchanged
+struct packed_position {
+	u16 Position[4]; // UNSIGNED_SHORT normalized, w unused
+};
+
+struct packed_attributes {
+	u32 Normal;       // INT_2_10_10_10_REV normalized
+	u16 TexCoords[2]; // HALF_FLOAT
+};
+StaticAssert(sizeof(packed_position) + sizeof(packed_attributes) == 16);
+
+// IEEE 754 half, rounded to nearest even, overflowing to infinity and flushing tiny values to zero
+inline u16 FloatToHalf(float Value) {
+	u32 Bits;
+	memcpy(&Bits, &Value, sizeof(Bits));
+
+	const u32 Sign = (Bits >> 16) & 0x8000;
+	const u32 Absolute = Bits & 0x7FFFFFFF;
+	if (Absolute >= 0x7F800000) { return (u16) (Sign | 0x7C00 | (Absolute > 0x7F800000 ? 0x200 : 0)); } // Inf, NaN
+	if (Absolute >= 0x477FF000) { return (u16) (Sign | 0x7C00); } // Rounds above the largest half
+	if (Absolute < 0x33000001) { return (u16) Sign; } // Rounds to zero
+
+	u32 Exponent = Absolute >> 23;
+	u32 Mantissa = Absolute & 0x7FFFFF;
+	u32 Shift;
+	if (Exponent < 113) { // Denormal half
+		Mantissa |= 0x800000;
+		Shift = 126 - Exponent;
+		Exponent = 0;
+	} else {
+		Shift = 13;
+		Exponent -= 112;
+	}
+
+	u32 Half = (Exponent << 10) | (Mantissa >> Shift);
+	const u32 Remainder = Mantissa & ((1u << Shift) - 1);
+	const u32 Halfway = 1u << (Shift - 1);
+	if (Remainder > Halfway || (Remainder == Halfway && (Half & 1))) { Half++; } // Carries into the exponent correctly
+	return (u16) (Sign | Half);
+}
+
+// Signed normalized 10 bit components, w = 0
+inline u32 PackNormal2101010(vec3 Normal) {
+	auto Component = [](float Value) { return (u32) ((i32) glm::round(glm::clamp(Value, -1.f, 1.f) * 511.f) & 0x3FF); };
+	return Component(Normal.x) | (Component(Normal.y) << 10) | (Component(Normal.z) << 20);
+}
+
+inline void PackVertex(const mesh_vertex& Vertex, vec3 BoundsMin, vec3 BoundsExtent, packed_position& Position, packed_attributes& Attributes) {
+	for (int i = 0; i < 3; ++i) {
+		const auto Normalized = BoundsExtent[i] > 0.f ? (Vertex.Position[i] - BoundsMin[i]) / BoundsExtent[i] : 0.f;
+		Position.Position[i] = (u16) glm::round(glm::clamp(Normalized, 0.f, 1.f) * 65535.f);
+	}
+	Position.Position[3] = 0;
+	Attributes.Normal = PackNormal2101010(Vertex.Normal);
+	Attributes.TexCoords[0] = FloatToHalf(Vertex.TexCoords.x);
+	Attributes.TexCoords[1] = FloatToHalf(Vertex.TexCoords.y);
+}
@@ -0,0 +1,9 @@
+#define saturate(x) (clamp(x, 0.0, 1.0))
+#define lengthSqr(x) (dot(x,x))
+#define PI 3.1415926535897932384626433832795
+
+struct camera {
+	vec3 Position;
+};
+
+uniform camera Camera;
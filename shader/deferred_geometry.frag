@@ -0,0 +1,22 @@
+#version 330 core
+
+in vertex {
+	vec3 Position;
+	vec3 Normal;
+    vec2 TexCoords;
+} Vertex;
+
+layout(location = 0) out vec4 OutAlbedoSpecular;
+layout(location = 1) out vec3 OutNormal;
+
+#include "material.glsl"
+
+// Specular power is stored normalized in an 8 bit channel
+#define MAX_SPECULAR_POWER 256.0
+
+void main() {
+	vec4 BaseColor = MaterialColor(Vertex.TexCoords);
+
+	OutAlbedoSpecular = vec4(BaseColor.rgb, Material.SpecularPower / MAX_SPECULAR_POWER);
+	OutNormal = normalize(Vertex.Normal);
+}
@@ -0,0 +1,41 @@
+#version 330 core
+
+out vec4 OutColor;
+
+uniform sampler2D AlbedoSpecular;
+uniform sampler2D Normals;
+uniform sampler2D Depth;
+
+uniform mat4 InverseViewProjection;
+uniform vec2 ScreenSize;
+
+// Sum of every light's ambient term, only non-zero for the first full-screen pass
+uniform vec3 AmbientLight;
+
+#include "lighting.glsl"
+
+uniform light Light;
+
+#define MAX_SPECULAR_POWER 256.0
+
+void main() {
+	ivec2 Texel = ivec2(gl_FragCoord.xy);
+
+	float FragDepth = texelFetch(Depth, Texel, 0).r;
+	if(FragDepth == 1.0) {
+		discard; // Nothing was drawn here
+	}
+
+	vec4 Albedo = texelFetch(AlbedoSpecular, Texel, 0);
+	vec3 Normal = normalize(texelFetch(Normals, Texel, 0).xyz);
+
+	// Reconstruct world position from depth
+	vec4 Clip = vec4(gl_FragCoord.xy / ScreenSize * 2.0 - 1.0, FragDepth * 2.0 - 1.0, 1.0);
+	vec4 World = InverseViewProjection * Clip;
+	vec3 Position = World.xyz / World.w;
+
+	vec3 ToCamera = normalize(Camera.Position - Position);
+	OutColor.rgb = AmbientLight * Albedo.rgb
+		+ DoLighting(Light, Albedo.rgb, Albedo.a * MAX_SPECULAR_POWER, Normal, Position, ToCamera);
+	OutColor.a = 1.0;
+}
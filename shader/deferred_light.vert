@@ -0,0 +1,16 @@
+#version 330 core
+
+layout(location = 0) in vec3 Position;
+
+uniform mat4 MVP;
+uniform bool Fullscreen;
+
+void main() {
+	if(Fullscreen) {
+		// A single triangle covering the whole screen, no vertex buffer needed
+		vec2 Corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+		gl_Position = vec4(Corner * 2.0 - 1.0, 0.0, 1.0);
+	} else {
+		gl_Position = MVP * vec4(Position, 1.0);
+	}
+}
@@ -0,0 +1,14 @@
+#version 330 core
+
+uniform sampler2D Lighting;
+uniform sampler2D Depth;
+
+out vec4 OutColor;
+
+void main() {
+	ivec2 Texel = ivec2(gl_FragCoord.xy);
+	OutColor = vec4(texelFetch(Lighting, Texel, 0).rgb, 1.0);
+
+	// Forward passes that come after (e.g. skybox) still depth test against the scene
+	gl_FragDepth = texelFetch(Depth, Texel, 0).r;
+}
@@ -0,0 +1,5 @@
+#version 330 core
+
+// Light volumes only write stencil in this pass
+void main() {
+}
@@ -0,0 +1,12 @@
+#version 330 core
+
+layout(location = 0) in vec3 Position;
+
+uniform mat4 MVP;
+
+// Must match the lit passes bit for bit, they test against this depth with EQUAL
+invariant gl_Position;
+
+void main() {
+    gl_Position = MVP * vec4(Position, 1.0);
+}
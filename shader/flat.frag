@@ -4,12 +4,12 @@
 in vec2 UV;
 flat in vec3 Lighting;
 
-out vec4 OutColor;
-
-uniform sampler2D Texture;
-uniform vec4 Color;
-uniform bool bTexture;
+#include "material.glsl"
+#include "transparency.glsl"
 
 void main() {
- 	OutColor = vec4(Lighting,1) * texture(Texture, UV);
-}
\ No newline at end of file
+ 	OutColor = vec4(Lighting, Material.Color.a);
+	OutColor *= MaterialTexture(UV);
+
+	FinishOutput();
+}
@@ -7,12 +7,12 @@ in vertex {
     vec3 Lighting;
 } Vertex;
 
-out vec4 OutColor;
-
-uniform sampler2D Texture;
-uniform vec4 Color;
-uniform bool bTexture;
+#include "material.glsl"
+#include "transparency.glsl"
 
 void main() {
- 	OutColor = vec4(Vertex.Lighting,1) * texture(Texture, Vertex.TexCoords);
-}
\ No newline at end of file
+ 	OutColor = vec4(Vertex.Lighting, Material.Color.a);
+	OutColor *= MaterialTexture(Vertex.TexCoords);
+
+	FinishOutput();
+}
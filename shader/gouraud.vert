@@ -8,6 +8,9 @@ uniform mat4 Model;
 uniform mat4 MVP;
 uniform mat4 NormalMat;
 
+// Same depth as the pre-pass, see depth.vert
+invariant gl_Position;
+
 out vertex {
 	vec3 Position;
 	vec3 Normal;
@@ -15,72 +18,12 @@ out vertex {
     vec3 Lighting;
 } Vertex;
 
-struct material {
-	sampler2D Texture;
-	vec4 Color;
-	float SpecularPower;
-};
-
-uniform material Material;
-
-struct camera {
-	vec3 Position;
-};
-
-uniform camera Camera;
-
-struct light {
-	vec4 Position;
-	vec3 Color;
-	float Ambient;
-	vec3 SpecularColor;
-	vec3 ConeDirection;
-	float LinearFalloff;
-	float QuadraticFalloff;
-	float InnerCone;
-	float OuterCone;
-};
-
-#define NUM_LIGHTS 3
-uniform light Lights[NUM_LIGHTS];
-
-#define saturate(x) (clamp(x, 0.0, 1.0))
-#define lengthSqr(x) (dot(x,x))
-#define PI 3.1415926535897932384626433832795
-
-vec3 DoLighting(light Light, vec3 Color, vec3 Normal, vec3 Pos, vec3 ToCamera) {
-	vec3 ToLight;
-	float Attenuation;
-	if(Light.Position.w == 0.0) {
-		// Directional
-		ToLight = normalize(Light.Position.xyz);
-		Attenuation = 1.0;
-	} else {
-		// Point
-		ToLight = Light.Position.xyz - Vertex.Position;
-		float DistanceToLight = length(ToLight);
-		ToLight = normalize(ToLight);
-
-		Attenuation = 1.0/(1.0 + Light.LinearFalloff * DistanceToLight
-			+ Light.QuadraticFalloff * DistanceToLight * DistanceToLight);
-
-		// Cone
-		if(lengthSqr(Light.ConeDirection) > 0) {
-			float Theta = dot(ToLight, normalize(-Light.ConeDirection));
-			Attenuation *= saturate((Theta - Light.OuterCone)/(Light.InnerCone-Light.OuterCone));
-		}
-	}
-
-	vec3 AmbientColor = Light.Ambient * Light.Color * Color;
-
-	float Diffuse = max(0.0, dot(Vertex.Normal, ToLight));
-	vec3 DiffuseColor = Diffuse * Color * Light.Color;
-
-	float Specular = pow(max(0.0, dot(ToCamera, reflect(-ToLight, Normal))), Material.SpecularPower);
-	vec3 SpecularColor = Specular * Color * Light.SpecularColor;
+#include "material.glsl"
+#include "light_data.glsl"
 
-	return AmbientColor + Attenuation * (DiffuseColor + SpecularColor);
-}
+// Lights reaching this object, culled on the CPU
+uniform int NumObjectLights;
+uniform int ObjectLights[MAX_OBJECT_LIGHTS];
 
 void main() {
     gl_Position = MVP * vec4(Position, 1.0);
@@ -88,10 +31,10 @@ void main() {
 	Vertex.Normal = vec3(NormalMat * vec4(Normal, 0.0));
     Vertex.TexCoords = TexCoords;
 
-	Vertex.Lighting = vec3(0);
-	for(int i = 0; i < NUM_LIGHTS; ++i)
+	vec3 ToCamera = normalize(Camera.Position - Vertex.Position);
+	Vertex.Lighting = AmbientLight * Material.Color.rgb;
+	for(int i = 0; i < NumObjectLights; ++i)
 	{
-		vec3 ToCamera = normalize(Camera.Position - Vertex.Position);
-		Vertex.Lighting.rgb += DoLighting(Lights[i], Material.Color.rgb, Vertex.Normal, Vertex.Position, ToCamera);
+		Vertex.Lighting.rgb += DoLighting(FetchLight(ObjectLights[i]), Material.Color.rgb, Material.SpecularPower, Vertex.Normal, Vertex.Position, ToCamera);
 	}
 }
\ No newline at end of file
@@ -0,0 +1,27 @@
+#include "lighting.glsl"
+
+// Lights packed in a texture buffer, LIGHT_TEXELS texels each, see light_texel in light.hpp
+uniform samplerBuffer LightData;
+
+// Ambient does not attenuate, so it's summed over every light on the CPU
+uniform vec3 AmbientLight;
+
+light FetchLight(int Index) {
+	int Base = Index * LIGHT_TEXELS;
+	vec4 ColorAmbient = texelFetch(LightData, Base + 1);
+	vec4 SpecularLinear = texelFetch(LightData, Base + 2);
+	vec4 ConeQuadratic = texelFetch(LightData, Base + 3);
+	vec4 ConesRadius = texelFetch(LightData, Base + 4);
+
+	light Light;
+	Light.Position = texelFetch(LightData, Base);
+	Light.Color = ColorAmbient.rgb;
+	Light.Ambient = ColorAmbient.a;
+	Light.SpecularColor = SpecularLinear.rgb;
+	Light.LinearFalloff = SpecularLinear.a;
+	Light.ConeDirection = ConeQuadratic.xyz;
+	Light.QuadraticFalloff = ConeQuadratic.a;
+	Light.InnerCone = ConesRadius.x;
+	Light.OuterCone = ConesRadius.y;
+	return Light;
+}
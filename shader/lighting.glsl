@@ -0,0 +1,51 @@
+#include "common.glsl"
+
+struct light {
+	vec4 Position;
+	vec3 Color;
+	float Ambient;
+	vec3 SpecularColor;
+	vec3 ConeDirection;
+	float LinearFalloff;
+	float QuadraticFalloff;
+	float InnerCone;
+	float OuterCone;
+};
+
+// The ambient term is left out, it does not attenuate so it's accumulated once for every light.
+// Without HAS_POINT_LIGHTS every light is taken as directional, without HAS_SPOT_LIGHTS as omnidirectional
+vec3 DoLighting(light Light, vec3 Color, float SpecularPower, vec3 Normal, vec3 Pos, vec3 ToCamera) {
+	vec3 ToLight;
+	float Attenuation = 1.0;
+#if HAS_POINT_LIGHTS
+	if(Light.Position.w != 0.0) {
+		// Point
+		ToLight = Light.Position.xyz - Pos;
+		float DistanceToLight = length(ToLight);
+		ToLight = normalize(ToLight);
+
+		Attenuation = 1.0/(1.0 + Light.LinearFalloff * DistanceToLight
+			+ Light.QuadraticFalloff * DistanceToLight * DistanceToLight);
+
+#if HAS_SPOT_LIGHTS
+		// Cone
+		if(lengthSqr(Light.ConeDirection) > 0) {
+			float Theta = dot(ToLight, normalize(-Light.ConeDirection));
+			Attenuation *= saturate((Theta - Light.OuterCone)/(Light.InnerCone-Light.OuterCone));
+		}
+#endif
+	} else
+#endif
+	{
+		// Directional
+		ToLight = normalize(Light.Position.xyz);
+	}
+
+	float Diffuse = max(0.0, dot(Normal, ToLight));
+	vec3 DiffuseColor = Diffuse * Color * Light.Color;
+
+	float Specular = pow(max(0.0, dot(ToCamera, reflect(-ToLight, Normal))), SpecularPower);
+	vec3 SpecularColor = Specular * Color * Light.SpecularColor;
+
+	return Attenuation * (DiffuseColor + SpecularColor);
+}
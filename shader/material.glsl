@@ -0,0 +1,23 @@
+struct material {
+	sampler2D Texture;
+	sampler2DArray TextureArray; // Instead of Texture, at Layer
+	float Layer;
+	vec4 Color;
+	float SpecularPower;
+};
+
+uniform material Material;
+
+vec4 MaterialTexture(vec2 TexCoords) {
+#if HAS_TEXTURE_ARRAY
+	return texture(Material.TextureArray, vec3(TexCoords, Material.Layer));
+#elif HAS_TEXTURE
+	return texture(Material.Texture, TexCoords);
+#else
+	return vec4(1.0);
+#endif
+}
+
+vec4 MaterialColor(vec2 TexCoords) {
+	return MaterialTexture(TexCoords) * Material.Color;
+}
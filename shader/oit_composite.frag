@@ -0,0 +1,18 @@
+#version 330 core
+
+// Resolves the weighted blended transparency targets over the opaque scene, blended with
+// BlendFunc(ONE_MINUS_SRC_ALPHA, SRC_ALPHA) so what the layers let through is kept
+uniform sampler2D Accumulation;
+uniform sampler2D Weights;
+
+out vec4 OutColor;
+
+void main() {
+	ivec2 Texel = ivec2(gl_FragCoord.xy);
+	vec4 Accumulated = texelFetch(Accumulation, Texel, 0);
+	float Revealage = Accumulated.a;
+	if (Revealage == 1.0) { discard; } // No transparent surface here
+
+	float WeightSum = texelFetch(Weights, Texel, 0).r;
+	OutColor = vec4(Accumulated.rgb / max(WeightSum, 1e-5), Revealage);
+}
@@ -6,84 +6,62 @@ in vertex {
     vec2 TexCoords;
 } Vertex;
 
-out vec4 OutColor;
-
-struct material {
-	sampler2D Texture;
-	vec4 Color;
-	float SpecularPower;
-};
-
-uniform material Material;
-
-struct camera {
-	vec3 Position;
+#include "material.glsl"
+#include "transparency.glsl"
+#include "light_data.glsl"
+
+// Clustered lights, see cluster.hpp
+uniform usamplerBuffer ClusterRanges;
+uniform usamplerBuffer ClusterLightIndices;
+
+// Lights reaching everywhere are at the start of LightData and evaluated by every fragment
+uniform int NumGlobalLights;
+
+struct cluster_grid {
+	ivec3 Tiles; // Screen tiles and depth slices
+	vec2 ScreenSize;
+	float Near;
+	float Far;
+	float SliceScale;
+	float SliceBias;
 };
 
-uniform camera Camera;
-
-struct light {
-	vec4 Position;
-	vec3 Color;
-	float Ambient;
-	vec3 SpecularColor;
-	vec3 ConeDirection;
-	float LinearFalloff;
-	float QuadraticFalloff;
-	float InnerCone;
-	float OuterCone;
-};
-
-#define NUM_LIGHTS 3
-uniform light Lights[NUM_LIGHTS];
-
-#define saturate(x) (clamp(x, 0.0, 1.0))
-#define lengthSqr(x) (dot(x,x))
-#define PI 3.1415926535897932384626433832795
-
-vec3 DoLighting(light Light, vec3 Color, vec3 Normal, vec3 Pos, vec3 ToCamera) {
-	vec3 ToLight;
-	float Attenuation;
-	if(Light.Position.w == 0.0) {
-		// Directional
-		ToLight = normalize(Light.Position.xyz);
-		Attenuation = 1.0;
-	} else {
-		// Point
-		ToLight = Light.Position.xyz - Vertex.Position;
-		float DistanceToLight = length(ToLight);
-		ToLight = normalize(ToLight);
+uniform cluster_grid Clusters;
 
-		Attenuation = 1.0/(1.0 + Light.LinearFalloff * DistanceToLight
-			+ Light.QuadraticFalloff * DistanceToLight * DistanceToLight);
+int ClusterIndex() {
+	ivec2 Tile = ivec2(gl_FragCoord.xy / Clusters.ScreenSize * vec2(Clusters.Tiles.xy));
+	Tile = clamp(Tile, ivec2(0), Clusters.Tiles.xy - 1);
 
-		// Cone
-		if(lengthSqr(Light.ConeDirection) > 0) {
-			float Theta = dot(ToLight, normalize(-Light.ConeDirection));
-			Attenuation *= saturate((Theta - Light.OuterCone)/(Light.InnerCone-Light.OuterCone));
-		}
-	}
-
-	vec3 AmbientColor = Light.Ambient * Light.Color * Color;
-
-	float Diffuse = max(0.0, dot(Vertex.Normal, ToLight));
-	vec3 DiffuseColor = Diffuse * Color * Light.Color;
+	// Linear view depth back from the perspective depth
+	float NDCDepth = 2.0 * gl_FragCoord.z - 1.0;
+	float ViewDepth = 2.0 * Clusters.Near * Clusters.Far / (Clusters.Far + Clusters.Near - NDCDepth * (Clusters.Far - Clusters.Near));
+	int Slice = int(floor(log(ViewDepth) * Clusters.SliceScale + Clusters.SliceBias));
+	Slice = clamp(Slice, 0, Clusters.Tiles.z - 1);
 
-	float Specular = pow(max(0.0, dot(ToCamera, reflect(-ToLight, Normal))), Material.SpecularPower);
-	vec3 SpecularColor = Specular * Color * Light.SpecularColor;
-
-	return AmbientColor + Attenuation * (DiffuseColor + SpecularColor);
+	return (Slice * Clusters.Tiles.y + Tile.y) * Clusters.Tiles.x + Tile.x;
 }
 
 void main() {
-	vec4 BaseColor = texture(Material.Texture, Vertex.TexCoords);
- 	BaseColor *= Material.Color;
+	vec4 BaseColor = MaterialColor(Vertex.TexCoords);
+
+	vec3 ToCamera = normalize(Camera.Position - Vertex.Position);
 
-	OutColor.rgb = vec3(0);
+	OutColor.rgb = AmbientLight * BaseColor.rgb;
 	OutColor.a = BaseColor.a;
-	for(int i = 0; i < NUM_LIGHTS; ++i)
+	for(int i = 0; i < NumGlobalLights; ++i)
 	{
-		vec3 ToCamera = normalize(Camera.Position - Vertex.Position);
-		OutColor.rgb += DoLighting(Lights[i], BaseColor.rgb, Vertex.Normal, Vertex.Position, ToCamera);
+		OutColor.rgb += DoLighting(FetchLight(i), BaseColor.rgb, Material.SpecularPower, Vertex.Normal, Vertex.Position, ToCamera);
 	}
-}
\ No newline at end of file
+
+#if HAS_POINT_LIGHTS
+	// Only the lights whose influence reaches this fragment's cluster
+	uvec2 Range = texelFetch(ClusterRanges, ClusterIndex()).xy;
+	for(uint i = 0u; i < Range.y; ++i)
+	{
+		int LightIndex = int(texelFetch(ClusterLightIndices, int(Range.x + i)).r);
+		OutColor.rgb += DoLighting(FetchLight(LightIndex), BaseColor.rgb, Material.SpecularPower, Vertex.Normal, Vertex.Position, ToCamera);
+	}
+#endif
+
+	FinishOutput();
+}
@@ -8,6 +8,9 @@ uniform mat4 Model;
 uniform mat4 MVP;
 uniform mat4 NormalMat;
 
+// Same depth as the pre-pass, see depth.vert
+invariant gl_Position;
+
 out vertex {
 	vec3 Position;
 	vec3 Normal;
@@ -0,0 +1,25 @@
+// Color output of the lit passes, write OutColor then call FinishOutput
+
+#if HAS_WEIGHTED_OIT
+// Weighted blended order-independent transparency (McGuire and Bavoil 2013). Both targets use
+// BlendFuncSeparate(ONE, ONE, ZERO, ONE_MINUS_SRC_ALPHA), which core 3.3 can do without per
+// target blend functions, see oit_composite.frag for the resolve
+layout(location = 0) out vec4 Accumulation; // rgb: sum of weighted premultiplied colors, a: product of (1 - alpha)
+layout(location = 1) out vec4 Weights;      // r: sum of weighted alphas
+
+vec4 OutColor;
+
+void FinishOutput() {
+	float Alpha = clamp(OutColor.a, 0.0, 1.0);
+
+	// Closer surfaces weigh more, so the front-most layer dominates like it would when sorted
+	float Weight = clamp(pow(min(1.0, Alpha * 10.0) + 0.01, 3.0) * 1e8 * pow(1.0 - gl_FragCoord.z * 0.9, 3.0), 1e-2, 3e3);
+
+	Accumulation = vec4(OutColor.rgb * Alpha * Weight, Alpha);
+	Weights = vec4(Alpha * Weight);
+}
+#else
+out vec4 OutColor;
+
+void FinishOutput() {}
+#endif
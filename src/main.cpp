@@ -6,13 +6,30 @@
 #include <common.hpp>
 #include <file.hpp>
 #include <shader.hpp>
+#include <shader_reload.hpp>
 #include <texture.hpp>
 #include <cubemap.hpp>
+#include <texture_array.hpp>
+#include <sampler.hpp>
+#include <texture_streamer.hpp>
+#include <texture_registry.hpp>
 #include <transform.hpp>
 #include <camera.hpp>
 #include <input.hpp>
 #include <mesh.hpp>
+#include <mesh_file.hpp>
+#include <obj.hpp>
+#include <gltf.hpp>
 #include <light.hpp>
+#include <gpu_memory.hpp>
+#include <deferred.hpp>
+#include <render_queue.hpp>
+#include <cluster.hpp>
+#include <light_culling.hpp>
+#include <jobs.hpp>
+#include <timer.hpp>
+#include <benchmark.hpp>
+#include <cstring>
 #include <glm/gtx/euler_angles.hpp>
 
 void GLFWErrorCallback(int Error, const char* Desc);
@@ -23,13 +40,33 @@ void APIENTRY GLErrorLog(GLenum Source, GLenum Type, GLuint ID, GLenum Severity,
 
 GLFWwindow* Window;
 
-int main() {
+int main(int ArgCount, char** Args) {
+	auto HasArg = [&](const char* Arg) {
+		for (int i = 1; i < ArgCount; ++i) { if (strcmp(Args[i], Arg) == 0) { return true; } }
+		return false;
+	};
+	auto ArgValue = [&](const char* Arg) -> const char* {
+		for (int i = 1; i + 1 < ArgCount; ++i) { if (strcmp(Args[i], Arg) == 0) { return Args[i + 1]; } }
+		return nullptr;
+	};
+
+	Jobs.Initialize();
+	defer{ Jobs.Shutdown(); };
+
+	// Needs no window
+	if (auto Path = ArgValue("--bench-obj")) {
+		BenchmarkOBJ(Path, stdout);
+		return 0;
+	}
 
 	// Initialize glfw systems
 	glfwInit();
 	defer{ glfwTerminate(); };
 	glfwSetErrorCallback(GLFWErrorCallback);
 
+	// Runs after every GPU resource below had the chance to be destroyed
+	defer{ if (DEBUGGING) { GPUMemory.ReportLeaks(stderr); } };
+
 	// OpenGL version and parameters
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
@@ -51,6 +88,7 @@ int main() {
 	defer{ Input.Shutdown(); };
 	glfwSetMouseButtonCallback(Window, MouseButtonCallback);
 	glfwSetCursorPosCallback(Window, CursorPosCallback);
+	glfwSetKeyCallback(Window, KeyCallback);
 	glfwSetInputMode(Window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 
 	// Load OpenGL
@@ -86,7 +124,18 @@ int main() {
 		gl::Viewport(0, 0, ScreenDimensionInt.x, ScreenDimensionInt.y);
 		
 		ScreenDimension = ScreenDimensionInt;
+
+		// Window surfaces are allocated by the window system, track them anyway to have the full budget
+		GLint Samples = 0;
+		gl::GetIntegerv(gl::SAMPLES, &Samples);
+		auto SurfaceSamples = (uint) glm::max(Samples, 1);
+		GPUMemory.Track(gpu_resource::Framebuffer, 0,
+			EstimateTextureBytes(gl::SRGB8_ALPHA8, ScreenDimensionInt.x, ScreenDimensionInt.y, 1, 1, SurfaceSamples)
+			+ EstimateTextureBytes(gl::DEPTH24_STENCIL8, ScreenDimensionInt.x, ScreenDimensionInt.y, 1, 1, SurfaceSamples)
+			+ 2 * EstimateTextureBytes(gl::SRGB8_ALPHA8, ScreenDimensionInt.x, ScreenDimensionInt.y), // Front and back buffers
+			"Window");
 	}
+	defer{ GPUMemory.Release(gpu_resource::Framebuffer, 0); };
 
 	// Enable vsync
     glfwSwapInterval(1);
@@ -102,59 +151,219 @@ int main() {
 	// Gamma correction
 	gl::Enable(gl::FRAMEBUFFER_SRGB);
 
-	// alpha blending
-	gl::Enable(gl::BLEND);
-	gl::BlendFunc(gl::SRC_ALPHA, gl::ONE_MINUS_SRC_ALPHA);
+	// Cubemaps filter across their faces' edges, mipmapped skies would show the seams otherwise
+	gl::Enable(gl::TEXTURE_CUBE_MAP_SEAMLESS);
+
+	// Alpha blending is only enabled for the transparent draws, see render_queue
+	gl::Disable(gl::BLEND);
 
 	//////////////////////////////////////
 	// RENDER PROGRAMS (aka shaders)
 	/////////////////////////////////////
 
-	// Blinn-Phong shading render program
-	render_program PhongRenderProg{};
-	PhongRenderProg.ShaderPaths[shader_stage::Vertex] = "shader/phong.vert";
-	PhongRenderProg.ShaderPaths[shader_stage::Fragment] = "shader/phong.frag";
-	if (!PhongRenderProg.LoadShaders()) {}
+	// Linked programs are kept on disk between runs, compare startup with --no-program-cache
+	if (!HasArg("--no-program-cache")) { ProgramCache.Initialize("shader_cache"); }
+	EnableParallelShaderCompile();
+	cpu_timer ShaderTimer;
 
-	// Flat shading render program
-	render_program FlatRenderProg{};
-	FlatRenderProg.ShaderPaths[shader_stage::Vertex] = "shader/flat.vert";
-	FlatRenderProg.ShaderPaths[shader_stage::Fragment] = "shader/flat.frag";
-	if(!FlatRenderProg.LoadShaders()) {}
+	// Every program is compiled in the background while the rest of the content loads
+	program_batch ShaderBatch;
 
-	// Gourard shading render program
-	render_program GouraudRenderProg{};
-	GouraudRenderProg.ShaderPaths[shader_stage::Vertex] = "shader/gouraud.vert";
-	GouraudRenderProg.ShaderPaths[shader_stage::Fragment] = "shader/gouraud.frag";
-	if (!GouraudRenderProg.LoadShaders()) {}
+	// Sizes shared by the C++ and GLSL sides of the light buffers
+	const auto LightDefines = ShaderDefine("LIGHT_TEXELS", light_texel::TOTAL) + ShaderDefine("MAX_OBJECT_LIGHTS", MaxObjectLights);
+
+	// Blinn-Phong shading render programs, one per feature combination in use
+	shader_variants PhongShaders{};
+	PhongShaders.ShaderPaths[shader_stage::Vertex] = "shader/phong.vert";
+	PhongShaders.ShaderPaths[shader_stage::Fragment] = "shader/phong.frag";
+	PhongShaders.Defines = LightDefines;
+
+	// Flat shading render programs
+	shader_variants FlatShaders{};
+	FlatShaders.ShaderPaths[shader_stage::Vertex] = "shader/flat.vert";
+	FlatShaders.ShaderPaths[shader_stage::Fragment] = "shader/flat.frag";
+	FlatShaders.Defines = LightDefines;
+
+	// Gourard shading render programs
+	shader_variants GouraudShaders{};
+	GouraudShaders.ShaderPaths[shader_stage::Vertex] = "shader/gouraud.vert";
+	GouraudShaders.ShaderPaths[shader_stage::Fragment] = "shader/gouraud.frag";
+	GouraudShaders.Defines = LightDefines;
 
 	// Skybox
 	render_program SkyRenderProg{};
 	SkyRenderProg.ShaderPaths[shader_stage::Vertex] = "shader/sky.vert";
 	SkyRenderProg.ShaderPaths[shader_stage::Fragment] = "shader/sky.frag";
-	if (!SkyRenderProg.LoadShaders()) {}
+	ShaderBatch.Add(SkyRenderProg);
+
+	// Deferred shading G-buffer and render programs
+	deferred_renderer Deferred{ glm::ivec2(ScreenDimension) };
+	Deferred.QueueShaders(ShaderBatch);
+
+	// Draw lists, depth pre-pass and transparency
+	render_queue RenderQueue{ glm::ivec2(ScreenDimension) };
+	RenderQueue.QueueShaders(ShaderBatch);
+
+	// Building the variants on first use would stall the frames that need them
+	PhongShaders.Precompile(ShaderBatch);
+	FlatShaders.Precompile(ShaderBatch);
+	GouraudShaders.Precompile(ShaderBatch);
+
+	const auto ShaderSubmitMilliseconds = ShaderTimer.Milliseconds();
+
+	// Light grid for clustered forward shading (Phong)
+	light_clusters Clusters;
+	Clusters.Initialize();
+	defer{ Clusters.Shutdown(); };
 
-	mesh Arrow{ GenerateArrowTriangles(.05f, .1f, .6f, .4f, 32), gl::TRIANGLES };
+	// Per-object light lists for the per-vertex lighting models (Gouraud, flat)
+	light_lists ObjectLightLists;
+	ObjectLightLists.Initialize();
+	defer{ ObjectLightLists.Shutdown(); };
+
+	RenderQueue.Initialize();
+	defer{ RenderQueue.Shutdown(); };
+
+	gpu_timer FrameTimer;
+	FrameTimer.Initialize();
+	defer{ FrameTimer.Shutdown(); };
+
+	light_benchmark LightBenchmark;
+	if (HasArg("--bench-lights")) {
+		LightBenchmark.Start();
+		glfwSwapInterval(0);
+	}
+
+	// Filtering of the material textures, T cycles through the presets
+	samplers Samplers;
+	Samplers.Initialize();
+	defer{ Samplers.Shutdown(); };
+	auto MaterialSampler = sampler_preset::Anisotropic;
+
+	sampler_benchmark SamplerBenchmark;
+	if (HasArg("--bench-samplers")) {
+		SamplerBenchmark.Start();
+		glfwSwapInterval(0);
+	}
+
+	// Procedural meshes have several tessellations, objects use the coarsest that looks right at their size on screen.
+	// The cube stays in floats, the sky shader uses its positions as directions
+	mesh Arrow{ GenerateRevolvedLods({ 32, 16, 8, 4 }, [](int Steps) { return GenerateArrowTriangles(.05f, .1f, .6f, .4f, Steps); }), gl::TRIANGLES, "Arrow", vertex_format::Packed };
 	defer{ Arrow.Destroy(); };
 
-	mesh Cube{ GenerateCubeTriangles(), gl::TRIANGLES };
+	mesh Cube{ GenerateCubeTriangles(), gl::TRIANGLES, nullptr, "Cube" };
 	defer{ Cube.Destroy(); };
 
-	mesh Cone{ GenerateConeTriangles(.5f, 1.f, 4), gl::TRIANGLES };
+	mesh Cone{ GenerateRevolvedLods({ 32, 16, 8, 4 }, [](int Steps) { return GenerateConeTriangles(.5f, 1.f, Steps); }), gl::TRIANGLES, "Cone", vertex_format::Packed };
 	defer{ Cone.Destroy(); };
 
+	// Optional model, --mesh <file> for one converted by MeshConverter or --obj <file>
+	mesh LoadedModel{ 0, 0, 0, gl::TRIANGLES, 0, 0 };
+	defer{ LoadedModel.Destroy(); };
+	if (auto Path = ArgValue("--mesh")) {
+		cpu_timer LoadTimer;
+		if (LoadMeshFile(Path, LoadedModel)) {
+			printf("[Mesh] %s: %u indices, %u vertices in %.1f ms\n", Path, LoadedModel.NumIndices, LoadedModel.NumVerts, LoadTimer.Milliseconds());
+		}
+	} else if (auto Path = ArgValue("--obj")) {
+		obj_mesh Obj;
+		obj_stats Stats;
+		if (LoadOBJ(Path, Obj, &Stats)) {
+			printf("[OBJ] %s: %u triangles, %u vertices in %.1f ms (parse %.1f ms, resolve %.1f ms)\n", Path, Stats.NumTriangles, (uint) Obj.Vertices.size(),
+				Stats.MapMilliseconds + Stats.ParseMilliseconds + Stats.ResolveMilliseconds, Stats.ParseMilliseconds, Stats.ResolveMilliseconds);
+			LoadedModel = mesh{ std::move(Obj.Vertices), gl::TRIANGLES, &Obj.Indices, Path, vertex_format::Packed };
+		}
+	}
+
 	uint BlankTextureID = MakeBlankTexture();
+	defer{
+		GPUMemory.Release(gpu_resource::Texture, BlankTextureID);
+		gl::DeleteTextures(1, &BlankTextureID);
+	};
+
+	// Optional glTF scene, --gltf <file.gltf | file.glb>
+	gltf_model GltfModel;
+	defer{ GltfModel.Destroy(); };
+	if (auto Path = ArgValue("--gltf")) {
+		cpu_timer LoadTimer;
+		if (GltfModel.Load(Path, BlankTextureID)) { printf("[glTF] %s: loaded in %.1f ms\n", Path, LoadTimer.Milliseconds()); }
+	}
 
-	texture CubeTexture{ "content/box.jpg" };
-	Assert(CubeTexture.Load());
+	// Decoded by the workers and uploaded over the first frames, the blank texture (no sky) stands in meanwhile.
+	// The registry and the arrays outlive the streamer, which may still be writing to their textures
+	texture_arrays TextureArrays;
+	defer{ TextureArrays.Clear(); };
+	texture_registry Textures;
+	defer{ Textures.Clear(); };
+	cubemap Skybox{ 0 };
+	defer{ Skybox.Destroy(); };
+
+	texture_streamer TextureStreamer;
+	if (!HasArg("--no-texture-cache")) { TextureCache.Initialize("texture_cache"); }
+	TextureStreamer.Initialize(4 << 20, !HasArg("--no-texture-compression"));
+	defer{ TextureStreamer.Shutdown(); };
+	// Mip levels are filtered on the workers, compare the sharper default with --mip-filter box
+	if (auto Name = ArgValue("--mip-filter")) {
+		uint Filter = 0;
+		while (Filter < mip_filter::TOTAL && strcmp(Name, MipFilterNames[Filter]) != 0) { ++Filter; }
+		if (Filter < mip_filter::TOTAL) {
+			TextureStreamer.MipFilter = (mip_filter::type) Filter;
+		} else {
+			LogError("[Texture] Unknown mip filter %s, keeping %s\n", Name, MipFilterNames[TextureStreamer.MipFilter]);
+		}
+	}
+	Textures.Streamer = &TextureStreamer;
+	// Same sized textures share an array, compare the texture binds with --no-texture-arrays
+	if (!HasArg("--no-texture-arrays")) { Textures.Arrays = &TextureArrays; }
+
+	const auto CubeTexture = Textures.Acquire("content/box.jpg");
+	const auto TriangleTexture = Textures.Acquire("content/triangle.tga");
+	// Six files, or a single KTX/DDS cubemap with --skybox
+	if (auto Path = ArgValue("--skybox")) {
+		TextureStreamer.Load(Skybox, std::string{ Path }, true);
+	} else {
+		TextureStreamer.Load(Skybox, "content/skyboxes/day_", "tga", true);
+	}
 
-	texture TriangleTexture{ "content/triangle.tga" };
-	Assert(TriangleTexture.Load());
+	// Only now wait for the driver, whatever it did not finish meanwhile
+	{
+		const auto BatchDoneEarly = ShaderBatch.IsDone();
+		cpu_timer WaitTimer;
+		ShaderBatch.Finish();
+		Deferred.SetupShaders();
+		RenderQueue.SetupShaders();
+
+		printf("[Shader] Programs ready in %.1f ms (%s cache), %.1f ms to submit, %.1f ms waited after loading content%s: %u from binaries, %u compiled, %u binaries rejected\n",
+			ShaderTimer.Milliseconds(), !ProgramCache.Enabled ? "no" : ProgramCache.Compiled == 0 ? "warm" : "cold",
+			ShaderSubmitMilliseconds, WaitTimer.Milliseconds(), BatchDoneEarly ? " (already done)" : "",
+			ProgramCache.Hits, ProgramCache.Compiled, ProgramCache.Rejected);
+	}
+
+#if DEBUGGING
+	// Rebuild the programs as their sources are saved, F7 rebuilds them all
+	shader_hot_reload HotReload;
+	HotReload.Initialize();
+	defer{ HotReload.Shutdown(); };
+	HotReload.Add(PhongShaders);
+	HotReload.Add(FlatShaders);
+	HotReload.Add(GouraudShaders);
+	HotReload.Add(SkyRenderProg);
+	HotReload.Add(Deferred.GeometryShaders);
+	const auto SetupDeferred = [&] { Deferred.SetupShaders(); };
+	HotReload.Add(Deferred.StencilProg, SetupDeferred);
+	HotReload.Add(Deferred.LightProg, SetupDeferred);
+	HotReload.Add(Deferred.ResolveProg, SetupDeferred);
+	const auto SetupRenderQueue = [&] { RenderQueue.SetupShaders(); };
+	HotReload.Add(RenderQueue.DepthProg, SetupRenderQueue);
+	HotReload.Add(RenderQueue.CompositeProg, SetupRenderQueue);
+#endif
 
-	auto Skybox = MakeCubemap("content/skyboxes/day_", "tga", true);
-	Assert(Skybox.ID > 0);
+	GPUMemory.DumpReport(stdout);
 
-	std::array<light, 3> Lights;
+	// The first lights are the scene's, optionally followed by a field of small point lights
+	const size NumSceneLights = 3;
+	const uint NumStressLights = 512;
+	std::vector<light> Lights(NumSceneLights);
 	// Directional Light
 	Lights[0].Position = vec4(.125f, 1.f, 0.f, 0.f);
 	Lights[0].Color = vec3(.25f, .25f, 1.f);
@@ -192,10 +401,15 @@ int main() {
 		Phong,
 		Gouraud,
 		Flat,
+		Deferred,
 	};
 
 	auto Lighting = lighting_model::Phong;
 
+	// Level of detail of each object last frame, for the hysteresis
+	uint ConeLod = 0;
+	std::array<uint, 3> ArrowLods{};
+
 	//////////////////////////////////
 	// INTERACTION LOOP
 	//////////////////////////////////
@@ -247,133 +461,160 @@ int main() {
 			Camera.Transform.Rotation = glm::normalize(glm::angleAxis(CameraEulerAngles.y, vec3{ 0.f, 1.f, 0.f }) * glm::angleAxis(CameraEulerAngles.x, vec3{ 1.f, 0.f, 0.f }));
 		}
 
+		if (LightBenchmark.Active) {
+			if (!LightBenchmark.BeginFrame(Lights, NumSceneLights)) {
+				LightBenchmark.Report(stdout);
+				glfwSetWindowShouldClose(Window, true);
+				continue;
+			}
+
+			// Same view for every step
+			Camera.Transform.Position = vec3(0.f, 1.5f, 3.5f);
+			Camera.Transform.Rotation = quat{};
+			Lighting = lighting_model::Phong;
+		}
+
+		// Once the textures are in, their mip levels included
+		bool32 BenchmarkingSamplers = false;
+		float WallDistance = 0.f;
+		if (SamplerBenchmark.Active && TextureStreamer.IsIdle()) {
+			Camera.Transform.Position = vec3(0.f);
+			Camera.Transform.Rotation = quat{};
+			if (!SamplerBenchmark.BeginFrame(Camera, MaterialSampler, WallDistance)) {
+				SamplerBenchmark.Report(stdout);
+				glfwSetWindowShouldClose(Window, true);
+				continue;
+			}
+			BenchmarkingSamplers = true;
+			Lighting = lighting_model::Phong;
+		}
+
 		auto& Spotlight = Lights[2];
 		static bool IsFlashlightOn = true;
 		if (Input.JustUp(mouse_button::Left) || Input.JustUp(mouse_button::Right)) {
 			IsFlashlightOn = !IsFlashlightOn;
 		}
 
+		Spotlight.Enabled = IsFlashlightOn;
 		if (IsFlashlightOn) {
-			Lights[2].InnerCone = cos(Pi / 16);
-			Lights[2].OuterCone = cos(Pi / 12);
 			Spotlight.Position = vec4{ Camera.Transform.Position, 1.f };
 			Spotlight.ConeDirection = glm::rotate(Camera.Transform.Rotation, vec3{ 0.f, 0.f, -1.f });
-		} else {
-			Lights[2].InnerCone = 1;
-			Lights[2].OuterCone = 1;
 		}
 
 		if (Input.IsDown(GLFW_KEY_1)) { Lighting = lighting_model::Phong; }
 		else if (Input.IsDown(GLFW_KEY_2)) { Lighting = lighting_model::Gouraud; }
 		else if (Input.IsDown(GLFW_KEY_3)) { Lighting = lighting_model::Flat; }
+		else if (Input.IsDown(GLFW_KEY_4)) { Lighting = lighting_model::Deferred; }
+
+		// Cycle the depth pre-pass mode
+		if (Input.JustDown(GLFW_KEY_P)) {
+			const char* ModeNames[] = { "off", "on", "auto" };
+			RenderQueue.PrepassMode = (depth_prepass::type) ((RenderQueue.PrepassMode + 1) % depth_prepass::TOTAL);
+			printf("[Render] Depth pre-pass %s, last measured overdraw %.2f\n", ModeNames[RenderQueue.PrepassMode], RenderQueue.Overdraw);
+		}
+
+		// Switch between sorted and order-independent transparency
+		if (Input.JustDown(GLFW_KEY_O)) {
+			RenderQueue.TransparencyMode = (transparency::type) ((RenderQueue.TransparencyMode + 1) % transparency::TOTAL);
+			printf("[Render] %s transparency\n", RenderQueue.TransparencyMode == transparency::Sorted ? "Sorted" : "Weighted blended");
+		}
+
+		// Cycle the filtering of the material textures
+		if (Input.JustDown(GLFW_KEY_T)) {
+			MaterialSampler = (sampler_preset::type) ((MaterialSampler + 1) % sampler_preset::TOTAL);
+			printf("[Render] %s texture filtering\n", SamplerPresetNames[MaterialSampler]);
+		}
+
+		// Toggle a field of small point lights
+		if (Input.JustDown(GLFW_KEY_L)) {
+			if (Lights.size() > NumSceneLights) {
+				Lights.resize(NumSceneLights);
+			} else {
+				auto StressLights = MakeRandomPointLights(NumStressLights, vec3{ -4.f, -.5f, -4.f }, vec3{ 4.f, 3.f, 4.f });
+				Lights.insert(Lights.end(), StressLights.begin(), StressLights.end());
+			}
+		}
+
+		// Orbit them around the scene
+		const auto Orbit = glm::angleAxis(.25f * DeltaTime, vec3{ 0.f, 1.f, 0.f });
+		for (size i = NumSceneLights; i < Lights.size(); ++i) {
+			Lights[i].Position = vec4{ glm::rotate(Orbit, vec3{ Lights[i].Position }), 1.f };
+		}
+
+		if (Input.JustDown(GLFW_KEY_F9)) { GPUMemory.DumpReport(stdout); }
 
 #if DEBUGGING
 		gl::UseProgram(0);
 		// Reload shaders
-		if (Input.IsDown(GLFW_KEY_F7)) {
-			PhongRenderProg.ReloadShaders();
-			FlatRenderProg.ReloadShaders();
-			GouraudRenderProg.ReloadShaders();
-			SkyRenderProg.ReloadShaders();
-		}
+		if (Input.JustDown(GLFW_KEY_F7)) { HotReload.ReloadAll(); }
+		HotReload.Update();
 #endif
 
 		/////////////////////////////////
 		// DRAWING
 		/////////////////////////////////
 
+		FrameTimer.Begin();
+		TextureStreamer.Update();
+		Textures.Update();
+
 		// Clear buffers
 		const auto ClearColor = vec3{ .2f, .3f, .65f };
 		gl::ClearColor(ClearColor.r, ClearColor.g, ClearColor.b, 1.f);
 		gl::Clear(gl::COLOR_BUFFER_BIT | gl::DEPTH_BUFFER_BIT);
 
-		render_program* RenderProg = nullptr;
+		shader_variants* Shaders = nullptr;
 	    switch (Lighting) {
-		case lighting_model::Phong: RenderProg = &PhongRenderProg; break;
-		case lighting_model::Gouraud: RenderProg = &GouraudRenderProg; break;
-		case lighting_model::Flat: RenderProg = &FlatRenderProg; break;
+		case lighting_model::Phong: Shaders = &PhongShaders; break;
+		case lighting_model::Gouraud: Shaders = &GouraudShaders; break;
+		case lighting_model::Flat: Shaders = &FlatShaders; break;
+		case lighting_model::Deferred: Shaders = &Deferred.GeometryShaders; break;
 		default: Assert(!"Invalid Lighting model");
 	    }
 
-		gl::UseProgram(RenderProg->ID);
-
-		// Lighting uniforms
-		for (int i = 0; i < Lights.size(); ++i) {
-			char Buffer[24];
-			sprintf(Buffer, "Lights[%d]", i);
-			BindLight(RenderProg->ID, Buffer, Lights[i]);
+		if (Lighting == lighting_model::Deferred) {
+			Deferred.BeginGeometryPass();
 		}
-		
-		// Transform uniforms
-		auto ModelLoc = gl::GetUniformLocation(RenderProg->ID, "Model");
-		auto MVPLoc = gl::GetUniformLocation(RenderProg->ID, "MVP");
-		auto NormalMatLoc = gl::GetUniformLocation(RenderProg->ID, "NormalMat");
-		
-		// Material uniforms
-		auto TextureLoc = gl::GetUniformLocation(RenderProg->ID, "Material.Texture");
-    	auto ColorLoc = gl::GetUniformLocation(RenderProg->ID, "Material.Color");
-		auto SpecularPowerLoc = gl::GetUniformLocation(RenderProg->ID, "Material.SpecularPower");
-		
-		
-    	auto CameraPositionLoc = gl::GetUniformLocation(RenderProg->ID, "Camera.Position");
-		gl::Uniform3f(CameraPositionLoc, Camera.Transform.Position.x, Camera.Transform.Position.y, Camera.Transform.Position.z);
-		
-
-		auto SetupRender = [&] (glm::mat4 Model, glm::mat4 MVP, glm::mat4 NormalMat, glm::vec4 Color, float SpecularPower, int TextureSampler, int Texture) {
-			gl::UniformMatrix4fv(ModelLoc, 1, false, glm::value_ptr(Model));
-			gl::UniformMatrix4fv(MVPLoc, 1, false, glm::value_ptr(MVP));
-			gl::UniformMatrix4fv(NormalMatLoc, 1, false, glm::value_ptr(NormalMat));
-			gl::Uniform4f(ColorLoc, Color.r, Color.g, Color.b, Color.a);
-			gl::Uniform1f(SpecularPowerLoc, SpecularPower);
-			gl::Uniform1i(TextureLoc, TextureSampler);
-			gl::ActiveTexture(gl::TEXTURE0 + TextureSampler);
-			gl::BindTexture(gl::TEXTURE_2D, Texture);
-		};
 
+		// Scene
+		RenderQueue.Clear();
 		{
-			// Draw Cone
+			// Cone
 			transform Transform;
 			Transform.Position = vec3{ -1.f, 0.f, 0.f };
 			Transform.Rotation = glm::rotate(mat4{}, Pi / 2, vec3{ 0.f, 0.f, 1.f });
 			auto Model = Transform.ToMatrix();
-			auto MVP = Camera.ViewProjection() * Model;
-			auto NormalMat = glm::transpose(glm::inverse(Transform.ToMatrix()));
-			auto Color = vec4{1.f, 1.f, 1.f, 1.f};
-			auto SpecularPower = 32.f;
-			auto TextureSampler = 0;
-			auto Texture = TriangleTexture.ID;
-
-			SetupRender(Model, MVP, NormalMat, Color, SpecularPower, TextureSampler, Texture);
-			
-			gl::BindVertexArray(Cone.VAO);
-			Cone.Draw();
-
-			gl::BindTexture(gl::TEXTURE_2D, 0);
+			ConeLod = Cone.SelectLod(Camera.ScreenSize(TransformSphere(Model, Cone.Bounds)), ConeLod);
+			RenderQueue.Add(draw_item{ &Cone, Model, material{ vec4{ 1.f, 1.f, 1.f, 1.f }, 32.f, Textures.ID(TriangleTexture, BlankTextureID), false, Textures.Layer(TriangleTexture) }, ConeLod });
 		}
 
 		{
-			// Draw Cube
+			// Cube
 			transform Transform;
 			Transform.Position = vec3{ 1.f, .5f, 0.f };
-			auto Model = Transform.ToMatrix();
-			auto MVP = Camera.ViewProjection() * Model;
-			auto NormalMat = glm::transpose(glm::inverse(Transform.ToMatrix()));
-			auto Color = vec4{ 1.f, 1.f, 1.f, 1.f };
-			auto SpecularPower = 256.f;
-			auto TextureSampler = 0;
-			auto Texture = CubeTexture.ID;
-
-			SetupRender(Model, MVP, NormalMat, Color, SpecularPower, TextureSampler, Texture);
+			RenderQueue.Add(draw_item{ &Cube, Transform.ToMatrix(), material{ vec4{ 1.f, 1.f, 1.f, 1.f }, 256.f, Textures.ID(CubeTexture, BlankTextureID), false, Textures.Layer(CubeTexture) } });
+		}
 
-			gl::BindVertexArray(Cube.VAO);
-			Cube.Draw();
+		if (LoadedModel.NumIndices > 0) {
+			// Loaded model, scaled to a 1.5 units wide sphere behind the widget
+			transform Transform;
+			Transform.Scale = vec3{ .75f / glm::max(LoadedModel.Bounds.Radius, 1e-6f) };
+			Transform.Position = vec3{ 0.f, .75f, -2.f } - Transform.Scale * LoadedModel.Bounds.Center;
+			RenderQueue.Add(draw_item{ &LoadedModel, Transform.ToMatrix(), material{ vec4{ 1.f, 1.f, 1.f, 1.f }, 64.f, BlankTextureID, false } });
+		}
 
-			gl::BindTexture(gl::TEXTURE_2D, 0);
+		if (!GltfModel.Primitives.empty()) {
+			// glTF scene, in the same spot
+			transform Transform;
+			Transform.Scale = vec3{ .75f / glm::max(GltfModel.Bounds.Radius, 1e-6f) };
+			Transform.Position = vec3{ 0.f, .75f, -2.f } - Transform.Scale * GltfModel.Bounds.Center;
+			GltfModel.ForEachPrimitive(Transform.ToMatrix(), [&](const mesh& Mesh, const mat4& Model, const material& Material) {
+				RenderQueue.Add(draw_item{ &Mesh, Model, Material });
+			});
 		}
 
-		
 		{
-			// Draw transform widget
+			// Transform widget
 			vec3 Position = vec3{ 0.f, 2.f, 0.f };
 			std::array<transform, 3> Models = {transform{}, transform{}, transform{}};
 			Models[0].Position = Position;
@@ -391,24 +632,171 @@ int main() {
 
 			std::array<vec3, 3> Colors = { vec3{1.f, 0.f, 0.f}, vec3{0.f, 1.f, 0.f}, vec3{0.f, 0.f, 1.f} };
 
-			gl::BindVertexArray(Arrow.VAO);
 			for (int i = 0; i < 3; ++i) {
 				auto Model = Models[i].ToMatrix();
-				auto MVP = Camera.ViewProjection() * Model;
-				auto NormalMat = glm::transpose(glm::inverse(Model));
-				auto Color = vec4{ Colors[i], 1.f };
-				auto SpecularPower = 32.f;
-				auto TextureSampler = 0;
-				auto Texture = BlankTextureID;
+				ArrowLods[i] = Arrow.SelectLod(Camera.ScreenSize(TransformSphere(Model, Arrow.Bounds)), ArrowLods[i]);
+				RenderQueue.Add(draw_item{ &Arrow, Model, material{ vec4{ Colors[i], 1.f }, 32.f, BlankTextureID, false }, ArrowLods[i] });
+			}
+		}
 
-				SetupRender(Model, MVP, NormalMat, Color, SpecularPower, TextureSampler, Texture);
+		{
+			// Tinted glass cubes in a row, overlapping from most viewpoints
+			std::array<vec4, 3> Tints = { vec4{ 1.f, .2f, .2f, .35f }, vec4{ .2f, 1.f, .2f, .35f }, vec4{ .2f, .2f, 1.f, .35f } };
+			for (uint i = 0; i < Tints.size(); ++i) {
+				transform Transform;
+				Transform.Position = vec3{ -1.5f + 1.5f * i, .5f, 1.5f };
+				Transform.Scale = vec3{ .5f };
+				RenderQueue.Add(draw_item{ &Cube, Transform.ToMatrix(), material{ Tints[i], 128.f, BlankTextureID, true } });
+			}
+		}
 
-				Arrow.Draw();
+		if (BenchmarkingSamplers) {
+			// Only the wall, the frame time is its texturing
+			RenderQueue.Clear();
+			const auto Material = material{ vec4{ 1.f }, 32.f, Textures.ID(CubeTexture, BlankTextureID), false, Textures.Layer(CubeTexture) };
+			for (uint i = 0; i < sampler_benchmark::GridSize * sampler_benchmark::GridSize; ++i) {
+				RenderQueue.Add(draw_item{ &Cube, SamplerBenchmark.CubeModel(i, WallDistance), Material });
 			}
 		}
 
-		{
-			//Render skybox
+		// Light types present this frame, the shaders leave out the code for the missing ones
+		uint FrameLightFeatures = 0;
+		for (const auto& Light : Lights) {
+			if (Light.Enabled) { FrameLightFeatures |= LightShaderFeatures(Light); }
+		}
+
+		// Deferred shading cannot blend, its transparent draws are forward shaded with the Phong programs
+		shader_variants* TransparentShaders = Lighting == lighting_model::Deferred ? &PhongShaders : Shaders;
+
+		if (Shaders == &PhongShaders || (TransparentShaders == &PhongShaders && !RenderQueue.Transparent.empty())) {
+			Clusters.Build(Camera, Lights);
+			Clusters.Upload();
+		}
+
+		const bool32 UsesObjectLights = Lighting == lighting_model::Gouraud || Lighting == lighting_model::Flat;
+		if (UsesObjectLights) {
+			ObjectLightLists.Build(Lights);
+		}
+
+		// Draws pick the variant matching their features, per-frame uniforms are set when it changes.
+		// Material textures and arrays have units of their own past the light buffers' (a sampler2D and a
+		// sampler2DArray may not share one), sampled with the frame's preset wrapped as the material asks.
+		// Textures and samplers are only bound again when they change
+		const auto TextureSampler = 4;
+		const auto TextureArraySampler = 5;
+		uint BoundTexture = 0, BoundTextureArray = 0;
+		GLuint BoundSampler = 0, BoundArraySampler = 0;
+		render_program* RenderProg = nullptr;
+		GLint ModelLoc = -1, MVPLoc = -1, NormalMatLoc = -1;
+		GLint TextureLoc = -1, TextureArrayLoc = -1, LayerLoc = -1, ColorLoc = -1, SpecularPowerLoc = -1;
+		GLint NumObjectLightsLoc = -1, ObjectLightsLoc = -1;
+
+		// False while the variant is still being built, the draw is skipped until it links
+		auto UseRenderProgram = [&] (uint Features) {
+			auto Program = Shaders->Get(Features);
+			if (!Program) { return false; }
+			if (Program == RenderProg) { return true; }
+
+			RenderProg = Program;
+			gl::UseProgram(RenderProg->ID);
+
+			if (Shaders == &PhongShaders) { Clusters.Bind(RenderProg->ID, 1); }
+			if (UsesObjectLights) { ObjectLightLists.Bind(RenderProg->ID, 1); }
+
+			// Transform uniforms
+			ModelLoc = gl::GetUniformLocation(RenderProg->ID, "Model");
+			MVPLoc = gl::GetUniformLocation(RenderProg->ID, "MVP");
+			NormalMatLoc = gl::GetUniformLocation(RenderProg->ID, "NormalMat");
+
+			// Material uniforms
+			TextureLoc = gl::GetUniformLocation(RenderProg->ID, "Material.Texture");
+			TextureArrayLoc = gl::GetUniformLocation(RenderProg->ID, "Material.TextureArray");
+			LayerLoc = gl::GetUniformLocation(RenderProg->ID, "Material.Layer");
+			gl::Uniform1i(TextureLoc, TextureSampler);
+			gl::Uniform1i(TextureArrayLoc, TextureArraySampler);
+			ColorLoc = gl::GetUniformLocation(RenderProg->ID, "Material.Color");
+			SpecularPowerLoc = gl::GetUniformLocation(RenderProg->ID, "Material.SpecularPower");
+
+			// Light list uniforms
+			NumObjectLightsLoc = gl::GetUniformLocation(RenderProg->ID, "NumObjectLights");
+			ObjectLightsLoc = gl::GetUniformLocation(RenderProg->ID, "ObjectLights");
+
+			auto CameraPositionLoc = gl::GetUniformLocation(RenderProg->ID, "Camera.Position");
+			gl::Uniform3f(CameraPositionLoc, Camera.Transform.Position.x, Camera.Transform.Position.y, Camera.Transform.Position.z);
+			return true;
+		};
+
+		const auto ViewProjection = Camera.ViewProjection();
+		auto SetupRender = [&] (const draw_item& Item, uint PassFeatures) {
+			const auto& Material = Item.Material;
+			const auto Model = Item.Model * Item.Mesh->PositionTransform;
+			const auto MVP = ViewProjection * Model;
+			const auto NormalMat = glm::transpose(glm::inverse(Item.Model));
+
+			// The blank texture is only there to make sampling a no-op, skip it altogether
+			uint Features = PassFeatures;
+			if (Material.Layer.Array) { Features |= shader_feature::TextureArray; }
+			else if (Material.Texture != BlankTextureID) { Features |= shader_feature::Texture; }
+
+			object_lights ObjectLights{};
+			if (UsesObjectLights) {
+				ObjectLights = ObjectLightLists.Cull(TransformSphere(Item.Model, Item.Mesh->Bounds));
+				Features |= ObjectLights.Features;
+			} else {
+				Features |= FrameLightFeatures;
+			}
+
+			if (!UseRenderProgram(Features)) { return; }
+
+			if (UsesObjectLights) {
+				gl::Uniform1i(NumObjectLightsLoc, ObjectLights.Count);
+				if (ObjectLights.Count > 0) { gl::Uniform1iv(ObjectLightsLoc, ObjectLights.Count, ObjectLights.Indices.data()); }
+			}
+
+			gl::UniformMatrix4fv(ModelLoc, 1, false, glm::value_ptr(Model));
+			gl::UniformMatrix4fv(MVPLoc, 1, false, glm::value_ptr(MVP));
+			gl::UniformMatrix4fv(NormalMatLoc, 1, false, glm::value_ptr(NormalMat));
+			gl::Uniform4f(ColorLoc, Material.Color.r, Material.Color.g, Material.Color.b, Material.Color.a);
+			gl::Uniform1f(SpecularPowerLoc, Material.SpecularPower);
+			const auto Sampler = Samplers.ID(MaterialSampler, Material.Sampler);
+			if (Material.Layer.Array) {
+				gl::Uniform1f(LayerLoc, (float) Material.Layer.Layer);
+				if (Sampler != BoundArraySampler) {
+					gl::BindSampler(TextureArraySampler, Sampler);
+					BoundArraySampler = Sampler;
+				}
+				if (Material.Layer.Array != BoundTextureArray) {
+					gl::ActiveTexture(gl::TEXTURE0 + TextureArraySampler);
+					gl::BindTexture(gl::TEXTURE_2D_ARRAY, Material.Layer.Array);
+					gl::ActiveTexture(gl::TEXTURE0);
+					BoundTextureArray = Material.Layer.Array;
+				}
+			} else {
+				if (Sampler != BoundSampler) {
+					gl::BindSampler(TextureSampler, Sampler);
+					BoundSampler = Sampler;
+				}
+				if (Material.Texture != BoundTexture) {
+					gl::ActiveTexture(gl::TEXTURE0 + TextureSampler);
+					gl::BindTexture(gl::TEXTURE_2D, Material.Texture);
+					gl::ActiveTexture(gl::TEXTURE0);
+					BoundTexture = Material.Texture;
+				}
+			}
+
+			gl::BindVertexArray(Item.Mesh->VAO);
+			Item.Mesh->Draw(0, Item.Lod);
+		};
+
+		// Deferred lighting already runs once per pixel, its G-buffer pass gains little from a pre-pass
+		RenderQueue.DrawOpaque(ViewProjection, Lighting != lighting_model::Deferred, SetupRender);
+
+		if (Lighting == lighting_model::Deferred) {
+			Deferred.LightingPass(Camera, Lights);
+		}
+
+		if (Skybox.ID > 0) {
+			//Render skybox, once it has streamed in
 			gl::CullFace(gl::FRONT);
 			defer{ gl::CullFace(gl::BACK); };
 
@@ -430,12 +818,32 @@ int main() {
 			gl::BindTexture(gl::TEXTURE_CUBE_MAP, Skybox.ID);
 			defer{ gl::BindTexture(gl::TEXTURE_CUBE_MAP, 0); };
 
-			gl::BindVertexArray(Cube.VAO);
+			gl::BindVertexArray(Cube.PositionVAO);
 			defer{ gl::BindVertexArray(0); };
 
 			Cube.Draw();
 		}
 
+		// After the sky, which would otherwise overwrite them since they leave depth untouched
+		Shaders = TransparentShaders;
+		RenderProg = nullptr;
+		RenderQueue.DrawTransparent(Camera, SetupRender);
+		gl::ActiveTexture(gl::TEXTURE0 + TextureSampler);
+		gl::BindTexture(gl::TEXTURE_2D, 0);
+		gl::ActiveTexture(gl::TEXTURE0 + TextureArraySampler);
+		gl::BindTexture(gl::TEXTURE_2D_ARRAY, 0);
+		gl::ActiveTexture(gl::TEXTURE0);
+		gl::BindSampler(TextureSampler, 0);
+		gl::BindSampler(TextureArraySampler, 0);
+
+		FrameTimer.End();
+		if (LightBenchmark.Active) {
+			LightBenchmark.EndFrame(Clusters.BuildMilliseconds, FrameTimer.LastMilliseconds);
+		}
+		if (BenchmarkingSamplers) {
+			SamplerBenchmark.EndFrame(FrameTimer.LastMilliseconds);
+		}
+
         glfwSwapBuffers(Window);
 		Input.EndFrame();
     }
@@ -178,6 +178,9 @@ namespace gl
 		extern LoadTest var_EXT_texture_sRGB;
 		extern LoadTest var_EXT_texture_filter_anisotropic;
 		extern LoadTest var_KHR_debug;
+		extern LoadTest var_ARB_get_program_binary;
+		extern LoadTest var_KHR_parallel_shader_compile;
+		extern LoadTest var_ARB_texture_storage;
 		
 	} //namespace exts
 	enum
@@ -249,6 +252,16 @@ namespace gl
 		STACK_UNDERFLOW                  = 0x0504,
 		VERTEX_ARRAY                     = 0x8074,
 		
+		NUM_PROGRAM_BINARY_FORMATS       = 0x87FE,
+		PROGRAM_BINARY_FORMATS           = 0x87FF,
+		PROGRAM_BINARY_LENGTH            = 0x8741,
+		PROGRAM_BINARY_RETRIEVABLE_HINT  = 0x8257,
+		
+		COMPLETION_STATUS_KHR            = 0x91B1,
+		MAX_SHADER_COMPILER_THREADS_KHR  = 0x91B0,
+		
+		TEXTURE_IMMUTABLE_FORMAT         = 0x912F,
+		
 		ALPHA                            = 0x1906,
 		ALWAYS                           = 0x0207,
 		AND                              = 0x1501,
@@ -1093,6 +1106,16 @@ namespace gl
 	extern void (CODEGEN_FUNCPTR *PopDebugGroup)(void);
 	extern void (CODEGEN_FUNCPTR *PushDebugGroup)(GLenum source, GLuint id, GLsizei length, const GLchar * message);
 	
+	extern void (CODEGEN_FUNCPTR *GetProgramBinary)(GLuint program, GLsizei bufSize, GLsizei * length, GLenum * binaryFormat, void * binary);
+	extern void (CODEGEN_FUNCPTR *ProgramBinary)(GLuint program, GLenum binaryFormat, const void * binary, GLsizei length);
+	extern void (CODEGEN_FUNCPTR *ProgramParameteri)(GLuint program, GLenum pname, GLint value);
+	
+	extern void (CODEGEN_FUNCPTR *MaxShaderCompilerThreadsKHR)(GLuint count);
+	
+	extern void (CODEGEN_FUNCPTR *TexStorage1D)(GLenum target, GLsizei levels, GLenum internalformat, GLsizei width);
+	extern void (CODEGEN_FUNCPTR *TexStorage2D)(GLenum target, GLsizei levels, GLenum internalformat, GLsizei width, GLsizei height);
+	extern void (CODEGEN_FUNCPTR *TexStorage3D)(GLenum target, GLsizei levels, GLenum internalformat, GLsizei width, GLsizei height, GLsizei depth);
+	
 	extern void (CODEGEN_FUNCPTR *BlendFunc)(GLenum sfactor, GLenum dfactor);
 	extern void (CODEGEN_FUNCPTR *Clear)(GLbitfield mask);
 	extern void (CODEGEN_FUNCPTR *ClearColor)(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha);
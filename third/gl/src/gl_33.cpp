@@ -94,6 +94,9 @@ namespace gl
 		LoadTest var_EXT_texture_sRGB;
 		LoadTest var_EXT_texture_filter_anisotropic;
 		LoadTest var_KHR_debug;
+		LoadTest var_ARB_get_program_binary;
+		LoadTest var_KHR_parallel_shader_compile;
+		LoadTest var_ARB_texture_storage;
 		
 	} //namespace exts
 	typedef void (CODEGEN_FUNCPTR *PFNDEBUGMESSAGECALLBACK)(GLDEBUGPROC, const void *);
@@ -147,6 +150,55 @@ namespace gl
 		return numFailed;
 	}
 	
+	typedef void (CODEGEN_FUNCPTR *PFNGETPROGRAMBINARY)(GLuint, GLsizei, GLsizei *, GLenum *, void *);
+	PFNGETPROGRAMBINARY GetProgramBinary = 0;
+	typedef void (CODEGEN_FUNCPTR *PFNPROGRAMBINARY)(GLuint, GLenum, const void *, GLsizei);
+	PFNPROGRAMBINARY ProgramBinary = 0;
+	typedef void (CODEGEN_FUNCPTR *PFNPROGRAMPARAMETERI)(GLuint, GLenum, GLint);
+	PFNPROGRAMPARAMETERI ProgramParameteri = 0;
+	
+	static int Load_ARB_get_program_binary()
+	{
+		int numFailed = 0;
+		GetProgramBinary = reinterpret_cast<PFNGETPROGRAMBINARY>(IntGetProcAddress("glGetProgramBinary"));
+		if(!GetProgramBinary) ++numFailed;
+		ProgramBinary = reinterpret_cast<PFNPROGRAMBINARY>(IntGetProcAddress("glProgramBinary"));
+		if(!ProgramBinary) ++numFailed;
+		ProgramParameteri = reinterpret_cast<PFNPROGRAMPARAMETERI>(IntGetProcAddress("glProgramParameteri"));
+		if(!ProgramParameteri) ++numFailed;
+		return numFailed;
+	}
+	
+	typedef void (CODEGEN_FUNCPTR *PFNMAXSHADERCOMPILERTHREADSKHR)(GLuint);
+	PFNMAXSHADERCOMPILERTHREADSKHR MaxShaderCompilerThreadsKHR = 0;
+	
+	static int Load_KHR_parallel_shader_compile()
+	{
+		int numFailed = 0;
+		MaxShaderCompilerThreadsKHR = reinterpret_cast<PFNMAXSHADERCOMPILERTHREADSKHR>(IntGetProcAddress("glMaxShaderCompilerThreadsKHR"));
+		if(!MaxShaderCompilerThreadsKHR) ++numFailed;
+		return numFailed;
+	}
+	
+	typedef void (CODEGEN_FUNCPTR *PFNTEXSTORAGE1D)(GLenum, GLsizei, GLenum, GLsizei);
+	PFNTEXSTORAGE1D TexStorage1D = 0;
+	typedef void (CODEGEN_FUNCPTR *PFNTEXSTORAGE2D)(GLenum, GLsizei, GLenum, GLsizei, GLsizei);
+	PFNTEXSTORAGE2D TexStorage2D = 0;
+	typedef void (CODEGEN_FUNCPTR *PFNTEXSTORAGE3D)(GLenum, GLsizei, GLenum, GLsizei, GLsizei, GLsizei);
+	PFNTEXSTORAGE3D TexStorage3D = 0;
+	
+	static int Load_ARB_texture_storage()
+	{
+		int numFailed = 0;
+		TexStorage1D = reinterpret_cast<PFNTEXSTORAGE1D>(IntGetProcAddress("glTexStorage1D"));
+		if(!TexStorage1D) ++numFailed;
+		TexStorage2D = reinterpret_cast<PFNTEXSTORAGE2D>(IntGetProcAddress("glTexStorage2D"));
+		if(!TexStorage2D) ++numFailed;
+		TexStorage3D = reinterpret_cast<PFNTEXSTORAGE3D>(IntGetProcAddress("glTexStorage3D"));
+		if(!TexStorage3D) ++numFailed;
+		return numFailed;
+	}
+	
 	typedef void (CODEGEN_FUNCPTR *PFNBLENDFUNC)(GLenum, GLenum);
 	PFNBLENDFUNC BlendFunc = 0;
 	typedef void (CODEGEN_FUNCPTR *PFNCLEAR)(GLbitfield);
@@ -1574,11 +1626,14 @@ namespace gl
 			
 			void InitializeMappingTable(std::vector<MapEntry> &table)
 			{
-				table.reserve(4);
+				table.reserve(7);
 				table.push_back(MapEntry("GL_EXT_texture_compression_s3tc", &exts::var_EXT_texture_compression_s3tc));
 				table.push_back(MapEntry("GL_EXT_texture_sRGB", &exts::var_EXT_texture_sRGB));
 				table.push_back(MapEntry("GL_EXT_texture_filter_anisotropic", &exts::var_EXT_texture_filter_anisotropic));
 				table.push_back(MapEntry("GL_KHR_debug", &exts::var_KHR_debug, Load_KHR_debug));
+				table.push_back(MapEntry("GL_ARB_get_program_binary", &exts::var_ARB_get_program_binary, Load_ARB_get_program_binary));
+				table.push_back(MapEntry("GL_KHR_parallel_shader_compile", &exts::var_KHR_parallel_shader_compile, Load_KHR_parallel_shader_compile));
+				table.push_back(MapEntry("GL_ARB_texture_storage", &exts::var_ARB_texture_storage, Load_ARB_texture_storage));
 			}
 			
 			void ClearExtensionVars()
@@ -1587,6 +1642,9 @@ namespace gl
 				exts::var_EXT_texture_sRGB = exts::LoadTest();
 				exts::var_EXT_texture_filter_anisotropic = exts::LoadTest();
 				exts::var_KHR_debug = exts::LoadTest();
+				exts::var_ARB_get_program_binary = exts::LoadTest();
+				exts::var_KHR_parallel_shader_compile = exts::LoadTest();
+				exts::var_ARB_texture_storage = exts::LoadTest();
 			}
 			
 			void LoadExtByName(std::vector<MapEntry> &table, const char *extensionName)
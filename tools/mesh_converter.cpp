@@ -0,0 +1,85 @@
+// Converts meshes to the binary format of mesh_file.hpp, ahead of time so the application only
+// maps the result. Everything slow is done here: parsing, welding and ordering for the caches.
+//
+//   MeshConverter <input.obj> <output.mesh> [--float | --packed]
+//   MeshConverter --generate <arrow | cone | cube | sphere> <output.mesh> [--float | --packed]
+
+// GL
+#include <gl_33.hpp>
+
+// Ours
+#include <common.hpp>
+#include <jobs.hpp>
+#include <mesh.hpp>
+#include <mesh_file.hpp>
+#include <obj.hpp>
+#include <timer.hpp>
+#include <cstring>
+#include <string>
+
+int Usage() {
+	LogError("Usage: MeshConverter <input.obj> <output.mesh> [--float | --packed]\n"
+		"       MeshConverter --generate <arrow | cone | cube | sphere> <output.mesh> [--float | --packed]\n");
+	return 1;
+}
+
+int main(int ArgCount, char** Args) {
+	if (ArgCount < 3) { return Usage(); }
+
+	auto HasArg = [&](const char* Arg) {
+		for (int i = 1; i < ArgCount; ++i) { if (strcmp(Args[i], Arg) == 0) { return true; } }
+		return false;
+	};
+
+	Jobs.Initialize();
+	defer{ Jobs.Shutdown(); };
+
+	cpu_timer Timer;
+	mesh_data Data;
+	std::string Output;
+
+	// Same formats as the application uses unless asked otherwise, the cube is in floats for the sky
+	auto Format = [&](vertex_format::type Default) {
+		return HasArg("--float") ? vertex_format::Float : HasArg("--packed") ? vertex_format::Packed : Default;
+	};
+
+	if (strcmp(Args[1], "--generate") == 0) {
+		if (ArgCount < 4) { return Usage(); }
+		const std::string Name = Args[2];
+		Output = Args[3];
+
+		if (Name == "arrow") {
+			Data = BuildMeshData(GenerateRevolvedLods({ 32, 16, 8, 4 }, [](int Steps) { return GenerateArrowTriangles(.05f, .1f, .6f, .4f, Steps); }), gl::TRIANGLES, nullptr, "Arrow", Format(vertex_format::Packed));
+		} else if (Name == "cone") {
+			Data = BuildMeshData(GenerateRevolvedLods({ 32, 16, 8, 4 }, [](int Steps) { return GenerateConeTriangles(.5f, 1.f, Steps); }), gl::TRIANGLES, nullptr, "Cone", Format(vertex_format::Packed));
+		} else if (Name == "cube") {
+			Data = BuildMeshData(lod_vertices{ GenerateCubeTriangles(), {} }, gl::TRIANGLES, nullptr, "Cube", Format(vertex_format::Float));
+		} else if (Name == "sphere") {
+			Data = BuildMeshData(lod_vertices{ GenerateSphereTriangles(1.f, 16, 32), {} }, gl::TRIANGLES, nullptr, "Sphere", Format(vertex_format::Packed));
+		} else {
+			LogError("Unknown mesh %s\n", Name.c_str());
+			return Usage();
+		}
+	} else {
+		Output = Args[2];
+
+		obj_mesh Obj;
+		obj_stats Stats;
+		if (!LoadOBJ(Args[1], Obj, &Stats)) { return 1; }
+		printf("[OBJ] %s: %u triangles, %u vertices, %.1f ms\n", Args[1], Stats.NumTriangles, (uint) Obj.Vertices.size(), Timer.Milliseconds());
+
+		// The loader keeps the file's order, reorder for the post-transform cache and fetching
+		const auto BeforeACMR = ComputeACMR(Obj.Indices.data(), Obj.Indices.size());
+		OptimizeVertexCache(Obj.Indices.data(), Obj.Indices.size(), Obj.Vertices.size());
+		OptimizeVertexFetch(Obj.Vertices, Obj.Indices);
+		printf("[Mesh] ACMR %.2f as loaded, %.2f optimized\n", BeforeACMR, ComputeACMR(Obj.Indices.data(), Obj.Indices.size()));
+
+		Data = BuildMeshData(lod_vertices{ std::move(Obj.Vertices), {} }, gl::TRIANGLES, &Obj.Indices, Args[1], Format(vertex_format::Packed));
+	}
+
+	if (!SaveMeshFile(Output, Data)) { return 1; }
+	printf("[Mesh] %s: %u vertices (%s), %u indices, %u levels, %.1f KB in %.1f ms\n", Output.c_str(), Data.Layout.NumVerts,
+		Data.Layout.Format == vertex_format::Packed ? "packed" : "float", Data.Layout.NumIndices, (uint) Data.Layout.Lods.size(),
+		(Data.Positions.size() + Data.Attributes.size() + Data.Indices.size()) / 1024., Timer.Milliseconds());
+	return 0;
+}